@@ -0,0 +1,478 @@
+#ifndef _ACL_UTIL_H_
+#define _ACL_UTIL_H_
+
+/*
+ *    Packet classification: the first of an ordered list of ACL rules each packet matches, over
+ * the IPv4 5-tuple of pkt_metadata_t.  A rule is an inclusive range of source and destination
+ * address and source and destination port (host byte order, so the prefix a.b.c.d/n is the range
+ * from the network address to its broadcast address) and a set of L4 protocols.  The result for a
+ * packet is the index of the first rule it matches, or ACL_NONE; packets other than IPv4 match
+ * nothing.
+ *
+ *    There are two engines with the same results, for different sizes of rule set:
+ *    == acl_linear_t compares each packet against 16 rules per instruction: the rules are stored
+ *       a block of 16 at a time with each bound a vector, so a block is one compare per bound
+ *       (chained through the compare masks), and the first block with a hit ends the search.
+ *       Nothing to build and very little memory, but the cost grows with the rules a packet has
+ *       to get past, so it's for small sets.
+ *    == acl_bv_t is bit-vector classification (Lakshman and Stiliadis, with the aggregated bit
+ *       vectors of Baboescu and Varghese).  Each dimension is cut into the intervals between
+ *       rule bounds, and each interval has a bit vector of the rules covering it, so the rules a
+ *       packet matches are the AND of one bit vector per dimension, and the first set bit is the
+ *       answer.  Words of those bit vectors are only read where a summary says there may be a
+ *       hit: each has an aggregate word (bit k set if rule word k is non-zero) and each aggregate
+ *       word has a summary bit.  All 16 packets are classified together: the intervals by a
+ *       binary search with a gather per step, the summary bits with lookup_P2_bit_x16(), the
+ *       aggregate and rule words with gathers, and their lowest set bits with a vector count
+ *       trailing zeros (VPOPCNT).  The cost grows with the number of 1024 rule summaries, not
+ *       the rules, but the memory grows with rules x intervals.
+ */
+
+#define ACL_NONE        (~0U)
+#define ACL_L4_ANY      (~0U)
+#define ACL_L4(_md_l4)  (1U << ((_md_l4) >> 16))    // The bit for an MD_PROTO_L4_* (0 for other)
+
+enum {
+    ACL_SRC = 0,
+    ACL_DST,
+    ACL_SPORT,
+    ACL_DPORT,
+    ACL_NRANGES,
+    ACL_L4_DIM = ACL_NRANGES,   // acl_bv_t's fifth dimension, the protocol
+    ACL_NDIMS
+};
+
+typedef struct {
+    u32 lo[ACL_NRANGES];
+    u32 hi[ACL_NRANGES];
+    u32 l4;                     // ACL_L4() bits of the protocols that match, or ACL_L4_ANY
+} acl_rule_t;
+
+/*
+ *    The fields a rule tests of each of md[0, 16), in host byte order, and the ACL_L4() bit
+ * number of its protocol.  Returns the lanes of lanes which are IPv4.
+ */
+static ALWAYS_INLINE __mmask16 _acl_fields_x16(const pkt_metadata_t * const RESTR md,
+                                               const __mmask16 lanes, u32_16 * const RESTR f)
+{
+    u32_16 col[16];
+
+    transpose_u32_16x16((const u32_16 *)md, col);
+
+    const u32_16 src = col[offsetof(pkt_metadata_t, src_ip) / sizeof(u32)];
+    const u32_16 dst = col[offsetof(pkt_metadata_t, dst_ip) / sizeof(u32)];
+    const u32_16 ports = col[offsetof(pkt_metadata_t, src_port) / sizeof(u32)];
+    const u32_16 flags = col[offsetof(pkt_metadata_t, proto_flags) / sizeof(u32)];
+    const u32_16 hports = ((ports >> 8) & 0x00FF00FF) | ((ports << 8) & 0xFF00FF00);
+
+    f[ACL_SRC] = ((u32_16)_mm512_rol_epi32((__m512i)src, 8) & 0x00FF00FF) |
+                 ((u32_16)_mm512_rol_epi32((__m512i)src, 24) & 0xFF00FF00);
+    f[ACL_DST] = ((u32_16)_mm512_rol_epi32((__m512i)dst, 8) & 0x00FF00FF) |
+                 ((u32_16)_mm512_rol_epi32((__m512i)dst, 24) & 0xFF00FF00);
+    f[ACL_SPORT] = hports & 0xFFFF;
+    f[ACL_DPORT] = hports >> 16;
+    f[ACL_L4_DIM] = (flags >> 16) & 31;
+    return lanes & VEC_TO_MASK((flags & (3 << 8)) == MD_PROTO_L3_IP4);
+}
+
+/*
+ * Rules are valid if every range is the right way round and the port ranges are 16 bit.
+ */
+static inline int _acl_rules_valid(const acl_rule_t * const RESTR rules, const u32 nrules)
+{
+    u32 r, d;
+
+    for (r = 0; r < nrules; r++) {
+        for (d = 0; d < ACL_NRANGES; d++) {
+            if (rules[r].lo[d] > rules[r].hi[d]) {
+                return 0;
+            }
+        }
+
+        if ((rules[r].hi[ACL_SPORT] > 0xFFFF) | (rules[r].hi[ACL_DPORT] > 0xFFFF)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Lowest set bit of each lane (which must have one). */
+static ALWAYS_INLINE u32_16 _acl_tzcnt_x16(const u32_16 x)
+{
+#ifdef __AVX512VPOPCNTDQ__
+    return (u32_16)_mm512_popcnt_epi32((__m512i)(~x & (x - 1)));
+#else
+    return 31 - (u32_16)_mm512_lzcnt_epi32((__m512i)(x & -x));
+#endif
+}
+
+/*
+ * Linear: blocks of 16 rules, each bound a vector.  Padding rules have empty ranges.
+ */
+typedef struct {
+    u32_16  lo[ACL_NRANGES];
+    u32_16  hi[ACL_NRANGES];
+    u32_16  l4;
+} acl_linear_block_t;
+
+typedef struct {
+    u32                 nrules;
+    u32                 nblocks;
+    acl_linear_block_t  block[0] __attribute__((__aligned__(64)));
+} acl_linear_t;
+
+#define ACL_LINEAR_MEM_SIZE(_nrules)                                                        \
+    (sizeof(acl_linear_t) + ((((_nrules) + 15) / 16) * sizeof(acl_linear_block_t)))
+
+/*
+ *    Lay out rules[0, nrules) in mem, which must be 64 byte aligned and at least
+ * ACL_LINEAR_MEM_SIZE(nrules) bytes.  Returns NULL on bad arguments or rules.
+ */
+static inline acl_linear_t *acl_linear_init(void * const mem, const acl_rule_t * const RESTR rules,
+                                            const u32 nrules)
+{
+    acl_linear_t * const acl = (acl_linear_t *)mem;
+    u32 r, d;
+
+    if ((mem == NULL) | ((u64)mem & 63) | (nrules == 0) || !_acl_rules_valid(rules, nrules)) {
+        return NULL;
+    }
+
+    acl->nrules = nrules;
+    acl->nblocks = (nrules + 15) / 16;
+
+    for (r = 0; r < acl->nblocks * 16; r++) {
+        acl_linear_block_t * const b = &acl->block[r / 16];
+
+        for (d = 0; d < ACL_NRANGES; d++) {
+            b->lo[d][r % 16] = (r < nrules) ? rules[r].lo[d] : ~0U;
+            b->hi[d][r % 16] = (r < nrules) ? rules[r].hi[d] : 0;
+        }
+
+        b->l4[r % 16] = (r < nrules) ? rules[r].l4 : 0;
+    }
+
+    return acl;
+}
+
+/*
+ *    The first rule each of md[0, 16) matches, ACL_NONE for no match or for lanes not in
+ * lanes.  Each packet goes through the blocks on its own, with its fields broadcast.
+ */
+static inline u32_16 acl_linear_classify_x16(const acl_linear_t * const RESTR acl,
+                                             const pkt_metadata_t * const RESTR md,
+                                             const __mmask16 lanes)
+{
+    u32_16 f[ACL_NDIMS], res = (u32_16){} + ACL_NONE;
+    __mmask16 m;
+    u32 b, d;
+
+    for (m = _acl_fields_x16(md, lanes, f); m; m &= m - 1) {
+        const u32 i = __builtin_ctz(m);
+        __m512i x[ACL_NRANGES];
+
+        for (d = 0; d < ACL_NRANGES; d++) {
+            x[d] = _mm512_set1_epi32(f[d][i]);
+        }
+
+        const __m512i l4 = _mm512_set1_epi32(1U << f[ACL_L4_DIM][i]);
+
+        for (b = 0; b < acl->nblocks; b++) {
+            const acl_linear_block_t * const blk = &acl->block[b];
+            __mmask16 h = _mm512_test_epi32_mask((__m512i)blk->l4, l4);
+
+            for (d = 0; d < ACL_NRANGES; d++) {
+                h = _mm512_mask_cmple_epu32_mask(h, (__m512i)blk->lo[d], x[d]);
+                h = _mm512_mask_cmple_epu32_mask(h, x[d], (__m512i)blk->hi[d]);
+            }
+
+            if (h) {
+                res[i] = (b * 16) + __builtin_ctz(h);
+                break;
+            }
+        }
+    }
+
+    return res;
+}
+
+/*
+ *    Bit vectors.  Everything lives in data[] at the u32 offsets recorded per dimension.  A range
+ * dimension has nint[d] intervals, interval i starting at bound[d][i] (bound[d][0] is 0); the
+ * protocol dimension has 32, one per ACL_L4() bit.  Each interval has a row of nwords rule words
+ * (bit r % 32 of word r / 32 is rule r) and of nagg aggregate words (bit k of word a is whether
+ * rule word (a * 32) + k is non-zero), and summary bit (i * nagg) + a is whether aggregate word a
+ * is non-zero.
+ */
+typedef struct {
+    u32     nrules;
+    u32     nwords;             // Rule words per row, a whole number of aggregate words
+    u32     nagg;               // Aggregate words per row
+    u32     nint[ACL_NDIMS];
+    u32     steps[ACL_NRANGES]; // Binary search steps, log2 of nint rounded up
+    u64     bound[ACL_NRANGES]; // Offsets in data[]
+    u64     bv[ACL_NDIMS];
+    u64     agg[ACL_NDIMS];
+    u64     sum[ACL_NDIMS];
+    u64     mem_used;           // Bytes of mem actually used
+    u32     data[0] __attribute__((__aligned__(64)));
+} acl_bv_t;
+
+#define _ACL_BV_NWORDS(_nrules)     (((((_nrules) + 31) / 32) + 31) & ~31UL)
+#define _ACL_BV_NINT_MAX(_nrules)   ((2UL * (_nrules)) + 1)
+#define _ACL_BV_ROUND(_nu32)        (((_nu32) + 15) & ~15UL)
+
+/* u32s of data[] one dimension of nint intervals takes at most (the sort scratch fits in it). */
+#define _ACL_BV_DIM_U32S(_nint, _nwords)                                                    \
+    (_ACL_BV_ROUND(_nint) + ((_nint) * (_nwords)) + _ACL_BV_ROUND((_nint) * ((_nwords) / 32)) + \
+     _ACL_BV_ROUND((((_nint) * ((_nwords) / 32)) + 31) / 32))
+
+/*
+ *    Memory for acl_bv_init() for nrules rules, assuming every bound is distinct.  Real rule sets
+ * share bounds and use less (see mem_used), so an anonymous mapping of this size only ever
+ * faults in what's used.
+ */
+#define ACL_BV_MEM_SIZE(_nrules)                                                            \
+    (sizeof(acl_bv_t) + sizeof(u32) *                                                       \
+     ((ACL_NRANGES * _ACL_BV_DIM_U32S(_ACL_BV_NINT_MAX(_nrules), _ACL_BV_NWORDS(_nrules))) + \
+      _ACL_BV_DIM_U32S(32UL, _ACL_BV_NWORDS(_nrules))))
+
+/* Index of the last bound <= x of the n sorted bounds at b (b[0] <= x). */
+static inline u32 _acl_bv_find(const u32 * const RESTR b, const u32 n, const u32 x)
+{
+    u32 lo = 0, hi = n;
+
+    while (hi - lo > 1) {
+        const u32 mid = (lo + hi) / 2;
+
+        if (b[mid] <= x) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/*
+ *    Fill in the aggregate words and summary bits of dimension d from its rule words, and
+ * return the u32s they took.
+ */
+static inline u64 _acl_bv_aggregate(acl_bv_t * const RESTR acl, const u32 d)
+{
+    const u32 * const bv = acl->data + acl->bv[d];
+    u32 * const agg = acl->data + acl->agg[d];
+    u32 * const sum = acl->data + acl->sum[d];
+    const u64 nagg = (u64)acl->nint[d] * acl->nagg;
+    u64 a;
+
+    __builtin_memset(sum, 0, _ACL_BV_ROUND((nagg + 31) / 32) * sizeof(u32));
+
+    for (a = 0; a < nagg; a++) {
+        const u32_16 w0 = *(const u32_16 *)(bv + (a * 32));
+        const u32_16 w1 = *(const u32_16 *)(bv + (a * 32) + 16);
+
+        agg[a] = (u32)_mm512_test_epi32_mask((__m512i)w0, (__m512i)w0) |
+                 ((u32)_mm512_test_epi32_mask((__m512i)w1, (__m512i)w1) << 16);
+        sum[a / 32] |= (u32)(agg[a] != 0) << (a % 32);
+    }
+
+    return _ACL_BV_ROUND(nagg) + _ACL_BV_ROUND((nagg + 31) / 32);
+}
+
+/*
+ *    Build the bit vectors for rules[0, nrules) in mem, which must be 64 byte aligned and at
+ * least ACL_BV_MEM_SIZE(nrules) bytes.  Returns NULL on bad arguments or rules.
+ *
+ *    Per range dimension: every lo and hi + 1 is a bound (with 0), sorted (sort_u32()) and made
+ * unique in place.  Each rule then covers a run of intervals, so its bit is xor-ed into the
+ * rows where the run starts and just after it ends, and a running xor down the rows fills in
+ * the rest.
+ */
+static inline acl_bv_t *acl_bv_init(void * const mem, const acl_rule_t * const RESTR rules,
+                                    const u32 nrules)
+{
+    acl_bv_t * const acl = (acl_bv_t *)mem;
+    u64 cur = 0, i, w;
+    u32 r, d, n;
+
+    if ((mem == NULL) | ((u64)mem & 63) | (nrules == 0) || !_acl_rules_valid(rules, nrules)) {
+        return NULL;
+    }
+
+    __builtin_memset(acl, 0, sizeof(*acl));
+    acl->nrules = nrules;
+    acl->nwords = _ACL_BV_NWORDS(nrules);
+    acl->nagg = acl->nwords / 32;
+
+    for (d = 0; d < ACL_NRANGES; d++) {
+        u32 * const b = acl->data + cur;
+        u32 * const scratch = b + _ACL_BV_ROUND(_ACL_BV_NINT_MAX(nrules));
+
+        b[0] = 0;
+
+        for (r = 0, n = 1; r < nrules; r++) {
+            b[n++] = rules[r].lo[d];
+
+            if (rules[r].hi[d] != ~0U) {
+                b[n++] = rules[r].hi[d] + 1;
+            }
+        }
+
+        sort_u32(b, scratch, n);
+
+        for (i = 1, w = 1; i < n; i++) {
+            if (b[i] != b[w - 1]) {
+                b[w++] = b[i];
+            }
+        }
+
+        acl->bound[d] = cur;
+        acl->nint[d] = w;
+        acl->steps[d] = 32 - __builtin_clz(w);
+        cur += _ACL_BV_ROUND(w);
+        acl->bv[d] = cur;
+
+        u32 * const bv = acl->data + cur;
+
+        __builtin_memset(bv, 0, (u64)w * acl->nwords * sizeof(u32));
+
+        for (r = 0; r < nrules; r++) {
+            const u32 first = _acl_bv_find(b, w, rules[r].lo[d]);
+            const u32 last = _acl_bv_find(b, w, rules[r].hi[d]);
+
+            bv[((u64)first * acl->nwords) + (r / 32)] ^= 1U << (r % 32);
+
+            if (last + 1 < w) {
+                bv[((u64)(last + 1) * acl->nwords) + (r / 32)] ^= 1U << (r % 32);
+            }
+        }
+
+        for (i = 1; i < w; i++) {
+            u32_16 * const row = (u32_16 *)(bv + (i * acl->nwords));
+            const u32_16 * const prev = (const u32_16 *)(bv + ((i - 1) * acl->nwords));
+            u32 k;
+
+            for (k = 0; k < acl->nwords / 16; k++) {
+                row[k] ^= prev[k];
+            }
+        }
+
+        cur += (u64)w * acl->nwords;
+        acl->agg[d] = cur;
+        acl->sum[d] = cur + _ACL_BV_ROUND((u64)w * acl->nagg);
+        cur += _acl_bv_aggregate(acl, d);
+    }
+
+    /* The protocol: one row per ACL_L4() bit. */
+    d = ACL_L4_DIM;
+    acl->nint[d] = 32;
+    acl->bv[d] = cur;
+    __builtin_memset(acl->data + cur, 0, 32UL * acl->nwords * sizeof(u32));
+
+    for (r = 0; r < nrules; r++) {
+        for (i = 0; i < 32; i++) {
+            acl->data[cur + (i * acl->nwords) + (r / 32)] |= ((rules[r].l4 >> i) & 1) << (r % 32);
+        }
+    }
+
+    cur += 32UL * acl->nwords;
+    acl->agg[d] = cur;
+    acl->sum[d] = cur + _ACL_BV_ROUND(32UL * acl->nagg);
+    cur += _acl_bv_aggregate(acl, d);
+
+    acl->mem_used = sizeof(*acl) + (cur * sizeof(u32));
+    return acl;
+}
+
+/*
+ *    Interval of each lane's x in range dimension d: a branch free binary search, with a gather
+ * of each lane's probe per step.
+ */
+static ALWAYS_INLINE u32_16 _acl_bv_interval_x16(const acl_bv_t * const RESTR acl, const u32 d,
+                                                 const u32_16 x, const __mmask16 lanes)
+{
+    const u32 * const b = acl->data + acl->bound[d];
+    const u32 n = acl->nint[d];
+    u32_16 pos = {};
+    u32 step;
+
+    for (step = (1U << acl->steps[d]) >> 1; step; step >>= 1) {
+        const u32_16 probe = pos + step;
+        const __mmask16 in = lanes & VEC_TO_MASK(probe < n);
+        const u32_16 bp = (u32_16)_mm512_mask_i32gather_epi32(_mm512_setzero_si512(), in,
+                                                             (__m512i)probe, b, sizeof(u32));
+
+        pos = (u32_16)_mm512_mask_mov_epi32((__m512i)pos,
+                                            _mm512_mask_cmple_epu32_mask(in, (__m512i)bp,
+                                                                         (__m512i)x),
+                                            (__m512i)probe);
+    }
+
+    return pos;
+}
+
+/*
+ *    The first rule each of md[0, 16) matches, ACL_NONE for no match or for lanes not in lanes.
+ * Aggregate words are taken in order, and within each the candidate rule words lowest first, so
+ * the first rule word with a bit left after the AND holds the answer.
+ */
+static inline u32_16 acl_bv_classify_x16(const acl_bv_t * const RESTR acl,
+                                         const pkt_metadata_t * const RESTR md,
+                                         const __mmask16 lanes)
+{
+    const __m512i zero = {};
+    u32_16 f[ACL_NDIMS], iv[ACL_NDIMS], res = (u32_16){} + ACL_NONE;
+    __mmask16 live = _acl_fields_x16(md, lanes, f), m;
+    u32 a, d;
+
+    for (d = 0; d < ACL_NRANGES; d++) {
+        iv[d] = _acl_bv_interval_x16(acl, d, f[d], live);
+    }
+
+    iv[ACL_L4_DIM] = f[ACL_L4_DIM];
+
+    for (a = 0; (a < acl->nagg) & (live != 0); a++) {
+        u32_16 agg = (u32_16){} + ~0U;
+
+        for (d = 0, m = live; d < ACL_NDIMS; d++) {
+            m &= lookup_P2_bit_x16(acl->data + acl->sum[d],
+                                   ((acl->nint[d] * acl->nagg) + 31) & ~31U,
+                                   (iv[d] * acl->nagg) + a);
+        }
+
+        for (d = 0; (d < ACL_NDIMS) & (m != 0); d++) {
+            agg &= (u32_16)_mm512_mask_i32gather_epi32(zero, m,
+                                                       (__m512i)((iv[d] * acl->nagg) + a),
+                                                       acl->data + acl->agg[d], sizeof(u32));
+        }
+
+        m &= _mm512_test_epi32_mask((__m512i)agg, (__m512i)agg);
+
+        while (m) {
+            const u32_16 word = (a * 32) + _acl_tzcnt_x16(agg);
+            u32_16 rw = (u32_16){} + ~0U;
+
+            for (d = 0; d < ACL_NDIMS; d++) {
+                rw &= (u32_16)_mm512_mask_i32gather_epi32(zero, m,
+                                                          (__m512i)((iv[d] * acl->nwords) + word),
+                                                          acl->data + acl->bv[d], sizeof(u32));
+            }
+
+            const __mmask16 hit = m & _mm512_test_epi32_mask((__m512i)rw, (__m512i)rw);
+
+            res = (u32_16)_mm512_mask_mov_epi32((__m512i)res, hit,
+                                                (__m512i)((word * 32) + _acl_tzcnt_x16(rw)));
+            live &= ~hit;
+            m &= ~hit;
+            agg &= agg - 1;
+            m &= _mm512_test_epi32_mask((__m512i)agg, (__m512i)agg);
+        }
+    }
+
+    return res;
+}
+
+#endif /* _ACL_UTIL_H_ */
@@ -0,0 +1,209 @@
+#ifndef _BATCH_UTIL_H_
+#define _BATCH_UTIL_H_
+
+/*
+ *    Binning and batch dispatch.  Work items (a u32 handle such as a position in an input FIFO
+ * plus a u32 hazard key such as a state machine hash) arrive in vectors of up to 16 and are sorted
+ * into per-operation bins using compress/expand.  Each bin holds at most one full vector of items
+ * and is handed to the dispatch callback when:
+ *    == It reaches a full vector (16 items).
+ *    == Appending the next item would put two items with the same hazard key in one batch (the
+ *       bin is dispatched first so that items sharing a key are processed in arrival order).
+ *    == Its oldest item has waited longer than max_latency TSC ticks (see bin_dispatch_poll()).
+ *    == The caller flushes it.
+ *
+ *    Hazards are only tracked within a bin.  If two different operations on the same key must
+ * be ordered with respect to one another then the bin should be chosen by key, not operation.
+ *
+ *    The dispatch callback is a plain function pointer, but since everything here is inline
+ * a call site that passes a constant function will generally have it inlined right into the
+ * insertion loop.
+ */
+
+#define BIN_DISPATCH_MAX_BINS   (64)
+#define BIN_DISPATCH_NEVER      (~0ULL)
+
+enum {
+    BIN_DISPATCH_FULL = 0,      // Bin filled a whole vector
+    BIN_DISPATCH_CONFLICT,      // Next item would have conflicted with one already in the bin
+    BIN_DISPATCH_DEADLINE,      // Oldest item in the bin hit its latency deadline
+    BIN_DISPATCH_FLUSH,         // Caller requested flush
+    BIN_DISPATCH_NREASONS
+};
+
+typedef void (*bin_dispatch_func_t)(void *ctx, const u32 bin, const u32_16 items,
+                                    const u32_16 keys, const __mmask16 lanes, const u32 reason);
+
+typedef struct {
+    u32_16  items;
+    u32_16  keys;
+} bin_slot_t;
+
+typedef struct {
+    bin_slot_t          bin[BIN_DISPATCH_MAX_BINS];
+    union {
+        u64             deadline[BIN_DISPATCH_MAX_BINS];
+        u64_8           deadline_z[BIN_DISPATCH_MAX_BINS / 8];
+    };
+    u8                  count[BIN_DISPATCH_MAX_BINS];
+    bin_dispatch_func_t dispatch;
+    void                *ctx;
+    u64                 max_latency;
+    u32                 nbins;
+    u32                 pending;
+    u64                 n_dispatch[BIN_DISPATCH_NREASONS];
+    u64                 n_items;
+} bin_dispatch_t;
+
+static inline int bin_dispatch_init(bin_dispatch_t * const RESTR bd, const u32 nbins,
+                                    const u64 max_latency, bin_dispatch_func_t dispatch,
+                                    void *ctx)
+{
+    if ((nbins == 0) | (nbins > BIN_DISPATCH_MAX_BINS) | (dispatch == NULL)) {
+        return -1;
+    }
+
+    __builtin_memset(bd, 0, sizeof(*bd));
+    __builtin_memset(bd->deadline, 0xFF, sizeof(bd->deadline));
+    bd->dispatch = dispatch;
+    bd->ctx = ctx;
+    bd->max_latency = max_latency;
+    bd->nbins = nbins;
+    return 0;
+}
+
+/*
+ * Hand one bin to the dispatch callback and mark it empty.
+ */
+static inline void bin_dispatch_one(bin_dispatch_t * const RESTR bd, const u32 b, const u32 reason)
+{
+    const u32 c = bd->count[b];
+
+    if (c == 0) {
+        return;
+    }
+
+    bd->count[b] = 0;
+    bd->deadline[b] = BIN_DISPATCH_NEVER;
+    bd->pending -= c;
+    bd->n_dispatch[reason]++;
+    bd->n_items += c;
+    bd->dispatch(bd->ctx, b, bd->bin[b].items, bd->bin[b].keys, (__mmask16)((1U << c) - 1), reason);
+}
+
+/*
+ * Append the lanes of items/keys selected by m to bin b, preserving lane order, and dispatching
+ * the bin as many times as necessary along the way (when it fills, or when an incoming key
+ * matches one already waiting in the bin).
+ */
+static inline void bin_dispatch_append(bin_dispatch_t * const RESTR bd, const u32 b,
+                                       const u32_16 items, const u32_16 keys, __mmask16 m,
+                                       const u64 now)
+{
+    const u32_16 zero = {};
+
+    while (m) {
+        bin_slot_t * const RESTR s = bd->bin + b;
+        const u32 c = bd->count[b];
+        const u32 n = __builtin_popcount(m);
+        const __mmask16 old = (__mmask16)((1U << c) - 1);
+        const __mmask16 valid = (__mmask16)((c + n >= 16) ? 0xFFFF : ((1U << (c + n)) - 1));
+
+        // Pack the incoming lanes down and splice them on after the c lanes already in the bin
+        const u32_16 nk = (u32_16)_mm512_maskz_compress_epi32(m, (__m512i)keys);
+        const u32_16 ni = (u32_16)_mm512_maskz_compress_epi32(m, (__m512i)items);
+        const u32_16 ck = (u32_16)_mm512_mask_expand_epi32((__m512i)s->keys, ~old, (__m512i)nk);
+        const u32_16 ci = (u32_16)_mm512_mask_expand_epi32((__m512i)s->items, ~old, (__m512i)ni);
+
+        // Any new lane whose key matches some earlier lane is a hazard, the batch must end before it
+        const u32_16 conf = conflict_detect_u32_16(ck, zero, valid);
+        const __mmask16 hz = _mm512_test_epi32_mask((__m512i)conf, (__m512i)conf) & ~old & valid;
+
+        const u32 room = 16 - c;
+        const u32 lim = hz ? (__builtin_ctz(hz) - c) : n;
+        const u32 take = (lim < room) ? lim : room;
+        const __mmask16 tm = (__mmask16)(((1U << take) - 1) << c);
+
+        s->keys = (u32_16)_mm512_mask_mov_epi32((__m512i)s->keys, tm, (__m512i)ck);
+        s->items = (u32_16)_mm512_mask_mov_epi32((__m512i)s->items, tm, (__m512i)ci);
+
+        if ((c == 0) & (take > 0)) {
+            bd->deadline[b] = now + bd->max_latency;
+        }
+
+        bd->count[b] = c + take;
+        bd->pending += take;
+
+        if (c + take == 16) {
+            bin_dispatch_one(bd, b, BIN_DISPATCH_FULL);
+        } else if (take < n) {
+            bin_dispatch_one(bd, b, BIN_DISPATCH_CONFLICT);
+        }
+
+        // Retire the lanes we just consumed (the lowest 'take' set bits of m)
+        m &= ~_pdep_u32((1U << take) - 1, m);
+    }
+}
+
+/*
+ * Sort up to 16 work items (selected by lanes) into the bins given by bin_ids.  Lanes with a bin
+ * id >= nbins are dropped.  Each distinct bin id in the vector costs one trip around the loop so
+ * this works best when a vector carries only a few distinct operations.
+ */
+static inline void bin_dispatch_add_x16(bin_dispatch_t * const RESTR bd, const u32_16 bin_ids,
+                                        const u32_16 items, const u32_16 keys, __mmask16 lanes,
+                                        const u64 now)
+{
+    lanes &= VEC_TO_MASK(bin_ids < bd->nbins);
+
+    while (lanes) {
+        const u32 b = bin_ids[__builtin_ctz(lanes)];
+        const __mmask16 m = lanes & VEC_TO_MASK(bin_ids == b);
+        lanes &= ~m;
+        bin_dispatch_append(bd, b, items, keys, m, now);
+    }
+}
+
+/*
+ * Dispatch every bin whose oldest item's deadline is at or before now.  Eight deadlines are
+ * compared per instruction, so a poll of all 64 bins is only a handful of instructions when
+ * nothing is due.  Returns the number of bins dispatched.
+ */
+static inline int bin_dispatch_poll(bin_dispatch_t * const RESTR bd, const u64 now)
+{
+    const u64_8 nv = (u64_8)_mm512_set1_epi64(now);
+    const u32 nz = (bd->nbins + 7) / 8;
+    int ret = 0;
+    u32 i;
+
+    if (bd->pending == 0) {
+        return 0;
+    }
+
+    for (i = 0; i < nz; i++) {
+        __mmask8 due = _mm512_cmple_epu64_mask((__m512i)bd->deadline_z[i], (__m512i)nv);
+
+        while (due) {
+            const u32 b = (i * 8) + __builtin_ctz(due);
+            due &= due - 1;
+            bin_dispatch_one(bd, b, BIN_DISPATCH_DEADLINE);
+            ret++;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Dispatch all non-empty bins regardless of deadline.
+ */
+static inline void bin_dispatch_flush(bin_dispatch_t * const RESTR bd)
+{
+    u32 i;
+
+    for (i = 0; i < bd->nbins; i++) {
+        bin_dispatch_one(bd, i, BIN_DISPATCH_FLUSH);
+    }
+}
+
+#endif /* _BATCH_UTIL_H_ */
@@ -0,0 +1,208 @@
+#ifndef _BITSLICE_UTIL_H_
+#define _BITSLICE_UTIL_H_
+
+/*
+ *    Bitsliced evaluation of small integer predicates.  A set of nbits-bit values is stored as
+ * nbits bit planes, plane b holding bit b of every value, so one bitwise op on a plane does the
+ * same step for 64 (u64 planes) or 512 (u64_8 planes) values at once.  Comparing against a
+ * constant costs one or two ops per bit, independent of the number of values, and the answer is
+ * a bitmask in the same convention as mask_util: bit i of the result is value i, and with u64_8
+ * planes lane L bit i is value 64 * L + i (so each lane is a __mmask64 for those 64 values).
+ *
+ *    The compare and counter macros work on any plane type the bitwise operators work on (u64,
+ * u64_8, u32_16, ...), given as an array of planes, least significant first.  Planes are in and
+ * out of the bitsliced form with bitslice_u64_x512() / unbitslice_u64_x512(), which need GFNI
+ * and VBMI for transpose_bits_64x64().
+ */
+
+/*
+ * Values equal to (_k).
+ */
+#define BS_CMPEQ_K(_planes, _nbits, _k)                                                     \
+({                                                                                          \
+    typedef typeof((_planes)[0] ^ (_planes)[0]) __bs_t;   /* drops any const */             \
+    const __bs_t __zero = {0};                                                              \
+    __bs_t __eq = ~__zero;                                                                  \
+    unsigned __b;                                                                           \
+                                                                                            \
+    for (__b = 0; __b < (_nbits); __b++) {                                                  \
+        const __bs_t __kb = (((_k) >> __b) & 1) ? ~__zero : __zero;                         \
+        __eq &= ~((_planes)[__b] ^ __kb);                                                   \
+    }                                                                                       \
+                                                                                            \
+    __eq;                                                                                   \
+}) /* end of macro */
+
+/*
+ * Values less than (_k), unsigned.  Walks down from the top bit keeping the values still equal
+ * to _k so far; those with a 0 where _k has a 1 are less.
+ */
+#define BS_CMPLT_K(_planes, _nbits, _k)                                                     \
+({                                                                                          \
+    typedef typeof((_planes)[0] ^ (_planes)[0]) __bs_t;   /* drops any const */             \
+    const __bs_t __zero = {0};                                                              \
+    __bs_t __eq = ~__zero, __lt = __zero;                                                   \
+    unsigned __b;                                                                           \
+                                                                                            \
+    for (__b = (_nbits); __b-- > 0; ) {                                                     \
+        const __bs_t __p = (_planes)[__b];                                                  \
+        const __bs_t __kb = (((_k) >> __b) & 1) ? ~__zero : __zero;                         \
+        __lt |= __eq & ~__p & __kb;                                                         \
+        __eq &= ~(__p ^ __kb);                                                              \
+    }                                                                                       \
+                                                                                            \
+    __lt;                                                                                   \
+}) /* end of macro */
+
+/*
+ * Values greater than (_k), unsigned.
+ */
+#define BS_CMPGT_K(_planes, _nbits, _k)                                                     \
+({                                                                                          \
+    typedef typeof((_planes)[0] ^ (_planes)[0]) __bs_t;   /* drops any const */             \
+    const __bs_t __zero = {0};                                                              \
+    __bs_t __eq = ~__zero, __gt = __zero;                                                   \
+    unsigned __b;                                                                           \
+                                                                                            \
+    for (__b = (_nbits); __b-- > 0; ) {                                                     \
+        const __bs_t __p = (_planes)[__b];                                                  \
+        const __bs_t __kb = (((_k) >> __b) & 1) ? ~__zero : __zero;                         \
+        __gt |= __eq & __p & ~__kb;                                                         \
+        __eq &= ~(__p ^ __kb);                                                              \
+    }                                                                                       \
+                                                                                            \
+    __gt;                                                                                   \
+}) /* end of macro */
+
+/*
+ * Values in [_lo, _hi), unsigned.
+ */
+#define BS_IN_RANGE_K(_planes, _nbits, _lo, _hi)                                            \
+    (~BS_CMPLT_K(_planes, _nbits, _lo) & BS_CMPLT_K(_planes, _nbits, _hi))
+
+/*
+ * Element-wise a == b and a < b (unsigned) between two bitsliced sets of values.
+ */
+#define BS_CMPEQ(_a, _b, _nbits)                                                            \
+({                                                                                          \
+    typedef typeof((_a)[0] ^ (_a)[0]) __bs_t;   /* drops any const */                       \
+    const __bs_t __zero = {0};                                                              \
+    __bs_t __eq = ~__zero;                                                                  \
+    unsigned __i;                                                                           \
+                                                                                            \
+    for (__i = 0; __i < (_nbits); __i++) {                                                  \
+        __eq &= ~((_a)[__i] ^ (_b)[__i]);                                                   \
+    }                                                                                       \
+                                                                                            \
+    __eq;                                                                                   \
+}) /* end of macro */
+
+#define BS_CMPLT(_a, _b, _nbits)                                                            \
+({                                                                                          \
+    typedef typeof((_a)[0] ^ (_a)[0]) __bs_t;   /* drops any const */                       \
+    const __bs_t __zero = {0};                                                              \
+    __bs_t __eq = ~__zero, __lt = __zero;                                                   \
+    unsigned __i;                                                                           \
+                                                                                            \
+    for (__i = (_nbits); __i-- > 0; ) {                                                     \
+        const __bs_t __pa = (_a)[__i];                                                      \
+        const __bs_t __pb = (_b)[__i];                                                      \
+        __lt |= __eq & ~__pa & __pb;                                                        \
+        __eq &= ~(__pa ^ __pb);                                                             \
+    }                                                                                       \
+                                                                                            \
+    __lt;                                                                                   \
+}) /* end of macro */
+
+/*
+ *    Add the 0/1 per value in mask (_m) to a bitsliced counter of (_cbits) planes, i.e. a
+ * ripple of half adders.  Counts wrap at 1 << _cbits.  Adding each of a number of predicate
+ * results into one counter gives, per value, how many of them it matched; BS_CMPGT_K() on the
+ * counter then picks out the values matching more than some number.
+ */
+#define BS_COUNTER_ADD(_cnt, _cbits, _m)                                                    \
+({                                                                                          \
+    typedef typeof((_cnt)[0] ^ (_cnt)[0]) __bs_t;   /* drops any const */                   \
+    __bs_t __carry = (_m);                                                                  \
+    unsigned __b;                                                                           \
+                                                                                            \
+    for (__b = 0; __b < (_cbits); __b++) {                                                  \
+        const __bs_t __c = (_cnt)[__b];                                                     \
+        (_cnt)[__b] = __c ^ __carry;                                                        \
+        __carry &= __c;                                                                     \
+    }                                                                                       \
+}) /* end of macro */
+
+/*
+ * Number of values set in a 512 value mask.
+ */
+static inline u64 bs_count_u64_8(const u64_8 m)
+{
+#ifdef __AVX512VPOPCNTDQ__
+    return _mm512_reduce_add_epi64(_mm512_popcnt_epi64((__m512i)m));
+#else
+    u64 n = 0;
+    unsigned i;
+
+    for (i = 0; i < 8; i++) {
+        n += __builtin_popcountll(m[i]);
+    }
+
+    return n;
+#endif
+}
+
+#if defined(__GFNI__) && defined(__AVX512VBMI__)
+/*
+ *    Bitslice 512 u64 values (in must be 64 byte aligned) into 64 u64_8 planes: eight 64x64 bit
+ * transposes, one per 64 values, then transpose_u64_8x8() to bring lane L of each plane together
+ * from the transpose of values 64 * L .. 64 * L + 63.  Planes above the width of the values will
+ * just be zero; there's no saving in skipping them since the transposes produce them anyway.
+ */
+static inline void bitslice_u64_x512(const u64 * const RESTR in, u64_8 * const RESTR planes)
+{
+    const u64_8 * const rows = (const u64_8 *)in;
+    u64_8 t[8][8];
+    unsigned i, g;
+
+    for (i = 0; i < 8; i++) {
+        transpose_bits_64x64(rows + (8 * i), t[i]);
+    }
+
+    for (g = 0; g < 8; g++) {
+        u64_8 blk[8];
+
+        for (i = 0; i < 8; i++) {
+            blk[i] = t[i][g];
+        }
+
+        transpose_u64_8x8(blk, planes + (8 * g));
+    }
+}
+
+/*
+ * The reverse of bitslice_u64_x512(), out must be 64 byte aligned.
+ */
+static inline void unbitslice_u64_x512(const u64_8 * const RESTR planes, u64 * const RESTR out)
+{
+    u64_8 * const rows = (u64_8 *)out;
+    u64_8 t[8][8];
+    unsigned i, g;
+
+    for (g = 0; g < 8; g++) {
+        u64_8 blk[8];
+
+        transpose_u64_8x8(planes + (8 * g), blk);
+
+        for (i = 0; i < 8; i++) {
+            t[i][g] = blk[i];
+        }
+    }
+
+    for (i = 0; i < 8; i++) {
+        transpose_bits_64x64(t[i], rows + (8 * i));
+    }
+}
+#endif
+
+#endif /* _BITSLICE_UTIL_H_ */
@@ -0,0 +1,63 @@
+#ifndef _FILTER_UTIL_H_
+#define _FILTER_UTIL_H_
+
+/*
+ *    Array level stream compaction: copy the elements of src for which a predicate holds to dst,
+ * in order, and return how many there were.  The predicate sees a whole vector of elements at a
+ * time and returns the mask of those to keep:
+ *
+ *      static __mmask16 is_odd(const u32_16 v, const void *ctx)
+ *      {
+ *          return _mm512_test_epi32_mask((__m512i)v, (__m512i)((u32_16){} + 1));
+ *      }
+ *
+ *      n = filter_u32(out, in, len, is_odd, NULL);
+ *
+ * The filter functions are inline so that a predicate known at the call site gets inlined into
+ * the loop rather than called through the pointer.  Lanes past the end of src are masked off
+ * before they reach the predicate's result (the predicate still sees them, as zeroes).  dst may
+ * be src to filter in place, since the output never gets ahead of the input.
+ */
+
+typedef __mmask16 (*filter_pred_u32_fn)(const u32_16 v, const void *ctx);
+typedef __mmask8 (*filter_pred_u64_fn)(const u64_8 v, const void *ctx);
+
+static inline u64 filter_u32(u32 * const dst, const u32 * const src, const u64 n,
+                             const filter_pred_u32_fn pred, const void * const ctx)
+{
+    u64 i, out = 0;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        const u32_16 v = (u32_16)_mm512_loadu_si512(src + i);
+        out += COMPRESS_STORE(dst + out, pred(v, ctx), v);
+    }
+
+    if (i < n) {
+        const __mmask16 em = _bzhi_u32(~0U, n - i);
+        const u32_16 v = (u32_16)_mm512_maskz_loadu_epi32(em, src + i);
+        out += COMPRESS_STORE(dst + out, pred(v, ctx) & em, v);
+    }
+
+    return out;
+}
+
+static inline u64 filter_u64(u64 * const dst, const u64 * const src, const u64 n,
+                             const filter_pred_u64_fn pred, const void * const ctx)
+{
+    u64 i, out = 0;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        const u64_8 v = (u64_8)_mm512_loadu_si512(src + i);
+        out += COMPRESS_STORE(dst + out, pred(v, ctx), v);
+    }
+
+    if (i < n) {
+        const __mmask8 em = _bzhi_u32(~0U, n - i);
+        const u64_8 v = (u64_8)_mm512_maskz_loadu_epi64(em, src + i);
+        out += COMPRESS_STORE(dst + out, pred(v, ctx) & em, v);
+    }
+
+    return out;
+}
+
+#endif /* _FILTER_UTIL_H_ */
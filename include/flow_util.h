@@ -0,0 +1,426 @@
+#ifndef _FLOW_UTIL_H_
+#define _FLOW_UTIL_H_
+
+/*
+ *    A flow table keyed by the flow_key_mask part of pkt_metadata_t (addresses, ports, VLAN tags
+ * and protocol flags), with per-flow packet and byte counters.
+ *
+ *    Each flow is one cache line: the masked key (the same 64 byte layout as the metadata it came
+ * from), with the hash and the counters in the dwords flow_key_mask leaves out.  So checking a
+ * candidate is one zmm xor + test under flow_key_mask, and counting a packet touches the line the
+ * compare already brought in.  Flows are found through buckets of 8 (hash, flow) slots, one line
+ * per bucket, starting at the bucket the hash selects and moving on to the next whenever one is
+ * full.  Flows are never removed, so the first bucket with a free slot ends a search.  There are
+ * at least twice as many slots as flows, so that's rarely far.
+ *
+ *    flow_table_update_x16() takes the metadata of 16 packets straight from pkt_digest_x16():
+ * masks and hashes the 16 keys together, prefetches their buckets, then finds or adds each flow
+ * and counts the packet (and its original length in bytes).  The keys are all the same size and
+ * already in zmm registers, so they're hashed in registers (see flow_hash_x16()) rather than
+ * gathered a dword at a time from memory.
+ *
+ *    Like the rings (see ring_util.h) a table is one contiguous, pointer free, chunk of caller
+ * memory: the control block, then the buckets, then the flows.
+ *
+ *    For spreading packets over worker cores there is also a symmetric hash (the same for both
+ * directions of a connection) and a steering stage, after the NICs' receive side scaling: the hash
+ * picks an entry of an indirection table, the entry names the queue, and each queue is a
+ * spsc_ring_t feeding one core.
+ */
+
+#define FLOW_KEY_BYTES      (offsetof(pkt_metadata_t, proto_flags) + sizeof(u32))
+#define FLOW_KEY_DWORDS     (FLOW_KEY_BYTES / sizeof(u32))
+#define FLOW_NONE           (~0U)
+
+typedef union {
+    u32_16          zmm;
+    pkt_metadata_t  key;        // Only the flow_key_mask part is meaningful
+    struct {
+        u32         _key[FLOW_KEY_DWORDS];
+        u32         hash;
+        u64         pkts;
+        u64         bytes;
+    };
+} flow_entry_t;
+
+STATIC_ASSERT(sizeof(flow_entry_t) == 64);
+STATIC_ASSERT(offsetof(flow_entry_t, hash) == FLOW_KEY_BYTES);
+
+typedef struct {
+    u32     sig[8];             // Full hash of the flow in each slot
+    u32     idx[8];             // 1 + the flow's index, 0 for a free slot
+} flow_bucket_t;
+
+typedef struct {
+    u32             bucket_mask;
+    u32             max_flows;
+    u32             n_flows;
+    u32             seed;
+    u64             drops;      // Packets of new flows that didn't fit
+    flow_bucket_t   bucket[0] __attribute__((__aligned__(64)));
+} flow_table_t;
+
+/* Enough 8 slot buckets (a power of two) to keep them at most half full. */
+#define _FLOW_TABLE_BUCKETS(_max_flows)                                                     \
+    (((_max_flows) <= 4) ? 1UL : (2UL << (63 - __builtin_clzl((((_max_flows) + 3) / 4) - 1))))
+
+#define FLOW_TABLE_MEM_SIZE(_max_flows)                                                     \
+    (sizeof(flow_table_t) + (_FLOW_TABLE_BUCKETS(_max_flows) * sizeof(flow_bucket_t)) +     \
+     ((_max_flows) * sizeof(flow_entry_t)))
+
+/*
+ *    Lay out an empty table for up to max_flows flows in mem, which must be 64 byte aligned and
+ * at least FLOW_TABLE_MEM_SIZE(max_flows) bytes.  Returns NULL on bad arguments.
+ */
+static inline flow_table_t *flow_table_init(void * const mem, const u32 max_flows, const u32 seed)
+{
+    flow_table_t * const ft = (flow_table_t *)mem;
+
+    if ((mem == NULL) | ((u64)mem & 63) | (max_flows == 0) | (max_flows > (1U << 30))) {
+        return NULL;
+    }
+
+    const u64 nbuckets = _FLOW_TABLE_BUCKETS(max_flows);
+
+    __builtin_memset(ft, 0, sizeof(*ft) + (nbuckets * sizeof(flow_bucket_t)));
+    ft->bucket_mask = nbuckets - 1;
+    ft->max_flows = max_flows;
+    ft->seed = seed;
+    return ft;
+}
+
+static ALWAYS_INLINE flow_entry_t *flow_table_entries(const flow_table_t * const ft)
+{
+    return (flow_entry_t *)(ft->bucket + ft->bucket_mask + 1);
+}
+
+/*
+ * The hash the table files md's flow under: murmur3 of the masked key.
+ */
+static inline u32 flow_hash(const pkt_metadata_t * const RESTR md, const u32 seed)
+{
+    const u32_16 key = md->zmm & flow_key_mask.zmm;
+
+    return murmur3_u32(&key, FLOW_KEY_BYTES, seed);
+}
+
+/*
+ *    flow_hash() of 16 masked keys at once: transposed so that each of the FLOW_KEY_DWORDS
+ * columns is one register, then hashed column by column.  (Permutes feeding only the columns
+ * past the key are dead code.)
+ */
+static ALWAYS_INLINE u32_16 _flow_hash_keys_x16(const u32_16 * const RESTR keys, const u32 seed)
+{
+    u32_16 col[16];
+
+    transpose_u32_16x16(keys, col);
+    return murmur3_u32_16_cols(col, FLOW_KEY_DWORDS, seed);
+}
+
+/*
+ * flow_hash() of each of md[0, 16).
+ */
+static inline u32_16 flow_hash_x16(const pkt_metadata_t * const RESTR md, const u32 seed)
+{
+    u32_16 keys[16];
+    unsigned i;
+
+    for (i = 0; i < 16; i++) {
+        keys[i] = md[i].zmm & flow_key_mask.zmm;
+    }
+
+    return _flow_hash_keys_x16(keys, seed);
+}
+
+/*
+ *    Symmetric flow_hash(): each dword of the source and destination addresses, and the two
+ * ports, put in (min, max) order before hashing, so swapping source and destination hashes the
+ * same.
+ */
+static inline u32 flow_hash_sym(const pkt_metadata_t * const RESTR md, const u32 seed)
+{
+    pkt_metadata_t key = { .zmm = md->zmm & flow_key_mask.zmm };
+    const u16 sp = key.src_port, dp = key.dst_port;
+    unsigned i;
+
+    for (i = 0; i < 4; i++) {
+        const u32 s = key.src_ip.u32[i], d = key.dst_ip.u32[i];
+
+        key.src_ip.u32[i] = (s < d) ? s : d;
+        key.dst_ip.u32[i] = (s < d) ? d : s;
+    }
+
+    key.src_port = (sp < dp) ? sp : dp;
+    key.dst_port = (sp < dp) ? dp : sp;
+    return murmur3_u32(&key, FLOW_KEY_BYTES, seed);
+}
+
+/*
+ * flow_hash_sym() of each of md[0, 16): flow_hash_x16() with a min/max per address column and a
+ * min/max of the two port halves of the port column.
+ */
+static inline u32_16 flow_hash_sym_x16(const pkt_metadata_t * const RESTR md, const u32 seed)
+{
+    const u32 pcol = offsetof(pkt_metadata_t, src_port) / sizeof(u32);
+    u32_16 keys[16], col[16];
+    unsigned i;
+
+    for (i = 0; i < 16; i++) {
+        keys[i] = md[i].zmm & flow_key_mask.zmm;
+    }
+
+    transpose_u32_16x16(keys, col);
+
+    for (i = 0; i < 4; i++) {
+        const __m512i s = (__m512i)col[i], d = (__m512i)col[i + 4];
+
+        col[i] = (u32_16)_mm512_min_epu32(s, d);
+        col[i + 4] = (u32_16)_mm512_max_epu32(s, d);
+    }
+
+    const __m512i ports = (__m512i)col[pcol];
+    const __m512i swapped = _mm512_rol_epi32(ports, 16);
+
+    col[pcol] = (u32_16)_mm512_mask_blend_epi16(0xAAAAAAAA, _mm512_min_epu16(ports, swapped),
+                                                _mm512_max_epu16(ports, swapped));
+    return murmur3_u32_16_cols(col, FLOW_KEY_DWORDS, seed);
+}
+
+/*
+ *    Find the flow with (masked) key and hash h, adding it if add is set and there's room (and
+ * setting *added).  Returns its index or FLOW_NONE.
+ */
+static ALWAYS_INLINE u32 _flow_table_probe(flow_table_t * const RESTR ft, const u32_16 key,
+                                           const u32 h, const int add, u32 * const RESTR added)
+{
+    flow_entry_t * const ent = flow_table_entries(ft);
+    u32 b = h & ft->bucket_mask;
+
+    for (;;) {
+        flow_bucket_t * const bk = &ft->bucket[b];
+        const __m256i idx = _mm256_load_si256((const __m256i *)bk->idx);
+        const __m256i sig = _mm256_load_si256((const __m256i *)bk->sig);
+        __mmask8 cand = _mm256_mask_cmpeq_epi32_mask(_mm256_test_epi32_mask(idx, idx), sig,
+                                                     _mm256_set1_epi32(h));
+
+        while (cand) {
+            const u32 e = bk->idx[__builtin_ctz(cand)] - 1;
+
+            if (!_mm512_test_epi32_mask((__m512i)(ent[e].zmm ^ key), (__m512i)flow_key_mask.zmm)) {
+                return e;
+            }
+
+            cand &= cand - 1;
+        }
+
+        const __mmask8 empty = _mm256_testn_epi32_mask(idx, idx);
+
+        if (empty) {
+            if (!add | (ft->n_flows == ft->max_flows)) {
+                return FLOW_NONE;
+            }
+
+            const u32 slot = __builtin_ctz(empty);
+            const u32 e = ft->n_flows++;
+
+            ent[e].zmm = key;
+            ent[e].hash = h;
+            ent[e].pkts = 0;
+            ent[e].bytes = 0;
+            bk->sig[slot] = h;
+            bk->idx[slot] = e + 1;
+            *added = 1;
+            return e;
+        }
+
+        b = (b + 1) & ft->bucket_mask;
+    }
+}
+
+/*
+ * The flow md belongs to, or NULL if the table hasn't seen it.
+ */
+static inline const flow_entry_t *flow_table_find(flow_table_t * const RESTR ft,
+                                                  const pkt_metadata_t * const RESTR md)
+{
+    const u32_16 key = md->zmm & flow_key_mask.zmm;
+    u32 added = 0;
+    const u32 e = _flow_table_probe(ft, key, murmur3_u32(&key, FLOW_KEY_BYTES, ft->seed), 0,
+                                    &added);
+
+    return (e == FLOW_NONE) ? NULL : &flow_table_entries(ft)[e];
+}
+
+/*
+ *    Count the packets of md[i] for each lane i in lanes (e.g. the mask pkt_digest_x16() returned)
+ * against their flows, adding any flows not yet in the table.  flow[0, 16) gets each lane's flow
+ * index, FLOW_NONE for lanes not in lanes or whose new flow didn't fit (which count as drops).
+ * Returns the lanes which added a flow.  md[i] is only read for lanes in lanes.
+ */
+static inline __mmask16 flow_table_update_x16(flow_table_t * const RESTR ft,
+                                              const pkt_metadata_t * const RESTR md,
+                                              const __mmask16 lanes, u32 * const RESTR flow)
+{
+    u32_16 keys[16];
+    flow_entry_t * const ent = flow_table_entries(ft);
+    __mmask16 added = 0;
+    u32 h[16] __attribute__((__aligned__(64)));
+    u32 m, i;
+
+    for (i = 0; i < 16; i++) {
+        keys[i] = ((lanes >> i) & 1) ? md[i].zmm & flow_key_mask.zmm : (u32_16){};
+    }
+
+    *(u32_16 *)h = _flow_hash_keys_x16(keys, ft->seed);
+
+    for (m = lanes; m; m &= m - 1) {
+        _mm_prefetch((const char *)&ft->bucket[h[__builtin_ctz(m)] & ft->bucket_mask],
+                     _MM_HINT_T0);
+    }
+
+    _mm512_storeu_si512(flow, _mm512_set1_epi32(FLOW_NONE));
+
+    for (m = lanes; m; m &= m - 1) {
+        u32 new = 0;
+
+        i = __builtin_ctz(m);
+        flow[i] = _flow_table_probe(ft, keys[i], h[i], 1, &new);
+
+        if (flow[i] == FLOW_NONE) {
+            ft->drops++;
+            continue;
+        }
+
+        added |= new << i;
+        ent[flow[i]].pkts++;
+        ent[flow[i]].bytes += md[i].pph->orig_len;
+    }
+
+    return added;
+}
+
+/*
+ *    Steering: 16 packet handles (any u32 but FLOW_NONE, e.g. positions in a batch) at a time go
+ * to queue reta[hash % reta_size].  Each queue's handles are compress-stored into a pending
+ * buffer, and every 16 go to its ring as one slot.  If the ring is full the slot is dropped (and
+ * counted), the steering core can't wait on one worker.  flow_steer_flush() pushes out partly
+ * filled slots, padded with FLOW_NONE.
+ *
+ *    reta starts out round robin (entry i is queue i % nqueues), and may be rewritten with any
+ * queues < nqueues between calls, e.g. to move load off a busy core.
+ */
+#define FLOW_STEER_MAX_QUEUES   (64)
+#define FLOW_STEER_RETA_MAX     (512)
+
+typedef struct {
+    u32             pend[FLOW_STEER_MAX_QUEUES][32] __attribute__((__aligned__(64)));
+    u32             reta[FLOW_STEER_RETA_MAX];
+    spsc_ring_t    *ring[FLOW_STEER_MAX_QUEUES];
+    u32             count[FLOW_STEER_MAX_QUEUES];   // Handles pending
+    u64             handles[FLOW_STEER_MAX_QUEUES]; // Handles steered to each queue
+    u64             drops[FLOW_STEER_MAX_QUEUES];   // Of those, dropped because the ring was full
+    u32             nqueues;
+    u32             reta_size;
+} flow_steer_t;
+
+/*
+ * reta_size must be a power of two, at most FLOW_STEER_RETA_MAX.  Returns 0, or -1 on bad args.
+ */
+static inline int flow_steer_init(flow_steer_t * const RESTR fs, spsc_ring_t * const * const ring,
+                                  const u32 nqueues, const u32 reta_size)
+{
+    u32 i;
+
+    if ((nqueues == 0) | (nqueues > FLOW_STEER_MAX_QUEUES) | (reta_size == 0) |
+        (reta_size > FLOW_STEER_RETA_MAX) | (reta_size & (reta_size - 1))) {
+        return -1;
+    }
+
+    __builtin_memset(fs, 0, sizeof(*fs));
+
+    for (i = 0; i < nqueues; i++) {
+        if (ring[i] == NULL) {
+            return -1;
+        }
+
+        fs->ring[i] = ring[i];
+    }
+
+    for (i = 0; i < reta_size; i++) {
+        fs->reta[i] = i % nqueues;
+    }
+
+    fs->nqueues = nqueues;
+    fs->reta_size = reta_size;
+    return 0;
+}
+
+/*
+ *    Steer the handles of the lanes in lanes by hash h (flow_hash_sym_x16() to keep connections
+ * on one core).  Returns each lane's queue.  Each distinct queue among the lanes is one compress
+ * store, so this costs more the more queues a vector spreads over.
+ */
+static inline u32_16 flow_steer_x16(flow_steer_t * const RESTR fs, const u32_16 h,
+                                    const u32_16 handles, __mmask16 lanes)
+{
+    const u32_16 queue = gather_u32_from_lookup_table_x16(h & (fs->reta_size - 1), fs->reta,
+                                                          fs->reta_size);
+
+    while (lanes) {
+        const u32 q = queue[__builtin_ctz(lanes)];
+        const __mmask16 m = lanes & VEC_TO_MASK(queue == q);
+        const u32 n = __builtin_popcount(m);
+        u32 c = fs->count[q];
+
+        lanes &= ~m;
+        _mm512_mask_compressstoreu_epi32(&fs->pend[q][c], m, (__m512i)handles);
+        fs->handles[q] += n;
+        c += n;
+
+        if (c >= 16) {
+            u32_16 * const RESTR pv = (u32_16 *)fs->pend[q];
+
+            if (!spsc_ring_enqueue(fs->ring[q], pv, 1)) {
+                fs->drops[q] += 16;
+            }
+
+            pv[0] = pv[1];
+            c -= 16;
+        }
+
+        fs->count[q] = c;
+    }
+
+    return queue;
+}
+
+/*
+ *    Send every queue's pending handles, padded out to a whole slot with FLOW_NONE.  Returns the
+ * number of queues whose ring was full, which keep their handles pending.
+ */
+static inline u32 flow_steer_flush(flow_steer_t * const RESTR fs)
+{
+    u32 q, full = 0;
+
+    for (q = 0; q < fs->nqueues; q++) {
+        u32_16 * const RESTR pv = (u32_16 *)fs->pend[q];
+        const u32 c = fs->count[q];
+
+        if (c == 0) {
+            continue;
+        }
+
+        pv[0] = (u32_16)_mm512_mask_mov_epi32((__m512i)pv[0], (__mmask16)(~0U << c),
+                                              _mm512_set1_epi32(FLOW_NONE));
+
+        if (spsc_ring_enqueue(fs->ring[q], pv, 1)) {
+            fs->count[q] = 0;
+        } else {
+            full++;
+        }
+    }
+
+    return full;
+}
+
+#endif /* _FLOW_UTIL_H_ */
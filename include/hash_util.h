@@ -90,14 +90,12 @@ static inline PURE_FUNC u32_8 murmur3_u32_8(const mpv_8 * const RESTR key, const
         const u32_8 t4 = accum ^ t3;
         const u32_8 t5 = rotl_u32_imm(t4, 13);
         const u32_8 t6 = (t5 * 5);
-        const u32_8 t7 = t6 + c3;
-        accum = MUX_ON_MASK(lanes, t7, accum);
+        accum = MASKED_OP(add, lanes, accum, t6, (u32_8){} + c3);
     }
 
     lanes = initial_lanes & VEC_TO_MASK(rem > 0);
 
     if (lanes) {
-        const u32_8 z = {};
         u32_8 tmp = {};
 
         for (j = 0; j < 8; j++) {
@@ -116,7 +114,7 @@ static inline PURE_FUNC u32_8 murmur3_u32_8(const mpv_8 * const RESTR key, const
         const u32_8 t1 = t0 * c1;
         const u32_8 t2 = rotl_u32_imm(t1, 15);
         const u32_8 t3 = t2 * c2;
-        accum ^= MUX_ON_MASK(lanes, t3, z);
+        accum = MASKED_OP(xor, lanes, accum, accum, t3);
     }
 
     accum ^= len;
@@ -156,8 +154,7 @@ static inline PURE_FUNC u32_8 murmur3_u32_8_notail(const mpv_8 * const RESTR key
         const u32_8 t4 = accum ^ t3;
         const u32_8 t5 = rotl_u32_imm(t4, 13);
         const u32_8 t6 = (t5 * 5);
-        const u32_8 t7 = t6 + c3;
-        accum = MUX_ON_MASK(lanes, t7, accum);
+        accum = MASKED_OP(add, lanes, accum, t6, (u32_8){} + c3);
     }
 
     accum ^= nblk * 4;
@@ -169,6 +166,41 @@ static inline PURE_FUNC u32_8 murmur3_u32_8_notail(const mpv_8 * const RESTR key
     return m4;
 }
 
+/*
+ *    murmur3 of 16 keys of nblk dwords each, already transposed: col[i] holds dword i of all 16
+ * keys (e.g. from transpose_u32_16x16()).  No gathers, and the per-block work that doesn't depend
+ * on the running hash is free to run ahead of it.
+ */
+static ALWAYS_INLINE PURE_FUNC u32_16 murmur3_u32_16_cols(const u32_16 * const RESTR col,
+                                                          const unsigned nblk, const u32 seed)
+{
+    const u32 c1 = 0xcc9e2d51U;
+    const u32 c2 = 0x1b873593U;
+    const u32 c3 = 0xe6546b64U;
+    const u32 f1 = 0x85ebca6bU;
+    const u32 f2 = 0xc2b2ae35U;
+
+    unsigned i;
+    u32_16 accum = (u32_16){} + seed;
+
+    for (i = 0; i < nblk; i++) {
+        const u32_16 t1 = col[i] * c1;
+        const u32_16 t2 = (u32_16)_mm512_rol_epi32((__m512i)t1, 15);
+        const u32_16 t3 = t2 * c2;
+        const u32_16 t4 = accum ^ t3;
+        const u32_16 t5 = (u32_16)_mm512_rol_epi32((__m512i)t4, 13);
+        accum = (t5 * 5) + c3;
+    }
+
+    accum ^= nblk * 4;
+    const u32_16 m0 = accum ^ (accum >> 16);
+    const u32_16 m1 = m0 * f1;
+    const u32_16 m2 = m1 ^ (m1 >> 13);
+    const u32_16 m3 = m2 * f2;
+    const u32_16 m4 = m3 ^ (m3 >> 16);
+    return m4;
+}
+
 //static const u8 _rss_iv[48] = {
 //    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
 //    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
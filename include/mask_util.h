@@ -8,6 +8,14 @@ extern int __attribute__((__error__("Unknown lane size"))) _mask_util_unknown_la
 extern int __attribute__((__error__("Mismatched types for mux/blend"))) _mismatched_types_for_mux(
         void);
 
+extern int __attribute__((__error__("Byte and word compress need AVX512_VBMI2")))
+        _mask_util_needs_vbmi2(void);
+
+extern int __attribute__((__error__("Unknown lane type"))) _mask_util_unknown_lane_type(void);
+
+extern int __attribute__((__error__("Mismatched types for masked op")))
+        _mismatched_types_for_masked_op(void);
+
 /*
  * Supplied with an input mask (as a scalar) and a vector type this macro
  * returns a vector of the requested type where each lane has all bits
@@ -599,4 +607,500 @@ static inline int schedule_batch(u32 * const RESTR hash, u32 * const RESTR posn,
     _ret.out;                                                                               \
 }) /* end of macro */
 
+#ifdef __AVX512VBMI2__
+#define _COMPRESS_EPI8(_pfx, _m, _v)    _pfx##_maskz_compress_epi8((_m), (_v))
+#define _COMPRESS_EPI16(_pfx, _m, _v)   _pfx##_maskz_compress_epi16((_m), (_v))
+#else
+#define _COMPRESS_EPI8(_pfx, _m, _v)    (_mask_util_needs_vbmi2(), (_v))
+#define _COMPRESS_EPI16(_pfx, _m, _v)   (_mask_util_needs_vbmi2(), (_v))
+#endif
+
+/*
+ *    Stream compaction in the style of MUX_ON_MASK(): for any vector type, COMPRESS_ON_MASK()
+ * returns a vector of the same type holding the lanes selected by the mask packed down to the
+ * bottom (in order) and zeroes above them.  Byte and word lanes need AVX512_VBMI2.
+ */
+#define COMPRESS_ON_MASK(_mask, _vec)                                                       \
+({                                                                                          \
+    const union {                                                                           \
+        __m128i     x;                                                                      \
+        __m256i     y;                                                                      \
+        __m512i     z;                                                                      \
+        typeof(_vec) in;                                                                    \
+    } _v_in = { .in = (_vec) };                                                             \
+    union {                                                                                 \
+        __m128i     x;                                                                      \
+        __m256i     y;                                                                      \
+        __m512i     z;                                                                      \
+        typeof(_v_in.in) out;                                                               \
+    } _ret = {};                                                                            \
+    const u64 _sel = (u64)(_mask) & (~0ULL >> (64 - VEC_LANES(_ret.out)));                  \
+                                                                                            \
+    if (IS_VEC_LEN(_ret.out, 16)) {                                                         \
+        if (IS_LANE_SIZE(_ret.out, 1)) {                                                    \
+            _ret.x = _COMPRESS_EPI8(_mm, _sel, _v_in.x);                                    \
+        } else if (IS_LANE_SIZE(_ret.out, 2)) {                                             \
+            _ret.x = _COMPRESS_EPI16(_mm, _sel, _v_in.x);                                   \
+        } else if (IS_LANE_SIZE(_ret.out, 4)) {                                             \
+            _ret.x = _mm_maskz_compress_epi32(_sel, _v_in.x);                               \
+        } else if (IS_LANE_SIZE(_ret.out, 8)) {                                             \
+            _ret.x = _mm_maskz_compress_epi64(_sel, _v_in.x);                               \
+        } else {                                                                            \
+            _mask_util_unknown_lane_size();                                                 \
+        }                                                                                   \
+    } else if (IS_VEC_LEN(_ret.out, 32)) {                                                  \
+        if (IS_LANE_SIZE(_ret.out, 1)) {                                                    \
+            _ret.y = _COMPRESS_EPI8(_mm256, _sel, _v_in.y);                                 \
+        } else if (IS_LANE_SIZE(_ret.out, 2)) {                                             \
+            _ret.y = _COMPRESS_EPI16(_mm256, _sel, _v_in.y);                                \
+        } else if (IS_LANE_SIZE(_ret.out, 4)) {                                             \
+            _ret.y = _mm256_maskz_compress_epi32(_sel, _v_in.y);                            \
+        } else if (IS_LANE_SIZE(_ret.out, 8)) {                                             \
+            _ret.y = _mm256_maskz_compress_epi64(_sel, _v_in.y);                            \
+        } else {                                                                            \
+            _mask_util_unknown_lane_size();                                                 \
+        }                                                                                   \
+    } else if (IS_VEC_LEN(_ret.out, 64)) {                                                  \
+        if (IS_LANE_SIZE(_ret.out, 1)) {                                                    \
+            _ret.z = _COMPRESS_EPI8(_mm512, _sel, _v_in.z);                                 \
+        } else if (IS_LANE_SIZE(_ret.out, 2)) {                                             \
+            _ret.z = _COMPRESS_EPI16(_mm512, _sel, _v_in.z);                                \
+        } else if (IS_LANE_SIZE(_ret.out, 4)) {                                             \
+            _ret.z = _mm512_maskz_compress_epi32(_sel, _v_in.z);                            \
+        } else if (IS_LANE_SIZE(_ret.out, 8)) {                                             \
+            _ret.z = _mm512_maskz_compress_epi64(_sel, _v_in.z);                            \
+        } else {                                                                            \
+            _mask_util_unknown_lane_size();                                                 \
+        }                                                                                   \
+    } else {                                                                                \
+        _mask_util_unknown_vector_size();                                                   \
+    }                                                                                       \
+    /* Return requested type */                                                             \
+    _ret.out;                                                                               \
+}) /* end of macro */
+
+/*
+ *    Store the lanes of _vec selected by _mask contiguously at _dst (unaligned, any pointer to the
+ * lane type) and return how many there were, so appending to an output cursor is just:
+ *
+ *      n += COMPRESS_STORE(out + n, VEC_TO_MASK(keep), v);
+ *
+ * Only the selected count of lanes is written, never anything past it.  The compress goes
+ * through a register and a masked store rather than vpcompress* with a memory destination, which
+ * is microcoded and much slower on some cores.
+ */
+#define COMPRESS_STORE(_dst, _mask, _vec)                                                   \
+({                                                                                          \
+    const u64 _cs_sel = (u64)(_mask) & (~0ULL >> (64 - VEC_TYPE_LANES(_vec)));              \
+    const union {                                                                           \
+        __m128i     x;                                                                      \
+        __m256i     y;                                                                      \
+        __m512i     z;                                                                      \
+        typeof(_vec) in;                                                                    \
+    } _packed = { .in = COMPRESS_ON_MASK(_cs_sel, (_vec)) };                                \
+    const u32 _cs_n = __builtin_popcountll(_cs_sel);                                        \
+    const u64 _cs_sm = _bzhi_u64(~0ULL, _cs_n);                                             \
+                                                                                            \
+    if (IS_VEC_LEN(_packed.in, 16)) {                                                       \
+        if (IS_LANE_SIZE(_packed.in, 1)) {                                                  \
+            _mm_mask_storeu_epi8((void *)(_dst), _cs_sm, _packed.x);                        \
+        } else if (IS_LANE_SIZE(_packed.in, 2)) {                                           \
+            _mm_mask_storeu_epi16((void *)(_dst), _cs_sm, _packed.x);                       \
+        } else if (IS_LANE_SIZE(_packed.in, 4)) {                                           \
+            _mm_mask_storeu_epi32((void *)(_dst), _cs_sm, _packed.x);                       \
+        } else if (IS_LANE_SIZE(_packed.in, 8)) {                                           \
+            _mm_mask_storeu_epi64((void *)(_dst), _cs_sm, _packed.x);                       \
+        } else {                                                                            \
+            _mask_util_unknown_lane_size();                                                 \
+        }                                                                                   \
+    } else if (IS_VEC_LEN(_packed.in, 32)) {                                                \
+        if (IS_LANE_SIZE(_packed.in, 1)) {                                                  \
+            _mm256_mask_storeu_epi8((void *)(_dst), _cs_sm, _packed.y);                     \
+        } else if (IS_LANE_SIZE(_packed.in, 2)) {                                           \
+            _mm256_mask_storeu_epi16((void *)(_dst), _cs_sm, _packed.y);                    \
+        } else if (IS_LANE_SIZE(_packed.in, 4)) {                                           \
+            _mm256_mask_storeu_epi32((void *)(_dst), _cs_sm, _packed.y);                    \
+        } else if (IS_LANE_SIZE(_packed.in, 8)) {                                           \
+            _mm256_mask_storeu_epi64((void *)(_dst), _cs_sm, _packed.y);                    \
+        } else {                                                                            \
+            _mask_util_unknown_lane_size();                                                 \
+        }                                                                                   \
+    } else if (IS_VEC_LEN(_packed.in, 64)) {                                                \
+        if (IS_LANE_SIZE(_packed.in, 1)) {                                                  \
+            _mm512_mask_storeu_epi8((void *)(_dst), _cs_sm, _packed.z);                     \
+        } else if (IS_LANE_SIZE(_packed.in, 2)) {                                           \
+            _mm512_mask_storeu_epi16((void *)(_dst), _cs_sm, _packed.z);                    \
+        } else if (IS_LANE_SIZE(_packed.in, 4)) {                                           \
+            _mm512_mask_storeu_epi32((void *)(_dst), _cs_sm, _packed.z);                    \
+        } else if (IS_LANE_SIZE(_packed.in, 8)) {                                           \
+            _mm512_mask_storeu_epi64((void *)(_dst), _cs_sm, _packed.z);                    \
+        } else {                                                                            \
+            _mask_util_unknown_lane_size();                                                 \
+        }                                                                                   \
+    } else {                                                                                \
+        _mask_util_unknown_vector_size();                                                   \
+    }                                                                                       \
+    /* Return the number of lanes stored */                                                 \
+    _cs_n;                                                                                  \
+}) /* end of macro */
+
+/*
+ *    Horizontal reductions of any SIMD type to a scalar of its lane type: VEC_REDUCE_ADD(),
+ * _MIN(), _MAX(), _AND(), _OR() and _XOR().  The tree halves the vector until it fits in an XMM
+ * register (vextracti64x4 / vextracti128 and one vertical op each), then folds the XMM register on
+ * itself with byte shifts of 8, 4, 2 and 1 down to the lane size, so a u32_16 sum is two extracts,
+ * two shifts and four adds.  Min and max use the signed, unsigned or floating point instruction
+ * for the lane type (the type, not just its size, is dispatched on), the bitwise ops work on the
+ * bits of floating point lanes too, and integer sums wrap in the lane type.
+ *
+ *    The _MASKED() forms only reduce the lanes selected by the mask, the others are replaced by
+ * the identity of the op first (so an empty mask gives 0 for add, or and xor, all ones for and,
+ * and the largest / smallest value of the lane type, or +/- infinity, for min / max).
+ */
+#define _VR_OP_ADD(_a, _b)      ((_a) + (_b))
+#define _VR_BITS(_a)            ((typeof((_a) < (_a)))(_a))  /* same size integer lanes */
+#define _VR_OP_AND(_a, _b)      ((typeof(_a))(_VR_BITS(_a) & _VR_BITS(_b)))
+#define _VR_OP_OR(_a, _b)       ((typeof(_a))(_VR_BITS(_a) | _VR_BITS(_b)))
+#define _VR_OP_XOR(_a, _b)      ((typeof(_a))(_VR_BITS(_a) ^ _VR_BITS(_b)))
+#define _VR_OP_MIN(_a, _b)      _VR_MINMAX(min, (_a), (_b))
+#define _VR_OP_MAX(_a, _b)      _VR_MINMAX(max, (_a), (_b))
+
+#define _VR_MINMAX_LANES(_fn, _pfx, _r, _out, _a, _b)                                       \
+    if (EXPR_MATCHES_TYPE((_out).v[0], u8)) {                                               \
+        (_out)._r = _pfx##_##_fn##_epu8((_a)._r, (_b)._r);                                  \
+    } else if (EXPR_MATCHES_TYPE((_out).v[0], u16)) {                                       \
+        (_out)._r = _pfx##_##_fn##_epu16((_a)._r, (_b)._r);                                 \
+    } else if (EXPR_MATCHES_TYPE((_out).v[0], u32)) {                                       \
+        (_out)._r = _pfx##_##_fn##_epu32((_a)._r, (_b)._r);                                 \
+    } else if (EXPR_MATCHES_TYPE((_out).v[0], u64)) {                                       \
+        (_out)._r = _pfx##_##_fn##_epu64((_a)._r, (_b)._r);                                 \
+    } else if (EXPR_MATCHES_TYPE((_out).v[0], i8)) {                                        \
+        (_out)._r = _pfx##_##_fn##_epi8((_a)._r, (_b)._r);                                  \
+    } else if (EXPR_MATCHES_TYPE((_out).v[0], i16)) {                                       \
+        (_out)._r = _pfx##_##_fn##_epi16((_a)._r, (_b)._r);                                 \
+    } else if (EXPR_MATCHES_TYPE((_out).v[0], i32)) {                                       \
+        (_out)._r = _pfx##_##_fn##_epi32((_a)._r, (_b)._r);                                 \
+    } else if (EXPR_MATCHES_TYPE((_out).v[0], i64)) {                                       \
+        (_out)._r = _pfx##_##_fn##_epi64((_a)._r, (_b)._r);                                 \
+    } else if (EXPR_MATCHES_TYPE((_out).v[0], f32)) {                                       \
+        (_out)._r##s = _pfx##_##_fn##_ps((_a)._r##s, (_b)._r##s);                           \
+    } else if (EXPR_MATCHES_TYPE((_out).v[0], f64)) {                                       \
+        (_out)._r##d = _pfx##_##_fn##_pd((_a)._r##d, (_b)._r##d);                           \
+    } else {                                                                                \
+        _mask_util_unknown_lane_type();                                                     \
+    }
+
+#define _VR_MINMAX(_fn, _a, _b)                                                             \
+({                                                                                          \
+    typedef union {                                                                         \
+        __m128i     x;                                                                      \
+        __m128      xs;                                                                     \
+        __m128d     xd;                                                                     \
+        __m256i     y;                                                                      \
+        __m256      ys;                                                                     \
+        __m256d     yd;                                                                     \
+        typeof(_a)  v;                                                                      \
+    } _mm_t;                                                                                \
+    const _mm_t _ma = { .v = (_a) }, _mb = { .v = (_b) };                                   \
+    _mm_t _mr = {};                                                                         \
+                                                                                            \
+    if (IS_VEC_LEN(_mr.v, 16)) {                                                            \
+        _VR_MINMAX_LANES(_fn, _mm, x, _mr, _ma, _mb);                                       \
+    } else if (IS_VEC_LEN(_mr.v, 32)) {                                                     \
+        _VR_MINMAX_LANES(_fn, _mm256, y, _mr, _ma, _mb);                                    \
+    } else {                                                                                \
+        _mask_util_unknown_vector_size();                                                   \
+    }                                                                                       \
+                                                                                            \
+    _mr.v;                                                                                  \
+}) /* end of macro */
+
+#define _VR_STEP_128(_op, _r, _nbytes)                                                      \
+({                                                                                          \
+    if (sizeof((_r)[0]) <= (_nbytes)) {                                                     \
+        union {                                                                             \
+            __m128i     x;                                                                  \
+            typeof(_r)  v;                                                                  \
+        } _sh = { .v = (_r) };                                                              \
+                                                                                            \
+        _sh.x = _mm_bsrli_si128(_sh.x, (_nbytes));                                          \
+        (_r) = _op((_r), _sh.v);                                                            \
+    }                                                                                       \
+}) /* end of macro */
+
+#define _VEC_REDUCE(_op, _vec)                                                              \
+({                                                                                          \
+    typedef typeof(+(_vec)) _vr_t;                                                          \
+    const _vr_t _vr_v = (_vec);                                                             \
+    typedef typeof(((_vr_t){})[0]) _vr_lane_t;                                              \
+    typedef _vr_lane_t _vr_128_t __attribute__((__vector_size__(16)));                      \
+    typedef _vr_lane_t _vr_256_t __attribute__((__vector_size__(32)));                      \
+    const union {                                                                           \
+        _vr_t       in;                                                                     \
+        _vr_256_t   y[2];                                                                   \
+        _vr_128_t   x[4];                                                                   \
+    } _vr_in = { .in = _vr_v };                                                             \
+    _vr_128_t _vr_r = {};                                                                   \
+                                                                                            \
+    if (IS_VEC_LEN(_vr_v, 64)) {                                                            \
+        const union {                                                                       \
+            _vr_256_t   y;                                                                  \
+            _vr_128_t   x[2];                                                               \
+        } _vr_h = { .y = _op(_vr_in.y[0], _vr_in.y[1]) };                                   \
+                                                                                            \
+        _vr_r = _op(_vr_h.x[0], _vr_h.x[1]);                                                \
+    } else if (IS_VEC_LEN(_vr_v, 32)) {                                                     \
+        _vr_r = _op(_vr_in.x[0], _vr_in.x[1]);                                              \
+    } else if (IS_VEC_LEN(_vr_v, 16)) {                                                     \
+        _vr_r = _vr_in.x[0];                                                                \
+    } else {                                                                                \
+        _mask_util_unknown_vector_size();                                                   \
+    }                                                                                       \
+                                                                                            \
+    _VR_STEP_128(_op, _vr_r, 8);                                                            \
+    _VR_STEP_128(_op, _vr_r, 4);                                                            \
+    _VR_STEP_128(_op, _vr_r, 2);                                                            \
+    _VR_STEP_128(_op, _vr_r, 1);                                                            \
+    _vr_r[0];                                                                               \
+}) /* end of macro */
+
+#define VEC_REDUCE_ADD(_vec)    _VEC_REDUCE(_VR_OP_ADD, _vec)
+#define VEC_REDUCE_MIN(_vec)    _VEC_REDUCE(_VR_OP_MIN, _vec)
+#define VEC_REDUCE_MAX(_vec)    _VEC_REDUCE(_VR_OP_MAX, _vec)
+#define VEC_REDUCE_AND(_vec)    _VEC_REDUCE(_VR_OP_AND, _vec)
+#define VEC_REDUCE_OR(_vec)     _VEC_REDUCE(_VR_OP_OR, _vec)
+#define VEC_REDUCE_XOR(_vec)    _VEC_REDUCE(_VR_OP_XOR, _vec)
+
+/*
+ * Largest and smallest values of a (scalar) lane type, +/- infinity for floating point.
+ */
+#define _VR_IS_FLOAT(_t)        ((_t)0.5 != 0)
+#define _VR_IS_SIGNED(_t)       ((_t)-1 < 0)
+#define _VR_LANE_MAX(_t)                                                                    \
+    ((_t)(_VR_IS_FLOAT(_t) ? (_t)__builtin_inf() :                                          \
+          _VR_IS_SIGNED(_t) ? (_t)(~0ULL >> (65 - BIT_SIZE(_t))) : (_t)~0ULL))
+#define _VR_LANE_MIN(_t)                                                                    \
+    ((_t)(_VR_IS_FLOAT(_t) ? (_t)-__builtin_inf() :                                         \
+          _VR_IS_SIGNED(_t) ? (_t)(-(_t)(~0ULL >> (65 - BIT_SIZE(_t))) - 1) : (_t)0))
+
+#define _VR_ID_ZERO(_t)         ((_t)0)
+
+#define _VEC_REDUCE_MASKED(_reduce, _mask, _vec, _identity)                                 \
+({                                                                                          \
+    typedef typeof(+(_vec)) _vrm_t;                                                         \
+    typedef typeof(((_vrm_t){})[0]) _vrm_lane_t;                                            \
+    const _vrm_t _vrm_id = (_vrm_t){} + _identity(_vrm_lane_t);                             \
+                                                                                            \
+    _reduce(MUX_ON_MASK((_mask), (_vrm_t)(_vec), _vrm_id));                                 \
+}) /* end of macro */
+
+#define VEC_REDUCE_ADD_MASKED(_m, _vec) _VEC_REDUCE_MASKED(VEC_REDUCE_ADD, _m, _vec, _VR_ID_ZERO)
+#define VEC_REDUCE_MIN_MASKED(_m, _vec) _VEC_REDUCE_MASKED(VEC_REDUCE_MIN, _m, _vec, _VR_LANE_MAX)
+#define VEC_REDUCE_MAX_MASKED(_m, _vec) _VEC_REDUCE_MASKED(VEC_REDUCE_MAX, _m, _vec, _VR_LANE_MIN)
+#define VEC_REDUCE_OR_MASKED(_m, _vec)  _VEC_REDUCE_MASKED(VEC_REDUCE_OR, _m, _vec, _VR_ID_ZERO)
+#define VEC_REDUCE_XOR_MASKED(_m, _vec) _VEC_REDUCE_MASKED(VEC_REDUCE_XOR, _m, _vec, _VR_ID_ZERO)
+
+/* All ones isn't a value of a floating point lane, so this one goes through the bits. */
+#define VEC_REDUCE_AND_MASKED(_m, _vec)                                                     \
+({                                                                                          \
+    typedef typeof(+(_vec)) _vra_t;                                                         \
+    _vra_t _vra_ones;                                                                       \
+                                                                                            \
+    __builtin_memset(&_vra_ones, 0xFF, sizeof(_vra_ones));                                  \
+    VEC_REDUCE_AND(MUX_ON_MASK((_m), (_vra_t)(_vec), _vra_ones));                           \
+}) /* end of macro */
+
+/*
+ *    Index of the (first) smallest / largest lane: the reduction broadcast back, compared with
+ * every lane, and the lowest set bit of the result.  The _MASKED() forms only consider the
+ * selected lanes and return VEC_LANES(_vec) for an empty mask.
+ */
+#define _VEC_ARG(_reduce, _vec, _mask)                                                      \
+({                                                                                          \
+    typedef typeof(+(_vec)) _va_t;                                                          \
+    const _va_t _va_v = (_vec);                                                             \
+    const u64 _va_sel = (u64)(_mask) & (~0ULL >> (64 - VEC_LANES(_va_v)));                  \
+    const u64 _va_hit = VEC_TO_MASK(_va_v == _reduce(_va_sel, _va_v)) & _va_sel;            \
+    const u32 _va_idx = _tzcnt_u64(_va_hit);                                                \
+                                                                                            \
+    (_va_idx < VEC_LANES(_va_v)) ? _va_idx : (u32)VEC_LANES(_va_v);                         \
+}) /* end of macro */
+
+#define _VR_ALL_MIN(_m, _vec)           VEC_REDUCE_MIN(_vec)
+#define _VR_ALL_MAX(_m, _vec)           VEC_REDUCE_MAX(_vec)
+
+#define VEC_ARGMIN(_vec)                _VEC_ARG(_VR_ALL_MIN, _vec, ~0ULL)
+#define VEC_ARGMAX(_vec)                _VEC_ARG(_VR_ALL_MAX, _vec, ~0ULL)
+#define VEC_ARGMIN_MASKED(_mask, _vec)  _VEC_ARG(VEC_REDUCE_MIN_MASKED, _vec, _mask)
+#define VEC_ARGMAX_MASKED(_mask, _vec)  _VEC_ARG(VEC_REDUCE_MAX_MASKED, _vec, _mask)
+
+/*
+ *    Arithmetic with the mask applied by the instruction itself, rather than computing the op in
+ * every lane and then blending with MUX_ON_MASK():
+ *
+ *      MASKED_OP(op, mask, src, a, b)  lanes set in mask get (a op b), the others src's lane
+ *      MASKZ_OP(op, mask, a, b)        lanes set in mask get (a op b), the others zero
+ *
+ * op is one of add, sub, min, max, and, or, xor, and src, a and b must all be the same vector type.
+ * Min and max follow the lane type (signed, unsigned or floating point) as VEC_REDUCE_MIN() does,
+ * and the bitwise ops act on the bits of floating point lanes.  There are no masked bitwise
+ * instructions for byte and word lanes, so those do the op on the whole register and then one
+ * masked move, which is still one instruction less than op + blend.
+ */
+#define _MO_PASTE(_a, _b)               _a##_b
+#define _MO_SFX(_sign, _bits)           _MO_PASTE(_sign, _bits)
+#define _MO_FN(_pfx, _kind, _op, _sfx)  _MO_FN_(_pfx, _kind, _op, _sfx)
+#define _MO_FN_(_pfx, _kind, _op, _sfx) _pfx##_##_kind##_##_op##_##_sfx
+#define _MO_ARGS_mask(_s, _m, _rest...)     (_s), (_m), _rest
+#define _MO_ARGS_maskz(_s, _m, _rest...)    (_m), _rest
+
+/* Unsigned lanes only need their own instruction for min and max. */
+#define _MO_U_add   epi
+#define _MO_U_sub   epi
+#define _MO_U_min   epu
+#define _MO_U_max   epu
+#define _MO_U_and   epi
+#define _MO_U_or    epi
+#define _MO_U_xor   epi
+
+/* How byte and word lanes get each op done. */
+#define _MO_BW_add  _MO_NATIVE
+#define _MO_BW_sub  _MO_NATIVE
+#define _MO_BW_min  _MO_NATIVE
+#define _MO_BW_max  _MO_NATIVE
+#define _MO_BW_and  _MO_WHOLE
+#define _MO_BW_or   _MO_WHOLE
+#define _MO_BW_xor  _MO_WHOLE
+#define _MO_NATIVE(_pfx, _w, _kind, _op, _sfx, _r)                                          \
+    (_mo_r._r = _MO_FN(_pfx, _kind, _op, _sfx)(_MO_ARGS_##_kind(_mo_s._r, _mo_m,            \
+                                                                _mo_a._r, _mo_b._r)))
+#define _MO_WHOLE(_pfx, _w, _kind, _op, _sfx, _r)                                           \
+    (_mo_r._r = _MO_FN(_pfx, _kind, mov, _sfx)(_MO_ARGS_##_kind(_mo_s._r, _mo_m,            \
+                                               _pfx##_##_op##_si##_w(_mo_a._r, _mo_b._r))))
+
+#define _MO_LANES(_pfx, _w, _r, _kind, _op)                                                 \
+    if (EXPR_MATCHES_TYPE(_mo_r.v[0], u8)) {                                                \
+        _MO_BW_##_op(_pfx, _w, _kind, _op, _MO_SFX(_MO_U_##_op, 8), _r);                    \
+    } else if (EXPR_MATCHES_TYPE(_mo_r.v[0], u16)) {                                        \
+        _MO_BW_##_op(_pfx, _w, _kind, _op, _MO_SFX(_MO_U_##_op, 16), _r);                   \
+    } else if (EXPR_MATCHES_TYPE(_mo_r.v[0], u32)) {                                        \
+        _MO_NATIVE(_pfx, _w, _kind, _op, _MO_SFX(_MO_U_##_op, 32), _r);                     \
+    } else if (EXPR_MATCHES_TYPE(_mo_r.v[0], u64)) {                                        \
+        _MO_NATIVE(_pfx, _w, _kind, _op, _MO_SFX(_MO_U_##_op, 64), _r);                     \
+    } else if (EXPR_MATCHES_TYPE(_mo_r.v[0], i8)) {                                         \
+        _MO_BW_##_op(_pfx, _w, _kind, _op, epi8, _r);                                       \
+    } else if (EXPR_MATCHES_TYPE(_mo_r.v[0], i16)) {                                        \
+        _MO_BW_##_op(_pfx, _w, _kind, _op, epi16, _r);                                      \
+    } else if (EXPR_MATCHES_TYPE(_mo_r.v[0], i32)) {                                        \
+        _MO_NATIVE(_pfx, _w, _kind, _op, epi32, _r);                                        \
+    } else if (EXPR_MATCHES_TYPE(_mo_r.v[0], i64)) {                                        \
+        _MO_NATIVE(_pfx, _w, _kind, _op, epi64, _r);                                        \
+    } else if (EXPR_MATCHES_TYPE(_mo_r.v[0], f32)) {                                        \
+        _MO_NATIVE(_pfx, _w, _kind, _op, ps, _r##s);                                        \
+    } else if (EXPR_MATCHES_TYPE(_mo_r.v[0], f64)) {                                        \
+        _MO_NATIVE(_pfx, _w, _kind, _op, pd, _r##d);                                        \
+    } else {                                                                                \
+        _mask_util_unknown_lane_type();                                                     \
+    }
+
+#define _MASKED_OP(_kind, _op, _mask, _src, _a, _b)                                         \
+({                                                                                          \
+    typedef union {                                                                         \
+        __m128i     x;                                                                      \
+        __m128      xs;                                                                     \
+        __m128d     xd;                                                                     \
+        __m256i     y;                                                                      \
+        __m256      ys;                                                                     \
+        __m256d     yd;                                                                     \
+        __m512i     z;                                                                      \
+        __m512      zs;                                                                     \
+        __m512d     zd;                                                                     \
+        typeof(+(_a)) v;                                                                    \
+    } _mo_t;                                                                                \
+    const _mo_t _mo_a = { .v = (_a) }, _mo_b = { .v = (_b) }, _mo_s = { .v = (_src) };      \
+    const u64 _mo_m = (u64)(_mask);                                                         \
+    _mo_t _mo_r = {};                                                                       \
+                                                                                            \
+    (void)_mo_s; /* Not used by the zeroing form. */                                        \
+    if (!EXPR_TYPES_MATCH(_mo_a.v, +(_b)) | !EXPR_TYPES_MATCH(_mo_a.v, +(_src))) {          \
+        _mismatched_types_for_masked_op();                                                  \
+    } else if (IS_VEC_LEN(_mo_r.v, 16)) {                                                   \
+        _MO_LANES(_mm, 128, x, _kind, _op);                                                 \
+    } else if (IS_VEC_LEN(_mo_r.v, 32)) {                                                   \
+        _MO_LANES(_mm256, 256, y, _kind, _op);                                              \
+    } else if (IS_VEC_LEN(_mo_r.v, 64)) {                                                   \
+        _MO_LANES(_mm512, 512, z, _kind, _op);                                              \
+    } else {                                                                                \
+        _mask_util_unknown_vector_size();                                                   \
+    }                                                                                       \
+                                                                                            \
+    _mo_r.v;                                                                                \
+}) /* end of macro */
+
+#define MASKED_OP(_op, _mask, _src, _a, _b) _MASKED_OP(mask, _op, _mask, _src, _a, _b)
+#define MASKZ_OP(_op, _mask, _a, _b)        _MASKED_OP(maskz, _op, _mask, (typeof(+(_a))){}, _a, _b)
+
+/*
+ *    Masked unaligned loads and stores of any vector type.  MASKED_LOADU() returns a vector of
+ * _type with the lanes set in the mask loaded from _ptr and the others zero, MASKED_STOREU() only
+ * writes the lanes of _vec set in the mask.  The lanes left out aren't accessed at all (faults in
+ * them are suppressed), so these can run off the end of a buffer, or a mapping, as long as the mask
+ * stops at the end of it.
+ */
+#define _MO_MEM_LANES(_fn, _e, _pfx, _r)                                                    \
+    if (IS_LANE_SIZE(_e, 1)) {                                                              \
+        _fn(_pfx, _r, epi8);                                                                \
+    } else if (IS_LANE_SIZE(_e, 2)) {                                                       \
+        _fn(_pfx, _r, epi16);                                                               \
+    } else if (IS_LANE_SIZE(_e, 4)) {                                                       \
+        _fn(_pfx, _r, epi32);                                                               \
+    } else if (IS_LANE_SIZE(_e, 8)) {                                                       \
+        _fn(_pfx, _r, epi64);                                                               \
+    } else {                                                                                \
+        _mask_util_unknown_lane_size();                                                     \
+    }
+
+#define _MO_MEM_VECS(_fn, _e)                                                               \
+    if (IS_VEC_LEN(_e, 16)) {                                                               \
+        _MO_MEM_LANES(_fn, _e, _mm, x);                                                     \
+    } else if (IS_VEC_LEN(_e, 32)) {                                                        \
+        _MO_MEM_LANES(_fn, _e, _mm256, y);                                                  \
+    } else if (IS_VEC_LEN(_e, 64)) {                                                        \
+        _MO_MEM_LANES(_fn, _e, _mm512, z);                                                  \
+    } else {                                                                                \
+        _mask_util_unknown_vector_size();                                                   \
+    }
+
+#define _MO_LOADU(_pfx, _r, _sfx)   (_ml_r._r = _pfx##_maskz_loadu_##_sfx(_ml_m, _ml_p))
+#define _MO_STOREU(_pfx, _r, _sfx)  _pfx##_mask_storeu_##_sfx(_ms_p, _ms_m, _ms_v._r)
+
+#define MASKED_LOADU(_ptr, _mask, _type)                                                    \
+({                                                                                          \
+    const void * const _ml_p = (const void *)(_ptr);                                        \
+    const u64 _ml_m = (u64)(_mask);                                                         \
+    union {                                                                                 \
+        __m128i     x;                                                                      \
+        __m256i     y;                                                                      \
+        __m512i     z;                                                                      \
+        _type       v;                                                                      \
+    } _ml_r = {};                                                                           \
+                                                                                            \
+    _MO_MEM_VECS(_MO_LOADU, _ml_r.v);                                                       \
+    _ml_r.v;                                                                                \
+}) /* end of macro */
+
+#define MASKED_STOREU(_ptr, _mask, _vec)                                                    \
+({                                                                                          \
+    void * const _ms_p = (void *)(_ptr);                                                    \
+    const u64 _ms_m = (u64)(_mask);                                                         \
+    const union {                                                                           \
+        __m128i     x;                                                                      \
+        __m256i     y;                                                                      \
+        __m512i     z;                                                                      \
+        typeof(+(_vec)) v;                                                                  \
+    } _ms_v = { .v = (_vec) };                                                              \
+                                                                                            \
+    _MO_MEM_VECS(_MO_STOREU, _ms_v.v);                                                      \
+}) /* end of macro */
+
 #endif /* _MASK_UTIL_H_ */
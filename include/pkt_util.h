@@ -0,0 +1,518 @@
+#ifndef _PKT_UTIL_H_
+#define _PKT_UTIL_H_
+
+/*
+ *    Packet and pcap header layouts, the per-packet metadata the parsers produce, and a SIMD
+ * parallel packet digestor, pkt_digest_x16(), which fills in the same pkt_metadata_t as the
+ * scalar reference gen_pkt_metadata() (see perf_jig/packet_ops.c) for 16 packets at a time.
+ * Also checksum validation for the packets it parsed, pkt_csum_ok_x16() (whose scalar reference
+ * is pkt_csum_check(), also in packet_ops.c).
+ */
+
+typedef struct {
+    u32 magic;              // (0xa1b2c3d4 for usec res., 0xa1b23c4d for nsec res)
+    u16 v_major, v_minor;   // 2.4
+    i32 tz_adj;             // timezone adjust
+    u32 sigfigs;            // ignore
+    u32 snaplen;            // maximum packet bytes stored per packet
+    u32 network_encap;      // 1 = ethernet
+} pcap_file_hdr_t;
+
+typedef struct {
+    u32 ts_sec, ts_frac;    // Seconds and usec or nsec depending
+    u32 incl_len, orig_len; // Included length and original length
+    u8 pkt[0];              // packet...
+} pcap_pkt_hdr_t;
+
+typedef struct {
+    u8 dst[6];
+    u8 src[6];
+    u16 et;
+    u8 next[0];
+} eth_hdr_t;
+
+typedef struct {
+    u16 tag;
+    u16 et;
+    u8 next[0];
+} dot_q_t;
+
+typedef struct {
+    u8  ihl : 4,
+    ver : 4;
+    u8  ecn : 2,
+    dscp : 6;
+    u16 total_len;
+    u16 ident;
+    u16 flags_offs;
+    u8  ttl, proto;
+    u16 csum;
+    u32 src, dst;
+    u32 opts[0];
+} ip4_hdr_t;
+
+typedef struct {
+    u16     hw_type;
+    u16     l3_type;
+    u8      hw_size;
+    u8      l3_size;
+    u16     opcode;
+    u8      sender_mac[6];
+    u32     sender_ip;
+    u8      target_map[6];
+    u32     target_ip;
+} PACKED arp_eth_ip4_t;
+
+typedef struct {
+    u32     tc_h : 4,
+            ver : 4,
+            tc_l : 4,
+            label : 20;
+    u16     paylen;
+    u8      nexthdr, hoplim;
+    u32     src[4];
+    u32     dst[4];
+    u8      next[0];
+} ip6_hdr_t;
+
+typedef struct {
+    u8      nexthdr, optlen;
+    u8      data[6];
+    u8      next[0];
+} ip6_generic_opt_t;
+
+typedef struct {
+    u16 sport, dport, len, csum;
+    u8 next[0];
+} udp_hdr_t;
+
+typedef struct {
+    u16 sport, dport;
+    u32 seq, ack;
+    u16 doff_flags, wsize;
+    u16 csum, urg;
+    u8 next[0];
+} tcp_hdr_t;
+
+#define CONST_HTONS(x) (((x >> 8) & 0xFF) | ((x << 8) & 0xFF00))
+
+#define HW_ETHERNET (0x0001)
+
+#define ET_CVLAN    (0x8100)
+#define ET_SVLAN    (0x88A8)
+#define ET_IP4      (0x0800)
+#define ET_ARP      (0x0806)
+#define ET_IP6      (0x86DD)
+
+#define L4T_ICMP    (0x01)
+#define L4T_TCP     (0x06)
+#define L4T_UDP     (0x11)
+#define L4T_SCTP    (0x84)
+
+typedef union {
+    u32_4   u32_4;
+    u16_8   u16_8;
+    u32     u32[4];
+    u16     u16[8];
+} l3_addr_t;
+
+#define MD_PROTO_L2_CTAG    (1 << 0)
+#define MD_PROTO_L2_STAG    (1 << 1)
+
+#define MD_PROTO_L3_IP4     (1 << 8)
+#define MD_PROTO_L3_IP6     (2 << 8)
+#define MD_PROTO_L3_ARP     (3 << 8)
+
+#define MD_PROTO_L4_TCP     (1 << 16)
+#define MD_PROTO_L4_UDP     (2 << 16)
+#define MD_PROTO_L4_SCTP    (3 << 16)
+#define MD_PROTO_L4_ICMP    (4 << 16)
+
+typedef union {
+    u32_16  zmm;
+    struct {
+        // Flow Key Fields
+        l3_addr_t               src_ip;
+        l3_addr_t               dst_ip;
+        u16                     src_port, dst_port;
+        u16                     c_tag, s_tag;
+        u32                     proto_flags;
+        // Other Metadata fields
+        const pcap_pkt_hdr_t   *pph;
+        u16                     offs_vlan;
+        u16                     offs_l3;
+        u16                     offs_l4;
+        u16                     offs_payload;
+    };
+} pkt_metadata_t;
+
+/* The dword columns pkt_digest_x16() builds. */
+STATIC_ASSERT(sizeof(pkt_metadata_t) == 64);
+STATIC_ASSERT(offsetof(pkt_metadata_t, src_port) == 8 * sizeof(u32));
+STATIC_ASSERT(offsetof(pkt_metadata_t, c_tag) == 9 * sizeof(u32));
+STATIC_ASSERT(offsetof(pkt_metadata_t, proto_flags) == 10 * sizeof(u32));
+STATIC_ASSERT(offsetof(pkt_metadata_t, pph) == 12 * sizeof(u32));
+STATIC_ASSERT(offsetof(pkt_metadata_t, offs_vlan) == 14 * sizeof(u32));
+STATIC_ASSERT(offsetof(pkt_metadata_t, offs_l4) == 15 * sizeof(u32));
+
+static const pkt_metadata_t flow_key_mask = {
+    .src_ip.u32 = {~0U, ~0U, ~0U, ~0U },
+    .dst_ip.u32 = {~0U, ~0U, ~0U, ~0U },
+    .src_port = ~((u16)0), .dst_port = ~((u16)0),
+    .c_tag = ~((u16)0), .s_tag = ~((u16)0),
+    .proto_flags = ~0U,
+};
+
+/*
+ *    Bitmap of the IPv6 next header values which are extension headers to skip over (0, 43, 44,
+ * 50, 51, 60, 135, 139, 140, 253 and 254), one dword per 32 values so a vpermd picks the dword
+ * for each lane.
+ */
+#define _PKT_IP6_EXT_BITMAP                                                                 \
+    ((u32_8){ (1U << 0), (1U << (43 - 32)) | (1U << (44 - 32)) | (1U << (50 - 32)) |        \
+              (1U << (51 - 32)) | (1U << (60 - 32)), 0, 0, (1U << (135 - 128)) |            \
+              (1U << (139 - 128)) | (1U << (140 - 128)), 0, 0,                              \
+              (1U << (253 - 224)) | (1U << (254 - 224)) })
+
+static ALWAYS_INLINE __mmask16 _pkt_is_ip6_ext_x16(const u32_16 nh)
+{
+    const __m512i bitmap = _mm512_castsi256_si512((__m256i)_PKT_IP6_EXT_BITMAP);
+    const u32_16 dw = (u32_16)_mm512_permutexvar_epi32((__m512i)(nh >> 5), bitmap);
+
+    return _mm512_test_epi32_mask((__m512i)(dw >> (nh & 31)), _mm512_set1_epi32(1));
+}
+
+/*
+ *    The dword at byte offset offs of the pcap record at each lane's pph (so the packet starts at
+ * offset 16), for the lanes in m, 0 in the others.
+ */
+static ALWAYS_INLINE u32_16 _pkt_gather_x16(const u64_8 pph_lo, const u64_8 pph_hi,
+                                            const u32_16 offs, const __mmask16 m)
+{
+    const __m256i zero = {};
+    const __m256i o_lo = _mm512_castsi512_si256((__m512i)offs);
+    const __m256i o_hi = _mm512_extracti64x4_epi64((__m512i)offs, 1);
+    const u64_8 a_lo = pph_lo + (u64_8)_mm512_cvtepu32_epi64(o_lo);
+    const u64_8 a_hi = pph_hi + (u64_8)_mm512_cvtepu32_epi64(o_hi);
+    const __m256i g_lo = _mm512_mask_i64gather_epi32(zero, (__mmask8)m, (__m512i)a_lo, NULL, 1);
+    const __m256i g_hi = _mm512_mask_i64gather_epi32(zero, (__mmask8)(m >> 8), (__m512i)a_hi,
+                                                     NULL, 1);
+
+    return (u32_16)_mm512_inserti64x4(_mm512_castsi256_si512(g_lo), g_hi, 1);
+}
+
+/* Lanes in m for which an extent of ext bytes at cur would run past the end of the packet. */
+#define _PKT_OOB(_m, _cur, _ext, _ub)                                                       \
+    _mm512_mask_cmpgt_epu32_mask((_m), (__m512i)((_cur) + (_ext)), (__m512i)(_ub))
+
+#define _PKT_IS_VLAN(_et)                                                                   \
+    (VEC_TO_MASK((_et) == CONST_HTONS(ET_CVLAN)) | VEC_TO_MASK((_et) == CONST_HTONS(ET_SVLAN)))
+
+#define _PKT_SET(_v, _m, _x)    ((_v) = MUX_ON_MASK((_m), (u32_16)(_x), (_v)))
+
+/*
+ *    Parse the packets of up to 16 pcap records (hdrs[0, n)) in lockstep, filling md[0, n) with
+ * exactly what gen_pkt_metadata() would, and return the mask of those it would have returned 0
+ * for.  Each lane carries its own parse offset, header fields are gathered from each packet at
+ * that offset, and each protocol step only updates the lanes it applies to, so lanes which take
+ * different paths (or stop early) all come out of the same instruction stream.  Lanes stop at the
+ * same point the scalar parser would return -1, with whatever it had filled in by then.
+ *
+ *    Every gathered dword lies inside an extent that has already been checked against the
+ * packet's length, so nothing past the end of any packet is read.  The columns of the metadata
+ * (dword i of each lane's result) are built as 16 vectors and transposed into the 16 structs.
+ */
+static inline __mmask16 pkt_digest_x16(const pcap_pkt_hdr_t * const * const RESTR hdrs,
+                                       pkt_metadata_t * const RESTR md, const unsigned n)
+{
+    const __mmask16 in = _bzhi_u32(0xFFFF, n);
+    const u64_8 pph_lo = (u64_8)_mm512_maskz_loadu_epi64((__mmask8)in, hdrs);
+    const u64_8 pph_hi = (u64_8)_mm512_maskz_loadu_epi64((__mmask8)(in >> 8), hdrs + 8);
+    const u32_16 pkt = (u32_16){} + sizeof(pcap_pkt_hdr_t);
+    const u32_16 offs_none = (u32_16){} + 0xFFFF;
+    const u32_16 incl = _pkt_gather_x16(pph_lo, pph_hi, (u32_16){} + 8, in);
+    const u32_16 orig = _pkt_gather_x16(pph_lo, pph_hi, (u32_16){} + 12, in);
+    const u32_16 ub = (u32_16)_mm512_min_epu32((__m512i)incl, (__m512i)orig);
+    u32_16 col[16] = {}, cur = (u32_16){} + sizeof(eth_hdr_t), et, l4 = (u32_16){} + 0xFF, w;
+    u32_16 flags = {}, ctag = {}, stag = {};
+    u32_16 offs_vlan = offs_none, offs_l3 = offs_none, offs_l4 = offs_none;
+    u32_16 offs_payload = offs_none;
+    __mmask16 live = in & ~_PKT_OOB(in, (u32_16){}, sizeof(eth_hdr_t), ub), m, bad, c;
+    unsigned i;
+
+    /* Ethernet and any number of VLAN tags. */
+    et = _pkt_gather_x16(pph_lo, pph_hi, pkt + 10, live) >> 16;
+    m = live & _PKT_IS_VLAN(et);
+
+    while (m) {
+        bad = _PKT_OOB(m, cur, sizeof(dot_q_t), ub);
+        live &= ~bad;
+        m &= ~bad;
+        w = _pkt_gather_x16(pph_lo, pph_hi, pkt + cur, m);
+        c = m & VEC_TO_MASK(et == CONST_HTONS(ET_CVLAN));
+        _PKT_SET(ctag, c, w & 0xFFFF);
+        _PKT_SET(stag, m & ~c, w & 0xFFFF);
+        _PKT_SET(flags, c, flags | MD_PROTO_L2_CTAG);
+        _PKT_SET(flags, m & ~c, flags | MD_PROTO_L2_STAG);
+        _PKT_SET(offs_vlan, m, cur);
+        _PKT_SET(et, m, w >> 16);
+        _PKT_SET(cur, m, cur + sizeof(dot_q_t));
+        m &= _PKT_IS_VLAN(et);
+    }
+
+    /* IPv4: the version must match and the header (with options) must fit. */
+    m = live & VEC_TO_MASK(et == CONST_HTONS(ET_IP4));
+    bad = _PKT_OOB(m, cur, sizeof(ip4_hdr_t), ub);
+    live &= ~bad;
+    m &= ~bad;
+    w = _pkt_gather_x16(pph_lo, pph_hi, pkt + cur, m);
+    bad = m & VEC_TO_MASK(((w >> 4) & 0xF) != 4);
+    live &= ~bad;
+    m &= ~bad;
+    _PKT_SET(offs_l3, m, cur);
+    _PKT_SET(flags, m, flags | MD_PROTO_L3_IP4);
+    col[0] = _pkt_gather_x16(pph_lo, pph_hi, pkt + cur + offsetof(ip4_hdr_t, src), m);
+    col[4] = _pkt_gather_x16(pph_lo, pph_hi, pkt + cur + offsetof(ip4_hdr_t, dst), m);
+    bad = _PKT_OOB(m, cur, (w & 0xF) * sizeof(u32), ub);
+    live &= ~bad;
+    m &= ~bad;
+    _PKT_SET(l4, m, (_pkt_gather_x16(pph_lo, pph_hi, pkt + cur + 8, m) >> 8) & 0xFF);
+    _PKT_SET(cur, m, cur + (w & 0xF) * sizeof(u32));
+
+    /* IPv6, then whichever extension headers fit. */
+    m = live & VEC_TO_MASK(et == CONST_HTONS(ET_IP6));
+    bad = _PKT_OOB(m, cur, sizeof(ip6_hdr_t), ub);
+    live &= ~bad;
+    m &= ~bad;
+    w = _pkt_gather_x16(pph_lo, pph_hi, pkt + cur, m);
+    bad = m & VEC_TO_MASK(((w >> 4) & 0xF) != 6);
+    live &= ~bad;
+    m &= ~bad;
+
+    if (m) {
+        _PKT_SET(offs_l3, m, cur);
+        _PKT_SET(flags, m, flags | MD_PROTO_L3_IP6);
+
+        for (i = 0; i < 4; i++) {
+            _PKT_SET(col[i], m, _pkt_gather_x16(pph_lo, pph_hi,
+                                                pkt + cur + offsetof(ip6_hdr_t, src) + 4 * i, m));
+            _PKT_SET(col[4 + i], m, _pkt_gather_x16(pph_lo, pph_hi,
+                                                    pkt + cur + offsetof(ip6_hdr_t, dst) + 4 * i,
+                                                    m));
+        }
+
+        _PKT_SET(l4, m, (_pkt_gather_x16(pph_lo, pph_hi, pkt + cur + 4, m) >> 16) & 0xFF);
+        _PKT_SET(cur, m, cur + sizeof(ip6_hdr_t));
+        m &= ~_PKT_OOB(m, cur, sizeof(ip6_generic_opt_t), ub) & _pkt_is_ip6_ext_x16(l4);
+
+        while (m) {
+            w = _pkt_gather_x16(pph_lo, pph_hi, pkt + cur, m);
+            _PKT_SET(l4, m, w & 0xFF);
+            _PKT_SET(cur, m, cur + sizeof(ip6_generic_opt_t) + 8 * ((w >> 8) & 0xFF));
+            m &= ~_PKT_OOB(m, cur, sizeof(ip6_generic_opt_t), ub) & _pkt_is_ip6_ext_x16(l4);
+        }
+    }
+
+    /* ARP for IPv4 over Ethernet only. */
+    m = live & VEC_TO_MASK(et == CONST_HTONS(ET_ARP));
+    bad = _PKT_OOB(m, cur, sizeof(arp_eth_ip4_t), ub);
+    live &= ~bad;
+    m &= ~bad;
+    _PKT_SET(offs_l3, m, cur);
+    w = _pkt_gather_x16(pph_lo, pph_hi, pkt + cur, m);
+    bad = m & VEC_TO_MASK(w != ((CONST_HTONS(ET_IP4) << 16) | CONST_HTONS(HW_ETHERNET)));
+    live &= ~bad;
+    m &= ~bad;
+    _PKT_SET(flags, m, flags | MD_PROTO_L3_ARP);
+    _PKT_SET(cur, m, cur + sizeof(arp_eth_ip4_t));
+
+    /* TCP: the data offset must cover at least the fixed header, and all of it must fit. */
+    m = live & VEC_TO_MASK(l4 == L4T_TCP);
+    bad = _PKT_OOB(m, cur, sizeof(tcp_hdr_t), ub);
+    live &= ~bad;
+    m &= ~bad;
+    _PKT_SET(offs_l4, m, cur);
+    _PKT_SET(flags, m, flags | MD_PROTO_L4_TCP);
+    _PKT_SET(col[8], m, _pkt_gather_x16(pph_lo, pph_hi, pkt + cur, m));
+    w = (_pkt_gather_x16(pph_lo, pph_hi, pkt + cur + 12, m) & 0xF0) >> 2;
+    bad = _PKT_OOB(m, cur, w, ub) | (m & VEC_TO_MASK(w < sizeof(tcp_hdr_t)));
+    live &= ~bad;
+    m &= ~bad;
+    _PKT_SET(offs_payload, m, cur + w);
+
+    /* UDP */
+    m = live & VEC_TO_MASK(l4 == L4T_UDP);
+    bad = _PKT_OOB(m, cur, sizeof(udp_hdr_t), ub);
+    live &= ~bad;
+    m &= ~bad;
+    _PKT_SET(offs_l4, m, cur);
+    _PKT_SET(flags, m, flags | MD_PROTO_L4_UDP);
+    _PKT_SET(col[8], m, _pkt_gather_x16(pph_lo, pph_hi, pkt + cur, m));
+    _PKT_SET(offs_payload, m, cur + sizeof(udp_hdr_t));
+
+    /* ICMP, nothing past the type is looked at. */
+    m = live & VEC_TO_MASK(l4 == L4T_ICMP);
+    _PKT_SET(offs_l4, m, cur);
+    _PKT_SET(flags, m, flags | MD_PROTO_L4_ICMP);
+
+    col[9] = ctag | (stag << 16);
+    col[10] = flags;
+    col[12] = (u32_16)_mm512_permutex2var_epi32((__m512i)pph_lo, (__m512i)(IDX_VEC(u32_16) * 2),
+                                                (__m512i)pph_hi);
+    col[13] = (u32_16)_mm512_permutex2var_epi32((__m512i)pph_lo,
+                                                (__m512i)(IDX_VEC(u32_16) * 2 + 1),
+                                                (__m512i)pph_hi);
+    col[14] = (offs_vlan & 0xFFFF) | (offs_l3 << 16);
+    col[15] = (offs_l4 & 0xFFFF) | (offs_payload << 16);
+
+    if (n >= 16) {
+        transpose_u32_16x16(col, (u32_16 *)md);
+    } else {
+        u32_16 rows[16];
+
+        transpose_u32_16x16(col, rows);
+        __builtin_memcpy(md, rows, n * sizeof(*md));
+    }
+
+    return live;
+}
+
+/*
+ *    Checksums.  A ones' complement sum doesn't care which byte order its 16 bit words are read
+ * in (RFC 1071): summed as little endian words the result is the byte swap of the network order
+ * sum, and a correct checksum folds to 0xFFFF either way.  So packet data is summed as loaded,
+ * and only the pseudo header's protocol and length words, which come from registers, are swapped
+ * to match.  Every sum here is of 32 bit lanes that each take two 16 bit words per dword, so they
+ * can't overflow for anything up to 64KB.
+ */
+static ALWAYS_INLINE u32_16 _pkt_csum_fold_x16(u32_16 s)
+{
+    s = (s & 0xFFFF) + (s >> 16);
+    return (s & 0xFFFF) + (s >> 16);
+}
+
+/*
+ *    Ones' complement sum (unfolded) of len bytes at p, a zmm at a time.  The tail is a masked
+ * load, which reads nothing past p + len.
+ */
+static ALWAYS_INLINE u32 _pkt_csum_bytes(const u8 * const RESTR p, const u32 len)
+{
+    u32_16 acc = {}, acc2 = {}, v, v2;
+    u32 off;
+
+    for (off = 0; off + (2 * sizeof(u32_16)) <= len; off += 2 * sizeof(u32_16)) {
+        v = (u32_16)_mm512_loadu_si512(p + off);
+        v2 = (u32_16)_mm512_loadu_si512(p + off + sizeof(u32_16));
+        acc += (v & 0xFFFF) + (v >> 16);
+        acc2 += (v2 & 0xFFFF) + (v2 >> 16);
+    }
+
+    const u32 rem = len - off;
+
+    v = (u32_16)_mm512_maskz_loadu_epi8(_bzhi_u64(~0ULL, rem), p + off);
+    v2 = (u32_16)_mm512_maskz_loadu_epi8(_bzhi_u64(~0ULL, (rem > 64) ? rem - 64 : 0),
+                                         p + off + sizeof(u32_16));
+    acc += (v & 0xFFFF) + (v >> 16);
+    acc2 += (v2 & 0xFFFF) + (v2 >> 16);
+    return _mm512_reduce_add_epi32((__m512i)(acc + acc2));
+}
+
+/*
+ *    Validate the checksums of the packets of md[0, 16) in lanes, which must be lanes that
+ * pkt_digest_x16() returned as parsed.  Returns the lanes with no bad checksum:
+ *    == IPv4 packets need a good header checksum (and a header of at least 5 dwords).
+ *    == TCP and UDP (over IPv4 or IPv6) need a good checksum over the pseudo header and the
+ *       whole segment (as long as the IP header says), so the segment must have been captured
+ *       in full: one that wasn't can't be validated and isn't returned.  UDP over IPv4 may leave
+ *       the checksum out (0).
+ *    == IPv4 fragments (MF set or a non-zero offset) only get the header check: the segment
+ *       checksum covers the whole reassembled datagram, and only the first fragment even has
+ *       the L4 header.
+ *    == Nothing else (ARP, ICMP, ...) is checked, and is returned.
+ *
+ *    The IPv4 header checksums of all 16 lanes are summed together, a gathered dword of each per
+ * step.  Segment lengths vary too much for that, so the pseudo headers are summed across lanes
+ * from the metadata (which has the addresses) and then each segment is summed on its own, a zmm
+ * at a time.
+ */
+static inline __mmask16 pkt_csum_ok_x16(const pkt_metadata_t * const RESTR md, __mmask16 lanes)
+{
+    const u32_16 pkt = (u32_16){} + sizeof(pcap_pkt_hdr_t);
+    const u32_16 pidx = (IDX_VEC(u32_16) >> 1) + ((IDX_VEC(u32_16) & 1) << 4);
+    u32_16 col[16], sum = {}, l4_len = {}, w, ph;
+    u32 seg[16] __attribute__((__aligned__(64)));
+    __mmask16 m, bad, l4, frag = 0;
+    unsigned i;
+
+    transpose_u32_16x16((const u32_16 *)md, col);
+
+    const u64_8 pph_lo = (u64_8)_mm512_permutex2var_epi32((__m512i)col[12], (__m512i)pidx,
+                                                          (__m512i)col[13]);
+    const u64_8 pph_hi = (u64_8)_mm512_permutex2var_epi32((__m512i)col[12], (__m512i)(pidx + 8),
+                                                          (__m512i)col[13]);
+    const u32_16 flags = col[10];
+    const u32_16 offs_l3 = col[14] >> 16;
+    const u32_16 offs_l4 = col[15] & 0xFFFF;
+    const u32_16 incl = _pkt_gather_x16(pph_lo, pph_hi, (u32_16){} + 8, lanes);
+    const u32_16 orig = _pkt_gather_x16(pph_lo, pph_hi, (u32_16){} + 12, lanes);
+    const u32_16 ub = (u32_16)_mm512_min_epu32((__m512i)incl, (__m512i)orig);
+    const __mmask16 ip4 = lanes & VEC_TO_MASK((flags & (3 << 8)) == MD_PROTO_L3_IP4);
+    const __mmask16 ip6 = lanes & VEC_TO_MASK((flags & (3 << 8)) == MD_PROTO_L3_IP6);
+    const __mmask16 tcp = (ip4 | ip6) & VEC_TO_MASK((flags & (0xFF << 16)) == MD_PROTO_L4_TCP);
+    const __mmask16 udp = (ip4 | ip6) & VEC_TO_MASK((flags & (0xFF << 16)) == MD_PROTO_L4_UDP);
+
+    /* IPv4 headers, all of which pkt_digest_x16() checked fit. */
+    w = _pkt_gather_x16(pph_lo, pph_hi, pkt + offs_l3, ip4);
+    const u32_16 ihl = w & 0xF;
+    const u32_16 ip4_len = ((w >> 24) | ((w >> 8) & 0xFF00)) - (ihl * sizeof(u32));
+
+    for (i = 0, m = ip4; m; i++, m &= VEC_TO_MASK(i < ihl)) {
+        w = _pkt_gather_x16(pph_lo, pph_hi, pkt + offs_l3 + (u32)(i * sizeof(u32)), m);
+        sum += (w & 0xFFFF) + (w >> 16);
+
+        if (i == 1) {
+            /* The flags / fragment offset word: MF and the 13 bit offset. */
+            frag = m & _mm512_test_epi32_mask((__m512i)w, _mm512_set1_epi32(0xFF3F0000));
+        }
+    }
+
+    bad = ip4 & (VEC_TO_MASK(_pkt_csum_fold_x16(sum) != 0xFFFF) | VEC_TO_MASK(ihl < 5));
+
+    /*
+     *    Segment lengths: what the IPv4 header says is left after it, or the IPv6 payload less
+     * any extension headers.  Lengths that come out below the fixed header (including any that
+     * wrap) or that run past what was captured can't be checked.
+     */
+    _PKT_SET(l4_len, ip4, ip4_len);
+    w = _pkt_gather_x16(pph_lo, pph_hi, pkt + offs_l3 + 4, ip6);
+    _PKT_SET(l4_len, ip6, (((w >> 8) & 0xFF) | ((w & 0xFF) << 8)) -
+             (offs_l4 - offs_l3 - sizeof(ip6_hdr_t)));
+    l4 = (tcp | udp) & ~frag;
+    bad |= _PKT_OOB(l4, offs_l4, l4_len, ub) | (l4 & VEC_TO_MASK(l4_len > 0xFFFF));
+    bad |= tcp & VEC_TO_MASK(l4_len < sizeof(tcp_hdr_t));
+    bad |= udp & VEC_TO_MASK(l4_len < sizeof(udp_hdr_t));
+    l4 &= ~bad;
+
+    /* A UDP checksum of 0 is no checksum (IPv4 only). */
+    w = _pkt_gather_x16(pph_lo, pph_hi, pkt + offs_l4 + 4, udp & ip4 & l4);
+    l4 &= ~(udp & ip4 & VEC_TO_MASK((w >> 16) == 0));
+
+    /* Pseudo headers: the addresses, then the protocol and length words, byte swapped. */
+    ph = MUX_ON_MASK(tcp, (u32_16){} + (L4T_TCP << 8), (u32_16){} + (L4T_UDP << 8));
+    ph += ((l4_len & 0xFF) << 8) | (l4_len >> 8);
+
+    for (i = 0; i < 8; i++) {
+        ph += (col[i] & 0xFFFF) + (col[i] >> 16);
+    }
+
+    for (m = l4; m; m &= m - 1) {
+        i = __builtin_ctz(m);
+        seg[i] = _pkt_csum_bytes(md[i].pph->pkt + md[i].offs_l4, l4_len[i]);
+    }
+
+    sum = ph + (u32_16)_mm512_maskz_load_epi32(l4, seg);
+    bad |= l4 & VEC_TO_MASK(_pkt_csum_fold_x16(sum) != 0xFFFF);
+    return lanes & ~bad;
+}
+
+#endif /* _PKT_UTIL_H_ */
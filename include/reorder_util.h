@@ -0,0 +1,120 @@
+#ifndef _REORDER_UTIL_H_
+#define _REORDER_UTIL_H_
+
+/*
+ *    A reorder buffer for restoring input order after out-of-order batch processing (e.g. after
+ * schedule_batch() has swizzled events across hashes and recorded where each came from in posn).
+ *
+ *    Completed results are scattered into a ring indexed by (posn & mask).  Alongside each value
+ * the ring records the sequence number (posn) that was written there, so a slot is "complete" for
+ * the current lap only when its recorded sequence equals the sequence we expect to find there.
+ * Releasing loads 16 recorded sequences starting at the head, compares them against head + lane
+ * index to form a 16-bit completion bitmap, and the longest in-order prefix is simply the count
+ * of trailing ones in that bitmap.
+ *
+ *    Since every lane of a completion carries a distinct posn there are never two lanes scattering
+ * to the same slot, so no conflict detection is needed on the completion path.  The caller is
+ * responsible for never completing a posn at or beyond head + nslots (see rob_fits_x16()) since
+ * that would overwrite a slot which has not been released yet.
+ */
+
+typedef struct {
+    u32 * RESTR seq;    // Sequence number last completed into each slot
+    u32 * RESTR val;    // Result value for each slot
+    u32         head;   // Next sequence number to be released
+    u32         mask;   // nslots - 1
+} rob_t;
+
+#define ROB_MEM_SIZE(_nslots)   ((_nslots) * sizeof(u32) * 2)
+
+/*
+ * Set up a reorder buffer of nslots (a power of two, at least 16) in mem, which must be at least
+ * ROB_MEM_SIZE(nslots) bytes and 64 byte aligned.  The first sequence number to be released will
+ * be first_seq.
+ */
+static inline int rob_init(rob_t * const RESTR rob, void * const RESTR mem, const u32 nslots,
+                           const u32 first_seq)
+{
+    u32 i;
+
+    if ((nslots < 16) | (nslots & (nslots - 1)) | ((u64)mem & 63)) {
+        return -1;
+    }
+
+    rob->seq = (u32 *)mem;
+    rob->val = rob->seq + nslots;
+    rob->head = first_seq;
+    rob->mask = nslots - 1;
+
+    /* Stamp every slot with the sequence number from the lap before the one we expect. */
+    for (i = 0; i < nslots; i += 16) {
+        const u32_16 s = IDX_VEC(u32_16) + (first_seq + i);
+        const u32_16 slot = s & rob->mask;
+        _mm512_i32scatter_epi32(rob->seq, (__m512i)slot, (__m512i)(s - nslots), sizeof(u32));
+    }
+
+    return 0;
+}
+
+/*
+ * Returns a mask of the lanes in posn which may be completed right now without overwriting a slot
+ * that has not yet been released.
+ */
+static inline __mmask16 rob_fits_x16(const rob_t * const RESTR rob, const u32_16 posn)
+{
+    return VEC_TO_MASK((posn - rob->head) <= rob->mask);
+}
+
+/*
+ * Record results for up to 16 completed sequence numbers (selected by lanes).
+ */
+static inline void rob_complete_x16(rob_t * const RESTR rob, const u32_16 posn, const u32_16 vals,
+                                    const __mmask16 lanes)
+{
+    const u32_16 slot = posn & rob->mask;
+    _mm512_mask_i32scatter_epi32(rob->val, lanes, (__m512i)slot, (__m512i)vals, sizeof(u32));
+    _mm512_mask_i32scatter_epi32(rob->seq, lanes, (__m512i)slot, (__m512i)posn, sizeof(u32));
+}
+
+/*
+ * Copy the longest run of completed results starting at the head (up to max of them) to out and
+ * advance the head past them.  Returns the number released.
+ */
+static inline u32 rob_release(rob_t * const RESTR rob, u32 * const RESTR out, const u32 max)
+{
+    const u32_16 idx = IDX_VEC(u32_16);
+    u32 n = 0;
+
+    while (n < max) {
+        const u32 head = rob->head;
+        const u32 slot = head & rob->mask;
+        u32_16 s, v;
+
+        if (slot + 16 <= rob->mask + 1) {
+            s = (u32_16)_mm512_loadu_si512(rob->seq + slot);
+            v = (u32_16)_mm512_loadu_si512(rob->val + slot);
+        } else {
+            /* The window wraps around the end of the ring. */
+            const u32_16 widx = (idx + slot) & rob->mask;
+            s = (u32_16)_mm512_i32gather_epi32((__m512i)widx, rob->seq, sizeof(u32));
+            v = (u32_16)_mm512_i32gather_epi32((__m512i)widx, rob->val, sizeof(u32));
+        }
+
+        const __mmask16 done = VEC_TO_MASK(s == (idx + head));
+        const u32 run = _tzcnt_u32(~(u32)done);
+        const u32 left = max - n;
+        const u32 take = (run < left) ? run : left;
+
+        _mm512_mask_storeu_epi32(out + n, (__mmask16)((1U << take) - 1), (__m512i)v);
+        rob->head = head + take;
+        n += take;
+
+        if (take < 16) {
+            break;
+        }
+    }
+
+    return n;
+}
+
+#endif /* _REORDER_UTIL_H_ */
@@ -0,0 +1,212 @@
+#ifndef _RING_UTIL_H_
+#define _RING_UTIL_H_
+
+/*
+ *    Ring buffers for handing work between cores.  Every slot is one whole zmm register (one
+ * cache line) so a slot is written and read with a single full-line store/load and two slots never
+ * share a line.  The producer-owned and consumer-owned indices live on separate cache lines (each
+ * alongside that side's cached copy of the other side's index) so the two cores only exchange a
+ * line when one of them actually runs out of cached space/items.
+ *
+ *    The control block and the slots are laid out in one contiguous chunk of memory (control block
+ * first) with no internal pointers, so a ring can live in a shared mapping: map_segment() a file
+ * (or an anonymous segment before fork()ing, its mappings are MAP_SHARED) of at least
+ * *_RING_MEM_SIZE(nslots) bytes, have one side *_ring_init() it and hand the other side the
+ * address.  A batch of 16 u32 items (hashes, positions, ...) is one slot; messages that need
+ * several such vectors (e.g. hashes plus positions) are several slots enqueued at once.
+ */
+
+typedef struct {
+    /* Producer-owned line */
+    u64     tail __attribute__((__aligned__(64)));
+    u64     head_cache;
+    /* Consumer-owned line */
+    u64     head __attribute__((__aligned__(64)));
+    u64     tail_cache;
+    /* Read-only after init */
+    u64     mask __attribute__((__aligned__(64)));
+    u64     nslots;
+    u32_16  slot[0];
+} spsc_ring_t;
+
+#define SPSC_RING_MEM_SIZE(_nslots) (sizeof(spsc_ring_t) + ((_nslots) * sizeof(u32_16)))
+
+/*
+ * Lay out a ring of nslots (a power of two) slots in mem, which must be 64 byte aligned and at
+ * least SPSC_RING_MEM_SIZE(nslots) bytes.  Returns NULL on bad arguments.
+ */
+static inline spsc_ring_t *spsc_ring_init(void * const mem, const u64 nslots)
+{
+    spsc_ring_t * const r = (spsc_ring_t *)mem;
+
+    if ((mem == NULL) | ((u64)mem & 63) | (nslots == 0) | (nslots & (nslots - 1))) {
+        return NULL;
+    }
+
+    __builtin_memset(r, 0, sizeof(*r));
+    r->mask = nslots - 1;
+    r->nslots = nslots;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return r;
+}
+
+/*
+ * Enqueue n slots from src.  This is all-or-nothing (so a message spanning several slots is never
+ * split) and returns n on success or 0 if there is not currently room for all n.
+ */
+static inline u32 spsc_ring_enqueue(spsc_ring_t * const RESTR r, const u32_16 * const RESTR src,
+                                    const u32 n)
+{
+    const u64 tail = r->tail;
+    u32 i;
+
+    if ((tail + n - r->head_cache) > r->nslots) {
+        r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+        if ((tail + n - r->head_cache) > r->nslots) {
+            return 0;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        r->slot[(tail + i) & r->mask] = src[i];
+    }
+
+    __atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/*
+ * Dequeue exactly n slots into dst.  Returns n on success or 0 if fewer than n are available.
+ */
+static inline u32 spsc_ring_dequeue(spsc_ring_t * const RESTR r, u32_16 * const RESTR dst,
+                                    const u32 n)
+{
+    const u64 head = r->head;
+    u32 i;
+
+    if ((r->tail_cache - head) < n) {
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+        if ((r->tail_cache - head) < n) {
+            return 0;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        dst[i] = r->slot[(head + i) & r->mask];
+    }
+
+    __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/*
+ *    Multi-producer / multi-consumer variant.  Every slot has a sequence number (kept in an array
+ * of their own between the control block and the slots) telling whose turn it is: a producer
+ * claiming position p waits for seq == p, and after filling the slot publishes seq = p + 1; a
+ * consumer claiming position p waits for seq == p + 1 and then frees the slot for the next lap by
+ * publishing seq = p + nslots.  Claiming a position is a CAS on the shared tail (producers) or
+ * head (consumers) index, so unlike the SPSC ring each operation moves exactly one slot.
+ */
+
+typedef struct {
+    u64     tail __attribute__((__aligned__(64)));
+    u64     head __attribute__((__aligned__(64)));
+    u64     mask __attribute__((__aligned__(64)));
+    u64     nslots;
+    u64     slot_ofs;   // Byte offset of slot[0] from the start of the ring
+    u64     seq[0] __attribute__((__aligned__(64)));
+} mpmc_ring_t;
+
+#define MPMC_RING_SEQ_SIZE(_nslots) ((((_nslots) * sizeof(u64)) + 63) & ~63UL)
+#define MPMC_RING_MEM_SIZE(_nslots) (sizeof(mpmc_ring_t) + MPMC_RING_SEQ_SIZE(_nslots) + \
+                                     ((_nslots) * sizeof(u32_16)))
+
+static inline u32_16 *mpmc_ring_slots(mpmc_ring_t * const r)
+{
+    return (u32_16 *)((u8 *)r + r->slot_ofs);
+}
+
+/*
+ * Same contract as spsc_ring_init().
+ */
+static inline mpmc_ring_t *mpmc_ring_init(void * const mem, const u64 nslots)
+{
+    mpmc_ring_t * const r = (mpmc_ring_t *)mem;
+    u64 i;
+
+    if ((mem == NULL) | ((u64)mem & 63) | (nslots == 0) | (nslots & (nslots - 1))) {
+        return NULL;
+    }
+
+    __builtin_memset(r, 0, sizeof(*r));
+    r->mask = nslots - 1;
+    r->nslots = nslots;
+    r->slot_ofs = sizeof(mpmc_ring_t) + MPMC_RING_SEQ_SIZE(nslots);
+
+    for (i = 0; i < nslots; i++) {
+        r->seq[i] = i;
+    }
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return r;
+}
+
+/*
+ * Enqueue one slot.  Returns 1 on success or 0 if the ring is full.
+ */
+static inline u32 mpmc_ring_enqueue(mpmc_ring_t * const RESTR r, const u32_16 src)
+{
+    u64 pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        const u64 seq = __atomic_load_n(r->seq + (pos & r->mask), __ATOMIC_ACQUIRE);
+        const i64 dif = (i64)(seq - pos);
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return 0;
+        } else {
+            pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    mpmc_ring_slots(r)[pos & r->mask] = src;
+    __atomic_store_n(r->seq + (pos & r->mask), pos + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*
+ * Dequeue one slot into dst.  Returns 1 on success or 0 if the ring is empty.
+ */
+static inline u32 mpmc_ring_dequeue(mpmc_ring_t * const RESTR r, u32_16 * const RESTR dst)
+{
+    u64 pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        const u64 seq = __atomic_load_n(r->seq + (pos & r->mask), __ATOMIC_ACQUIRE);
+        const i64 dif = (i64)(seq - (pos + 1));
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return 0;
+        } else {
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    *dst = mpmc_ring_slots(r)[pos & r->mask];
+    __atomic_store_n(r->seq + (pos & r->mask), pos + r->nslots, __ATOMIC_RELEASE);
+    return 1;
+}
+
+#endif /* _RING_UTIL_H_ */
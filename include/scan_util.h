@@ -0,0 +1,258 @@
+#ifndef _SCAN_UTIL_H_
+#define _SCAN_UTIL_H_
+
+/*
+ *    Prefix sums.  The in register scans are the usual log step ones: add the vector to itself
+ * shifted up 1, 2, 4 and 8 lanes (valignd / valignq against zero), 4 steps for u32_16 and 3 for
+ * u64_8.  The exclusive scan is the inclusive one minus the input.
+ *
+ *    The masked scans only count the lanes set in the mask (the others add nothing but still get
+ * the running total), which is what turning a keep mask into output positions looks like.  The
+ * segmented scans restart at every lane set in heads, carrying a flag along with the shifts so a
+ * lane stops adding once a head has been seen between it and the lane being added in.
+ *
+ *    The array scans carry the running total from one vector to the next as a broadcast of the
+ * last lane, so the carry never leaves the vector unit.  dst may be src.
+ */
+
+#define _SCAN_SHL_32(_v, _k)    \
+    ((u32_16)_mm512_alignr_epi32((__m512i)(_v), _mm512_setzero_si512(), 16 - (_k)))
+#define _SCAN_SHL_64(_v, _k)    \
+    ((u64_8)_mm512_alignr_epi64((__m512i)(_v), _mm512_setzero_si512(), 8 - (_k)))
+
+static inline u32_16 scan_incl_u32_16(u32_16 v)
+{
+    v += _SCAN_SHL_32(v, 1);
+    v += _SCAN_SHL_32(v, 2);
+    v += _SCAN_SHL_32(v, 4);
+    v += _SCAN_SHL_32(v, 8);
+
+    return v;
+}
+
+static inline u32_16 scan_excl_u32_16(const u32_16 v)
+{
+    return scan_incl_u32_16(v) - v;
+}
+
+static inline u64_8 scan_incl_u64_8(u64_8 v)
+{
+    v += _SCAN_SHL_64(v, 1);
+    v += _SCAN_SHL_64(v, 2);
+    v += _SCAN_SHL_64(v, 4);
+
+    return v;
+}
+
+static inline u64_8 scan_excl_u64_8(const u64_8 v)
+{
+    return scan_incl_u64_8(v) - v;
+}
+
+static inline u32_16 scan_incl_masked_u32_16(const u32_16 v, const __mmask16 m)
+{
+    return scan_incl_u32_16((u32_16)_mm512_maskz_mov_epi32(m, (__m512i)v));
+}
+
+static inline u32_16 scan_excl_masked_u32_16(const u32_16 v, const __mmask16 m)
+{
+    return scan_excl_u32_16((u32_16)_mm512_maskz_mov_epi32(m, (__m512i)v));
+}
+
+static inline u64_8 scan_incl_masked_u64_8(const u64_8 v, const __mmask8 m)
+{
+    return scan_incl_u64_8((u64_8)_mm512_maskz_mov_epi64(m, (__m512i)v));
+}
+
+static inline u64_8 scan_excl_masked_u64_8(const u64_8 v, const __mmask8 m)
+{
+    return scan_excl_u64_8((u64_8)_mm512_maskz_mov_epi64(m, (__m512i)v));
+}
+
+/*
+ * Inclusive scan restarting at each lane set in heads (lane 0 always starts a segment).
+ */
+static inline u32_16 scan_seg_incl_u32_16(u32_16 v, const __mmask16 heads)
+{
+    __mmask16 seen = heads;
+
+    v = (u32_16)_mm512_mask_add_epi32((__m512i)v, ~seen, (__m512i)v, (__m512i)_SCAN_SHL_32(v, 1));
+    seen |= seen << 1;
+    v = (u32_16)_mm512_mask_add_epi32((__m512i)v, ~seen, (__m512i)v, (__m512i)_SCAN_SHL_32(v, 2));
+    seen |= seen << 2;
+    v = (u32_16)_mm512_mask_add_epi32((__m512i)v, ~seen, (__m512i)v, (__m512i)_SCAN_SHL_32(v, 4));
+    seen |= seen << 4;
+    v = (u32_16)_mm512_mask_add_epi32((__m512i)v, ~seen, (__m512i)v, (__m512i)_SCAN_SHL_32(v, 8));
+
+    return v;
+}
+
+static inline u32_16 scan_seg_excl_u32_16(const u32_16 v, const __mmask16 heads)
+{
+    return scan_seg_incl_u32_16(v, heads) - v;
+}
+
+static inline u64_8 scan_seg_incl_u64_8(u64_8 v, const __mmask8 heads)
+{
+    __mmask8 seen = heads;
+
+    v = (u64_8)_mm512_mask_add_epi64((__m512i)v, ~seen, (__m512i)v, (__m512i)_SCAN_SHL_64(v, 1));
+    seen |= seen << 1;
+    v = (u64_8)_mm512_mask_add_epi64((__m512i)v, ~seen, (__m512i)v, (__m512i)_SCAN_SHL_64(v, 2));
+    seen |= seen << 2;
+    v = (u64_8)_mm512_mask_add_epi64((__m512i)v, ~seen, (__m512i)v, (__m512i)_SCAN_SHL_64(v, 4));
+
+    return v;
+}
+
+static inline u64_8 scan_seg_excl_u64_8(const u64_8 v, const __mmask8 heads)
+{
+    return scan_seg_incl_u64_8(v, heads) - v;
+}
+
+/*
+ *    dst[i] = init + src[0] + ... + src[i] (inclusive) or init + src[0] + ... + src[i - 1]
+ * (exclusive).  Both return init plus the sum of all of src, i.e. what to pass as init for the
+ * next chunk of a longer array.
+ */
+static inline u32 scan_incl_u32(u32 * const dst, const u32 * const src, const u64 n, const u32 init)
+{
+    const __m512i last = _mm512_set1_epi32(15);
+    u32_16 carry = (u32_16){} + init;
+    u64 i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        const u32_16 s = scan_incl_u32_16((u32_16)_mm512_loadu_si512(src + i)) + carry;
+        _mm512_storeu_si512(dst + i, (__m512i)s);
+        carry = (u32_16)_mm512_permutexvar_epi32(last, (__m512i)s);
+    }
+
+    if (i < n) {
+        const __mmask16 em = _bzhi_u32(~0U, n - i);
+        const u32_16 s = scan_incl_u32_16((u32_16)_mm512_maskz_loadu_epi32(em, src + i)) + carry;
+        _mm512_mask_storeu_epi32(dst + i, em, (__m512i)s);
+        carry = (u32_16)_mm512_permutexvar_epi32(last, (__m512i)s);
+    }
+
+    return carry[0];
+}
+
+static inline u32 scan_excl_u32(u32 * const dst, const u32 * const src, const u64 n, const u32 init)
+{
+    const __m512i last = _mm512_set1_epi32(15);
+    u32_16 carry = (u32_16){} + init;
+    u64 i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        const u32_16 v = (u32_16)_mm512_loadu_si512(src + i);
+        const u32_16 s = scan_incl_u32_16(v) + carry;
+        _mm512_storeu_si512(dst + i, (__m512i)(s - v));
+        carry = (u32_16)_mm512_permutexvar_epi32(last, (__m512i)s);
+    }
+
+    if (i < n) {
+        const __mmask16 em = _bzhi_u32(~0U, n - i);
+        const u32_16 v = (u32_16)_mm512_maskz_loadu_epi32(em, src + i);
+        const u32_16 s = scan_incl_u32_16(v) + carry;
+        _mm512_mask_storeu_epi32(dst + i, em, (__m512i)(s - v));
+        carry = (u32_16)_mm512_permutexvar_epi32(last, (__m512i)s);
+    }
+
+    return carry[0];
+}
+
+static inline u64 scan_incl_u64(u64 * const dst, const u64 * const src, const u64 n, const u64 init)
+{
+    const __m512i last = _mm512_set1_epi64(7);
+    u64_8 carry = (u64_8){} + init;
+    u64 i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        const u64_8 s = scan_incl_u64_8((u64_8)_mm512_loadu_si512(src + i)) + carry;
+        _mm512_storeu_si512(dst + i, (__m512i)s);
+        carry = (u64_8)_mm512_permutexvar_epi64(last, (__m512i)s);
+    }
+
+    if (i < n) {
+        const __mmask8 em = _bzhi_u32(~0U, n - i);
+        const u64_8 s = scan_incl_u64_8((u64_8)_mm512_maskz_loadu_epi64(em, src + i)) + carry;
+        _mm512_mask_storeu_epi64(dst + i, em, (__m512i)s);
+        carry = (u64_8)_mm512_permutexvar_epi64(last, (__m512i)s);
+    }
+
+    return carry[0];
+}
+
+static inline u64 scan_excl_u64(u64 * const dst, const u64 * const src, const u64 n, const u64 init)
+{
+    const __m512i last = _mm512_set1_epi64(7);
+    u64_8 carry = (u64_8){} + init;
+    u64 i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        const u64_8 v = (u64_8)_mm512_loadu_si512(src + i);
+        const u64_8 s = scan_incl_u64_8(v) + carry;
+        _mm512_storeu_si512(dst + i, (__m512i)(s - v));
+        carry = (u64_8)_mm512_permutexvar_epi64(last, (__m512i)s);
+    }
+
+    if (i < n) {
+        const __mmask8 em = _bzhi_u32(~0U, n - i);
+        const u64_8 v = (u64_8)_mm512_maskz_loadu_epi64(em, src + i);
+        const u64_8 s = scan_incl_u64_8(v) + carry;
+        _mm512_mask_storeu_epi64(dst + i, em, (__m512i)(s - v));
+        carry = (u64_8)_mm512_permutexvar_epi64(last, (__m512i)s);
+    }
+
+    return carry[0];
+}
+
+/*
+ *    Segmented inclusive scans over arrays, segments starting at the elements whose bit is set
+ * in the heads bitmap (bit i of heads[i / 64] for element i).  The carry from the previous vector
+ * is only added to the lanes before the first head in this one: (h & -h) - 1 is all of them when
+ * there's no head at all.  Returns the running total of the last segment.
+ */
+static inline u32 scan_seg_incl_u32(u32 * const dst, const u32 * const src,
+                                    const u64 * const heads, const u64 n)
+{
+    const __m512i last = _mm512_set1_epi32(15);
+    u32_16 carry = {};
+    u64 i;
+
+    for (i = 0; i < n; i += 16) {
+        const __mmask16 em = (n - i >= 16) ? 0xFFFF : _bzhi_u32(~0U, n - i);
+        const __mmask16 h = (heads[i / 64] >> (i % 64)) & em;
+        const __mmask16 pre = (h & -h) - 1;
+        u32_16 s = scan_seg_incl_u32_16((u32_16)_mm512_maskz_loadu_epi32(em, src + i), h);
+
+        s = (u32_16)_mm512_mask_add_epi32((__m512i)s, pre, (__m512i)s, (__m512i)carry);
+        _mm512_mask_storeu_epi32(dst + i, em, (__m512i)s);
+        carry = (u32_16)_mm512_permutexvar_epi32(last, (__m512i)s);
+    }
+
+    return carry[0];
+}
+
+static inline u64 scan_seg_incl_u64(u64 * const dst, const u64 * const src,
+                                    const u64 * const heads, const u64 n)
+{
+    const __m512i last = _mm512_set1_epi64(7);
+    u64_8 carry = {};
+    u64 i;
+
+    for (i = 0; i < n; i += 8) {
+        const __mmask8 em = (n - i >= 8) ? 0xFF : _bzhi_u32(~0U, n - i);
+        const __mmask8 h = (heads[i / 64] >> (i % 64)) & em;
+        const __mmask8 pre = (h & -h) - 1;
+        u64_8 s = scan_seg_incl_u64_8((u64_8)_mm512_maskz_loadu_epi64(em, src + i), h);
+
+        s = (u64_8)_mm512_mask_add_epi64((__m512i)s, pre, (__m512i)s, (__m512i)carry);
+        _mm512_mask_storeu_epi64(dst + i, em, (__m512i)s);
+        carry = (u64_8)_mm512_permutexvar_epi64(last, (__m512i)s);
+    }
+
+    return carry[0];
+}
+
+#endif /* _SCAN_UTIL_H_ */
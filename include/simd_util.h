@@ -8,6 +8,7 @@
 
 #define OPT_SIZE __attribute__((__optimize__("Os")))
 #define OPT_NONE __attribute__((__optimize__("O0")))
+#define ALWAYS_INLINE __attribute__((__always_inline__)) inline
 
 #define VEC_LANES(_inst) (sizeof(_inst) / sizeof((_inst)[0]))
 #define VEC_TYPE_LANES(_typ) ({ typeof(_typ) _tmp; VEC_LANES(_tmp); })
@@ -24,6 +25,18 @@
 #include "mask_util.h"
 #include "sg_util.h"
 #include "transpose_util.h"
+#include "bitslice_util.h"
+#include "filter_util.h"
+#include "scan_util.h"
+#include "sort_util.h"
+#include "set_util.h"
+#include "topk_util.h"
 #include "hash_util.h"
+#include "ring_util.h"
+#include "batch_util.h"
+#include "reorder_util.h"
+#include "pkt_util.h"
+#include "flow_util.h"
+#include "acl_util.h"
 
 
@@ -0,0 +1,255 @@
+#ifndef _SORT_UTIL_H_
+#define _SORT_UTIL_H_
+
+/*
+ *    Bitonic sorting networks in a register, and an array sort built from them.
+ *
+ *    Each step of a network pairs lane i with lane i ^ j (one vpermd / vpermq) and keeps the min
+ * in one of the two lanes and the max in the other.  Which lane gets the min depends only on the
+ * step, so it's a constant mask and the step is permute, min, max, blend.  Sorting 16 lanes is 10
+ * steps and 8 lanes is 6.  The key + payload variants compare the keys and swap both vectors in
+ * the lanes where the partner should win, so the payload (e.g. a posn style index, see
+ * schedule_batch()) follows its key.  Equal keys never swap, which keeps the swap masks of the
+ * two lanes of a pair consistent, but the networks aren't stable.
+ *
+ *    The array sorts sort each vector in place to make runs of 16 (8), then merge pairs of runs
+ * bottom up, ping-ponging between the two halves of a scratch buffer.  The merge keeps a vector of
+ * the largest values seen so far, loads the next vector from whichever run has the smaller head,
+ * and puts the two through the 32 (16) lane merge network: the low half is output, the high half
+ * is kept.  The tail of the array is padded with all ones so every run is a whole number of
+ * vectors; they sort to the end and are never copied back.  To sort keys with a payload, sort u64
+ * with the key in the high half and the payload (a posn) in the low half.
+ */
+
+/*
+ *    One compare-exchange step of lane i against lane i ^ j, min to the lanes in minmask.  They
+ * take the vector by pointer so the key + payload steps can go through the same network macros.
+ */
+static ALWAYS_INLINE void _sort_step_u32_16(u32_16 * const v, const unsigned j,
+                                            const __mmask16 minmask)
+{
+    const __m512i p = _mm512_permutexvar_epi32((__m512i)(IDX_VEC(u32_16) ^ j), (__m512i)*v);
+
+    *v = (u32_16)_mm512_mask_blend_epi32(minmask, _mm512_max_epu32((__m512i)*v, p),
+                                         _mm512_min_epu32((__m512i)*v, p));
+}
+
+static ALWAYS_INLINE void _sort_step_u64_8(u64_8 * const v, const unsigned j,
+                                          const __mmask8 minmask)
+{
+    const __m512i p = _mm512_permutexvar_epi64((__m512i)(IDX_VEC(u64_8) ^ j), (__m512i)*v);
+
+    *v = (u64_8)_mm512_mask_blend_epi64(minmask, _mm512_max_epu64((__m512i)*v, p),
+                                        _mm512_min_epu64((__m512i)*v, p));
+}
+
+static ALWAYS_INLINE void _sort_step_kv_u32_16(u32_16 * const k, u32_16 * const v,
+                                               const unsigned j, const __mmask16 minmask)
+{
+    const __m512i idx = (__m512i)(IDX_VEC(u32_16) ^ j);
+    const __m512i pk = _mm512_permutexvar_epi32(idx, (__m512i)*k);
+    const __mmask16 swap = (minmask & _mm512_cmplt_epu32_mask(pk, (__m512i)*k)) |
+                           (~minmask & _mm512_cmpgt_epu32_mask(pk, (__m512i)*k));
+
+    *k = (u32_16)_mm512_mask_mov_epi32((__m512i)*k, swap, pk);
+    *v = (u32_16)_mm512_mask_permutexvar_epi32((__m512i)*v, swap, idx, (__m512i)*v);
+}
+
+static ALWAYS_INLINE void _sort_step_kv_u64_8(u64_8 * const k, u64_8 * const v,
+                                              const unsigned j, const __mmask8 minmask)
+{
+    const __m512i idx = (__m512i)(IDX_VEC(u64_8) ^ j);
+    const __m512i pk = _mm512_permutexvar_epi64(idx, (__m512i)*k);
+    const __mmask8 swap = (minmask & _mm512_cmplt_epu64_mask(pk, (__m512i)*k)) |
+                          (~minmask & _mm512_cmpgt_epu64_mask(pk, (__m512i)*k));
+
+    *k = (u64_8)_mm512_mask_mov_epi64((__m512i)*k, swap, pk);
+    *v = (u64_8)_mm512_mask_permutexvar_epi64((__m512i)*v, swap, idx, (__m512i)*v);
+}
+
+/*
+ *    The networks, one step per line: lane i ^ j is the partner and the constant is the lanes
+ * which keep the min, those where (i & j) == 0 matches (i & k) == 0 for the block size k of the
+ * stage.  Only the last stage (k = lanes) is needed to sort a bitonic vector.  Spelled out
+ * rather than looped since GCC won't fully unroll the nested loops and fold the masks.
+ */
+#define _SORT_BITONIC_16(_step, _args...)                                                   \
+({                                                                                          \
+    _step(_args, 8, 0x00FF);                                                                \
+    _step(_args, 4, 0x0F0F);                                                                \
+    _step(_args, 2, 0x3333);                                                                \
+    _step(_args, 1, 0x5555);                                                                \
+}) /* end of macro */
+
+#define _SORT_NETWORK_16(_step, _args...)                                                   \
+({                                                                                          \
+    _step(_args, 1, 0x9999);                                        /* k = 2 */             \
+    _step(_args, 2, 0xC3C3);                                        /* k = 4 */             \
+    _step(_args, 1, 0xA5A5);                                                                \
+    _step(_args, 4, 0xF00F);                                        /* k = 8 */             \
+    _step(_args, 2, 0xCC33);                                                                \
+    _step(_args, 1, 0xAA55);                                                                \
+    _SORT_BITONIC_16(_step, _args);                                 /* k = 16 */            \
+}) /* end of macro */
+
+#define _SORT_BITONIC_8(_step, _args...)                                                    \
+({                                                                                          \
+    _step(_args, 4, 0x0F);                                                                  \
+    _step(_args, 2, 0x33);                                                                  \
+    _step(_args, 1, 0x55);                                                                  \
+}) /* end of macro */
+
+#define _SORT_NETWORK_8(_step, _args...)                                                    \
+({                                                                                          \
+    _step(_args, 1, 0x99);                                          /* k = 2 */             \
+    _step(_args, 2, 0xC3);                                          /* k = 4 */             \
+    _step(_args, 1, 0xA5);                                                                  \
+    _SORT_BITONIC_8(_step, _args);                                  /* k = 8 */             \
+}) /* end of macro */
+
+/*
+ * Sort the lanes of a vector ascending (unsigned).
+ */
+static ALWAYS_INLINE u32_16 sort_u32_16(u32_16 v)
+{
+    _SORT_NETWORK_16(_sort_step_u32_16, &v);
+    return v;
+}
+
+static ALWAYS_INLINE u64_8 sort_u64_8(u64_8 v)
+{
+    _SORT_NETWORK_8(_sort_step_u64_8, &v);
+    return v;
+}
+
+/*
+ * Sort the keys ascending (unsigned), moving each lane of the payload with its key.
+ */
+static ALWAYS_INLINE void sort_kv_u32_16(u32_16 * const RESTR keys, u32_16 * const RESTR vals)
+{
+    _SORT_NETWORK_16(_sort_step_kv_u32_16, keys, vals);
+}
+
+static ALWAYS_INLINE void sort_kv_u64_8(u64_8 * const RESTR keys, u64_8 * const RESTR vals)
+{
+    _SORT_NETWORK_8(_sort_step_kv_u64_8, keys, vals);
+}
+
+/*
+ *    Merge two sorted vectors: *lo gets the smallest half of the lanes of both and *hi the
+ * largest, each sorted.  Reversing b makes a : b bitonic, so one min / max splits the halves and
+ * each is then a bitonic sequence which the last log2(lanes) steps of the network sort.
+ */
+static ALWAYS_INLINE void merge_u32_16(u32_16 * const RESTR lo, u32_16 * const RESTR hi)
+{
+    const __m512i r = _mm512_permutexvar_epi32((__m512i)(IDX_VEC(u32_16) ^ 15), (__m512i)*hi);
+    u32_16 l = (u32_16)_mm512_min_epu32((__m512i)*lo, r);
+    u32_16 h = (u32_16)_mm512_max_epu32((__m512i)*lo, r);
+
+    _SORT_BITONIC_16(_sort_step_u32_16, &l);
+    _SORT_BITONIC_16(_sort_step_u32_16, &h);
+
+    *lo = l;
+    *hi = h;
+}
+
+static ALWAYS_INLINE void merge_u64_8(u64_8 * const RESTR lo, u64_8 * const RESTR hi)
+{
+    const __m512i r = _mm512_permutexvar_epi64((__m512i)(IDX_VEC(u64_8) ^ 7), (__m512i)*hi);
+    u64_8 l = (u64_8)_mm512_min_epu64((__m512i)*lo, r);
+    u64_8 h = (u64_8)_mm512_max_epu64((__m512i)*lo, r);
+
+    _SORT_BITONIC_8(_sort_step_u64_8, &l);
+    _SORT_BITONIC_8(_sort_step_u64_8, &h);
+
+    *lo = l;
+    *hi = h;
+}
+
+/*
+ *    Merge the sorted runs a[0, na) and b[0, nb) (both non-zero multiples of the lane count) to
+ * out, with the given register merge.
+ */
+#define _SORT_MERGE_RUNS(_vtype, _merge, _out, _a, _na, _b, _nb)                            \
+({                                                                                          \
+    const unsigned __nl = VEC_TYPE_LANES(_vtype);                                           \
+    _vtype __lo = *(const _vtype *)(_a), __hi = *(const _vtype *)(_b);                      \
+    u64 __ia = __nl, __ib = __nl, __o = 0;                                                  \
+                                                                                            \
+    _merge(&__lo, &__hi);                                                                   \
+    *(_vtype *)((_out) + __o) = __lo;                                                       \
+    __o += __nl;                                                                            \
+                                                                                            \
+    while ((__ia < (_na)) | (__ib < (_nb))) {                                               \
+        if ((__ib >= (_nb)) || ((__ia < (_na)) && ((_a)[__ia] <= (_b)[__ib]))) {            \
+            __lo = *(const _vtype *)((_a) + __ia);                                          \
+            __ia += __nl;                                                                   \
+        } else {                                                                            \
+            __lo = *(const _vtype *)((_b) + __ib);                                          \
+            __ib += __nl;                                                                   \
+        }                                                                                   \
+                                                                                            \
+        _merge(&__lo, &__hi);                                                               \
+        *(_vtype *)((_out) + __o) = __lo;                                                   \
+        __o += __nl;                                                                        \
+    }                                                                                       \
+                                                                                            \
+    *(_vtype *)((_out) + __o) = __hi;                                                       \
+}) /* end of macro */
+
+/*
+ *    Sort an array: the vector sort of each run into the first half of scratch (the tail padded
+ * with all ones), merge passes back and forth between the halves, and a copy of the first n back
+ * to data.  scratch must be 64 byte aligned and hold 2 * SORT_SCRATCH_ELEMS(n, lanes) elements.
+ */
+#define SORT_SCRATCH_ELEMS(_n, _nlanes)     (((_n) + (_nlanes) - 1) & ~(u64)((_nlanes) - 1))
+
+#define _SORT_ARRAY(_type, _vtype, _sortv, _merge, _data, _scratch, _n)                     \
+({                                                                                          \
+    const unsigned __nl = VEC_TYPE_LANES(_vtype);                                           \
+    const u64 __np = SORT_SCRATCH_ELEMS((_n), __nl);                                        \
+    _type *__src = (_scratch), *__dst = (_scratch) + __np;                                  \
+    u64 __i, __w;                                                                           \
+                                                                                            \
+    for (__i = 0; __i < (_n); __i += __nl) {                                                \
+        _vtype __v = ~(_vtype){};                                                           \
+                                                                                            \
+        if ((_n) - __i >= __nl) {                                                           \
+            __builtin_memcpy(&__v, (_data) + __i, sizeof(__v));                             \
+        } else {                                                                            \
+            __builtin_memcpy(&__v, (_data) + __i, ((_n) - __i) * sizeof(_type));            \
+        }                                                                                   \
+                                                                                            \
+        *(_vtype *)(__src + __i) = _sortv(__v);                                             \
+    }                                                                                       \
+                                                                                            \
+    for (__w = __nl; __w < __np; __w <<= 1) {                                               \
+        for (__i = 0; __i < __np; __i += 2 * __w) {                                         \
+            if (__i + __w >= __np) {                                                        \
+                __builtin_memcpy(__dst + __i, __src + __i, (__np - __i) * sizeof(_type));   \
+            } else {                                                                        \
+                const u64 __nb = (__np - (__i + __w)) < __w ? (__np - (__i + __w)) : __w;   \
+                _SORT_MERGE_RUNS(_vtype, _merge, __dst + __i, __src + __i, __w,             \
+                                 __src + __i + __w, __nb);                                  \
+            }                                                                               \
+        }                                                                                   \
+                                                                                            \
+        _type * const __t = __src;                                                          \
+        __src = __dst;                                                                      \
+        __dst = __t;                                                                        \
+    }                                                                                       \
+                                                                                            \
+    __builtin_memcpy((_data), __src, (_n) * sizeof(_type));                                 \
+}) /* end of macro */
+
+static inline void sort_u32(u32 * const RESTR data, u32 * const RESTR scratch, const u64 n)
+{
+    _SORT_ARRAY(u32, u32_16, sort_u32_16, merge_u32_16, data, scratch, n);
+}
+
+static inline void sort_u64(u64 * const RESTR data, u64 * const RESTR scratch, const u64 n)
+{
+    _SORT_ARRAY(u64, u64_8, sort_u64_8, merge_u64_8, data, scratch, n);
+}
+
+#endif /* _SORT_UTIL_H_ */
@@ -0,0 +1,185 @@
+#ifndef _TOPK_UTIL_H_
+#define _TOPK_UTIL_H_
+
+/*
+ *    Streaming top-k selection: the k largest of a stream of u32 or u64 (e.g. flow byte counts,
+ * with the flow id in the low half of a u64 as sort_u64() suggests for key + payload).
+ *
+ *    Values are filtered a vector at a time against a threshold and the survivors compress stored
+ * to a candidate buffer of about 2k.  Whenever the buffer is full it's sorted (sort_u32/u64(),
+ * see sort_util.h), cut back to its k largest, and the threshold becomes the smallest of those.
+ * From then on only values strictly above the threshold can change the top k (one equal to it
+ * would only tie the one it displaces), and the threshold only ever rises, so on a long stream
+ * nearly every vector is one compare and a mask test.  Until the first cut everything is kept.
+ *
+ *    Push any number of chunks with topk_*_push() after topk_*_init(), then topk_*_result()
+ * writes the k largest (fewer if fewer were pushed) in descending order.  Getting the result
+ * sorts the candidates in place, after which more may still be pushed.  topk_u32() / topk_u64()
+ * do all three over one array.
+ */
+
+typedef struct {
+    u32 * RESTR cand;       // Candidates, the first n are valid
+    u32 * RESTR scratch;    // Sort scratch for the candidates
+    u64         k;
+    u64         cap;        // Size of cand, rounded to whole vectors with room for one more
+    u64         n;
+    u32         thr;        // Once cut, only values above this are kept
+    u32         cut;        // Whether the candidates have been cut to k yet
+} topk_u32_t;
+
+typedef struct {
+    u64 * RESTR cand;
+    u64 * RESTR scratch;
+    u64         k;
+    u64         cap;
+    u64         n;
+    u64         thr;
+    u32         cut;
+} topk_u64_t;
+
+#define _TOPK_CAP(_k, _nlanes)      (SORT_SCRATCH_ELEMS(2 * (_k), (_nlanes)) + (_nlanes))
+
+/*
+ * Elements of memory for topk_*_init() for a given k (lanes is 16 for u32 and 8 for u64).
+ */
+#define TOPK_MEM_ELEMS(_k, _nlanes) (3 * _TOPK_CAP((_k), (_nlanes)))
+
+#define _TOPK_INIT(_t, _mem, _k, _nlanes)                                                   \
+({                                                                                          \
+    int __ret = -1;                                                                         \
+                                                                                            \
+    if (((_k) > 0) & !((u64)(_mem) & 63)) {                                                 \
+        (_t)->k = (_k);                                                                     \
+        (_t)->cap = _TOPK_CAP((_k), (_nlanes));                                             \
+        (_t)->cand = (_mem);                                                                \
+        (_t)->scratch = (_mem) + (_t)->cap;                                                 \
+        (_t)->n = 0;                                                                        \
+        (_t)->thr = 0;                                                                      \
+        (_t)->cut = 0;                                                                      \
+        __ret = 0;                                                                          \
+    }                                                                                       \
+                                                                                            \
+    __ret;                                                                                  \
+}) /* end of macro */
+
+/*
+ * Sort the candidates and keep the k largest, at the front.
+ */
+#define _TOPK_CUT(_t, _sort)                                                                \
+({                                                                                          \
+    _sort((_t)->cand, (_t)->scratch, (_t)->n);                                              \
+                                                                                            \
+    if ((_t)->n > (_t)->k) {                                                                \
+        __builtin_memmove((_t)->cand, (_t)->cand + ((_t)->n - (_t)->k),                     \
+                          (_t)->k * sizeof((_t)->cand[0]));                                 \
+        (_t)->n = (_t)->k;                                                                  \
+        (_t)->thr = (_t)->cand[0];                                                          \
+        (_t)->cut = 1;                                                                      \
+    }                                                                                       \
+}) /* end of macro */
+
+#define _TOPK_PUSH(_t, _src, _n, _vtype, _sort, _cmpgt, _loadz)                             \
+({                                                                                          \
+    const unsigned __nl = VEC_TYPE_LANES(_vtype);                                           \
+    u64 __i;                                                                                \
+                                                                                            \
+    for (__i = 0; __i < (_n); __i += __nl) {                                                \
+        const u64 __em = ((_n) - __i >= __nl) ? ~0ULL : _bzhi_u64(~0ULL, (_n) - __i);       \
+        const _vtype __v = (_vtype)_loadz(__em, (_src) + __i);                              \
+        const _vtype __thr = (_vtype){} + (_t)->thr;                                        \
+        u64 __keep = (_t)->cut ? (u64)_cmpgt((__m512i)__v, (__m512i)__thr) & __em : __em;   \
+                                                                                            \
+        if (__keep == 0) {                                                                  \
+            continue;                                                                       \
+        }                                                                                   \
+                                                                                            \
+        if ((_t)->n + __nl > (_t)->cap) {                                                   \
+            _TOPK_CUT((_t), _sort);                                                         \
+            __keep = (u64)_cmpgt((__m512i)__v, (__m512i)((_vtype){} + (_t)->thr)) & __em;   \
+        }                                                                                   \
+                                                                                            \
+        (_t)->n += COMPRESS_STORE((_t)->cand + (_t)->n, __keep, __v);                       \
+    }                                                                                       \
+}) /* end of macro */
+
+#define _TOPK_RESULT(_t, _dst, _sort)                                                       \
+({                                                                                          \
+    const u64 __out = ((_t)->n < (_t)->k) ? (_t)->n : (_t)->k;                              \
+    u64 __j;                                                                                \
+                                                                                            \
+    _TOPK_CUT((_t), _sort);                                                                 \
+                                                                                            \
+    for (__j = 0; __j < __out; __j++) {                                                     \
+        (_dst)[__j] = (_t)->cand[(_t)->n - 1 - __j];                                        \
+    }                                                                                       \
+                                                                                            \
+    __out;                                                                                  \
+}) /* end of macro */
+
+/*
+ *    Set up t to select the k largest, in mem, which must be 64 byte aligned and hold at least
+ * TOPK_MEM_ELEMS(k, 16) (u32) or TOPK_MEM_ELEMS(k, 8) (u64) elements.
+ */
+static inline int topk_u32_init(topk_u32_t * const RESTR t, u32 * const RESTR mem, const u64 k)
+{
+    return _TOPK_INIT(t, mem, k, 16);
+}
+
+static inline int topk_u64_init(topk_u64_t * const RESTR t, u64 * const RESTR mem, const u64 k)
+{
+    return _TOPK_INIT(t, mem, k, 8);
+}
+
+static inline void topk_u32_push(topk_u32_t * const RESTR t, const u32 * const RESTR src,
+                                 const u64 n)
+{
+    _TOPK_PUSH(t, src, n, u32_16, sort_u32, _mm512_cmpgt_epu32_mask, _mm512_maskz_loadu_epi32);
+}
+
+static inline void topk_u64_push(topk_u64_t * const RESTR t, const u64 * const RESTR src,
+                                 const u64 n)
+{
+    _TOPK_PUSH(t, src, n, u64_8, sort_u64, _mm512_cmpgt_epu64_mask, _mm512_maskz_loadu_epi64);
+}
+
+/*
+ * Write the k largest pushed so far to dst, largest first, and return how many that was.
+ */
+static inline u64 topk_u32_result(topk_u32_t * const RESTR t, u32 * const RESTR dst)
+{
+    return _TOPK_RESULT(t, dst, sort_u32);
+}
+
+static inline u64 topk_u64_result(topk_u64_t * const RESTR t, u64 * const RESTR dst)
+{
+    return _TOPK_RESULT(t, dst, sort_u64);
+}
+
+static inline u64 topk_u32(u32 * const RESTR dst, const u32 * const RESTR src, const u64 n,
+                           const u64 k, u32 * const RESTR mem)
+{
+    topk_u32_t t;
+
+    if (topk_u32_init(&t, mem, k)) {
+        return 0;
+    }
+
+    topk_u32_push(&t, src, n);
+    return topk_u32_result(&t, dst);
+}
+
+static inline u64 topk_u64(u64 * const RESTR dst, const u64 * const RESTR src, const u64 n,
+                           const u64 k, u64 * const RESTR mem)
+{
+    topk_u64_t t;
+
+    if (topk_u64_init(&t, mem, k)) {
+        return 0;
+    }
+
+    topk_u64_push(&t, src, n);
+    return topk_u64_result(&t, dst);
+}
+
+#endif /* _TOPK_UTIL_H_ */
@@ -1,12 +1,12 @@
 #ifndef _TRANSPOSE_UTIL_H
 #define _TRANSPOSE_UTIL_H
 
+extern int __attribute__((__error__("Byte transposes need AVX512_VBMI")))
+        _transpose_needs_vbmi(void);
+
 /*
- * XXX: This whole file is experimantal and _badly_ needs a refactor but until I figure out
- * what direction(s) to take it in / how best to usefully generalize AOS-to-SOA and SOA-to-AOS
- * transformations for any given struct S within some basic/reasonable limits (fields all 32-bit or
- * 64-bit aligned) I'm not sure exactly what that'll look like.  So all these types, functions,
- * etc. are subject to change.
+ * XXX: transpose_func() and friends below are the original experiments and are subject to change.
+ * New code should use the square transposes and the AOS/SOA generator that follow them.
  */
 
 typedef union {
@@ -72,4 +72,559 @@ static inline u64_8 deinterleave_u32_16(const u32_16 in)
     return (u64_8) _mm512_permutexvar_epi32((__m512i)idx, (__m512i)in);
 }
 
+/*
+ *    Square transposes are built from a ladder of two-source permutes.  With the row index i and
+ * column index j written in binary, transposing swaps bit k of i with bit k of j for every k, and
+ * those swaps commute, so each bit can be its own stage.  The stage for bit k pairs row i with row
+ * i + (1 << k) (for the rows where bit k of i is clear) and rebuilds both from the two of them with
+ * one vpermt2* each.  For an n x n transpose that is log2(n) stages of n permutes.
+ *
+ *    Lane j of the new low row comes from the low row if bit k of j is clear, otherwise from lane
+ * j - (1 << k) of the high row; lane j of the new high row comes from lane j + (1 << k) of the low
+ * row if bit k of j is clear, otherwise from lane j of the high row.
+ */
+#define _TRANSPOSE_STAGE_IDX_LO(_type, _nl, _bit)                                           \
+({                                                                                          \
+    const _type __j = IDX_VEC(_type);                                                       \
+    const typeof(__j[0]) __b = (_bit), __nl = (_nl);                                        \
+    __j + ((_type)((__j & __b) != 0) & (typeof(__j[0]))(__nl - __b));                       \
+}) /* end of macro */
+
+#define _TRANSPOSE_STAGE_IDX_HI(_type, _nl, _bit)                                           \
+({                                                                                          \
+    const _type __j = IDX_VEC(_type);                                                       \
+    const typeof(__j[0]) __b = (_bit), __nl = (_nl);                                        \
+    (__j | __b) + ((_type)((__j & __b) != 0) & __nl);                                       \
+}) /* end of macro */
+
+/*
+ *    One stage of the ladder over n rows of 64 bytes, pairing row i with row i + bit where the
+ * rows hold elements of esz bytes.  Elements only ever move by bit lanes, and in runs of bit, so
+ * the stage can use the widest permute whose lanes divide bit * esz bytes (capped at qwords).
+ * That keeps the word and byte permutes to the bottom stages of the u16 and u8 shapes, which
+ * matters because vpermt2w is three uops where vpermt2q is one.
+ */
+static ALWAYS_INLINE void _transpose_stage(__m512i * const r, const unsigned n, const unsigned bit,
+                                           const unsigned esz)
+{
+    const unsigned dist = bit * esz;
+    const unsigned lsz = (dist < 8) ? dist : 8;
+    __m512i lo, hi;
+    unsigned i;
+
+    switch (lsz) {
+    case 8:
+        lo = (__m512i)_TRANSPOSE_STAGE_IDX_LO(u64_8, 8, dist / 8);
+        hi = (__m512i)_TRANSPOSE_STAGE_IDX_HI(u64_8, 8, dist / 8);
+        break;
+    case 4:
+        lo = (__m512i)_TRANSPOSE_STAGE_IDX_LO(u32_16, 16, dist / 4);
+        hi = (__m512i)_TRANSPOSE_STAGE_IDX_HI(u32_16, 16, dist / 4);
+        break;
+    case 2:
+        lo = (__m512i)_TRANSPOSE_STAGE_IDX_LO(u16_32, 32, dist / 2);
+        hi = (__m512i)_TRANSPOSE_STAGE_IDX_HI(u16_32, 32, dist / 2);
+        break;
+    default:
+        lo = (__m512i)_TRANSPOSE_STAGE_IDX_LO(u8_64, 64, dist);
+        hi = (__m512i)_TRANSPOSE_STAGE_IDX_HI(u8_64, 64, dist);
+        break;
+    }
+
+#pragma GCC unroll 64
+    for (i = 0; i < n; i++) {
+        if (!(i & bit)) {
+            const __m512i a = r[i];
+            const __m512i b = r[i + bit];
+
+            if (lsz == 8) {
+                r[i] = _mm512_permutex2var_epi64(a, lo, b);
+                r[i + bit] = _mm512_permutex2var_epi64(a, hi, b);
+            } else if (lsz == 4) {
+                r[i] = _mm512_permutex2var_epi32(a, lo, b);
+                r[i + bit] = _mm512_permutex2var_epi32(a, hi, b);
+            } else if (lsz == 2) {
+                r[i] = _mm512_permutex2var_epi16(a, lo, b);
+                r[i + bit] = _mm512_permutex2var_epi16(a, hi, b);
+            } else {
+#ifdef __AVX512VBMI__
+                r[i] = _mm512_permutex2var_epi8(a, lo, b);
+                r[i + bit] = _mm512_permutex2var_epi8(a, hi, b);
+#else
+                _transpose_needs_vbmi();
+#endif
+            }
+        }
+    }
+}
+
+#define _TRANSPOSE_SQUARE(_in, _out, _n, _esz)                                              \
+({                                                                                          \
+    __m512i __r[_n];                                                                        \
+    unsigned __i, __k;                                                                      \
+                                                                                            \
+    for (__i = 0; __i < (_n); __i++) {                                                      \
+        __r[__i] = (__m512i)(_in)[__i];                                                     \
+    }                                                                                       \
+                                                                                            \
+    _Pragma("GCC unroll 8")                                                                 \
+    for (__k = 1; __k < (_n); __k <<= 1) {                                                  \
+        _transpose_stage(__r, (_n), __k, (_esz));                                           \
+    }                                                                                       \
+                                                                                            \
+    for (__i = 0; __i < (_n); __i++) {                                                      \
+        (_out)[__i] = (typeof((_out)[0]))__r[__i];                                          \
+    }                                                                                       \
+}) /* end of macro */
+
+/*
+ * Square transposes of one 64 byte row per element of a row, in and out may be the same:
+ *
+ *      transpose_u64_8x8()      3 stages:  24 vpermt2q
+ *      transpose_u32_16x16()    4 stages:  16 vpermt2d,  48 vpermt2q
+ *      transpose_u16_32x32()    5 stages:  32 vpermt2w,  32 vpermt2d,  96 vpermt2q
+ *      transpose_u8_64x64()     6 stages:  64 vpermt2b,  64 vpermt2w,  64 vpermt2d, 192 vpermt2q
+ *                                          (only with VBMI)
+ */
+static ALWAYS_INLINE void transpose_u64_8x8(const u64_8 * const in, u64_8 * const out)
+{
+    _TRANSPOSE_SQUARE(in, out, 8, sizeof(u64));
+}
+
+static ALWAYS_INLINE void transpose_u32_16x16(const u32_16 * const in, u32_16 * const out)
+{
+    _TRANSPOSE_SQUARE(in, out, 16, sizeof(u32));
+}
+
+static ALWAYS_INLINE void transpose_u16_32x32(const u16_32 * const in, u16_32 * const out)
+{
+    _TRANSPOSE_SQUARE(in, out, 32, sizeof(u16));
+}
+
+#ifdef __AVX512VBMI__
+static ALWAYS_INLINE void transpose_u8_64x64(const u8_64 * const in, u8_64 * const out)
+{
+    _TRANSPOSE_SQUARE(in, out, 64, sizeof(u8));
+}
+#endif
+
+/*
+ *    Array level transposes of a rows x cols row major matrix in one mapped segment into the cols
+ * x rows matrix in another, for column conversion of data far bigger than the caches.  Both
+ * dimensions must be multiples of the tile size (the rows per register block: 8 for u64 up to 64
+ * for u8), both segments 64 byte aligned (as map_segment() gives) and big enough; otherwise they
+ * return -1 without touching anything.
+ *
+ *    The matrix is walked a band of tile rows at a time, left to right, so reads are a tile's
+ * worth of sequential streams that the prefetchers can follow; each tile is transposed in
+ * registers and written out as whole 64 byte lines.  Tiles TRANSPOSE_SEGMENT_PF_TILES to the right
+ * are software prefetched since the band is more streams than the hardware will track.  With
+ * TRANSPOSE_SEGMENT_NT the output goes out with streaming stores, which neither read the output
+ * lines in first nor leave them polluting the cache; without it ordinary stores are used, which
+ * is better when the output is consumed straight away and fits in cache.
+ */
+#define TRANSPOSE_SEGMENT_NT        (1 << 0)
+#define TRANSPOSE_SEGMENT_PF_TILES  (8)
+
+#define _TRANSPOSE_SEGMENT(_type, _n, _func, _in, _out, _rows, _cols, _flags)               \
+({                                                                                          \
+    const u64 __rows = (_rows), __cols = (_cols);                                           \
+    const u64 __bytes = __rows * __cols * sizeof((_type){}[0]);                             \
+    const u64 __br = __rows / (_n), __bc = __cols / (_n);                                   \
+    const int __bad = (__rows % (_n)) | (__cols % (_n)) | ((u64)(_in)->ptr & 63) |          \
+                      ((u64)(_out)->ptr & 63) | ((_in)->maplen < __bytes) |                 \
+                      ((_out)->maplen < __bytes);                                           \
+    int __ret = -1;                                                                         \
+                                                                                            \
+    if (!__bad) {                                                                           \
+        const _type * const __src = (const _type *)(_in)->ptr;                              \
+        _type * const __dst = (_type *)(_out)->ptr;                                         \
+        const u64 __pf = TRANSPOSE_SEGMENT_PF_TILES;                                        \
+        _type __t[_n];                                                                      \
+        u64 __i, __j, __r;                                                                  \
+                                                                                            \
+        for (__i = 0; __i < __br; __i++) {                                                  \
+            const _type * const __band = __src + (__i * (_n) * __bc);                       \
+                                                                                            \
+            for (__j = 0; __j < __bc; __j++) {                                              \
+                for (__r = 0; (__r < (_n)) & (__j + __pf < __bc); __r++) {                  \
+                    _mm_prefetch((const char *)(__band + (__r * __bc) + __j + __pf),        \
+                                 _MM_HINT_T0);                                              \
+                }                                                                           \
+                                                                                            \
+                for (__r = 0; __r < (_n); __r++) {                                          \
+                    __t[__r] = __band[(__r * __bc) + __j];                                  \
+                }                                                                           \
+                                                                                            \
+                _func(__t, __t);                                                            \
+                                                                                            \
+                for (__r = 0; __r < (_n); __r++) {                                          \
+                    _type * const __o = __dst + (((__j * (_n)) + __r) * __br) + __i;        \
+                                                                                            \
+                    if ((_flags) & TRANSPOSE_SEGMENT_NT) {                                  \
+                        _mm512_stream_si512((void *)__o, (__m512i)__t[__r]);                \
+                    } else {                                                                \
+                        *__o = __t[__r];                                                    \
+                    }                                                                       \
+                }                                                                           \
+            }                                                                               \
+        }                                                                                   \
+                                                                                            \
+        if ((_flags) & TRANSPOSE_SEGMENT_NT) {                                              \
+            _mm_sfence();                                                                   \
+        }                                                                                   \
+                                                                                            \
+        __ret = 0;                                                                          \
+    }                                                                                       \
+                                                                                            \
+    __ret;                                                                                  \
+}) /* end of macro */
+
+static inline int transpose_u64_segment(const seg_desc_t * const in, const seg_desc_t * const out,
+                                        const u64 rows, const u64 cols, const u32 flags)
+{
+    return _TRANSPOSE_SEGMENT(u64_8, 8, transpose_u64_8x8, in, out, rows, cols, flags);
+}
+
+static inline int transpose_u32_segment(const seg_desc_t * const in, const seg_desc_t * const out,
+                                        const u64 rows, const u64 cols, const u32 flags)
+{
+    return _TRANSPOSE_SEGMENT(u32_16, 16, transpose_u32_16x16, in, out, rows, cols, flags);
+}
+
+static inline int transpose_u16_segment(const seg_desc_t * const in, const seg_desc_t * const out,
+                                        const u64 rows, const u64 cols, const u32 flags)
+{
+    return _TRANSPOSE_SEGMENT(u16_32, 32, transpose_u16_32x32, in, out, rows, cols, flags);
+}
+
+#ifdef __AVX512VBMI__
+static inline int transpose_u8_segment(const seg_desc_t * const in, const seg_desc_t * const out,
+                                       const u64 rows, const u64 cols, const u32 flags)
+{
+    return _TRANSPOSE_SEGMENT(u8_64, 64, transpose_u8_64x64, in, out, rows, cols, flags);
+}
+#endif
+
+/*
+ *    Bit matrix transposes, with byte i of a qword being row i of an 8x8 bit matrix and bit j of
+ * that byte column j (so bit 8 * i + j of the qword), and likewise row r of a 64x64 bit matrix
+ * being a u64 in which bit c is column c.
+ *
+ *    gf2p8affineqb(x, A) sets bit i of each byte x to the parity of (x & byte 7 - i of A).  Given
+ * the identity bytes {0x01, 0x02, .. 0x80} as x and the matrix as A that makes bit i of byte k of
+ * the result bit k of row 7 - i, i.e. the transpose with the rows flipped, so the rows are
+ * reversed first to cancel that out.
+ */
+#ifdef __GFNI__
+static inline u64_8 transpose_bits_8x8_x8(const u64_8 in)
+{
+    const __m512i rev = (__m512i)(IDX_VEC(u8_64) ^ 7);      // vpshufb only looks at bits 0-3
+    const __m512i ident = _mm512_set1_epi64(0x8040201008040201ULL);
+
+    return (u64_8)_mm512_gf2p8affine_epi64_epi8(ident, _mm512_shuffle_epi8((__m512i)in, rev), 0);
+}
+#endif
+
+/*
+ *    Transpose 64 rows of 64 bits (row r in lane r % 8 of in[r / 8]), in and out may be the same.
+ * Split into 8x8 blocks, block (R, C) being byte C of rows 8R .. 8R + 7: one vpermb per input
+ * vector gathers each block into a qword (rows already flipped for the gf2p8affineqb), one
+ * gf2p8affineqb per vector transposes the blocks, transpose_u64_8x8() moves block (R, C) to
+ * where block (C, R) was and a last vpermb per vector spreads the blocks back out into rows.
+ * 48 instructions in all.
+ */
+#if defined(__GFNI__) && defined(__AVX512VBMI__)
+static ALWAYS_INLINE void transpose_bits_64x64(const u64_8 * const in, u64_8 * const out)
+{
+    const u8_64 j = IDX_VEC(u8_64);
+    const __m512i gather = (__m512i)((((j & 7) ^ 7) << 3) | (j >> 3));
+    const __m512i spread = (__m512i)(((j & 7) << 3) | (j >> 3));
+    const __m512i ident = _mm512_set1_epi64(0x8040201008040201ULL);
+    u64_8 blk[8];
+    unsigned i;
+
+    for (i = 0; i < 8; i++) {
+        const __m512i q = _mm512_permutexvar_epi8(gather, (__m512i)in[i]);
+        blk[i] = (u64_8)_mm512_gf2p8affine_epi64_epi8(ident, q, 0);
+    }
+
+    transpose_u64_8x8(blk, blk);
+
+    for (i = 0; i < 8; i++) {
+        out[i] = (u64_8)_mm512_permutexvar_epi8(spread, (__m512i)blk[i]);
+    }
+}
+#endif
+
+/*
+ *    Generator for packed Array-of-Structs <--> Struct-of-Arrays transposes of 16 records at a
+ * time.  Describe the fields you want as columns with an X-macro taking two callbacks, one for
+ * 32-bit and one for 64-bit fields:
+ *
+ *      typedef struct { u32 saddr, daddr; u64 ts; u32 len; } __attribute__((packed)) rec_t;
+ *      #define REC_FIELDS(F32, F64)  F32(saddr) F32(daddr) F64(ts) F32(len)
+ *      DEFINE_AOS_SOA_TRANSPOSE(rec, rec_t, REC_FIELDS)
+ *
+ * which defines:
+ *
+ *      typedef struct { u32_16 saddr, daddr; u64_8 ts[2]; u32_16 len; } rec_soa_t;
+ *      void rec_aos_to_soa(const rec_t *in, rec_soa_t *out);      // in[0..15] -> *out
+ *      void rec_soa_to_aos(const rec_soa_t *in, rec_t *out);      // *in -> out[0..15]
+ *
+ * A 64-bit field comes out as two u64_8 (records 0-7 and 8-15).  Fields are plain member names
+ * (the SOA struct reuses them, so no array elements or nested members) and need to be 4 byte
+ * aligned within the struct (64-bit ones need not be 8 byte aligned) and the struct must be a
+ * multiple of 4 bytes and at most 64 bytes long.  Fields can be listed in any order and need not
+ * cover the whole struct; soa_to_aos writes zeroes to any bytes not covered by a listed field.
+ *
+ *    Underneath, each record is loaded as one (masked) row of dwords, the 16 rows go through
+ * transpose_u32_16x16() and each field is picked out of the resulting dword columns (64-bit fields
+ * re-interleaved from their low and high columns with one more vpermt2d per half).  Because it's
+ * all inlined with constant offsets, permutes feeding only unused columns are dead code, so
+ * narrower structs get proportionally cheaper transposes.
+ */
+#define _AOS_SOA_DECL32(_f)     u32_16 _f;
+#define _AOS_SOA_DECL64(_f)     u64_8 _f[2];
+
+#define _AOS_SOA_CHECK(_f, _sz)                                                             \
+    _Static_assert((sizeof(((__aos_rec_t *)0)->_f) == (_sz)) &&                             \
+                   ((__builtin_offsetof(__aos_rec_t, _f) & 3) == 0),                        \
+                   "AOS/SOA fields must be 4 byte aligned u32 or u64: " #_f);
+
+#define _AOS_SOA_DW(_f)         (__builtin_offsetof(__aos_rec_t, _f) / sizeof(u32))
+
+#define _AOS_TO_SOA32(_f)                                                                   \
+    _AOS_SOA_CHECK(_f, 4)                                                                   \
+    out->_f = __col[_AOS_SOA_DW(_f)];
+
+#define _AOS_TO_SOA64(_f)                                                                   \
+    _AOS_SOA_CHECK(_f, 8)                                                                   \
+    out->_f[0] = (u64_8)_mm512_permutex2var_epi32((__m512i)__col[_AOS_SOA_DW(_f)],          \
+                 (__m512i)__ilv, (__m512i)__col[_AOS_SOA_DW(_f) + 1]);                      \
+    out->_f[1] = (u64_8)_mm512_permutex2var_epi32((__m512i)__col[_AOS_SOA_DW(_f)],          \
+                 (__m512i)(__ilv + 8), (__m512i)__col[_AOS_SOA_DW(_f) + 1]);
+
+#define _SOA_TO_AOS32(_f)                                                                   \
+    _AOS_SOA_CHECK(_f, 4)                                                                   \
+    __col[_AOS_SOA_DW(_f)] = in->_f;
+
+#define _SOA_TO_AOS64(_f)                                                                   \
+    _AOS_SOA_CHECK(_f, 8)                                                                   \
+    __col[_AOS_SOA_DW(_f)] = (u32_16)_mm512_permutex2var_epi32((__m512i)in->_f[0],          \
+                             (__m512i)__dil, (__m512i)in->_f[1]);                           \
+    __col[_AOS_SOA_DW(_f) + 1] = (u32_16)_mm512_permutex2var_epi32((__m512i)in->_f[0],      \
+                                 (__m512i)(__dil + 1), (__m512i)in->_f[1]);
+
+#define DEFINE_SOA_TYPE(_name, _fields)                                                     \
+typedef struct {                                                                            \
+    _fields(_AOS_SOA_DECL32, _AOS_SOA_DECL64)                                               \
+} _name##_soa_t /* end of macro */
+
+#define DEFINE_AOS_SOA_TRANSPOSE(_name, _struct, _fields)                                   \
+DEFINE_SOA_TYPE(_name, _fields);                                                            \
+                                                                                            \
+static inline void _name##_aos_to_soa(const _struct * const RESTR in,                       \
+                                      _name##_soa_t * const RESTR out)                      \
+{                                                                                           \
+    typedef _struct __aos_rec_t;                                                            \
+    enum { __ndw = sizeof(__aos_rec_t) / sizeof(u32) };                                     \
+    _Static_assert(((sizeof(__aos_rec_t) & 3) == 0) && (__ndw <= 16),                       \
+                   "AOS/SOA structs must be a multiple of 4 and at most 64 bytes long.");   \
+    const __mmask16 __m = (__mmask16)((1U << __ndw) - 1);                                   \
+    const u32_16 __ilv __attribute__((unused)) =                                            \
+        IDX_VEC_CUSTOM(u32_16, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);     \
+    const u8 * const __rec = (const u8 *)in;                                                \
+    u32_16 __col[16];                                                                       \
+    unsigned __i;                                                                           \
+                                                                                            \
+    for (__i = 0; __i < 16; __i++) {                                                        \
+        __col[__i] = (u32_16)_mm512_maskz_loadu_epi32(__m,                                  \
+                     __rec + (__i * sizeof(__aos_rec_t)));                                  \
+    }                                                                                       \
+                                                                                            \
+    transpose_u32_16x16(__col, __col);                                                      \
+    _fields(_AOS_TO_SOA32, _AOS_TO_SOA64)                                                   \
+}                                                                                           \
+                                                                                            \
+static inline void _name##_soa_to_aos(const _name##_soa_t * const RESTR in,                 \
+                                      _struct * const RESTR out)                            \
+{                                                                                           \
+    typedef _struct __aos_rec_t;                                                            \
+    enum { __ndw = sizeof(__aos_rec_t) / sizeof(u32) };                                     \
+    _Static_assert(((sizeof(__aos_rec_t) & 3) == 0) && (__ndw <= 16),                       \
+                   "AOS/SOA structs must be a multiple of 4 and at most 64 bytes long.");   \
+    const __mmask16 __m = (__mmask16)((1U << __ndw) - 1);                                   \
+    const u32_16 __dil __attribute__((unused)) = IDX_VEC(u32_16) * 2;                       \
+    u8 * const __rec = (u8 *)out;                                                           \
+    u32_16 __col[16] = {};                                                                  \
+    unsigned __i;                                                                           \
+                                                                                            \
+    _fields(_SOA_TO_AOS32, _SOA_TO_AOS64)                                                   \
+    transpose_u32_16x16(__col, __col);                                                      \
+                                                                                            \
+    for (__i = 0; __i < 16; __i++) {                                                        \
+        _mm512_mask_storeu_epi32(__rec + (__i * sizeof(__aos_rec_t)), __m,                  \
+                                 (__m512i)__col[__i]);                                      \
+    }                                                                                       \
+} /* end of macro */
+
+/*
+ *    Generator for the same SOA layout built from (and written back to) 16 records scattered
+ * through memory, addressed by two mpv_8 pointer vectors (records 0-7 and 8-15).  Invalid lanes
+ * (NULL or flagged, see mpv_8_fixup_mask()) read as zero and are not written.  It needs the
+ * _name##_soa_t type to already exist, either from DEFINE_AOS_SOA_TRANSPOSE() or, for structs too
+ * big for that, from DEFINE_SOA_TYPE():
+ *
+ *      DEFINE_AOS_SOA_TRANSPOSE(rec, rec_t, REC_FIELDS)
+ *      DEFINE_AOS_SOA_GATHER(rec, rec_t, REC_FIELDS)
+ *
+ * which defines two ways of doing each direction plus a wrapper that picks one:
+ *
+ *      rec_gather_fields(ptrs, out) / rec_scatter_fields(in, ptrs)
+ *          Two 8-lane gathers (or scatters) per field.  Cost is proportional to the number of
+ *          fields and independent of struct size.
+ *
+ *      rec_gather_rows(ptrs, out) / rec_scatter_rows(in, ptrs)
+ *          One (masked) 64 byte load per record then transpose_u32_16x16(), or the reverse with
+ *          one masked store per record that only touches the listed fields.  Cost is roughly
+ *          fixed (16 loads/stores plus the permute ladder), so it only catches up with the gathers
+ *          at around half a cache line's worth of fields (and pulls ahead once the records are
+ *          out of cache).  It only works for structs of at most 64 bytes and falls back to the
+ *          per-field version for anything bigger.
+ *
+ *      rec_gather(ptrs, out) / rec_scatter(in, ptrs)
+ *          Rows if the struct fits in AOS_SOA_ROWS_MAX_BYTES and at least AOS_SOA_ROWS_MIN_FIELDS
+ *          fields are listed, fields otherwise (both are compile time constants, so there is no
+ *          runtime branch).  See the aos_soa_gather perf_jig test for where the crossover lies.
+ *
+ * Where two lanes point at the same record the higher lane's values win with both scatters.
+ */
+#define AOS_SOA_ROWS_MAX_BYTES  (64)
+#define AOS_SOA_ROWS_MIN_FIELDS (8)
+
+#define _SG_U32_16(_lo, _hi)                                                                \
+    (u32_16)_mm512_inserti64x4(_mm512_castsi256_si512((__m256i)(_lo)), (__m256i)(_hi), 1)
+
+#define _SG_GATHER32(_f)                                                                    \
+    out->_f = _SG_U32_16(GATHER_u32_8_FROM_STRUCTS(__aos_rec_t, _f, ptrs[0]),               \
+                         GATHER_u32_8_FROM_STRUCTS(__aos_rec_t, _f, ptrs[1]));
+
+#define _SG_GATHER64(_f)                                                                    \
+    out->_f[0] = GATHER_u64_8_FROM_STRUCTS(__aos_rec_t, _f, ptrs[0]);                       \
+    out->_f[1] = GATHER_u64_8_FROM_STRUCTS(__aos_rec_t, _f, ptrs[1]);
+
+#define _SG_SCATTER32(_f)                                                                   \
+    SCATTER_u32_8_TO_STRUCTS(__aos_rec_t, _f, ptrs[0],                                      \
+                             _mm512_castsi512_si256((__m512i)in->_f));                      \
+    SCATTER_u32_8_TO_STRUCTS(__aos_rec_t, _f, ptrs[1],                                      \
+                             _mm512_extracti64x4_epi64((__m512i)in->_f, 1));
+
+#define _SG_SCATTER64(_f)                                                                   \
+    SCATTER_u64_8_TO_STRUCTS(__aos_rec_t, _f, ptrs[0], in->_f[0]);                          \
+    SCATTER_u64_8_TO_STRUCTS(__aos_rec_t, _f, ptrs[1], in->_f[1]);
+
+#define _SG_COUNT32(_f)         + 1
+#define _SG_COUNT64(_f)         + 1
+#define _SG_WMASK32(_f)         | (0x1U << _AOS_SOA_DW(_f))
+#define _SG_WMASK64(_f)         | (0x3U << _AOS_SOA_DW(_f))
+
+/*
+ * Normalize a pair of mpv_8 into rp and return the 16-bit mask of valid lanes.
+ */
+static inline u32 _sg_row_ptrs_x16(const mpv_8 * const RESTR ptrs, mpv_8 * const RESTR rp)
+{
+    rp[0].vec = ptrs[0].vec;
+    rp[1].vec = ptrs[1].vec;
+    return mpv_8_fixup_mask(rp) | ((u32)mpv_8_fixup_mask(rp + 1) << 8);
+}
+
+#define DEFINE_AOS_SOA_GATHER(_name, _struct, _fields)                                      \
+static inline void _name##_gather_fields(const mpv_8 * const RESTR ptrs,                    \
+                                         _name##_soa_t * const RESTR out)                   \
+{                                                                                           \
+    typedef _struct __aos_rec_t;                                                            \
+    _fields(_SG_GATHER32, _SG_GATHER64)                                                     \
+}                                                                                           \
+                                                                                            \
+static inline void _name##_scatter_fields(const _name##_soa_t * const RESTR in,             \
+                                          const mpv_8 * const RESTR ptrs)                   \
+{                                                                                           \
+    typedef _struct __aos_rec_t;                                                            \
+    _fields(_SG_SCATTER32, _SG_SCATTER64)                                                   \
+}                                                                                           \
+                                                                                            \
+static inline void _name##_gather_rows(const mpv_8 * const RESTR ptrs,                      \
+                                       _name##_soa_t * const RESTR out)                     \
+{                                                                                           \
+    typedef _struct __aos_rec_t;                                                            \
+    if (sizeof(__aos_rec_t) > AOS_SOA_ROWS_MAX_BYTES) {                                     \
+        _name##_gather_fields(ptrs, out);                                                   \
+        return;                                                                             \
+    }                                                                                       \
+                                                                                            \
+    enum { __ndw = sizeof(__aos_rec_t) / sizeof(u32) };                                     \
+    const __mmask16 __m = (__mmask16)((__ndw >= 16) ? 0xFFFF : ((1U << __ndw) - 1));        \
+    const u32_16 __ilv __attribute__((unused)) =                                            \
+        IDX_VEC_CUSTOM(u32_16, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);     \
+    u32_16 __col[16];                                                                       \
+    mpv_8 __rp[2];                                                                          \
+    const u32 __valid = _sg_row_ptrs_x16(ptrs, __rp);                                       \
+    unsigned __i;                                                                           \
+                                                                                            \
+                                                                                            \
+    for (__i = 0; __i < 16; __i++) {                                                        \
+        const __mmask16 __lm = ((__valid >> __i) & 1) ? __m : 0;                            \
+        __col[__i] = (u32_16)_mm512_maskz_loadu_epi32(__lm, __rp[__i / 8].mp[__i % 8].cp);  \
+    }                                                                                       \
+                                                                                            \
+    transpose_u32_16x16(__col, __col);                                                      \
+    _fields(_AOS_TO_SOA32, _AOS_TO_SOA64)                                                   \
+}                                                                                           \
+                                                                                            \
+static inline void _name##_scatter_rows(const _name##_soa_t * const RESTR in,               \
+                                        const mpv_8 * const RESTR ptrs)                     \
+{                                                                                           \
+    typedef _struct __aos_rec_t;                                                            \
+    if (sizeof(__aos_rec_t) > AOS_SOA_ROWS_MAX_BYTES) {                                     \
+        _name##_scatter_fields(in, ptrs);                                                   \
+        return;                                                                             \
+    }                                                                                       \
+                                                                                            \
+    const __mmask16 __wm = (__mmask16)(0 _fields(_SG_WMASK32, _SG_WMASK64));                \
+    const u32_16 __dil __attribute__((unused)) = IDX_VEC(u32_16) * 2;                       \
+    u32_16 __col[16] = {};                                                                  \
+    mpv_8 __rp[2];                                                                          \
+    const u32 __valid = _sg_row_ptrs_x16(ptrs, __rp);                                       \
+    unsigned __i;                                                                           \
+                                                                                            \
+    _fields(_SOA_TO_AOS32, _SOA_TO_AOS64)                                                   \
+    transpose_u32_16x16(__col, __col);                                                      \
+                                                                                            \
+    for (__i = 0; __i < 16; __i++) {                                                        \
+        const __mmask16 __sm = ((__valid >> __i) & 1) ? __wm : 0;                           \
+        _mm512_mask_storeu_epi32(__rp[__i / 8].mp[__i % 8].p, __sm, (__m512i)__col[__i]);   \
+    }                                                                                       \
+}                                                                                           \
+                                                                                            \
+static inline void _name##_gather(const mpv_8 * const RESTR ptrs,                           \
+                                  _name##_soa_t * const RESTR out)                          \
+{                                                                                           \
+    if ((0 _fields(_SG_COUNT32, _SG_COUNT64)) >= AOS_SOA_ROWS_MIN_FIELDS) {                 \
+        _name##_gather_rows(ptrs, out);                                                     \
+    } else {                                                                                \
+        _name##_gather_fields(ptrs, out);                                                   \
+    }                                                                                       \
+}                                                                                           \
+                                                                                            \
+static inline void _name##_scatter(const _name##_soa_t * const RESTR in,                    \
+                                   const mpv_8 * const RESTR ptrs)                          \
+{                                                                                           \
+    if ((0 _fields(_SG_COUNT32, _SG_COUNT64)) >= AOS_SOA_ROWS_MIN_FIELDS) {                 \
+        _name##_scatter_rows(in, ptrs);                                                     \
+    } else {                                                                                \
+        _name##_scatter_fields(in, ptrs);                                                   \
+    }                                                                                       \
+} /* end of macro */
+
 #endif /* _TRANSPOSE_UTIL_H */
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "../include/simd_util.h"
+
+#include "perf_jig.h"
+
+#define ACL_NPREFIXES   (64)
+
+static const u32 acl_l4_types[] = { MD_PROTO_L4_TCP, MD_PROTO_L4_TCP, MD_PROTO_L4_UDP,
+                                    MD_PROTO_L4_ICMP };
+
+static u32 acl_rand(void)
+{
+    u32 r;
+
+    randomize_data(&r, sizeof(r));
+    return r;
+}
+
+/*
+ *    Rules shaped roughly like a ClassBench firewall set: destinations are /16 to /32 prefixes
+ * under a few dozen networks, mostly hosts, and sources the same or (one in four) anything; ports
+ * mostly one well known port, the ephemeral range or anything, and the protocol mostly TCP.  The
+ * last rule matches everything.
+ */
+static void acl_make_rules(acl_rule_t * const rules, const u32 nrules)
+{
+    static const u32 lens[] = { 16, 24, 24, 28, 32, 32, 32, 32 };
+    static const u32 well_known[] = { 20, 21, 22, 23, 25, 53, 80, 110, 123, 143, 161, 443, 445,
+                                      993, 3306, 8080 };
+    u32 prefixes[ACL_NPREFIXES], r, d;
+
+    randomize_data(prefixes, sizeof(prefixes));
+
+    for (r = 0; r < nrules; r++) {
+        for (d = ACL_SRC; d <= ACL_DST; d++) {
+            const u32 len = ((d == ACL_SRC) && !(acl_rand() % 4)) ? 0 : lens[acl_rand() % 8];
+            const u32 mask = len ? ~0U << (32 - len) : 0;
+            const u32 net = (prefixes[acl_rand() % ACL_NPREFIXES] ^ (acl_rand() & 0xFFFF)) & mask;
+
+            rules[r].lo[d] = net;
+            rules[r].hi[d] = net | ~mask;
+        }
+
+        for (d = ACL_SPORT; d <= ACL_DPORT; d++) {
+            const u32 p = acl_rand();
+
+            if ((d == ACL_SPORT) ? (p % 8) : !(p % 4)) {
+                rules[r].lo[d] = 0;
+                rules[r].hi[d] = 0xFFFF;
+            } else if (p % 3) {
+                rules[r].lo[d] = rules[r].hi[d] = well_known[(p >> 8) % 16];
+            } else if (p % 2) {
+                rules[r].lo[d] = 1024;
+                rules[r].hi[d] = 0xFFFF;
+            } else {
+                rules[r].lo[d] = (p >> 8) % 60000;
+                rules[r].hi[d] = rules[r].lo[d] + ((p >> 24) & 0xFF);
+            }
+        }
+
+        rules[r].l4 = (acl_rand() % 8) ? ACL_L4(acl_l4_types[acl_rand() % 4]) : ACL_L4_ANY;
+    }
+
+    rules[nrules - 1] = (acl_rule_t){ .hi = { ~0U, ~0U, 0xFFFF, 0xFFFF }, .l4 = ACL_L4_ANY };
+}
+
+/*
+ *    Packets: three in four a random point inside a random rule (which it may or may not be the
+ * first match for), the rest random addresses and ports.
+ */
+static void acl_make_pkts(pkt_metadata_t * const md, const u64 npkts,
+                          const acl_rule_t * const rules, const u32 nrules)
+{
+    u32 f[ACL_NRANGES], d;
+    u64 i;
+
+    __builtin_memset(md, 0, npkts * sizeof(*md));
+
+    for (i = 0; i < npkts; i++) {
+        const acl_rule_t * const ru = &rules[acl_rand() % nrules];
+        const u32 r = acl_rand();
+
+        for (d = 0; d < ACL_NRANGES; d++) {
+            f[d] = (r % 4) ? ru->lo[d] + (acl_rand() % ((u64)ru->hi[d] - ru->lo[d] + 1)) :
+                   acl_rand();
+        }
+
+        md[i].src_ip.u32[0] = htonl(f[ACL_SRC]);
+        md[i].dst_ip.u32[0] = htonl(f[ACL_DST]);
+        md[i].src_port = htons(f[ACL_SPORT]);
+        md[i].dst_port = htons(f[ACL_DPORT]);
+        md[i].proto_flags = MD_PROTO_L3_IP4 | acl_l4_types[(r >> 8) % 4];
+    }
+}
+
+/* The first rule md matches, one rule at a time. */
+static u32 acl_classify_scalar(const acl_rule_t * const RESTR rules, const u32 nrules,
+                               const pkt_metadata_t * const RESTR md)
+{
+    const u32 f[ACL_NRANGES] = { ntohl(md->src_ip.u32[0]), ntohl(md->dst_ip.u32[0]),
+                                 ntohs(md->src_port), ntohs(md->dst_port) };
+    const u32 l4 = ACL_L4(md->proto_flags & (0xFF << 16));
+    u32 r;
+
+    for (r = 0; r < nrules; r++) {
+        if ((f[0] >= rules[r].lo[0]) & (f[0] <= rules[r].hi[0]) &
+            (f[1] >= rules[r].lo[1]) & (f[1] <= rules[r].hi[1]) &
+            (f[2] >= rules[r].lo[2]) & (f[2] <= rules[r].hi[2]) &
+            (f[3] >= rules[r].lo[3]) & (f[3] <= rules[r].hi[3]) & !!(rules[r].l4 & l4)) {
+            return r;
+        }
+    }
+
+    return ACL_NONE;
+}
+
+/*
+ *    One rule set size: build both engines, classify npkts packets with each iters times, and
+ * report build time, memory and clocks per packet, along with the scalar loop (one pass).  All
+ * three must agree.
+ */
+static int acl_run(const char * const name, const u32 nrules, const u64 npkts,
+                   const unsigned iters)
+{
+    char errbuf[1024] = {};
+    const u64 rlen = ((nrules * sizeof(acl_rule_t)) + 63) & ~63UL;
+    const u64 plen = npkts * sizeof(pkt_metadata_t);
+    const u64 llen = (ACL_LINEAR_MEM_SIZE(nrules) + 63) & ~63UL;
+    const u64 olen = npkts * sizeof(u32);
+    seg_desc_t dseg = {
+        .maplen = (rlen + plen + llen + (3 * olen) + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+    seg_desc_t bseg = {
+        .maplen = (ACL_BV_MEM_SIZE(nrules) + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+    const char * const names[3] = { "scalar", "acl_linear_classify_x16()",
+                                    "acl_bv_classify_x16()" };
+    u64 clk[3] = {}, build_ns[3] = {}, hits = 0, i;
+    unsigned mode, it;
+    int ret = 0;
+
+    if (map_segment(NULL, &dseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", name, errbuf);
+        return -1;
+    }
+
+    if (map_segment(NULL, &bseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", name, errbuf);
+        unmap_segment(&dseg);
+        return -1;
+    }
+
+    acl_rule_t * const rules = (acl_rule_t *)dseg.ptr;
+    pkt_metadata_t * const md = (pkt_metadata_t *)((u8 *)dseg.ptr + rlen);
+    void * const lmem = (u8 *)md + plen;
+    u32 * const res[3] = { (u32 *)((u8 *)lmem + llen), (u32 *)((u8 *)lmem + llen + olen),
+                           (u32 *)((u8 *)lmem + llen + (2 * olen)) };
+
+    acl_make_rules(rules, nrules);
+    acl_make_pkts(md, npkts, rules, nrules);
+
+    u64 pre_ns = wall_clock_ns();
+    const acl_linear_t * const lin = acl_linear_init(lmem, rules, nrules);
+
+    build_ns[1] = wall_clock_ns() - pre_ns;
+    pre_ns = wall_clock_ns();
+
+    const acl_bv_t * const bv = acl_bv_init(bseg.ptr, rules, nrules);
+
+    build_ns[2] = wall_clock_ns() - pre_ns;
+
+    if ((lin == NULL) | (bv == NULL)) {
+        printf("%s: bad rules\n", name);
+        ret = -1;
+        goto out;
+    }
+
+    for (mode = 0; mode < 3; mode++) {
+        for (it = 0; it < (mode ? iters : 1); it++) {
+            const u64 pre = TSC_PRECISE();
+
+            if (mode == 0) {
+                for (i = 0; i < npkts; i++) {
+                    res[0][i] = acl_classify_scalar(rules, nrules, &md[i]);
+                }
+            } else if (mode == 1) {
+                for (i = 0; i < npkts; i += 16) {
+                    *(u32_16 *)&res[1][i] = acl_linear_classify_x16(lin, &md[i], 0xFFFF);
+                }
+            } else {
+                for (i = 0; i < npkts; i += 16) {
+                    *(u32_16 *)&res[2][i] = acl_bv_classify_x16(bv, &md[i], 0xFFFF);
+                }
+            }
+
+            clk[mode] += TSC_PRECISE() - pre;
+        }
+
+        consume_data(res[mode], olen);
+    }
+
+    for (i = 0; i < npkts; i++) {
+        hits += (res[0][i] != nrules - 1);
+    }
+
+    printf("%s: %u rules, %lu packets x %u, %.1f%% matched before the default rule\n", name,
+           nrules, npkts, iters, (100.0 * hits) / npkts);
+
+    for (mode = 0; mode < 3; mode++) {
+        printf("\t%-26s %10.2f clocks per packet", names[mode],
+               (double)clk[mode] / (npkts * (mode ? iters : 1)));
+
+        if (mode == 1) {
+            printf("   built in %8.3f ms, %10lu bytes", build_ns[1] / 1e6,
+                   (u64)ACL_LINEAR_MEM_SIZE(nrules));
+        } else if (mode == 2) {
+            printf("   built in %8.3f ms, %10lu bytes", build_ns[2] / 1e6, bv->mem_used);
+        }
+
+        printf("\n");
+    }
+
+    for (mode = 1; mode < 3; mode++) {
+        if (__builtin_memcmp(res[0], res[mode], olen)) {
+            printf("%s: %s disagrees with the scalar loop\n", name, names[mode]);
+            ret = -1;
+        }
+    }
+
+out:
+    unmap_segment(&bseg);
+    unmap_segment(&dseg);
+    return ret;
+}
+
+/*
+ *    Classify synthetic IPv4 packets against a synthetic rule set with the linear and
+ * bit-vector engines, at nrules rules, or at 100, 1000 and 10000 if it isn't given.
+ */
+static int perf_test_acl(const char **args)
+{
+    static const u32 sizes[] = { 100, 1000, 10000 };
+    const u32 nrules     = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : 0;
+    const u64 npkts      = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : (1 << 16);
+    const unsigned iters = ARG_VALID(args[3]) ? strtoul(args[3], NULL, 0) : 8;
+    unsigned s;
+
+    if ((npkts == 0) | (npkts & 15) | (iters == 0)) {
+        printf("%s: npkts must be a non-zero multiple of 16 and iters non-zero.\n", args[0]);
+        return -1;
+    }
+
+    if (nrules) {
+        return acl_run(args[0], nrules, npkts, iters);
+    }
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        if (acl_run(args[0], sizes[s], npkts, iters)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+PERF_FUNC_ENTRY(acl, "Classify IPv4 packets against ACL rules, 16 rules at a time vs. bit-vector "
+                "intersection, at 100, 1k and 10k rules by default.", "nrules", "npkts", "iters");
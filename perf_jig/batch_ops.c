@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <libgen.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "../include/simd_util.h"
+
+#include "perf_jig.h"
+
+typedef struct {
+    const u64 * RESTR   enq_tsc;
+    u64 * RESTR         latency;
+    u32                 work;
+    u32_16              accum;
+} bin_dispatch_sim_t;
+
+static void sim_dispatch(void *ctx, const u32 bin, const u32_16 items, const u32_16 keys,
+                         const __mmask16 lanes, const u32 reason)
+{
+    bin_dispatch_sim_t * const RESTR sim = (bin_dispatch_sim_t *)ctx;
+    const u64 now = TSC_SLOPPY();
+    unsigned i;
+
+    // Stand-in for the real batch operation: a few dependent multiplies per dispatch
+    for (i = 0; i < sim->work; i++) {
+        sim->accum = (sim->accum * 0x9e3779b1U) ^ keys;
+    }
+
+    for (i = 0; i < 16; i++) {
+        if ((lanes >> i) & 1) {
+            sim->latency[items[i]] = now - sim->enq_tsc[items[i]];
+        }
+    }
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    const u64 x = *(const u64 *)a;
+    const u64 y = *(const u64 *)b;
+    return (x > y) - (x < y);
+}
+
+static int perf_test_bin_dispatch(const char **args)
+{
+    char errbuf[1024] = {};
+    const unsigned nitems   = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : (1 << 20);
+    const unsigned nbins    = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 16;
+    const unsigned nkeys    = ARG_VALID(args[3]) ? strtoul(args[3], NULL, 0) : 1024;
+    const u64 max_lat       = ARG_VALID(args[4]) ? strtoul(args[4], NULL, 0) : 2000;
+    const u64 gap           = ARG_VALID(args[5]) ? strtoul(args[5], NULL, 0) : 100;
+    const unsigned burst    = ARG_VALID(args[6]) ? strtoul(args[6], NULL, 0) : 4;
+    const unsigned work     = ARG_VALID(args[7]) ? strtoul(args[7], NULL, 0) : 4;
+
+    if (!nitems | !nkeys | (nitems & 15) | !nbins | (nbins > BIN_DISPATCH_MAX_BINS) |
+            !burst | (burst > 16)) {
+        printf("%s: nitems must be a non-zero multiple of 16, nkeys must be non-zero, "
+               "0 < nbins <= %u and 0 < burst <= 16.\n", args[0], BIN_DISPATCH_MAX_BINS);
+        return -1;
+    }
+
+    // bin id, key, enqueue TSC and measured latency for each item, plus the dispatcher itself
+    const u64 dlen = ((((u64)nitems * (sizeof(u32) * 2 + sizeof(u64) * 2)) + sizeof(bin_dispatch_t))
+                      + HUGE_2M_MASK) & ~HUGE_2M_MASK;
+    seg_desc_t dseg = {.maplen = dlen, .flags = SEG_DESC_INITD | SEG_DESC_ANON};
+
+    if (map_segment(NULL, &dseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    bin_dispatch_t * const RESTR bd = (bin_dispatch_t *)dseg.ptr;
+    u32 * const RESTR bin = (u32 *)(bd + 1);
+    u32 * const RESTR key = bin + nitems;
+    u64 * const RESTR enq_tsc = (u64 *)(key + nitems);
+    u64 * const RESTR latency = enq_tsc + nitems;
+    unsigned i;
+
+    randomize_data(bin, (u64)nitems * sizeof(u32) * 2);
+
+    for (i = 0; i < nitems; i++) {
+        bin[i] %= nbins;
+        key[i] %= nkeys;
+    }
+
+    bin_dispatch_sim_t sim = {.enq_tsc = enq_tsc, .latency = latency, .work = work};
+    bin_dispatch_init(bd, nbins, max_lat, sim_dispatch, &sim);
+
+    /*
+     * Items arrive 'burst' at a time, one burst every 'gap' TSC ticks (as near as we can manage).
+     * Between arrivals we poll for bins whose deadline has passed.
+     */
+    const __mmask16 bm = (__mmask16)((1U << burst) - 1);
+    const u64 pre = TSC_PRECISE();
+    u64 next = pre;
+
+    for (i = 0; i < nitems; i += burst) {
+        u64 now;
+
+        while ((now = TSC_SLOPPY()) < next) {
+            bin_dispatch_poll(bd, now);
+        }
+
+        next += gap;
+
+        const __mmask16 m = bm & (__mmask16)((nitems - i >= 16) ? 0xFFFF : ((1U << (nitems - i)) - 1));
+        const u32_16 items = IDX_VEC(u32_16) + i;
+        const u32_16 bins = (u32_16)_mm512_maskz_loadu_epi32(m, bin + i);
+        const u32_16 keys = (u32_16)_mm512_maskz_loadu_epi32(m, key + i);
+
+        _mm512_mask_storeu_epi64(enq_tsc + i, (__mmask8)m, _mm512_set1_epi64(now));
+        _mm512_mask_storeu_epi64(enq_tsc + i + 8, (__mmask8)(m >> 8), _mm512_set1_epi64(now));
+        bin_dispatch_add_x16(bd, bins, items, keys, m, now);
+        bin_dispatch_poll(bd, now);
+    }
+
+    bin_dispatch_flush(bd);
+
+    const u64 post = TSC_PRECISE();
+    const u64 total_clk = post - pre;
+    consume_data(&sim.accum, sizeof(sim.accum));
+
+    qsort(latency, nitems, sizeof(u64), cmp_u64);
+
+    const u64 n_batches = bd->n_dispatch[BIN_DISPATCH_FULL] + bd->n_dispatch[BIN_DISPATCH_CONFLICT] +
+                          bd->n_dispatch[BIN_DISPATCH_DEADLINE] + bd->n_dispatch[BIN_DISPATCH_FLUSH];
+
+    printf("%s(%u, %u, %u, %lu, %lu, %u, %u):\n", args[0], nitems, nbins, nkeys, max_lat, gap,
+           burst, work);
+    printf("\t%lu items in %lu batches in %lu cycles (%.1f clocks per item, %.2f items per batch).\n",
+           bd->n_items, n_batches, total_clk, (float)total_clk / (float)nitems,
+           (float)bd->n_items / (float)n_batches);
+    printf("\tbatches by reason: full=%lu conflict=%lu deadline=%lu flush=%lu\n",
+           bd->n_dispatch[BIN_DISPATCH_FULL], bd->n_dispatch[BIN_DISPATCH_CONFLICT],
+           bd->n_dispatch[BIN_DISPATCH_DEADLINE], bd->n_dispatch[BIN_DISPATCH_FLUSH]);
+    printf("\tlatency (clocks): p50=%lu p90=%lu p99=%lu p99.9=%lu max=%lu\n",
+           latency[nitems / 2], latency[(nitems / 10) * 9], latency[(nitems / 100) * 99],
+           latency[(nitems / 1000) * 999], latency[nitems - 1]);
+
+    unmap_segment(&dseg);
+    return 0;
+}
+
+PERF_FUNC_ENTRY(bin_dispatch,
+                "Bin items by operation and dispatch on full vector, key conflict or TSC deadline.",
+                "nitems", "nbins", "nkeys", "max_lat", "gap", "burst", "work");
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <libgen.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#include "perf_jig.h"
+
+/* bitslice_u64_x512() needs GFNI and VBMI; without them there is nothing to time. */
+#if defined(__GFNI__) && defined(__AVX512VBMI__)
+
+/*
+ *    Count how many of nvals nbits-bit values fall in each of nfilters random ranges [lo, hi),
+ * once with a plain loop per filter over the values and once bitsliced: the values are first
+ * converted to nbits planes per 512 (the conversion is timed separately), then every filter is a
+ * BS_IN_RANGE_K() over the planes of each block plus a popcount.
+ */
+static int perf_test_bitslice_filter(const char **args)
+{
+    char errbuf[1024] = {};
+    const u32 nvals    = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : (1 << 20);
+    const u32 nfilters = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 64;
+    const u32 nbits    = ARG_VALID(args[3]) ? strtoul(args[3], NULL, 0) : 16;
+
+    if ((nvals < 512) | (nvals & 511) | !nfilters | (nfilters > 4096) | !nbits | (nbits > 64)) {
+        printf("%s: nvals must be a multiple of 512, 0 < nfilters <= 4096 and 0 < nbits <= 64.\n",
+               args[0]);
+        return -1;
+    }
+
+    const u32 nblk = nvals / 512;
+    const u64 vlen = (u64)nvals * sizeof(u64);
+    const u64 plen = (u64)nblk * nbits * sizeof(u64_8);
+    const u64 flen = (u64)nfilters * sizeof(u64) * 4;
+    seg_desc_t dseg = {
+        .maplen = (vlen + plen + flen + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &dseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    u64 * const RESTR vals = (u64 *)dseg.ptr;
+    u64_8 * const RESTR planes = (u64_8 *)((u8 *)dseg.ptr + vlen);
+    u64 * const RESTR lo = (u64 *)((u8 *)planes + plen);
+    u64 * const RESTR hi = lo + nfilters;
+    u64 * const RESTR cnt_scalar = hi + nfilters;
+    u64 * const RESTR cnt_bs = cnt_scalar + nfilters;
+    const u64 vmask = (nbits == 64) ? ~0UL : ((1UL << nbits) - 1);
+    u64 pre, clk_conv, clk_scalar, clk_bs;
+    u32 i, f, b;
+    int ret = 0;
+
+    randomize_data(vals, vlen);
+    randomize_data(lo, 2 * nfilters * sizeof(u64));
+
+    for (i = 0; i < nvals; i++) {
+        vals[i] &= vmask;
+    }
+
+    for (f = 0; f < nfilters; f++) {
+        lo[f] &= vmask;
+        hi[f] &= vmask;
+
+        if (lo[f] > hi[f]) {
+            const u64 t = lo[f];
+            lo[f] = hi[f];
+            hi[f] = t;
+        }
+    }
+
+    pre = TSC_PRECISE();
+    for (f = 0; f < nfilters; f++) {
+        const u64 l = lo[f], h = hi[f];
+        u64 n = 0;
+
+        for (i = 0; i < nvals; i++) {
+            n += (vals[i] >= l) & (vals[i] < h);
+        }
+
+        cnt_scalar[f] = n;
+    }
+    clk_scalar = TSC_PRECISE() - pre;
+
+    pre = TSC_PRECISE();
+    for (i = 0; i < nblk; i++) {
+        u64_8 all[64];
+
+        bitslice_u64_x512(vals + ((u64)i * 512), all);
+
+        for (b = 0; b < nbits; b++) {
+            planes[((u64)i * nbits) + b] = all[b];
+        }
+    }
+    clk_conv = TSC_PRECISE() - pre;
+
+    __builtin_memset(cnt_bs, 0, nfilters * sizeof(u64));
+
+    pre = TSC_PRECISE();
+    for (i = 0; i < nblk; i++) {
+        const u64_8 * const p = planes + ((u64)i * nbits);
+
+        for (f = 0; f < nfilters; f++) {
+            cnt_bs[f] += bs_count_u64_8(BS_IN_RANGE_K(p, nbits, lo[f], hi[f]));
+        }
+    }
+    clk_bs = TSC_PRECISE() - pre;
+
+    for (f = 0; f < nfilters; f++) {
+        if (cnt_bs[f] != cnt_scalar[f]) {
+            printf("%s: filter %u [%lu, %lu) counted %lu bitsliced, %lu scalar\n", args[0], f,
+                   lo[f], hi[f], cnt_bs[f], cnt_scalar[f]);
+            ret = -1;
+        }
+    }
+
+    const float evals = (float)nvals * nfilters;
+
+    printf("%s(%u, %u, %u):\n", args[0], nvals, nfilters, nbits);
+    printf("\tscalar:     %8.2f filter evaluations per clock\n", evals / clk_scalar);
+    printf("\tbitsliced:  %8.2f filter evaluations per clock (%.2f including conversion)\n",
+           evals / clk_bs, evals / (clk_bs + clk_conv));
+    printf("\tconversion: %8.2f clocks per 512 values\n", (float)clk_conv / nblk);
+
+    unmap_segment(&dseg);
+    return ret;
+}
+
+PERF_FUNC_ENTRY(bitslice_filter, "Range filters over small values, scalar vs bitsliced (GFNI "
+                "bit transposes + BS_IN_RANGE_K).", "nvals", "nfilters", "nbits");
+
+#endif
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <libgen.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#include "perf_jig.h"
+
+static __mmask16 below_u32(const u32_16 v, const void *ctx)
+{
+    return _mm512_cmplt_epu32_mask((__m512i)v, _mm512_set1_epi32(*(const u32 *)ctx));
+}
+
+static __mmask8 below_u64(const u64_8 v, const void *ctx)
+{
+    return _mm512_cmplt_epu64_mask((__m512i)v, _mm512_set1_epi64(*(const u64 *)ctx));
+}
+
+/*
+ * The loop a compiler makes of the obvious code: a compare and a branch around the store.
+ */
+static u64 __attribute__((noinline)) filter_u32_branchy(u32 * const RESTR dst,
+                                                        const u32 * const RESTR src, const u64 n,
+                                                        const u32 thresh)
+{
+    u64 i, out = 0;
+
+    for (i = 0; i < n; i++) {
+        if (src[i] < thresh) {
+            dst[out++] = src[i];
+        }
+    }
+
+    return out;
+}
+
+static u64 __attribute__((noinline)) filter_u64_branchy(u64 * const RESTR dst,
+                                                        const u64 * const RESTR src, const u64 n,
+                                                        const u64 thresh)
+{
+    u64 i, out = 0;
+
+    for (i = 0; i < n; i++) {
+        if (src[i] < thresh) {
+            dst[out++] = src[i];
+        }
+    }
+
+    return out;
+}
+
+static u64 __attribute__((noinline)) filter_u32_simd(u32 * const dst, const u32 * const src,
+                                                     const u64 n, const u32 thresh)
+{
+    return filter_u32(dst, src, n, below_u32, &thresh);
+}
+
+static u64 __attribute__((noinline)) filter_u64_simd(u64 * const dst, const u64 * const src,
+                                                     const u64 n, const u64 thresh)
+{
+    return filter_u64(dst, src, n, below_u64, &thresh);
+}
+
+/*
+ *    Keep the elements of a random array below a threshold picked for each of a set of
+ * selectivities, with the branchy scalar loop and with filter_u32/u64().  The branchy loop is at
+ * its best near 0% and 100% where the branch predicts and falls apart around 50%, the compress
+ * store costs about the same at every selectivity.  The array is sized to stay in L2 by default
+ * so this is the filter and not the memory being measured.
+ */
+static int perf_test_filter(const char **args)
+{
+    char errbuf[1024] = {};
+    const u64 nelem = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : (1 << 15);
+    const u32 esz   = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 4;
+    const u32 iters = ARG_VALID(args[3]) ? strtoul(args[3], NULL, 0) : 64;
+    const u32 pcts[] = { 0, 1, 10, 50, 90, 99, 100 };
+
+    if ((nelem == 0) | ((esz != 4) & (esz != 8)) | (iters == 0)) {
+        printf("%s: nelem and iters must be non-zero and esz 4 or 8.\n", args[0]);
+        return -1;
+    }
+
+    const u64 len = nelem * esz;
+    seg_desc_t dseg = {
+        .maplen = ((3 * len) + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &dseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    u8 * const src = (u8 *)dseg.ptr;
+    u8 * const dst_scalar = src + len;
+    u8 * const dst_simd = dst_scalar + len;
+    unsigned p, it;
+    int ret = 0;
+
+    randomize_data(src, len);
+
+    /* Fault the outputs in so the first selectivity isn't charged for it. */
+    memset(dst_scalar, 0, 2 * len);
+
+    printf("%s(%lu, %u, %u):\n", args[0], nelem, esz, iters);
+    printf("\t%5s %10s %10s %10s\n", "kept", "count", "branchy", "simd");
+
+    for (p = 0; p < sizeof(pcts) / sizeof(pcts[0]); p++) {
+        const u64 t64 = (pcts[p] == 100) ? ~0UL : ((~0UL / 100) * pcts[p]);
+        const u32 t32 = t64 >> 32;
+        u64 pre, clk_scalar, clk_simd, n_scalar = 0, n_simd = 0;
+
+        pre = TSC_PRECISE();
+        for (it = 0; it < iters; it++) {
+            n_scalar = (esz == 4) ?
+                filter_u32_branchy((u32 *)dst_scalar, (const u32 *)src, nelem, t32) :
+                filter_u64_branchy((u64 *)dst_scalar, (const u64 *)src, nelem, t64);
+        }
+        clk_scalar = TSC_PRECISE() - pre;
+
+        pre = TSC_PRECISE();
+        for (it = 0; it < iters; it++) {
+            n_simd = (esz == 4) ?
+                filter_u32_simd((u32 *)dst_simd, (const u32 *)src, nelem, t32) :
+                filter_u64_simd((u64 *)dst_simd, (const u64 *)src, nelem, t64);
+        }
+        clk_simd = TSC_PRECISE() - pre;
+
+        if ((n_scalar != n_simd) | !!memcmp(dst_scalar, dst_simd, n_scalar * esz)) {
+            printf("%s: %u%% filter kept %lu scalar and %lu simd, or they differ\n", args[0],
+                   pcts[p], n_scalar, n_simd);
+            ret = -1;
+        }
+
+        printf("\t%4u%% %10lu %10.2f %10.2f   clocks per element\n", pcts[p], n_simd,
+               (float)clk_scalar / ((float)nelem * iters), (float)clk_simd / ((float)nelem * iters));
+    }
+
+    unmap_segment(&dseg);
+    return ret;
+}
+
+PERF_FUNC_ENTRY(filter, "Stream compaction at a range of selectivities, branchy scalar loop vs "
+                "filter_u32/u64 (compress store).", "nelem", "esz", "iters");
@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <libgen.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#include "perf_jig.h"
+#include "pcap_reader.h"
+
+/*
+ *    One pass over the capture: digest every packet 16 at a time and, if ft isn't NULL, count it
+ * against its flow.  Returns the number of packets that parsed, or -1 if the capture is corrupt.
+ */
+static i64 flow_replay_pass(pcap_reader_t * const r, flow_table_t * const ft, u64 * const clk)
+{
+    pkt_metadata_t md[16] __attribute__((__aligned__(64)));
+    pcap_batch_t batch;
+    u32 flow[16];
+    i64 parsed = 0;
+    int n, i;
+
+    pcap_reader_rewind(r);
+
+    while ((n = pcap_reader_next(r, &batch, PCAP_BATCH_MAX)) > 0) {
+        const u64 pre = TSC_PRECISE();
+
+        for (i = 0; i < n; i += 16) {
+            const __mmask16 ok = pkt_digest_x16(batch.hdr + i, md, ((n - i) < 16) ? (n - i) : 16);
+
+            if (ft != NULL) {
+                flow_table_update_x16(ft, md, ok, flow);
+            }
+
+            parsed += _mm_popcnt_u32(ok);
+        }
+
+        *clk += TSC_PRECISE() - pre;
+    }
+
+    consume_data(md, sizeof(md));
+    return (n < 0) ? -1 : parsed;
+}
+
+/*
+ *    Replay a capture through pkt_digest_x16() alone, then through pkt_digest_x16() and
+ * flow_table_update_x16(), iters times each, and report Mpps (wall clock, including reading the
+ * capture) and clocks per packet (digesting and counting only) for both.  The table is emptied
+ * before each pass, and checked afterwards: its per-flow packet counts must add up to the
+ * packets that parsed, less any dropped for want of room.
+ */
+static int perf_test_flow_replay(const char **args)
+{
+    char errbuf[1024] = {};
+    const unsigned iters = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 3;
+    const u32 max_flows  = ARG_VALID(args[3]) ? strtoul(args[3], NULL, 0) : (1 << 20);
+    const u64 window_mb  = ARG_VALID(args[4]) ? strtoul(args[4], NULL, 0) : 64;
+
+    if (!ARG_VALID(args[1]) | (iters == 0) | (max_flows == 0)) {
+        printf("%s: file is required, and iters and max_flows must be non-zero.\n", args[0]);
+        return -1;
+    }
+
+    seg_desc_t tseg = {
+        .maplen = (FLOW_TABLE_MEM_SIZE(max_flows) + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &tseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    pcap_reader_t * const r = pcap_reader_open(args[1], window_mb << 20, 0, errbuf,
+                                               sizeof(errbuf) - 1);
+
+    if (r == NULL) {
+        printf("%s: %s\n", args[0], errbuf);
+        unmap_segment(&tseg);
+        return -1;
+    }
+
+    const pcap_reader_info_t * const info = pcap_reader_info(r);
+    const char * const names[2] = { "pkt_digest_x16()", "+ flow_table_update_x16()" };
+    flow_table_t *ft = NULL;
+    i64 parsed = 0;
+    u64 pkts = 0, sum = 0;
+    unsigned mode, it;
+    u32 f;
+    int ret = 0;
+
+    printf("%s(%s, %u, %lu MB window)\n", args[0], args[1], max_flows, window_mb);
+
+    for (mode = 0; (mode < 2) & (parsed >= 0); mode++) {
+        u64 clk = 0, ns = 0;
+
+        for (it = 0; (it < iters) & (parsed >= 0); it++) {
+            ft = mode ? flow_table_init(tseg.ptr, max_flows, 0x9747b28c) : NULL;
+
+            const u64 pre_ns = wall_clock_ns();
+
+            parsed = flow_replay_pass(r, ft, &clk);
+            ns += wall_clock_ns() - pre_ns;
+        }
+
+        pkts = info->pkts * iters;
+        printf("\t%-26s %8.2f Mpps %8.2f clocks per packet\n", names[mode],
+               (1000.0 * pkts) / ns, (double)clk / pkts);
+    }
+
+    if (parsed < 0) {
+        printf("%s: %s\n", args[0], pcap_reader_error(r));
+        ret = -1;
+    } else {
+        for (f = 0; f < ft->n_flows; f++) {
+            sum += flow_table_entries(ft)[f].pkts;
+        }
+
+        printf("\t%lu packets, %ld parsed, %u flows, %lu dropped\n", info->pkts, parsed,
+               ft->n_flows, ft->drops);
+
+        if (sum + ft->drops != (u64)parsed) {
+            printf("%s: flows hold %lu packets, expected %lu\n", args[0], sum,
+                   parsed - ft->drops);
+            ret = -1;
+        }
+    }
+
+    pcap_reader_close(r);
+    unmap_segment(&tseg);
+    return ret;
+}
+
+PERF_FUNC_ENTRY(flow_replay, "Replay a pcap / pcapng file through pkt_digest_x16() and the flow "
+                "table, in Mpps.", "file", "iters", "max_flows", "window_mb");
+
+/*
+ *    The way flow_table_update_x16() used to hash: 16 masked keys stored to the stack, then two
+ * murmur3_u32_8_notail() gathering them a dword at a time.
+ */
+static u32_16 flow_hash_x16_gather(const pkt_metadata_t * const RESTR md, const u32 seed)
+{
+    u32_16 keys[16] __attribute__((__aligned__(64)));
+    const mpv_8 lo = { .vec = (i64_8)((u64_8){} + (u64)keys + (IDX_VEC(u64_8) * sizeof(u32_16))) };
+    const mpv_8 hi = { .vec = lo.vec + (8 * sizeof(u32_16)) };
+    const u32_8 nblk = (u32_8){} + FLOW_KEY_DWORDS;
+    u32_16 h;
+    unsigned i;
+
+    for (i = 0; i < 16; i++) {
+        keys[i] = md[i].zmm & flow_key_mask.zmm;
+    }
+
+    *(u32_8 *)&h[0] = murmur3_u32_8_notail(&lo, nblk, (u32_8){} + seed);
+    *(u32_8 *)&h[8] = murmur3_u32_8_notail(&hi, nblk, (u32_8){} + seed);
+    return h;
+}
+
+/*
+ *    Hash nkeys random pkt_metadata_t flow keys 16 at a time, iters times over, by gathering
+ * through pointers (murmur3_u32_8_notail()) and by transposing in registers (flow_hash_x16()), and
+ * report clocks per key for each.  The two must agree.
+ */
+static int perf_test_flow_hash(const char **args)
+{
+    char errbuf[1024] = {};
+    const u64 nkeys      = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : (1 << 16);
+    const unsigned iters = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 16;
+    const char * const names[2] = { "murmur3_u32_8_notail() x 2", "flow_hash_x16()" };
+    u64 clk[2] = {}, i;
+    unsigned mode, it;
+    int ret = 0;
+
+    if ((nkeys == 0) | (nkeys & 15) | (iters == 0)) {
+        printf("%s: nkeys must be a non-zero multiple of 16 and iters non-zero.\n", args[0]);
+        return -1;
+    }
+
+    const u64 klen = nkeys * sizeof(pkt_metadata_t);
+    const u64 hlen = nkeys * sizeof(u32);
+    seg_desc_t dseg = {
+        .maplen = (klen + (2 * hlen) + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &dseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    const pkt_metadata_t * const RESTR md = (pkt_metadata_t *)dseg.ptr;
+    u32_16 * const RESTR res[2] = { (u32_16 *)((u8 *)dseg.ptr + klen),
+                                    (u32_16 *)((u8 *)dseg.ptr + klen + hlen) };
+
+    randomize_data(dseg.ptr, klen);
+
+    for (mode = 0; mode < 2; mode++) {
+        for (it = 0; it < iters; it++) {
+            const u64 pre = TSC_PRECISE();
+
+            if (mode) {
+                for (i = 0; i < nkeys; i += 16) {
+                    res[1][i / 16] = flow_hash_x16(&md[i], it);
+                }
+            } else {
+                for (i = 0; i < nkeys; i += 16) {
+                    res[0][i / 16] = flow_hash_x16_gather(&md[i], it);
+                }
+            }
+
+            clk[mode] += TSC_PRECISE() - pre;
+        }
+
+        consume_data(res[mode], hlen);
+    }
+
+    printf("%s: %lu keys x %u\n", args[0], nkeys, iters);
+
+    for (mode = 0; mode < 2; mode++) {
+        printf("\t%-26s %8.2f clocks per key\n", names[mode],
+               (double)clk[mode] / (nkeys * iters));
+    }
+
+    if (__builtin_memcmp(res[0], res[1], hlen)) {
+        printf("%s: flow_hash_x16() disagrees with murmur3_u32_8_notail()\n", args[0]);
+        ret = -1;
+    }
+
+    unmap_segment(&dseg);
+    return ret;
+}
+
+PERF_FUNC_ENTRY(flow_hash, "Hash pkt_metadata_t flow keys 16 at a time, gathering vs. in-register "
+                "transpose.", "nkeys", "iters");
+
+#define STEER_RING_SLOTS    (64)    // A pcap batch is at most 16 slots to any one queue
+
+/*
+ *    Read back everything steered so far, as the workers would, counting each queue's handles
+ * into got[].
+ */
+static void flow_steer_drain(flow_steer_t * const fs, u64 * const got)
+{
+    u32_16 slot;
+    u32 q;
+
+    for (q = 0; q < fs->nqueues; q++) {
+        while (spsc_ring_dequeue(fs->ring[q], &slot, 1)) {
+            got[q] += _mm_popcnt_u32(VEC_TO_MASK(slot != FLOW_NONE));
+        }
+    }
+}
+
+/*
+ *    One pass over the capture: digest every packet 16 at a time and, unless mode is 0, steer
+ * the ones that parsed by flow_hash_x16() (mode 1) or flow_hash_sym_x16() (mode 2).  Handles are
+ * packet numbers.  The rings are drained after each batch, outside the clocks.  Returns the
+ * number of packets that parsed, or -1 if the capture is corrupt.
+ */
+static i64 flow_steer_pass(pcap_reader_t * const r, flow_steer_t * const fs, const unsigned mode,
+                           u64 * const clk, u64 * const got)
+{
+    pkt_metadata_t md[16] __attribute__((__aligned__(64)));
+    pcap_batch_t batch;
+    u32 handle = 0;
+    i64 parsed = 0;
+    int n, i;
+
+    pcap_reader_rewind(r);
+
+    while ((n = pcap_reader_next(r, &batch, PCAP_BATCH_MAX)) > 0) {
+        const u64 pre = TSC_PRECISE();
+
+        for (i = 0; i < n; i += 16, handle += 16) {
+            const __mmask16 ok = pkt_digest_x16(batch.hdr + i, md, ((n - i) < 16) ? (n - i) : 16);
+
+            if (mode) {
+                const u32_16 h = (mode == 1) ? flow_hash_x16(md, 0x9747b28c) :
+                                               flow_hash_sym_x16(md, 0x9747b28c);
+
+                flow_steer_x16(fs, h, IDX_VEC(u32_16) + handle, ok);
+            }
+
+            parsed += _mm_popcnt_u32(ok);
+        }
+
+        *clk += TSC_PRECISE() - pre;
+
+        if (mode) {
+            flow_steer_drain(fs, got);
+        }
+    }
+
+    if (mode) {
+        flow_steer_flush(fs);
+        flow_steer_drain(fs, got);
+    }
+
+    consume_data(md, sizeof(md));
+    return (n < 0) ? -1 : parsed;
+}
+
+/*
+ *    Replay a capture through pkt_digest_x16() alone, then also steering each packet to one of
+ * nqueues rings by the plain and the symmetric flow hash, iters times each.  Reports Mpps (wall
+ * clock, including reading the capture) and clocks per packet (digesting and steering only), so
+ * the difference from the first line is the cost of hashing and steering, and for each hash how
+ * evenly the packets spread over the queues.  Every packet that parsed must come out of exactly
+ * one ring.
+ */
+static int perf_test_flow_steer(const char **args)
+{
+    char errbuf[1024] = {};
+    const unsigned iters = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 3;
+    const u32 nqueues    = ARG_VALID(args[3]) ? strtoul(args[3], NULL, 0) : 8;
+    const u32 reta_size  = ARG_VALID(args[4]) ? strtoul(args[4], NULL, 0) : 128;
+    const u64 window_mb  = ARG_VALID(args[5]) ? strtoul(args[5], NULL, 0) : 64;
+    spsc_ring_t *ring[FLOW_STEER_MAX_QUEUES];
+    flow_steer_t *fs;
+    u32 q;
+
+    if (!ARG_VALID(args[1]) | (iters == 0)) {
+        printf("%s: file is required, and iters must be non-zero.\n", args[0]);
+        return -1;
+    }
+
+    if ((nqueues == 0) | (nqueues > FLOW_STEER_MAX_QUEUES)) {
+        printf("%s: nqueues must be between 1 and %u.\n", args[0], FLOW_STEER_MAX_QUEUES);
+        return -1;
+    }
+
+    seg_desc_t rseg = {
+        .maplen = (sizeof(flow_steer_t) + (nqueues * SPSC_RING_MEM_SIZE(STEER_RING_SLOTS)) +
+                   HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &rseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    fs = (flow_steer_t *)rseg.ptr;
+
+    for (q = 0; q < nqueues; q++) {
+        ring[q] = spsc_ring_init((u8 *)(fs + 1) + (q * SPSC_RING_MEM_SIZE(STEER_RING_SLOTS)),
+                                 STEER_RING_SLOTS);
+    }
+
+    if (flow_steer_init(fs, ring, nqueues, reta_size)) {
+        printf("%s: reta_size must be a power of two no more than %u.\n", args[0],
+               FLOW_STEER_RETA_MAX);
+        unmap_segment(&rseg);
+        return -1;
+    }
+
+    pcap_reader_t * const r = pcap_reader_open(args[1], window_mb << 20, 0, errbuf,
+                                               sizeof(errbuf) - 1);
+
+    if (r == NULL) {
+        printf("%s: %s\n", args[0], errbuf);
+        unmap_segment(&rseg);
+        return -1;
+    }
+
+    const pcap_reader_info_t * const info = pcap_reader_info(r);
+    const char * const names[3] = { "pkt_digest_x16()", "+ flow_hash_x16() steer",
+                                    "+ flow_hash_sym_x16() steer" };
+    u64 got[3][FLOW_STEER_MAX_QUEUES] = {};
+    i64 parsed = 0;
+    unsigned mode, it;
+    int ret = 0;
+
+    printf("%s(%s, %u queues, %u entry reta, %lu MB window)\n", args[0], args[1], nqueues,
+           reta_size, window_mb);
+
+    for (mode = 0; (mode < 3) & (parsed >= 0); mode++) {
+        u64 clk = 0, ns = 0;
+
+        for (it = 0; (it < iters) & (parsed >= 0); it++) {
+            const u64 pre_ns = wall_clock_ns();
+
+            parsed = flow_steer_pass(r, fs, mode, &clk, got[mode]);
+            ns += wall_clock_ns() - pre_ns;
+        }
+
+        const u64 pkts = info->pkts * iters;
+
+        printf("\t%-28s %8.2f Mpps %8.2f clocks per packet\n", names[mode],
+               (1000.0 * pkts) / ns, (double)clk / pkts);
+    }
+
+    if (parsed < 0) {
+        printf("%s: %s\n", args[0], pcap_reader_error(r));
+        pcap_reader_close(r);
+        unmap_segment(&rseg);
+        return -1;
+    }
+
+    printf("\t%lu packets, %ld parsed, queue share of packets (%% of an even share):\n",
+           info->pkts, parsed);
+
+    for (mode = 1; mode < 3; mode++) {
+        u64 sum = 0, lo = ~0UL, hi = 0;
+
+        for (q = 0; q < nqueues; q++) {
+            sum += got[mode][q];
+            lo = (got[mode][q] < lo) ? got[mode][q] : lo;
+            hi = (got[mode][q] > hi) ? got[mode][q] : hi;
+        }
+
+        printf("\t%-28s min %6.1f%% max %6.1f%%  ", names[mode] + 2,
+               (100.0 * lo * nqueues) / sum, (100.0 * hi * nqueues) / sum);
+
+        for (q = 0; (q < nqueues) & (q < 16); q++) {
+            printf(" %5.1f", (100.0 * got[mode][q] * nqueues) / sum);
+        }
+
+        printf("%s\n", (nqueues > 16) ? " ..." : "");
+
+        if (sum != (u64)parsed * iters) {
+            printf("%s: rings held %lu handles, expected %lu\n", args[0], sum, parsed * iters);
+            ret = -1;
+        }
+    }
+
+    for (q = 0; q < nqueues; q++) {
+        if (fs->drops[q]) {
+            printf("%s: queue %u dropped %lu handles\n", args[0], q, fs->drops[q]);
+            ret = -1;
+        }
+    }
+
+    pcap_reader_close(r);
+    unmap_segment(&rseg);
+    return ret;
+}
+
+PERF_FUNC_ENTRY(flow_steer, "Replay a pcap / pcapng file through pkt_digest_x16() and flow "
+                "steering to per-core rings, reporting cost per packet and queue balance.",
+                "file", "iters", "nqueues", "reta_size", "window_mb");
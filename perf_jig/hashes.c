@@ -13,6 +13,7 @@
 #include "../include/simd_util.h"
 
 #include "perf_jig.h"
+#include "thread_pool.h"
 
 static int perf_test_clmul(const char **args)
 {
@@ -130,3 +131,85 @@ static int perf_test_murmur3_notail(const char **args)
 PERF_FUNC_ENTRY(clmul, "Perform carryless multiply on inputs a and b.", "a", "b");
 PERF_FUNC_ENTRY(murmur3_notail,
                 "Time 8-way parallel murmur3_32 hash on keys where ((len % 4) == 0).", "min_dw", "max_dw", "nkeys");
+
+typedef struct {
+    const u8 * RESTR        keys;
+    const u32_8 * RESTR     klen;
+    u32_8 * RESTR           res;
+    u32                     max_dw;
+} murmur3_job_t;
+
+static void murmur3_notail_range(void *ctx, const u64 start, const u64 end, const u32 worker)
+{
+    const murmur3_job_t * const RESTR job = (const murmur3_job_t *)ctx;
+    const u64 inc = (sizeof(u32) * job->max_dw * 8);
+    const i64_8 first_inc = IDX_VEC(i64_8) * sizeof(u32) * job->max_dw;
+    const u32_8 seed = IDX_VEC(u32_8) * 42;
+    mpv_8 ptrs = {};
+    u64 i;
+
+    ptrs.vec = first_inc + (u64)(job->keys + (start * inc));
+
+    for (i = start; i < end; i++) {
+        job->res[i] = murmur3_u32_8_notail(&ptrs, job->klen[i], seed);
+        ptrs.vec += inc;
+    }
+}
+
+static int perf_test_murmur3_notail_mt(const char **args)
+{
+    char err_buf[1024] = {};
+    const unsigned max_threads  = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) :
+                                  sysconf(_SC_NPROCESSORS_ONLN);
+    const u64 numa_mask         = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 0;
+    const unsigned min_dw       = ARG_VALID(args[3]) ? strtoul(args[3], NULL, 0) : 16;
+    const unsigned max_dw       = ARG_VALID(args[4]) ? strtoul(args[4], NULL, 0) : 16;
+    const unsigned nkeys        = ARG_VALID(args[5]) ? strtoul(args[5], NULL, 0) : (1 << 20);
+    const unsigned n            = nkeys / 8;
+    unsigned i;
+
+    if (!max_threads | (max_dw < min_dw) | (min_dw < 1) | (nkeys & 7) | !nkeys) {
+        printf("%s: requires max_threads > 0, 0 < min_dw <= max_dw and nkeys must be a non-zero "
+               "multiple of 8\n", args[0]);
+        return -1;
+    }
+
+    const u64 klen_len = (u64)n * sizeof(u32_8) * 2;
+    const u64 key_len = (u64)n * sizeof(u32_8) * max_dw;
+    seg_desc_t dseg = {
+        .maplen = (klen_len + key_len + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &dseg, err_buf, sizeof(err_buf) - 1)) {
+        printf("%s: %s\n", args[0], err_buf);
+        return -1;
+    }
+
+    randomize_data(dseg.ptr, klen_len + key_len);
+
+    murmur3_job_t job = {
+        .klen = (const u32_8 *)dseg.ptr,
+        .res = (u32_8 *)dseg.ptr + n,
+        .keys = (const u8 *)dseg.ptr + klen_len,
+        .max_dw = max_dw
+    };
+    u32_8 * const klen = (u32_8 *)job.klen;
+
+    for (i = 0; i < n; i++) {
+        klen[i] %= (max_dw - min_dw + 1);
+        klen[i] += min_dw;
+    }
+
+    printf("%s(%u, 0x%lx, %u, %u, %u):\n", args[0], max_threads, numa_mask, min_dw, max_dw, nkeys);
+    const int ret = pool_scaling_curve(args[0], max_threads, numa_mask, n, 256,
+                                       murmur3_notail_range, &job, "keys", 8.0);
+
+    consume_data(job.res, (u64)n * sizeof(u32_8));
+    unmap_segment(&dseg);
+    return ret;
+}
+
+PERF_FUNC_ENTRY(murmur3_notail_mt,
+                "Scaling curve for murmur3_u32_8_notail() across 1..max_threads pinned workers.",
+                "max_threads", "numa_mask", "min_dw", "max_dw", "nkeys");
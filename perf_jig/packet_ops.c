@@ -13,155 +13,101 @@
 #include "../include/simd_util.h"
 
 #include "perf_jig.h"
+#include "pcap_reader.h"
 
-typedef struct {
-    u32 magic;              // (0xa1b2c3d4 for usec res., 0xa1b23c4d for nsec res)
-    u16 v_major, v_minor;   // 2.4
-    i32 tz_adj;             // timezone adjust
-    u32 sigfigs;            // ignore
-    u32 snaplen;            // maximum packet bytes stored per packet
-    u32 network_encap;      // 1 = ethernet
-} pcap_file_hdr_t;
-
-typedef struct {
-    u32 ts_sec, ts_frac;    // Seconds and usec or nsec depending
-    u32 incl_len, orig_len; // Included length and original length
-    u8 pkt[0];              // packet...
-} pcap_pkt_hdr_t;
-
-typedef struct {
-    u8 dst[6];
-    u8 src[6];
-    u16 et;
-    u8 next[0];
-} eth_hdr_t;
-
-typedef struct {
-    u16 tag;
-    u16 et;
-    u8 next[0];
-} dot_q_t;
-
-typedef struct {
-    u8  ihl : 4,
-    ver : 4;
-    u8  ecn : 2,
-    dscp : 6;
-    u16 total_len;
-    u16 ident;
-    u16 flags_offs;
-    u8  ttl, proto;
-    u16 csum;
-    u32 src, dst;
-    u32 opts[0];
-} ip4_hdr_t;
+static u8 ip6_opt_hdr_flags[256] = {
+    [0] = 0x01, [43] = 0x01, [44] = 0x01, [50] = 0x01, [51] = 0x01, [60] = 0x01, [135] = 0x01, [139] = 0x01, [140] = 0x01, [253] = 0x01, [254] = 0x01,
+};
 
-typedef struct {
-    u16     hw_type;
-    u16     l3_type;
-    u8      hw_size;
-    u8      l3_size;
-    u16     opcode;
-    u8      sender_mac[6];
-    u32     sender_ip;
-    u8      target_map[6];
-    u32     target_ip;
-} PACKED arp_eth_ip4_t;
+/*
+ * Why gen_pkt_metadata() gave up on a packet (it returns the negative of one of these).
+ */
+enum {
+    PKT_PARSE_OK = 0,
+    PKT_PARSE_SHORT_ETH,        // Each SHORT_ is a header that runs past the end of the packet
+    PKT_PARSE_SHORT_VLAN,
+    PKT_PARSE_SHORT_IP4,
+    PKT_PARSE_BAD_IP4_VER,
+    PKT_PARSE_SHORT_IP4_OPTS,
+    PKT_PARSE_SHORT_IP6,
+    PKT_PARSE_BAD_IP6_VER,
+    PKT_PARSE_SHORT_ARP,
+    PKT_PARSE_BAD_ARP_TYPE,     // Not IPv4 over Ethernet
+    PKT_PARSE_SHORT_TCP,
+    PKT_PARSE_BAD_TCP_DOFF,     // Data offset shorter than the fixed header
+    PKT_PARSE_SHORT_TCP_OPTS,
+    PKT_PARSE_SHORT_UDP,
+    PKT_PARSE_NREASONS
+};
 
-typedef struct {
-    u32     tc_h : 4,
-            ver : 4,
-            tc_l : 4,
-            label : 20;
-    u16     paylen;
-    u8      nexthdr, hoplim;
-    u32     src[4];
-    u32     dst[4];
-    u8      next[0];
-} ip6_hdr_t;
+static const char * const pkt_parse_reason_names[PKT_PARSE_NREASONS] = {
+    "ok", "short eth", "short vlan", "short ip4", "bad ip4 ver", "short ip4 opts", "short ip6",
+    "bad ip6 ver", "short arp", "bad arp type", "short tcp", "bad tcp doff", "short tcp opts",
+    "short udp"
+};
 
-typedef struct {
-    u8      nexthdr, optlen;
-    u8      data[6];
-    u8      next[0];
-} ip6_generic_opt_t;
+/*
+ *    What gen_pkt_metadata() prints as it goes: nothing at 0, so that timing it times the parser
+ * and not stdio, a line per packet at 1 (see pcap_load), and every header found at 2.
+ */
+static unsigned pkt_trace_level;
 
-typedef struct {
-    u16 sport, dport, len, csum;
-    u8 next[0];
-} udp_hdr_t;
+#define PKT_TRACE(_lvl, _fmt, _args...)                                                         \
+({                                                                                              \
+    if (__builtin_expect(pkt_trace_level >= (_lvl), 0)) {                                       \
+        printf(_fmt, ##_args);                                                                  \
+    }                                                                                           \
+}) /* end of macro */
 
+/*
+ *    Per-run parse statistics.  Protocol counts are over every packet, from whatever the parser
+ * had recognised by the time it finished or gave up, so a TCP packet with a truncated header
+ * still counts as IPv4.
+ */
 typedef struct {
-    u16 sport, dport;
-    u32 seq, ack;
-    u16 doff_flags, wsize;
-    u16 csum, urg;
-    u8 next[0];
-} tcp_hdr_t;
-
-#define CONST_HTONS(x) (((x >> 8) & 0xFF) | ((x << 8) & 0xFF00))
-
-#define HW_ETHERNET (0x0001)
-
-#define ET_CVLAN    (0x8100)
-#define ET_SVLAN    (0x88A8)
-#define ET_IP4      (0x0800)
-#define ET_ARP      (0x0806)
-#define ET_IP6      (0x86DD)
-
-#define L4T_ICMP    (0x01)
-#define L4T_TCP     (0x06)
-#define L4T_UDP     (0x11)
-#define L4T_SCTP    (0x84)
+    u64 pkts;
+    u64 ctag, stag;             // Packets with at least one tag of each kind
+    u64 l3[4];                  // None / other, IPv4, IPv6, ARP (MD_PROTO_L3_* >> 8)
+    u64 l4[5];                  // None / other, TCP, UDP, SCTP, ICMP (MD_PROTO_L4_* >> 16)
+    u64 result[PKT_PARSE_NREASONS];
+    u64 clk;                    // TSC clocks and wall-clock ns over all timed passes
+    u64 ns;
+    u64 timed_pkts;
+} pkt_parse_stats_t;
+
+static void pkt_parse_stats_add(pkt_parse_stats_t * const st, const pkt_metadata_t * const md,
+                                const int ret)
+{
+    st->pkts++;
+    st->ctag += !!(md->proto_flags & MD_PROTO_L2_CTAG);
+    st->stag += !!(md->proto_flags & MD_PROTO_L2_STAG);
+    st->l3[(md->proto_flags >> 8) & 3]++;
+    st->l4[((md->proto_flags >> 16) & 0xFF) % 5]++;
+    st->result[-ret]++;
+}
 
-static u8 ip6_opt_hdr_flags[256] = {
-    [0] = 0x01, [43] = 0x01, [44] = 0x01, [50] = 0x01, [51] = 0x01, [60] = 0x01, [135] = 0x01, [139] = 0x01, [140] = 0x01, [253] = 0x01, [254] = 0x01,
-};
+static void pkt_parse_stats_print(const char * const name, const pkt_parse_stats_t * const st)
+{
+    unsigned i;
+
+    printf("%s: %lu packets, %lu parsed\n", name, st->pkts, st->result[PKT_PARSE_OK]);
+    printf("\tL2: %lu C-tagged, %lu S-tagged\n", st->ctag, st->stag);
+    printf("\tL3: %lu IPv4, %lu IPv6, %lu ARP, %lu other\n", st->l3[1], st->l3[2], st->l3[3],
+           st->l3[0]);
+    printf("\tL4: %lu TCP, %lu UDP, %lu SCTP, %lu ICMP, %lu other\n", st->l4[1], st->l4[2],
+           st->l4[3], st->l4[4], st->l4[0]);
+
+    for (i = 1; i < PKT_PARSE_NREASONS; i++) {
+        if (st->result[i]) {
+            printf("\tfailed, %s: %lu\n", pkt_parse_reason_names[i], st->result[i]);
+        }
+    }
 
-typedef union {
-    u32_4   u32_4;
-    u16_8   u16_8;
-    u32     u32[4];
-    u16     u16[8];
-} l3_addr_t;
-
-#define MD_PROTO_L2_CTAG    (1 << 0)
-#define MD_PROTO_L2_STAG    (1 << 1)
-
-#define MD_PROTO_L3_IP4     (1 << 8)
-#define MD_PROTO_L3_IP6     (2 << 8)
-#define MD_PROTO_L3_ARP     (3 << 8)
-
-#define MD_PROTO_L4_TCP     (1 << 16)
-#define MD_PROTO_L4_UDP     (2 << 16)
-#define MD_PROTO_L4_SCTP    (3 << 16)
-#define MD_PROTO_L4_ICMP    (4 << 16)
-
-typedef union {
-    u32_16  zmm;
-    struct {
-        // Flow Key Fields
-        l3_addr_t               src_ip;
-        l3_addr_t               dst_ip;
-        u16                     src_port, dst_port;
-        u16                     c_tag, s_tag;
-        u32                     proto_flags;
-        // Other Metadata fields
-        const pcap_pkt_hdr_t   *pph;
-        u16                     offs_vlan;
-        u16                     offs_l3;
-        u16                     offs_l4;
-        u16                     offs_payload;
-    };
-} pkt_metadata_t;
-
-static const pkt_metadata_t flow_key_mask = {
-    .src_ip.u32 = {~0U, ~0U, ~0U, ~0U },
-    .dst_ip.u32 = {~0U, ~0U, ~0U, ~0U },
-    .src_port = ~((u16)0), .dst_port = ~((u16)0),
-    .c_tag = ~((u16)0), .s_tag = ~((u16)0),
-    .proto_flags = ~0U,
-};
+    if (st->timed_pkts) {
+        printf("\t%.2f clocks per packet, %.2f Mpps\n", (double)st->clk / st->timed_pkts,
+               (1000.0 * st->timed_pkts) / st->ns);
+    }
+}
 
 /*
  * XXX: TLDR: Work-in-progress / half-baked idea...
@@ -170,7 +116,8 @@ static const pkt_metadata_t flow_key_mask = {
  * Eventually, if cleaned up and made more complete and robust, it could be used as a
  * reference (single lane / non parallel) implementation against which to test a SIMD
  * parallel packet digestor function for use as part of a SIMD parallel packet processing
- * state machine.
+ * state machine.  (pkt_digest_x16() in include/pkt_util.h is one, and the pkt_digest test below
+ * checks that the two agree on every packet of a capture.)
  *    Any such implementation intended for real-world use would generally differ in a couple
  * of important ways however (the specifics of which would depend entirely on the use case
  * itself).  The general gist of these difference would be:
@@ -205,6 +152,8 @@ static const pkt_metadata_t flow_key_mask = {
  * each packet.  It is also important to ensure that the expected behavior for any arbitrary packet
  * (including malformed or malicious packets) is well defined and can be reasoned about.  (Even if
  * it just means shunting them to an exception queue for slow-path processing).
+ *
+ *    Returns 0, or the negative of the PKT_PARSE_ reason it gave up.
  */
 int gen_pkt_metadata(const pcap_pkt_hdr_t * const RESTR pph, pkt_metadata_t * const RESTR md)
 {
@@ -224,7 +173,7 @@ int gen_pkt_metadata(const pcap_pkt_hdr_t * const RESTR pph, pkt_metadata_t * co
     }
 
     if (out_of_bounds(sizeof(eth_hdr_t))) {
-        return -1;
+        return -PKT_PARSE_SHORT_ETH;
     }
 
     const eth_hdr_t *eh = (eth_hdr_t *)pkt;
@@ -234,7 +183,7 @@ int gen_pkt_metadata(const pcap_pkt_hdr_t * const RESTR pph, pkt_metadata_t * co
 
     while ((*et == CONST_HTONS(ET_CVLAN)) | (*et == CONST_HTONS(ET_SVLAN))) {
         if (out_of_bounds(sizeof(dot_q_t))) {
-            return -1;
+            return -PKT_PARSE_SHORT_VLAN;
         }
 
         const dot_q_t *q = (dot_q_t *)next;
@@ -248,7 +197,7 @@ int gen_pkt_metadata(const pcap_pkt_hdr_t * const RESTR pph, pkt_metadata_t * co
         }
 
         md->offs_vlan = next - pkt;
-        printf("\tvlan at offset 0x%x\n", md->offs_vlan);
+        PKT_TRACE(2, "\tvlan at offset 0x%x\n", md->offs_vlan);
         et = &q->et;
         next = q->next;
     }
@@ -260,25 +209,25 @@ int gen_pkt_metadata(const pcap_pkt_hdr_t * const RESTR pph, pkt_metadata_t * co
         case CONST_HTONS(ET_IP4):
             {
                 if (out_of_bounds(sizeof(ip4_hdr_t))) {
-                    return -1;
+                    return -PKT_PARSE_SHORT_IP4;
                 }
 
                 const ip4_hdr_t * const ip4 = (const ip4_hdr_t *)next;
 
                 if (ip4->ver != 4) {
-                    return -1;
+                    return -PKT_PARSE_BAD_IP4_VER;
                 }
 
                 md->offs_l3 = next - pkt;
                 md->proto_flags |= MD_PROTO_L3_IP4;
                 md->src_ip.u32[0] = ip4->src;
                 md->dst_ip.u32[0] = ip4->dst;
-                printf("\tL3 at offset 0x%x -- IPv4\n", md->offs_l3);
+                PKT_TRACE(2, "\tL3 at offset 0x%x -- IPv4\n", md->offs_l3);
 
                 const unsigned optlen = ip4->ihl * sizeof(u32);
 
                 if (out_of_bounds(optlen)) {
-                    return -1;
+                    return -PKT_PARSE_SHORT_IP4_OPTS;
                 }
 
                 next += optlen;
@@ -289,26 +238,26 @@ int gen_pkt_metadata(const pcap_pkt_hdr_t * const RESTR pph, pkt_metadata_t * co
         case CONST_HTONS(ET_IP6):
             {
                 if (out_of_bounds(sizeof(ip6_hdr_t))) {
-                    return -1;
+                    return -PKT_PARSE_SHORT_IP6;
                 }
 
                 const ip6_hdr_t * const ip6 = (const ip6_hdr_t *)next;
 
                 if (ip6->ver != 6) {
-                    return -1;
+                    return -PKT_PARSE_BAD_IP6_VER;
                 }
 
                 unsigned i;
                 md->offs_l3 = next - pkt;
-                md->proto_flags |= MD_PROTO_L3_IP4;
+                md->proto_flags |= MD_PROTO_L3_IP6;
 
                 for (i = 0; i < 4; i++) {
                     md->src_ip.u32[i] = ip6->src[i];
                     md->dst_ip.u32[i] = ip6->dst[i];
                 }
 
-                printf("\tL3 at offset 0x%x -- IPv4\n", md->offs_l3);
-                printf("\tlabel = 0x%05x\n", ip6->label); // XXX: Broken bit field / endianness
+                PKT_TRACE(2, "\tL3 at offset 0x%x -- IPv6\n", md->offs_l3);
+                PKT_TRACE(2, "\tlabel = 0x%05x\n", ip6->label); // XXX: Broken bit field / endianness
                 l4_type = ip6->nexthdr;
                 next = ip6->next;
 
@@ -324,19 +273,19 @@ int gen_pkt_metadata(const pcap_pkt_hdr_t * const RESTR pph, pkt_metadata_t * co
         case CONST_HTONS(ET_ARP):
             {
                 if (out_of_bounds(sizeof(arp_eth_ip4_t))) {
-                    return -1;
+                    return -PKT_PARSE_SHORT_ARP;
                 }
 
                 const arp_eth_ip4_t * const arp = (const arp_eth_ip4_t *)next;
                 md->offs_l3 = next - pkt;
 
                 if ((arp->l3_type != CONST_HTONS(ET_IP4)) | (arp->hw_type != CONST_HTONS(HW_ETHERNET))) {
-                    return -1;
+                    return -PKT_PARSE_BAD_ARP_TYPE;
                 }
 
                 md->proto_flags |= MD_PROTO_L3_ARP;
                 next += sizeof(arp_eth_ip4_t);
-                printf("\tL3 at offset 0x%x -- ARP\n", md->offs_l3);
+                PKT_TRACE(2, "\tL3 at offset 0x%x -- ARP\n", md->offs_l3);
                 break;
             }
 
@@ -348,24 +297,29 @@ int gen_pkt_metadata(const pcap_pkt_hdr_t * const RESTR pph, pkt_metadata_t * co
         case L4T_TCP:
             {
                 if (out_of_bounds(sizeof(tcp_hdr_t))) {
-                    return -1;
+                    return -PKT_PARSE_SHORT_TCP;
                 }
 
                 md->offs_l4 = next - pkt;
-                printf("\tL4 at offset %x -- TCP\n", md->offs_l4);
+                PKT_TRACE(2, "\tL4 at offset %x -- TCP\n", md->offs_l4);
                 const tcp_hdr_t * const tcp = (const tcp_hdr_t *)next;
 
                 md->proto_flags |= MD_PROTO_L4_TCP;
                 md->src_port = tcp->sport;
                 md->dst_port = tcp->dport;
 
-                printf("\tL3 at offset 0x%x -- IPv4\n", md->offs_l3);
-                const unsigned opt_len = ((tcp->doff_flags & 0x00F0) >> 2) - sizeof(tcp_hdr_t);
+                const unsigned hdr_len = (tcp->doff_flags & 0x00F0) >> 2;
+
+                if (hdr_len < sizeof(tcp_hdr_t)) {
+                    return -PKT_PARSE_BAD_TCP_DOFF;
+                }
 
-                if (out_of_bounds(opt_len)) {
-                    return -1;
+                if (out_of_bounds(hdr_len)) {
+                    return -PKT_PARSE_SHORT_TCP_OPTS;
                 }
 
+                const unsigned opt_len = hdr_len - sizeof(tcp_hdr_t);
+
                 next = tcp->next + opt_len;
 
                 md->offs_payload = next - pkt;
@@ -375,11 +329,11 @@ int gen_pkt_metadata(const pcap_pkt_hdr_t * const RESTR pph, pkt_metadata_t * co
         case L4T_UDP:
             {
                 if (out_of_bounds(sizeof(udp_hdr_t))) {
-                    return -1;
+                    return -PKT_PARSE_SHORT_UDP;
                 }
 
                 md->offs_l4 = next - pkt;
-                printf("\tL4 at offset %x -- UDP\n", md->offs_l4);
+                PKT_TRACE(2, "\tL4 at offset %x -- UDP\n", md->offs_l4);
                 const udp_hdr_t * const udp = (const udp_hdr_t *)next;
 
                 md->proto_flags |= MD_PROTO_L4_UDP;
@@ -395,7 +349,8 @@ int gen_pkt_metadata(const pcap_pkt_hdr_t * const RESTR pph, pkt_metadata_t * co
         case L4T_ICMP:
             {
                 md->offs_l4 = next - pkt;
-                printf("\tL4 at offset %x -- ICMP\n", md->offs_l4);
+                md->proto_flags |= MD_PROTO_L4_ICMP;
+                PKT_TRACE(2, "\tL4 at offset %x -- ICMP\n", md->offs_l4);
                 break;
             }
 
@@ -403,115 +358,441 @@ int gen_pkt_metadata(const pcap_pkt_hdr_t * const RESTR pph, pkt_metadata_t * co
             break;
     }
 
-    printf("\tproto_flags = 0x%08x\n", md->proto_flags);
+    PKT_TRACE(2, "\tproto_flags = 0x%08x\n", md->proto_flags);
     return 0;
 }
 
 /*
- * Given a pointer to and length of a raw pcap file loaded into memory, this function will
- * (if hdrs != NULL and nhdrs > 0) populate an array of pointers to the pcap packet headers
- * in the file (until it runs out of space in hdrs).
- * Whether or not hdrs and nhdrs are supplied, the function returns the number of packets in
- * the pcap file or -1 if it cannot understand the file.
+ * Why pkt_csum_check() rejected a packet (it returns the negative of one of these).
  */
-int get_pcap_pkt_hdrs(const u8 * const data, const size_t len, const pcap_pkt_hdr_t **hdrs,
-                      const unsigned nhdrs)
+enum {
+    PKT_CSUM_OK = 0,
+    PKT_CSUM_BAD_IP4,           // IPv4 header checksum, or a header under 5 dwords
+    PKT_CSUM_SHORT_L4,          // TCP / UDP segment not all captured, or an impossible length
+    PKT_CSUM_BAD_L4,            // TCP / UDP checksum
+    PKT_CSUM_NREASONS
+};
+
+static const char * const pkt_csum_reason_names[PKT_CSUM_NREASONS] = {
+    "ok", "bad ip4", "short l4", "bad l4"
+};
+
+/* RFC 1071, a network order word at a time. */
+static u32 csum_add(u32 sum, const void * const data, unsigned len)
 {
-    if ((data == NULL) || (len < (sizeof(pcap_file_hdr_t) + sizeof(pcap_pkt_hdr_t)))) {
-        return -1;
+    const u8 *p = data;
+
+    for (; len > 1; len -= 2, p += 2) {
+        sum += (p[0] << 8) | p[1];
+    }
+
+    if (len) {
+        sum += p[0] << 8;
     }
 
-    const u8 * trav = data;
-    i64 left = len;
+    return sum;
+}
+
+static u16 csum_fold(u32 sum)
+{
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (sum & 0xFFFF) + (sum >> 16);
+}
+
+/*
+ *    Scalar reference for pkt_csum_ok_x16(): validate the checksums of a packet gen_pkt_metadata()
+ * parsed (filling in md).  Returns 0, or the negative of the PKT_CSUM_ reason it failed.
+ */
+int pkt_csum_check(const pkt_metadata_t * const RESTR md)
+{
+    const pcap_pkt_hdr_t * const pph = md->pph;
+    const u8 * const pkt = pph->pkt;
+    const unsigned upper_bound = (pph->incl_len < pph->orig_len) ? pph->incl_len : pph->orig_len;
+    const u32 l3 = md->proto_flags & (3 << 8);
+    const u32 l4 = md->proto_flags & (0xFF << 16);
+    int l4_len;
+    u32 sum;
+
+    if (l3 == MD_PROTO_L3_IP4) {
+        const ip4_hdr_t * const ip4 = (const ip4_hdr_t *)(pkt + md->offs_l3);
+
+        if ((ip4->ihl < 5) || (csum_fold(csum_add(0, ip4, ip4->ihl * sizeof(u32))) != 0xFFFF)) {
+            return -PKT_CSUM_BAD_IP4;
+        }
+
+        /* A fragment's segment checksum covers the whole datagram: nothing more to check. */
+        if (ntohs(ip4->flags_offs) & 0x3FFF) {
+            return 0;
+        }
 
-    const pcap_file_hdr_t * const fhdr = (pcap_file_hdr_t *)data;
+        l4_len = ntohs(ip4->total_len) - (ip4->ihl * sizeof(u32));
+        sum = csum_add(0, &ip4->src, 2 * sizeof(u32));
+    } else if (l3 == MD_PROTO_L3_IP6) {
+        const ip6_hdr_t * const ip6 = (const ip6_hdr_t *)(pkt + md->offs_l3);
+
+        l4_len = ntohs(ip6->paylen) - (md->offs_l4 - md->offs_l3 - sizeof(ip6_hdr_t));
+        sum = csum_add(0, ip6->src, sizeof(ip6->src) + sizeof(ip6->dst));
+    } else {
+        return 0;
+    }
+
+    if ((l4 != MD_PROTO_L4_TCP) && (l4 != MD_PROTO_L4_UDP)) {
+        return 0;
+    }
+
+    const int min_len = (l4 == MD_PROTO_L4_TCP) ? sizeof(tcp_hdr_t) : sizeof(udp_hdr_t);
+
+    if ((l4_len < min_len) || ((md->offs_l4 + l4_len) > upper_bound)) {
+        return -PKT_CSUM_SHORT_L4;
+    }
+
+    if ((l4 == MD_PROTO_L4_UDP) && (l3 == MD_PROTO_L3_IP4) &&
+            (((const udp_hdr_t *)(pkt + md->offs_l4))->csum == 0)) {
+        return 0;
+    }
+
+    sum += ((l4 == MD_PROTO_L4_TCP) ? L4T_TCP : L4T_UDP) + l4_len;
+    sum = csum_add(sum, pkt + md->offs_l4, l4_len);
+    return (csum_fold(sum) == 0xFFFF) ? 0 : -PKT_CSUM_BAD_L4;
+}
+
+/*
+ *    Count the packets of a capture opened with a window of 0 (so that nothing it hands out is
+ * ever unmapped), storing pointers to them all in hdrs if it isn't NULL.  Returns -1 if the
+ * capture is corrupt.
+ */
+static i64 pcap_collect(pcap_reader_t * const r, const pcap_pkt_hdr_t ** const hdrs)
+{
+    pcap_batch_t batch;
+    i64 count = 0;
+    int n;
+
+    pcap_reader_rewind(r);
+
+    while ((n = pcap_reader_next(r, &batch, PCAP_BATCH_MAX)) > 0) {
+        if (hdrs != NULL) {
+            memcpy(hdrs + count, batch.hdr, n * sizeof(batch.hdr[0]));
+        }
+
+        count += n;
+    }
+
+    return (n < 0) ? -1 : count;
+}
 
-    if ((fhdr->magic != 0xa1b2c3d4) & (fhdr->magic != 0xa1b23c4d)) {
+/*
+ *    Stream a capture (pcap or pcapng, any size) through gen_pkt_metadata() window_mb at a time:
+ * once, untimed, to gather the parse statistics (printing as much as the trace level asks for),
+ * then iters timed passes with tracing off.  Reported in clocks per packet and packets per
+ * second for the parser alone, and for the whole replay including reading the file.
+ */
+static int perf_test_pcap_load(const char **args)
+{
+    char errbuf[1024] = {};
+    const unsigned iters = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 1;
+    const unsigned trace = ARG_VALID(args[3]) ? strtoul(args[3], NULL, 0) : 0;
+    const u64 window_mb  = ARG_VALID(args[4]) ? strtoul(args[4], NULL, 0) : 64;
+    const u32 flags      = ARG_VALID(args[5]) ? strtoul(args[5], NULL, 0) : 0;
+
+    if (!ARG_VALID(args[1]) | (iters == 0)) {
+        printf("%s: file is required and iters must be non-zero.\n", args[0]);
         return -1;
     }
 
-    const unsigned max_frac = (fhdr->magic != 0xa1b23c4d) ? 999999999 : 999999;
+    pcap_reader_t * const r = pcap_reader_open(args[1], window_mb << 20, flags, errbuf,
+                                               sizeof(errbuf) - 1);
 
-    if ((fhdr->v_major != 2) | (fhdr->network_encap != 1)) {
+    if (r == NULL) {
+        printf("%s: %s\n", args[0], errbuf);
         return -1;
     }
 
-    trav += sizeof(*fhdr);
-    left -= sizeof(*fhdr);
+    const pcap_reader_info_t * const info = pcap_reader_info(r);
+    pkt_parse_stats_t st = {};
+    pkt_metadata_t md[16];
+    pcap_batch_t batch;
+    u64 pre, pre_ns, pre_all, clk_all = 0;
+    unsigned it;
+    int n, i, ret = 0;
+
+    pkt_trace_level = trace;
+
+    while ((n = pcap_reader_next(r, &batch, PCAP_BATCH_MAX)) > 0) {
+        for (i = 0; i < n; i++) {
+            PKT_TRACE(1, "%lu: %lu.%09lu %p/%u/%u\n", st.pkts + 1, batch.ts_ns[i] / 1000000000,
+                      batch.ts_ns[i] % 1000000000, batch.hdr[i]->pkt, batch.incl_len[i],
+                      batch.orig_len[i]);
+            pkt_parse_stats_add(&st, &md[0], gen_pkt_metadata(batch.hdr[i], &md[0]));
+        }
+    }
 
-    const u32 snap = fhdr->snaplen;
-    int count = 0;
+    pkt_trace_level = 0;
 
-    while(left >= sizeof(pcap_pkt_hdr_t)) {
-        const pcap_pkt_hdr_t * const hdr = (pcap_pkt_hdr_t *)trav;
+    pre_ns = wall_clock_ns();
+    pre_all = TSC_PRECISE();
+    for (it = 0; (it < iters) & (n == 0); it++) {
+        pcap_reader_rewind(r);
 
-        if ((hdrs != NULL) & (count < nhdrs)) {
-            hdrs[count] = hdr;
+        while ((n = pcap_reader_next(r, &batch, PCAP_BATCH_MAX)) > 0) {
+            pre = TSC_PRECISE();
+            for (i = 0; i < n; i++) {
+                gen_pkt_metadata(batch.hdr[i], &md[i & 15]);
+            }
+            st.clk += TSC_PRECISE() - pre;
+            st.timed_pkts += n;
         }
+    }
+    clk_all = TSC_PRECISE() - pre_all;
+    st.ns = wall_clock_ns() - pre_ns;
+    consume_data(md, sizeof(md));
 
-        if ((hdr->incl_len == 0) & (hdr->orig_len == 0)) {
-            break;
-        }
+    if (n < 0) {
+        printf("%s: %s\n", args[0], pcap_reader_error(r));
+        ret = -1;
+    }
 
-        trav += sizeof(pcap_pkt_hdr_t);
-        left -= sizeof(pcap_pkt_hdr_t);
+    printf("%s: %s, %lu MB window%s, %lu remaps, %lu skipped%s\n", args[0],
+           (info->fmt == PCAP_FMT_PCAP) ? "pcap" : "pcapng", window_mb,
+           (flags & PCAP_READER_POPULATE) ? " (populated)" : "", info->remaps, info->skipped,
+           info->truncated ? ", truncated" : "");
 
-        if (((snap != 0) & (hdr->incl_len > snap)) |
-                (hdr->incl_len > left) | (hdr->ts_frac > max_frac)) {
-            break;
+    /* st.ns covers the whole replay, so this Mpps is the replay rate, clocks are the parser's. */
+    pkt_parse_stats_print(args[0], &st);
+
+    if (st.timed_pkts) {
+        printf("\t%.2f clocks per packet including reading the capture\n",
+               (double)clk_all / st.timed_pkts);
+    }
+
+    pcap_reader_close(r);
+    return ret;
+}
+
+PERF_FUNC_ENTRY(pcap_load, "Stream a pcap / pcapng file through gen_pkt_metadata(), with parse "
+                "statistics.", "file", "iters", "trace", "window_mb", "flags");
+
+/*
+ *    Differential check of pkt_digest_x16() against gen_pkt_metadata() over every packet of a
+ * pcap file: the metadata and whether each packet parsed must be identical.  Then times each
+ * over the whole capture, iters times, in clocks per packet.
+ */
+static int perf_test_pkt_digest(const char **args)
+{
+    char errbuf[1024] = {};
+    const unsigned iters = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 10;
+
+    if (!ARG_VALID(args[1]) | (iters == 0)) {
+        printf("%s: file is required and iters must be non-zero.\n", args[0]);
+        return -1;
+    }
+
+    pcap_reader_t * const r = pcap_reader_open(args[1], 0, 0, errbuf, sizeof(errbuf) - 1);
+
+    if (r == NULL) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    const i64 npkts = pcap_collect(r, NULL);
+
+    if (npkts <= 0) {
+        printf("%s: no packets in %s %s\n", args[0], args[1], pcap_reader_error(r));
+        pcap_reader_close(r);
+        return -1;
+    }
+
+    const u64 nbatch = (npkts + 15) / 16;
+    seg_desc_t wseg = {
+        .maplen = ((nbatch * 16 * (sizeof(void *) + 2 * sizeof(pkt_metadata_t))) + HUGE_2M_MASK) &
+                  ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &wseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        pcap_reader_close(r);
+        return -1;
+    }
+
+    pkt_metadata_t * const md_scalar = (pkt_metadata_t *)wseg.ptr;
+    pkt_metadata_t * const md_simd = md_scalar + (nbatch * 16);
+    const pcap_pkt_hdr_t ** const hdrs = (const pcap_pkt_hdr_t **)(md_simd + (nbatch * 16));
+    u64 i, b, mismatches = 0, parsed = 0, pre, clk, clk_scalar;
+    unsigned it;
+
+    memset(wseg.ptr, 0, wseg.maplen);
+    pcap_collect(r, hdrs);
+
+    for (b = 0; b < nbatch; b++) {
+        const unsigned n = ((npkts - (b * 16)) < 16) ? (npkts - (b * 16)) : 16;
+        const __mmask16 ok = pkt_digest_x16(hdrs + (b * 16), md_simd + (b * 16), n);
+
+        for (i = 0; i < n; i++) {
+            const u64 p = (b * 16) + i;
+            const int ok_scalar = (gen_pkt_metadata(hdrs[p], &md_scalar[p]) == 0);
+
+            parsed += ok_scalar;
+
+            if ((ok_scalar != ((ok >> i) & 1)) |
+                    (memcmp(&md_scalar[p], &md_simd[p], sizeof(pkt_metadata_t)) != 0)) {
+                if (mismatches++ == 0) {
+                    printf("%s: packet %lu differs (scalar %s, simd %s):\n", args[0], p + 1,
+                           ok_scalar ? "ok" : "failed", ((ok >> i) & 1) ? "ok" : "failed");
+                    debug_print_vec(md_scalar[p].zmm, ~0);
+                    debug_print_vec(md_simd[p].zmm, ~0);
+                }
+            }
         }
+    }
 
-        count++;
-        trav += hdr->incl_len;
-        left -= hdr->incl_len;
+    pre = TSC_PRECISE();
+    for (it = 0; it < iters; it++) {
+        for (i = 0; i < (u64)npkts; i++) {
+            gen_pkt_metadata(hdrs[i], &md_scalar[i]);
+        }
+    }
+    clk_scalar = TSC_PRECISE() - pre;
+
+    pre = TSC_PRECISE();
+    for (it = 0; it < iters; it++) {
+        for (b = 0; b < nbatch; b++) {
+            const unsigned n = ((npkts - (b * 16)) < 16) ? (npkts - (b * 16)) : 16;
+            pkt_digest_x16(hdrs + (b * 16), md_simd + (b * 16), n);
+        }
     }
+    clk = TSC_PRECISE() - pre;
 
-    return count;
+    printf("%s: %ld packets (%lu parsed), %lu mismatches\n", args[0], npkts, parsed, mismatches);
+    printf("\tgen_pkt_metadata(): %8.2f clocks per packet\n",
+           (float)clk_scalar / ((u64)npkts * iters));
+    printf("\tpkt_digest_x16():   %8.2f clocks per packet\n", (float)clk / ((u64)npkts * iters));
+
+    unmap_segment(&wseg);
+    pcap_reader_close(r);
+    return mismatches ? -1 : 0;
 }
 
-static int perf_test_pcap_load(const char **args)
+PERF_FUNC_ENTRY(pkt_digest, "Check pkt_digest_x16() against gen_pkt_metadata() on a pcap file, "
+                "and time it.", "file", "iters");
+
+/*
+ *    Differential check of pkt_csum_ok_x16() against pkt_csum_check() over every packet of a
+ * pcap file that parses: they must agree on which have good checksums.  Then times each over
+ * the parsed packets, iters times, in clocks per packet.
+ */
+static int perf_test_pkt_csum(const char **args)
 {
     char errbuf[1024] = {};
-    seg_desc_t pcap_seg = {};
-    seg_desc_t wlist_seg = {.maplen = HUGE_2M_SIZE, .psize = HUGE_2M_SIZE, .flags = SEG_DESC_INITD | SEG_DESC_ANON};
+    const unsigned iters = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 10;
 
-    if (args[1] == NULL) {
-        printf("%s: file is required.\n", args[0]);
+    if (!ARG_VALID(args[1]) | (iters == 0)) {
+        printf("%s: file is required and iters must be non-zero.\n", args[0]);
         return -1;
     }
 
-    if (map_segment(args[1], &pcap_seg, errbuf, sizeof(errbuf) - 1)) {
+    pcap_reader_t * const r = pcap_reader_open(args[1], 0, 0, errbuf, sizeof(errbuf) - 1);
+
+    if (r == NULL) {
         printf("%s: %s\n", args[0], errbuf);
         return -1;
     }
 
-    printf("%s\n", errbuf);
+    const i64 npkts = pcap_collect(r, NULL);
+
+    if (npkts <= 0) {
+        printf("%s: no packets in %s %s\n", args[0], args[1], pcap_reader_error(r));
+        pcap_reader_close(r);
+        return -1;
+    }
+
+    const u64 nbatch = (npkts + 15) / 16;
+    seg_desc_t wseg = {
+        .maplen = ((nbatch * (16 * (sizeof(void *) + sizeof(pkt_metadata_t)) + sizeof(u32))) +
+                   HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
 
-    if (map_segment(NULL, &wlist_seg, errbuf, sizeof(errbuf) - 1)) {
-        unmap_segment(&pcap_seg);
+    if (map_segment(NULL, &wseg, errbuf, sizeof(errbuf) - 1)) {
         printf("%s: %s\n", args[0], errbuf);
+        pcap_reader_close(r);
         return -1;
     }
 
-    printf("%s\n", errbuf);
+    pkt_metadata_t * const md = (pkt_metadata_t *)wseg.ptr;
+    const pcap_pkt_hdr_t ** const hdrs = (const pcap_pkt_hdr_t **)(md + (nbatch * 16));
+    u32 * const parsed = (u32 *)(hdrs + (nbatch * 16));
+    u64 result[PKT_CSUM_NREASONS] = {};
+    u64 i, b, mismatches = 0, nparsed = 0, pre, clk, clk_scalar, sink = 0;
+    unsigned it;
+    int ret;
 
-    const pcap_pkt_hdr_t **hdrs = (const pcap_pkt_hdr_t **)wlist_seg.ptr;
-    const int max_ent = wlist_seg.maplen / sizeof(void *);
-    const int num_ent_ret = get_pcap_pkt_hdrs((const u8 *)pcap_seg.ptr, pcap_seg.maplen, hdrs, max_ent);
-    const int num_ent = (num_ent_ret < max_ent) ? num_ent_ret : max_ent;
-    int i;
-    pkt_metadata_t foo_md;
+    memset(wseg.ptr, 0, wseg.maplen);
+    pcap_collect(r, hdrs);
 
-    for (i = 0; i < num_ent; i++) {
-        printf("%d: %p/%u/%u\n", i + 1, hdrs[i]->pkt, hdrs[i]->incl_len, hdrs[i]->orig_len);
-        gen_pkt_metadata(hdrs[i], &foo_md);
+    for (b = 0; b < nbatch; b++) {
+        const unsigned n = ((npkts - (b * 16)) < 16) ? (npkts - (b * 16)) : 16;
+
+        parsed[b] = pkt_digest_x16(hdrs + (b * 16), md + (b * 16), n);
+        nparsed += _mm_popcnt_u32(parsed[b]);
+
+        const __mmask16 ok = pkt_csum_ok_x16(md + (b * 16), parsed[b]);
+
+        for (i = 0; i < n; i++) {
+            const u64 p = (b * 16) + i;
+
+            if (!((parsed[b] >> i) & 1)) {
+                continue;
+            }
+
+            ret = pkt_csum_check(&md[p]);
+            result[-ret]++;
+
+            if ((ret == 0) != ((ok >> i) & 1)) {
+                if (mismatches++ == 0) {
+                    printf("%s: packet %lu differs (scalar %s, simd %s)\n", args[0], p + 1,
+                           pkt_csum_reason_names[-ret], ((ok >> i) & 1) ? "ok" : "bad");
+                    debug_print_vec(md[p].zmm, ~0);
+                }
+            }
+        }
+    }
+
+    pre = TSC_PRECISE();
+    for (it = 0; it < iters; it++) {
+        for (b = 0; b < nbatch; b++) {
+            for (i = 0; i < 16; i++) {
+                if ((parsed[b] >> i) & 1) {
+                    sink += pkt_csum_check(&md[(b * 16) + i]);
+                }
+            }
+        }
     }
+    clk_scalar = TSC_PRECISE() - pre;
 
-    unmap_segment(&pcap_seg);
-    unmap_segment(&wlist_seg);
+    pre = TSC_PRECISE();
+    for (it = 0; it < iters; it++) {
+        for (b = 0; b < nbatch; b++) {
+            sink += pkt_csum_ok_x16(md + (b * 16), parsed[b]);
+        }
+    }
+    clk = TSC_PRECISE() - pre;
+    consume_data(&sink, sizeof(sink));
 
-    debug_print_vec(flow_key_mask.zmm, ~0);
-    return 0;
+    printf("%s: %ld packets (%lu parsed), %lu mismatches\n", args[0], npkts, nparsed,
+           mismatches);
+
+    for (i = 0; i < PKT_CSUM_NREASONS; i++) {
+        printf("\t%-10s %lu\n", pkt_csum_reason_names[i], result[i]);
+    }
+
+    printf("\tpkt_csum_check():  %8.2f clocks per packet\n",
+           (float)clk_scalar / (nparsed * iters));
+    printf("\tpkt_csum_ok_x16(): %8.2f clocks per packet\n", (float)clk / (nparsed * iters));
+
+    unmap_segment(&wseg);
+    pcap_reader_close(r);
+    return mismatches ? -1 : 0;
 }
 
-PERF_FUNC_ENTRY(pcap_load, "Load pcap file", "file");
+PERF_FUNC_ENTRY(pkt_csum, "Check pkt_csum_ok_x16() against pkt_csum_check() on a pcap file, and "
+                "time them.", "file", "iters");
@@ -0,0 +1,421 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#include "pcap_reader.h"
+
+#define PCAP_MAGIC_USEC     (0xa1b2c3d4)
+#define PCAP_MAGIC_NSEC     (0xa1b23c4d)
+#define PCAP_LINKTYPE_ETH   (1)
+
+#define PCAPNG_SHB          (0x0A0D0D0A)    // Section header block
+#define PCAPNG_IDB          (0x00000001)    // Interface description block
+#define PCAPNG_PB           (0x00000002)    // Packet block (obsolete)
+#define PCAPNG_SPB          (0x00000003)    // Simple packet block
+#define PCAPNG_EPB          (0x00000006)    // Enhanced packet block
+#define PCAPNG_BYTE_ORDER   (0x1A2B3C4D)
+#define PCAPNG_OPT_TSRESOL  (9)
+
+/* Offset of the pcap_pkt_hdr_t lookalike within a (enhanced) packet block. */
+#define PCAPNG_PB_HDR_OFFS  (12)
+
+#define PCAP_MAX_IFS        (64)
+
+STATIC_ASSERT((PCAP_BATCH_MAX % 16) == 0);
+
+struct pcap_reader {
+    int                 fd;
+    u32                 flags;
+    u64                 fsize;
+    u64                 first;          // File offset of the first record / block
+    u64                 off;            // File offset of the next record / block
+    u64                 wlen;           // Requested window size
+
+    const u8           *win;            // Current window, mapping wmap bytes from file offset woff
+    u64                 woff;
+    u64                 wmap;
+
+    /* Classic pcap */
+    u32                 snaplen;
+    u32                 nsec;
+
+    /* pcapng: per interface link type and timestamp resolution (if_tsresol) */
+    u32                 nifs;
+    u16                 linktype[PCAP_MAX_IFS];
+    u8                  tsresol[PCAP_MAX_IFS];
+
+    pcap_reader_info_t  info;
+    char                err[256];
+};
+
+static inline u64 min_u64(const u64 a, const u64 b)
+{
+    return (a < b) ? a : b;
+}
+
+static int pcap_reader_fail(pcap_reader_t * const r, const char * const what)
+{
+    snprintf(r->err, sizeof(r->err) - 1, "%s at file offset 0x%lx", what, r->off);
+    return -1;
+}
+
+/*
+ * Whether [off, off + len) of the file is inside the current window.
+ */
+static inline int in_window(const pcap_reader_t * const r, const u64 off, const u64 len)
+{
+    return (r->win != NULL) & (off >= r->woff) & (off + len <= r->woff + r->wmap);
+}
+
+/*
+ *    Move the window to start at the page holding off, big enough for at least len bytes from
+ * there (or to the end of the file, whichever comes first).
+ */
+static int pcap_reader_map(pcap_reader_t * const r, const u64 off, const u64 len)
+{
+    const u64 woff = off & ~PAGE_MASK;
+    const u64 want = (r->wlen > (off - woff) + len) ? r->wlen : (off - woff) + len;
+    const u64 wmap = min_u64((want + PAGE_MASK) & ~PAGE_MASK, r->fsize - woff);
+    const int populate = !!(r->flags & PCAP_READER_POPULATE);
+
+    if (r->win != NULL) {
+        munmap((void *)r->win, r->wmap);
+        r->win = NULL;
+        r->info.remaps++;
+    }
+
+    void * const ptr = mmap(NULL, wmap, PROT_READ, MAP_PRIVATE | (populate ? MAP_POPULATE : 0),
+                            r->fd, woff);
+
+    if (ptr == MAP_FAILED) {
+        const typeof(errno) err_tmp = errno;
+        snprintf(r->err, sizeof(r->err) - 1, "Cannot mmap() 0x%lx bytes at file offset 0x%lx: %s",
+                 wmap, woff, strerror(err_tmp));
+        return -1;
+    }
+
+    madvise(ptr, wmap, MADV_SEQUENTIAL);
+
+    if (!populate) {
+        madvise(ptr, wmap, MADV_WILLNEED);
+    }
+
+    r->win = (const u8 *)ptr;
+    r->woff = woff;
+    r->wmap = wmap;
+    return 0;
+}
+
+/*
+ * A pcapng timestamp in units of if_tsresol (10^-res, or 2^-(res & 0x7F) with the top bit set).
+ */
+static u64 pcapng_ts_ns(const u64 ts, const u8 res)
+{
+    static const u64 pow10[] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+        10000000000, 100000000000, 1000000000000, 10000000000000, 100000000000000,
+        1000000000000000, 10000000000000000, 100000000000000000, 1000000000000000000,
+        10000000000000000000UL
+    };
+
+    if (res & 0x80) {
+        return ((unsigned __int128)ts * 1000000000) >> min_u64(res & 0x7F, 127);
+    }
+
+    if (res <= 9) {
+        return ts * pow10[9 - res];
+    }
+
+    return ts / pow10[min_u64(res - 9, 19)];
+}
+
+static int pcapng_idb(pcap_reader_t * const r, const u8 * const blk, const u32 blen)
+{
+    u32 o = 16;
+
+    if (blen < 20) {
+        return pcap_reader_fail(r, "Short interface description block");
+    }
+
+    if (r->nifs == PCAP_MAX_IFS) {
+        return pcap_reader_fail(r, "Too many interfaces");
+    }
+
+    r->linktype[r->nifs] = *(const u16 *)(blk + 8);
+    r->tsresol[r->nifs] = 6;
+
+    while (o + 4 <= blen - 4) {
+        const u16 code = *(const u16 *)(blk + o);
+        const u16 olen = *(const u16 *)(blk + o + 2);
+
+        if ((code == 0) | (o + 4 + olen > blen - 4)) {
+            break;
+        }
+
+        if ((code == PCAPNG_OPT_TSRESOL) & (olen >= 1)) {
+            r->tsresol[r->nifs] = blk[o + 4];
+        }
+
+        o += 4 + ((olen + 3) & ~3);
+    }
+
+    r->nifs++;
+    return 0;
+}
+
+static inline void batch_add(pcap_batch_t * const b, const pcap_pkt_hdr_t * const hdr,
+                             const u64 ts_ns)
+{
+    b->hdr[b->n] = hdr;
+    b->ts_ns[b->n] = ts_ns;
+    b->incl_len[b->n] = hdr->incl_len;
+    b->orig_len[b->n] = hdr->orig_len;
+    b->n++;
+}
+
+/*
+ *    Handle one pcapng block of blen bytes (already known to be in the window), adding it to b if
+ * it's a packet we hand out.
+ */
+static int pcapng_block(pcap_reader_t * const r, pcap_batch_t * const b, const u8 * const blk,
+                        const u32 blen)
+{
+    const u32 type = *(const u32 *)blk;
+
+    switch (type) {
+    case PCAPNG_SHB:
+        if ((blen < 28) | (*(const u32 *)(blk + 8) != PCAPNG_BYTE_ORDER)) {
+            return pcap_reader_fail(r, "Bad (or byte swapped) section header block");
+        }
+
+        r->nifs = 0;
+        return 0;
+
+    case PCAPNG_IDB:
+        return pcapng_idb(r, blk, blen);
+
+    case PCAPNG_PB:
+    case PCAPNG_EPB:
+        {
+            const pcap_pkt_hdr_t * const hdr = (const pcap_pkt_hdr_t *)(blk + PCAPNG_PB_HDR_OFFS);
+            const u32 ifid = (type == PCAPNG_EPB) ? *(const u32 *)(blk + 8) :
+                             *(const u16 *)(blk + 8);
+
+            if ((blen < 32) || (hdr->incl_len > blen - 32) || (ifid >= r->nifs)) {
+                return pcap_reader_fail(r, "Bad packet block");
+            }
+
+            if (r->linktype[ifid] != PCAP_LINKTYPE_ETH) {
+                r->info.skipped++;
+                return 0;
+            }
+
+            batch_add(b, hdr, pcapng_ts_ns(((u64)hdr->ts_sec << 32) | hdr->ts_frac,
+                                           r->tsresol[ifid]));
+            return 0;
+        }
+
+    case PCAPNG_SPB:
+        r->info.skipped++;
+        return 0;
+
+    default:
+        return 0;
+    }
+}
+
+int pcap_reader_next(pcap_reader_t * const r, pcap_batch_t * const b, const u32 max)
+{
+    const u32 lim = (max < PCAP_BATCH_MAX) ? max : PCAP_BATCH_MAX;
+    const u32 hlen = (r->info.fmt == PCAP_FMT_PCAP) ? sizeof(pcap_pkt_hdr_t) : 8;
+
+    b->n = 0;
+
+    while ((b->n < lim) & !r->info.truncated) {
+        u64 rlen;
+
+        if (r->off + hlen > r->fsize) {
+            r->info.truncated = (r->off < r->fsize);
+            break;
+        }
+
+        /* Moving the window would unmap what this batch already points at. */
+        if (!in_window(r, r->off, hlen)) {
+            if (b->n || pcap_reader_map(r, r->off, hlen)) {
+                break;
+            }
+        }
+
+        const u8 *p = r->win + (r->off - r->woff);
+
+        if (r->info.fmt == PCAP_FMT_PCAP) {
+            rlen = sizeof(pcap_pkt_hdr_t) + ((const pcap_pkt_hdr_t *)p)->incl_len;
+        } else {
+            rlen = ((const u32 *)p)[1];
+
+            if ((rlen < 12) | (rlen & 3)) {
+                return pcap_reader_fail(r, "Bad block length");
+            }
+        }
+
+        if (r->off + rlen > r->fsize) {
+            r->info.truncated = 1;
+            break;
+        }
+
+        if (!in_window(r, r->off, rlen)) {
+            if (b->n) {
+                break;
+            }
+
+            if (pcap_reader_map(r, r->off, rlen)) {
+                return -1;
+            }
+
+            p = r->win + (r->off - r->woff);
+        }
+
+        if (r->info.fmt == PCAP_FMT_PCAP) {
+            const pcap_pkt_hdr_t * const hdr = (const pcap_pkt_hdr_t *)p;
+
+            if (((r->snaplen != 0) & (hdr->incl_len > r->snaplen)) |
+                    (hdr->ts_frac > (r->nsec ? 999999999 : 999999))) {
+                return pcap_reader_fail(r, "Corrupt record");
+            }
+
+            batch_add(b, hdr, ((u64)hdr->ts_sec * 1000000000) +
+                      ((u64)hdr->ts_frac * (r->nsec ? 1 : 1000)));
+        } else if (pcapng_block(r, b, p, rlen)) {
+            return -1;
+        }
+
+        r->off += rlen;
+    }
+
+    if (r->win == NULL) {
+        return -1;
+    }
+
+    r->info.pkts += b->n;
+    return b->n;
+}
+
+void pcap_reader_rewind(pcap_reader_t * const r)
+{
+    r->off = r->first;
+    r->nifs = 0;
+    r->info.truncated = 0;
+    r->info.pkts = 0;
+    r->info.skipped = 0;
+}
+
+pcap_reader_t *pcap_reader_open(const char *path, const u64 window, const u32 flags,
+                                char *errbuf, const unsigned eblen)
+{
+    pcap_reader_t * const r = calloc(1, sizeof(*r));
+    struct stat st = {};
+
+    if (errbuf) {
+        memset(errbuf, 0, eblen);
+    }
+
+    if (r == NULL) {
+        if (errbuf) {
+            snprintf(errbuf, eblen - 1, "Cannot allocate reader");
+        }
+
+        return NULL;
+    }
+
+    r->flags = flags;
+    r->fd = open(path, O_RDONLY);
+
+    if ((r->fd < 0) || fstat(r->fd, &st)) {
+        if (errbuf) {
+            const typeof(errno) err_tmp = errno;
+            snprintf(errbuf, eblen - 1, "Cannot open file %s: %s", path, strerror(err_tmp));
+        }
+
+        pcap_reader_close(r);
+        return NULL;
+    }
+
+    r->fsize = st.st_size;
+    r->wlen = (window == 0) ? r->fsize : ((window + PAGE_MASK) & ~PAGE_MASK);
+
+    if ((r->fsize < sizeof(pcap_file_hdr_t)) || pcap_reader_map(r, 0, sizeof(pcap_file_hdr_t))) {
+        if (errbuf) {
+            snprintf(errbuf, eblen - 1, "%s: %s", path, r->err[0] ? r->err : "File too short");
+        }
+
+        pcap_reader_close(r);
+        return NULL;
+    }
+
+    const pcap_file_hdr_t * const fhdr = (const pcap_file_hdr_t *)r->win;
+    const char *bad = NULL;
+
+    if ((fhdr->magic == PCAP_MAGIC_USEC) | (fhdr->magic == PCAP_MAGIC_NSEC)) {
+        r->info.fmt = PCAP_FMT_PCAP;
+        r->first = sizeof(pcap_file_hdr_t);
+        r->snaplen = fhdr->snaplen;
+        r->nsec = (fhdr->magic == PCAP_MAGIC_NSEC);
+
+        if ((fhdr->v_major != 2) | (fhdr->network_encap != PCAP_LINKTYPE_ETH)) {
+            bad = "Not a version 2 pcap of Ethernet";
+        }
+    } else if (fhdr->magic == PCAPNG_SHB) {
+        r->info.fmt = PCAP_FMT_PCAPNG;
+        r->first = 0;
+    } else {
+        bad = "Not a (host byte order) pcap or pcapng file";
+    }
+
+    if (bad) {
+        if (errbuf) {
+            snprintf(errbuf, eblen - 1, "%s: %s", path, bad);
+        }
+
+        pcap_reader_close(r);
+        return NULL;
+    }
+
+    r->info.remaps = 0;
+    pcap_reader_rewind(r);
+    return r;
+}
+
+void pcap_reader_close(pcap_reader_t * const r)
+{
+    if (r == NULL) {
+        return;
+    }
+
+    if (r->win != NULL) {
+        munmap((void *)r->win, r->wmap);
+    }
+
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+
+    free(r);
+}
+
+const pcap_reader_info_t *pcap_reader_info(const pcap_reader_t * const r)
+{
+    return &r->info;
+}
+
+const char *pcap_reader_error(const pcap_reader_t * const r)
+{
+    return r->err;
+}
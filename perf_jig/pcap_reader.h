@@ -0,0 +1,82 @@
+#ifndef _PCAP_READER_H_
+#define _PCAP_READER_H_
+
+/*
+ *    A streaming reader for classic pcap and pcapng captures, for replaying captures of any size
+ * (including much larger than RAM) through the packet parsers.
+ *
+ *    Only a window of the file is mapped at a time.  Records are handed out a batch at a time,
+ * and a batch never spans two windows, so everything a batch points at stays mapped until the
+ * next call to pcap_reader_next().  When the next record isn't inside the window the window is
+ * moved to start at it, and the new window is either prefaulted up front (MAP_POPULATE) or
+ * handed to the kernel to read ahead asynchronously (MADV_WILLNEED) while the first records in
+ * it are processed.  The window is also MADV_SEQUENTIAL, so pages already passed are cheap to
+ * evict.  A window of 0 maps the whole file once, in which case every pointer handed out stays
+ * valid until pcap_reader_close().
+ *
+ *    Every packet is handed out as a pcap_pkt_hdr_t pointer whatever the format, so that the
+ * parsers (gen_pkt_metadata(), pkt_digest_x16()) take either: a pcapng enhanced (or obsolete)
+ * packet block, viewed from 12 bytes in, has captured length, original length and packet data
+ * at the same offsets as a classic pcap record.  Only the timestamp words differ, which is why
+ * batches carry their own timestamps, converted to ns from whatever resolution the file (or the
+ * pcapng interface) uses.
+ *
+ *    Only Ethernet is handed out: a classic pcap of anything else is refused, and packets on
+ * non-Ethernet pcapng interfaces (and simple packet blocks, which record no interface or
+ * timestamp) are counted as skipped.  Only captures in host (little endian) byte order are read.
+ */
+
+#define PCAP_BATCH_MAX      (256)
+
+#define PCAP_READER_POPULATE    (1 << 0)    // Prefault each window rather than read ahead
+
+enum {
+    PCAP_FMT_PCAP = 0,
+    PCAP_FMT_PCAPNG
+};
+
+typedef struct pcap_reader pcap_reader_t;
+
+/*
+ * A batch of packets in SoA form.
+ */
+typedef struct {
+    const pcap_pkt_hdr_t   *hdr[PCAP_BATCH_MAX];
+    u64                     ts_ns[PCAP_BATCH_MAX];      // ns since the epoch
+    u32                     incl_len[PCAP_BATCH_MAX];
+    u32                     orig_len[PCAP_BATCH_MAX];
+    u32                     n;
+} pcap_batch_t;
+
+typedef struct {
+    u32 fmt;            // PCAP_FMT_*
+    u32 truncated;      // The file ends part way through a record
+    u64 pkts;           // Packets handed out this pass
+    u64 skipped;        // Packets not handed out (see above) this pass
+    u64 remaps;         // Times the window has moved since opening
+} pcap_reader_info_t;
+
+/*
+ *    Open a capture, to be read through a window of window bytes (rounded up to whole pages), or
+ * all at once if window is 0.  Returns NULL with the reason in errbuf if the file can't be read
+ * or isn't a capture this reads.
+ */
+pcap_reader_t *pcap_reader_open(const char *path, const u64 window, const u32 flags,
+                                char *errbuf, const unsigned eblen);
+void pcap_reader_close(pcap_reader_t *r);
+
+/*
+ *    Fill b with up to max (at most PCAP_BATCH_MAX) more packets.  Returns how many, 0 at the end
+ * of the capture, or -1 if the capture is corrupt (see pcap_reader_error()).
+ */
+int pcap_reader_next(pcap_reader_t *r, pcap_batch_t *b, const u32 max);
+
+/*
+ * Start again from the first packet, for another pass over the same capture.
+ */
+void pcap_reader_rewind(pcap_reader_t *r);
+
+const pcap_reader_info_t *pcap_reader_info(const pcap_reader_t *r);
+const char *pcap_reader_error(const pcap_reader_t *r);
+
+#endif /* _PCAP_READER_H_ */
@@ -1,6 +1,9 @@
 #ifndef _PERF_JIG_H_
 #define _PERF_JIG_H_
 
+#include <time.h>
+#include <sched.h>
+
 #define MAX_PERF_FUNC_ARGS  (18)
 
 static inline int example_perf_test_function(const char **args)
@@ -22,6 +25,30 @@ typedef struct perf_func_entry {
 
 #define ARG_VALID(_a) ({ const char * __a = (_a); (__a && __a[0]); })
 
+/*
+ * Wall-clock time for tests that need to report rates in real units (e.g. per second) or that
+ * span several threads whose TSC readings we'd rather not compare.
+ */
+static inline u64 wall_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((u64)ts.tv_sec * 1000000000UL) + ts.tv_nsec;
+}
+
+/*
+ * Back off while waiting on a ring: spin briefly, then give the CPU away so that oversubscribed runs
+ * (more threads than cores) still make forward progress.
+ */
+static inline void ring_backoff(u32 * const spins)
+{
+    if (++*spins & 63) {
+        _mm_pause();
+    } else {
+        sched_yield();
+    }
+}
+
 extern const perf_func_entry_t __start_test_desc_section;
 extern const perf_func_entry_t __stop_test_desc_section;
 
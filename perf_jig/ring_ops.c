@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <errno.h>
+#include <libgen.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#include "perf_jig.h"
+
+/*
+ * Results the child processes hand back to the parent through the shared segment.
+ */
+typedef struct {
+    u64 start __attribute__((__aligned__(64)));
+    u64 consumed __attribute__((__aligned__(64)));
+    u64 sum;
+    u64 errors;
+} ring_results_t;
+
+static int wait_children(const char *name, const u32 n)
+{
+    int status, ret = 0;
+    u32 i;
+
+    for (i = 0; i < n; i++) {
+        if ((wait(&status) < 0) || !WIFEXITED(status) || WEXITSTATUS(status)) {
+            printf("%s: Child process failed.\n", name);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/* Kill and reap the n children in pids, after a failure partway through starting them. */
+static void kill_children(const pid_t * const pids, const u32 n)
+{
+    u32 i;
+
+    for (i = 0; i < n; i++) {
+        kill(pids[i], SIGKILL);
+    }
+
+    for (i = 0; i < n; i++) {
+        waitpid(pids[i], NULL, 0);
+    }
+}
+
+/*
+ *    Two processes share a pair of SPSC rings (ping and pong) in one map_segment()ed region.
+ * First the parent bounces a single slot off the child 'rounds' times to measure round trip
+ * latency, then it streams 'nmsgs' slots (16 items each) one way to measure throughput while the
+ * child checks that every slot arrives intact and in order.
+ */
+static int perf_test_ring_pingpong(const char **args)
+{
+    char errbuf[1024] = {};
+    const u32 rounds = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : 100000;
+    const u32 nmsgs  = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : (1 << 22);
+    const u32 nslots = ARG_VALID(args[3]) ? strtoul(args[3], NULL, 0) : 1024;
+
+    if ((nslots == 0) | (nslots & (nslots - 1)) | !rounds | !nmsgs) {
+        printf("%s: nslots must be a power of 2, rounds and nmsgs must be non-zero.\n", args[0]);
+        return -1;
+    }
+
+    const u64 rlen = (SPSC_RING_MEM_SIZE(nslots) + 63) & ~63UL;
+    seg_desc_t dseg = {
+        .maplen = (sizeof(ring_results_t) + (rlen * 2) + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &dseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    ring_results_t * const res = (ring_results_t *)dseg.ptr;
+    spsc_ring_t * const ping = spsc_ring_init((u8 *)(res + 1), nslots);
+    spsc_ring_t * const pong = spsc_ring_init((u8 *)(res + 1) + rlen, nslots);
+    const u32_16 idx = IDX_VEC(u32_16);
+    u32_16 v;
+    u32 i, spins = 0;
+
+    const pid_t pid = fork();
+
+    if (pid < 0) {
+        printf("%s: fork() failed: %s\n", args[0], strerror(errno));
+        unmap_segment(&dseg);
+        return -1;
+    } else if (pid == 0) {
+        for (i = 0; i < rounds; i++) {
+            while (!spsc_ring_dequeue(ping, &v, 1)) {
+                ring_backoff(&spins);
+            }
+
+            while (!spsc_ring_enqueue(pong, &v, 1)) {
+                ring_backoff(&spins);
+            }
+        }
+
+        for (i = 0; i < nmsgs; i++) {
+            while (!spsc_ring_dequeue(ping, &v, 1)) {
+                ring_backoff(&spins);
+            }
+
+            res->errors += !!_mm512_cmpneq_epi32_mask((__m512i)v, (__m512i)(idx + i));
+            res->sum += v[15];
+        }
+
+        _exit(0);
+    }
+
+    const u64 pre_lat = wall_clock_ns();
+    const u64 pre_lat_tsc = TSC_PRECISE();
+
+    for (i = 0; i < rounds; i++) {
+        v = idx + i;
+
+        while (!spsc_ring_enqueue(ping, &v, 1)) {
+            ring_backoff(&spins);
+        }
+
+        while (!spsc_ring_dequeue(pong, &v, 1)) {
+            ring_backoff(&spins);
+        }
+    }
+
+    const u64 lat_tsc = TSC_PRECISE() - pre_lat_tsc;
+    const u64 lat_ns = wall_clock_ns() - pre_lat;
+    const u64 pre_tput = wall_clock_ns();
+
+    for (i = 0; i < nmsgs; i++) {
+        v = idx + i;
+
+        while (!spsc_ring_enqueue(ping, &v, 1)) {
+            ring_backoff(&spins);
+        }
+    }
+
+    int ret = wait_children(args[0], 1);
+    const u64 tput_ns = wall_clock_ns() - pre_tput;
+    const u64 expect = ((u64)nmsgs * (nmsgs - 1) / 2) + ((u64)nmsgs * 15);
+
+    printf("%s(%u, %u, %u):\n", args[0], rounds, nmsgs, nslots);
+    printf("\tround trip: %.1f ns (%lu clocks)\n", (float)lat_ns / (float)rounds, lat_tsc / rounds);
+    printf("\tstreaming: %.2f Mslots/s, %.2f Mitems/s (%.2f ns per slot)\n",
+           ((float)nmsgs * 1000.0) / (float)tput_ns, ((float)nmsgs * 16000.0) / (float)tput_ns,
+           (float)tput_ns / (float)nmsgs);
+
+    if (res->errors || (res->sum != expect)) {
+        printf("\tValidation failed: %lu corrupt or out of order slots.\n", res->errors);
+        ret = -1;
+    }
+
+    unmap_segment(&dseg);
+    return ret;
+}
+
+PERF_FUNC_ENTRY(ring_pingpong, "SPSC zmm-slot ring round trip latency and streaming throughput "
+                "between two processes.", "rounds", "nmsgs", "nslots");
+
+/*
+ *    nprod producer processes each push nmsgs / nprod slots tagged (producer, sequence) through
+ * one MPMC ring to ncons consumer processes.  Every consumer checks that it sees each producer's
+ * slots in increasing sequence order, and between them the consumers account for every slot.
+ */
+static int perf_test_ring_mpmc(const char **args)
+{
+    char errbuf[1024] = {};
+    const u32 nmsgs  = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : (1 << 22);
+    const u32 nslots = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 1024;
+    const u32 nprod  = ARG_VALID(args[3]) ? strtoul(args[3], NULL, 0) : 2;
+    const u32 ncons  = ARG_VALID(args[4]) ? strtoul(args[4], NULL, 0) : 2;
+
+    if ((nslots == 0) | (nslots & (nslots - 1)) | !nprod | !ncons | (nprod > 64) | (ncons > 64) |
+            (nmsgs < nprod)) {
+        printf("%s: nslots must be a power of 2, 0 < nprod, ncons <= 64 and nmsgs >= nprod.\n",
+               args[0]);
+        return -1;
+    }
+
+    const u32 per_prod = nmsgs / nprod;
+    const u64 total = (u64)per_prod * nprod;
+    seg_desc_t dseg = {
+        .maplen = (sizeof(ring_results_t) + MPMC_RING_MEM_SIZE(nslots) + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &dseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    ring_results_t * const res = (ring_results_t *)dseg.ptr;
+    mpmc_ring_t * const ring = mpmc_ring_init(res + 1, nslots);
+    const u32_16 idx = IDX_VEC(u32_16);
+    pid_t pids[128];
+    u32 i, j, nchild = 0, spins = 0;
+
+    for (i = 0; i < nprod + ncons; i++) {
+        const pid_t pid = fork();
+
+        if (pid < 0) {
+            printf("%s: fork() failed: %s\n", args[0], strerror(errno));
+            kill_children(pids, nchild);
+            unmap_segment(&dseg);
+            return -1;
+        } else if (pid > 0) {
+            pids[nchild++] = pid;
+            continue;
+        }
+
+        while (!__atomic_load_n(&res->start, __ATOMIC_ACQUIRE)) {
+            ring_backoff(&spins);
+        }
+
+        if (i < nprod) {
+            const u32_16 prod = (u32_16) {} + i;
+
+            /* Lane 0 is the producer, lane k > 0 holds sequence + k. */
+            for (j = 0; j < per_prod; j++) {
+                const u32_16 v = MUX_ON_MASK(0x0001, prod, idx + j);
+
+                while (!mpmc_ring_enqueue(ring, v)) {
+                    ring_backoff(&spins);
+                }
+            }
+        } else {
+            i64 last[64];
+            u64 sum = 0, errors = 0;
+            u32_16 v;
+
+            __builtin_memset(last, 0xFF, sizeof(last));
+
+            while (__atomic_load_n(&res->consumed, __ATOMIC_RELAXED) < total) {
+                if (!mpmc_ring_dequeue(ring, &v)) {
+                    ring_backoff(&spins);
+                    continue;
+                }
+
+                const u32 p = v[0], s = v[1] - 1;
+                const __mmask16 bad = _mm512_cmpneq_epi32_mask((__m512i)v, (__m512i)(idx + s)) & 0xFFFE;
+
+                errors += (p >= nprod) || ((i64)s <= last[p & 63]) || bad;
+                last[p & 63] = s;
+                sum += s;
+                __atomic_add_fetch(&res->consumed, 1, __ATOMIC_RELAXED);
+            }
+
+            __atomic_add_fetch(&res->sum, sum, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&res->errors, errors, __ATOMIC_RELAXED);
+        }
+
+        _exit(0);
+    }
+
+    const u64 pre = wall_clock_ns();
+    __atomic_store_n(&res->start, 1, __ATOMIC_RELEASE);
+
+    int ret = wait_children(args[0], nchild);
+    const u64 elapsed = wall_clock_ns() - pre;
+    const u64 expect = ((u64)per_prod * (per_prod - 1) / 2) * nprod;
+
+    printf("%s(%u, %u, %u, %u):\n", args[0], nmsgs, nslots, nprod, ncons);
+    printf("\t%lu slots: %.2f Mslots/s, %.2f Mitems/s (%.2f ns per slot)\n", total,
+           ((float)total * 1000.0) / (float)elapsed, ((float)total * 16000.0) / (float)elapsed,
+           (float)elapsed / (float)total);
+
+    if (res->errors || (res->consumed != total) || (res->sum != expect)) {
+        printf("\tValidation failed: %lu errors, %lu of %lu slots consumed.\n", res->errors,
+               res->consumed, total);
+        ret = -1;
+    }
+
+    unmap_segment(&dseg);
+    return ret;
+}
+
+PERF_FUNC_ENTRY(ring_mpmc, "MPMC zmm-slot ring throughput with nprod producer and ncons consumer "
+                "processes.", "nmsgs", "nslots", "nprod", "ncons");
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <libgen.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#include "perf_jig.h"
+
+/*
+ * The scalar loops, kept out of line so they're compiled once as written.
+ */
+#define SCALAR_SCAN(_name, _type)                                                           \
+static _type __attribute__((noinline)) _name(_type * const RESTR dst,                       \
+                                             const _type * const RESTR src,                 \
+                                             const u64 * const RESTR heads, const u64 n,    \
+                                             const int excl)                                \
+{                                                                                           \
+    _type sum = 0;                                                                          \
+    u64 i;                                                                                  \
+                                                                                            \
+    for (i = 0; i < n; i++) {                                                               \
+        if (heads) {                                                                        \
+            sum = ((heads[i / 64] >> (i % 64)) & 1) ? 0 : sum;                              \
+        }                                                                                   \
+                                                                                            \
+        dst[i] = excl ? sum : (sum + src[i]);                                               \
+        sum += src[i];                                                                      \
+    }                                                                                       \
+                                                                                            \
+    return sum;                                                                             \
+}
+
+SCALAR_SCAN(scalar_scan_u32, u32)
+SCALAR_SCAN(scalar_scan_u64, u64)
+
+static u64 __attribute__((noinline)) simd_scan(void * const dst, const void * const src,
+                                               const u64 * const heads, const u64 n,
+                                               const u32 esz, const int excl)
+{
+    if (esz == 4) {
+        return heads ? scan_seg_incl_u32(dst, src, heads, n) :
+            excl ? scan_excl_u32(dst, src, n, 0) : scan_incl_u32(dst, src, n, 0);
+    }
+
+    return heads ? scan_seg_incl_u64(dst, src, heads, n) :
+        excl ? scan_excl_u64(dst, src, n, 0) : scan_incl_u64(dst, src, n, 0);
+}
+
+/*
+ *    Inclusive, exclusive and segmented (a head about every 32 elements) scans of an array, the
+ * scalar loop vs the array scans, in elements per clock.  The default size stays in L2; bigger
+ * ones show where the scan becomes a memory copy.
+ */
+static int perf_test_prefix_scan(const char **args)
+{
+    char errbuf[1024] = {};
+    const u64 nelem = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : (1 << 15);
+    const u32 esz   = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 4;
+    const u32 iters = ARG_VALID(args[3]) ? strtoul(args[3], NULL, 0) : 64;
+    const char * const kinds[] = { "inclusive", "exclusive", "segmented" };
+
+    if ((nelem == 0) | ((esz != 4) & (esz != 8)) | (iters == 0)) {
+        printf("%s: nelem and iters must be non-zero and esz 4 or 8.\n", args[0]);
+        return -1;
+    }
+
+    const u64 len = nelem * esz;
+    const u64 hlen = ((nelem + 63) / 64) * sizeof(u64);
+    seg_desc_t dseg = {
+        .maplen = ((3 * len) + hlen + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &dseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    u8 * const src = (u8 *)dseg.ptr;
+    u8 * const dst_scalar = src + len;
+    u8 * const dst_simd = dst_scalar + len;
+    u64 * const heads = (u64 *)(dst_simd + len);
+    unsigned k, it, i;
+    int ret = 0;
+
+    randomize_data(src, len);
+    randomize_data(heads, hlen);
+    memset(dst_scalar, 0, 2 * len);
+
+    /* Each bit set with probability 1/32. */
+    for (i = 0; i < hlen / sizeof(u64); i++) {
+        u64 r[4];
+
+        randomize_data(r, sizeof(r));
+        heads[i] &= r[0] & r[1] & r[2] & r[3];
+    }
+
+    printf("%s(%lu, %u, %u):\n", args[0], nelem, esz, iters);
+
+    for (k = 0; k < 3; k++) {
+        const u64 * const h = (k == 2) ? heads : NULL;
+        u64 pre, clk_scalar, clk_simd, s_scalar = 0, s_simd = 0;
+
+        pre = TSC_PRECISE();
+        for (it = 0; it < iters; it++) {
+            s_scalar = (esz == 4) ?
+                scalar_scan_u32((u32 *)dst_scalar, (const u32 *)src, h, nelem, k == 1) :
+                scalar_scan_u64((u64 *)dst_scalar, (const u64 *)src, h, nelem, k == 1);
+        }
+        clk_scalar = TSC_PRECISE() - pre;
+
+        pre = TSC_PRECISE();
+        for (it = 0; it < iters; it++) {
+            s_simd = simd_scan(dst_simd, src, h, nelem, esz, k == 1);
+        }
+        clk_simd = TSC_PRECISE() - pre;
+
+        if ((s_scalar != s_simd) | !!memcmp(dst_scalar, dst_simd, len)) {
+            printf("%s: %s scan results differ\n", args[0], kinds[k]);
+            ret = -1;
+        }
+
+        printf("\t%-10s scalar: %6.2f  simd: %6.2f  elements per clock\n", kinds[k],
+               ((float)nelem * iters) / clk_scalar, ((float)nelem * iters) / clk_simd);
+    }
+
+    unmap_segment(&dseg);
+    return ret;
+}
+
+PERF_FUNC_ENTRY(prefix_scan, "Inclusive, exclusive and segmented prefix sums over an array, "
+                "scalar vs scan_util.h.", "nelem", "esz", "iters");
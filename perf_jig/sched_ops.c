@@ -9,6 +9,7 @@
 #include <libgen.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 
 #include "../include/simd_util.h"
 
@@ -66,6 +67,103 @@ static int perf_test_schedule_batch(const char **args)
 PERF_FUNC_ENTRY(schedule_batch,
                 "Perform batch scheduling operation", "qlen", "modulo");
 
+static int perf_test_schedule_reorder(const char **args)
+{
+    char errbuf[1024] = {};
+    const unsigned qlen     = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : (1 << 20);
+    const unsigned modulo   = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 16;
+    const unsigned nslots   = ARG_VALID(args[3]) ? strtoul(args[3], NULL, 0) : 4096;
+
+    if (!qlen | !modulo | (nslots < 16) | (nslots & (nslots - 1))) {
+        printf("%s: qlen and modulo must be non-zero and nslots a power of two >= 16.\n", args[0]);
+        return -1;
+    }
+
+    // hash, original hash, posn and released output, followed by the reorder ring itself.
+    const u64 qbytes = (((u64)qlen * sizeof(u32)) + 63) & ~63UL;
+    const u64 dlen = ((qbytes * 4) + ROB_MEM_SIZE(nslots) + HUGE_2M_MASK) & ~HUGE_2M_MASK;
+    seg_desc_t dseg = {.maplen = dlen, .flags = SEG_DESC_INITD | SEG_DESC_ANON};
+
+    if (map_segment(NULL, &dseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    u32 * const RESTR hash = (u32 *)dseg.ptr;
+    u32 * const RESTR orig = (u32 *)((u8 *)hash + qbytes);
+    u32 * const RESTR posn = (u32 *)((u8 *)orig + qbytes);
+    u32 * const RESTR out = (u32 *)((u8 *)posn + qbytes);
+    void * const rob_mem = (u8 *)out + qbytes;
+    const u32 mul = 0x9e3779b1U;
+    rob_t rob;
+    unsigned i, batches = 0, n_out = 0, max_dist = 0;
+
+    randomize_data(hash, qlen * sizeof(u32));
+
+    for (i = 0; i < qlen; i++) {
+        hash[i] %= modulo;
+        orig[i] = hash[i];
+        posn[i] = i;
+    }
+
+    if (rob_init(&rob, rob_mem, nslots, 0)) {
+        printf("%s: Cannot initialize reorder buffer.\n", args[0]);
+        unmap_segment(&dseg);
+        return -1;
+    }
+
+    const u64 pre = TSC_PRECISE();
+
+    for (i = 0; i < qlen; ) {
+        const unsigned n = schedule_batch(hash + i, posn + i, qlen - i);
+        const __mmask16 m = (__mmask16)((1U << n) - 1);
+        const u32_16 h = (u32_16)_mm512_maskz_loadu_epi32(m, hash + i);
+        const u32_16 p = (u32_16)_mm512_maskz_loadu_epi32(m, posn + i);
+        // Stand-in for the real per-event work: something that depends on both hash and position.
+        const u32_16 res = (h * mul) ^ p;
+
+        if ((rob_fits_x16(&rob, p) & m) != m) {
+            printf("%s: reorder distance exceeded %u slots at position %u.\n", args[0], nslots, i);
+            unmap_segment(&dseg);
+            return -1;
+        }
+
+        const unsigned dist = _mm512_mask_reduce_max_epu32(m, (__m512i)(p - rob.head));
+        max_dist = (dist > max_dist) ? dist : max_dist;
+
+        rob_complete_x16(&rob, p, res, m);
+        n_out += rob_release(&rob, out + n_out, qlen - n_out);
+        i += n;
+        batches++;
+    }
+
+    const u64 post = TSC_PRECISE();
+
+    consume_data(out, qlen * sizeof(u32));
+
+    const u64 total_clk = post - pre;
+    printf( "%s(%u, %u, %u):\n\t%u batches, %u results released in order in %lu cycles.\n"
+            "\t(%.1f clocks per batch, %.1f clocks per item, max reorder distance %u).\n",
+            args[0], qlen, modulo, nslots, batches, n_out, total_clk,
+            (float)total_clk / (float)batches, (float)total_clk / (float)qlen, max_dist);
+
+    for (i = 0; i < qlen; i++) {
+        if ((i >= n_out) || (out[i] != ((orig[i] * mul) ^ i))) {
+            printf("%s: Result validation failed at position %u!\n", args[0], i);
+            unmap_segment(&dseg);
+            return -1;
+        }
+    }
+
+    printf("%s: Result validation OK.\n", args[0]);
+    unmap_segment(&dseg);
+    return 0;
+}
+
+PERF_FUNC_ENTRY(schedule_reorder,
+                "Schedule batches, process them out of order and restore input order via a reorder buffer.",
+                "qlen", "modulo", "nslots");
+
 
 typedef struct {
     u32 last_id;
@@ -79,6 +177,42 @@ typedef struct {
     u32 delta;
 } transfer_t;
 
+/*
+ * Turn random bytes into valid transfers between distinct accounts with modest amounts.
+ */
+static void gen_transfers(transfer_t * const RESTR xfer, const u32 xfer_n, const u32 account_mask)
+{
+    u32 i;
+
+    for (i = 0; i < xfer_n; i++) {
+        transfer_t * const RESTR x = xfer + i;
+        x->id = i;
+        x->from &= account_mask;
+        x->to &= account_mask;
+        x->to ^= (x->from == x->to);
+        x->delta /= (x->delta > 0x10000) ? 0x10000 : 1;
+    }
+}
+
+/*
+ * Scalar reference: apply transfers one at a time, in order.
+ */
+static void apply_transfers_scalar(account_t * const RESTR account,
+                                   const transfer_t * const RESTR xfer, const u32 xfer_n)
+{
+    u32 i;
+
+    for (i = 0; i < xfer_n; i++) {
+        const transfer_t * const RESTR x = xfer + i;
+        account_t * const RESTR from = account + x->from;
+        account_t * const RESTR to = account + x->to;
+        from->balance -= x->delta;
+        to->balance += x->delta;
+        from->last_id = x->id;
+        to->last_id = x->id;
+    }
+}
+
 static int perf_test_accounts_table(const char **args)
 {
     char errbuf[1024] = {};
@@ -130,27 +264,12 @@ static int perf_test_accounts_table(const char **args)
 
     u32 i;
 
-    for (i = 0; i < xfer_n; i++) {
-        transfer_t * const RESTR x = xfer + i;
-        x->id = i;
-        x->from &= account_mask;
-        x->to &= account_mask;
-        x->to ^= (x->from == x->to);
-        x->delta /= (x->delta > 0x10000) ? 0x10000 : 1;
-    }
+    gen_transfers(xfer, xfer_n, account_mask);
 
     const u64 pre_scalar = TSC_PRECISE();
 
     /* Process them one at a time on the alternate array to validate results. */
-    for (i = 0; i < xfer_n; i++) {
-        const transfer_t * const RESTR x = xfer + i;
-        account_t * const RESTR from = alt + x->from;
-        account_t * const RESTR to = alt + x->to;
-        from->balance -= x->delta;
-        to->balance += x->delta;
-        from->last_id = x->id;
-        to->last_id = x->id;
-    }
+    apply_transfers_scalar(alt, xfer, xfer_n);
 
     const u64 pre = TSC_PRECISE();
 
@@ -228,3 +347,295 @@ static int perf_test_accounts_table(const char **args)
 
 PERF_FUNC_ENTRY(accounts_table,
                 "Use conflict detect operation to prevent data races in a simplified accounts table.");
+
+/*
+ *    Sharded, multi-threaded variant of the accounts table.  Accounts are hash partitioned across
+ * worker cores at cache line granularity (so no two workers ever write the same line) and the
+ * dispatcher (the calling thread) splits each transfer into a debit message for the shard owning
+ * 'from' and a credit message for the shard owning 'to'.  Messages are packed 16 to a batch of
+ * three ring slots (account, delta, id) and each worker applies its batches with the same
+ * conflict-detect / gather / scatter approach as accounts_table.
+ *
+ *    Per-account ordering is preserved because the dispatcher emits messages in transfer order
+ * (debit then credit for each transfer), each shard's ring is FIFO, and within a batch a worker
+ * never applies a lane before an earlier lane touching the same account.
+ */
+
+#define ACCT_SHARD_BUCKETS      (1024)
+#define ACCT_SHARD_RING_SLOTS   (4096)
+#define ACCT_PER_LINE           (64 / sizeof(account_t))
+
+typedef union {
+    u32_16  slot[3];
+    struct {
+        u32_16  acct;
+        i32_16  delta;
+        u32_16  id;
+    };
+} acct_msg_batch_t;
+
+typedef struct {
+    u32 acct[32] __attribute__((__aligned__(64)));
+    i32 delta[32];
+    u32 id[32];
+    u32 n;
+} acct_msg_stage_t;
+
+typedef struct {
+    account_t * RESTR   account;
+    spsc_ring_t        *ring;
+    const u32          *done;
+    u64                 n_msgs;
+    pthread_t           thread;
+} acct_shard_t;
+
+static void apply_msg_batch(account_t * const RESTR account, const acct_msg_batch_t * const RESTR b)
+{
+    const u32_16 zero = {};
+    __mmask16 v = VEC_TO_MASK(b->acct != ~0U);
+
+    while (v) {
+        // vpconflictd compares against every earlier lane, so ignore lanes already applied
+        const u32_16 conf = conflict_detect_u32_16(b->acct, zero, v) & (u32)v;
+        const __mmask16 hz = _mm512_test_epi32_mask((__m512i)conf, (__m512i)conf) & v;
+        const __mmask16 m = hz ? (v & (__mmask16)((1U << __builtin_ctz(hz)) - 1)) : v;
+        const i32_16 bal = (i32_16)_mm512_mask_i32gather_epi32((__m512i)zero, m, (__m512i)b->acct,
+                           &account->balance, sizeof(account_t));
+        _mm512_mask_i32scatter_epi32(&account->balance, m, (__m512i)b->acct, (__m512i)(bal + b->delta),
+                                     sizeof(account_t));
+        _mm512_mask_i32scatter_epi32(&account->last_id, m, (__m512i)b->acct, (__m512i)b->id,
+                                     sizeof(account_t));
+        v &= ~m;
+    }
+}
+
+static void *acct_shard_worker(void *arg)
+{
+    acct_shard_t * const RESTR sh = (acct_shard_t *)arg;
+    acct_msg_batch_t b;
+    u32 spins = 0;
+
+    for (;;) {
+        const u32 fin = __atomic_load_n(sh->done, __ATOMIC_ACQUIRE);
+
+        if (spsc_ring_dequeue(sh->ring, b.slot, 3)) {
+            apply_msg_batch(sh->account, &b);
+            sh->n_msgs += 16;
+        } else if (fin) {
+            break;
+        } else {
+            ring_backoff(&spins);
+        }
+    }
+
+    return NULL;
+}
+
+static inline void acct_stage_push(acct_msg_stage_t * const RESTR st, spsc_ring_t * const RESTR ring,
+                                   const u32_16 acct, const i32_16 delta, const u32_16 id,
+                                   const __mmask16 m)
+{
+    _mm512_mask_compressstoreu_epi32(st->acct + st->n, m, (__m512i)acct);
+    _mm512_mask_compressstoreu_epi32(st->delta + st->n, m, (__m512i)delta);
+    _mm512_mask_compressstoreu_epi32(st->id + st->n, m, (__m512i)id);
+    st->n += __builtin_popcount(m);
+
+    if (st->n >= 16) {
+        const acct_msg_batch_t b = {
+            .acct = (u32_16)_mm512_load_si512(st->acct),
+            .delta = (i32_16)_mm512_load_si512(st->delta),
+            .id = (u32_16)_mm512_load_si512(st->id),
+        };
+
+        u32 spins = 0;
+
+        while (!spsc_ring_enqueue(ring, b.slot, 3)) {
+            ring_backoff(&spins);
+        }
+
+        st->n -= 16;
+        _mm512_store_si512(st->acct, _mm512_loadu_si512(st->acct + 16));
+        _mm512_store_si512(st->delta, _mm512_loadu_si512(st->delta + 16));
+        _mm512_store_si512(st->id, _mm512_loadu_si512(st->id + 16));
+    }
+}
+
+static inline void acct_stage_flush(acct_msg_stage_t * const RESTR st, spsc_ring_t * const RESTR ring)
+{
+    if (st->n) {
+        const __mmask16 m = (__mmask16)((1U << st->n) - 1);
+        const acct_msg_batch_t b = {
+            .acct = (u32_16)_mm512_mask_loadu_epi32(_mm512_set1_epi32(~0U), m, st->acct),
+            .delta = (i32_16)_mm512_maskz_loadu_epi32(m, st->delta),
+            .id = (u32_16)_mm512_maskz_loadu_epi32(m, st->id),
+        };
+
+        u32 spins = 0;
+
+        while (!spsc_ring_enqueue(ring, b.slot, 3)) {
+            ring_backoff(&spins);
+        }
+
+        st->n = 0;
+    }
+}
+
+/*
+ * Split 8 debit/credit pairs (already interleaved in transfer order) across the shard rings.
+ */
+static inline void acct_dispatch_x16(acct_msg_stage_t * const RESTR stage,
+                                     acct_shard_t * const RESTR shard,
+                                     const u32 * const RESTR bucket_to_shard,
+                                     const u32_16 acct, const i32_16 delta, const u32_16 id,
+                                     __mmask16 lanes)
+{
+    const u32_16 bucket = (acct / ACCT_PER_LINE) & (ACCT_SHARD_BUCKETS - 1);
+    const u32_16 dest = gather_u32_from_lookup_table_x16(bucket, bucket_to_shard, ACCT_SHARD_BUCKETS);
+
+    while (lanes) {
+        const u32 s = dest[__builtin_ctz(lanes)];
+        const __mmask16 m = lanes & VEC_TO_MASK(dest == s);
+        lanes &= ~m;
+        acct_stage_push(stage + s, shard[s].ring, acct, delta, id, m);
+    }
+}
+
+static int perf_test_accounts_sharded(const char **args)
+{
+    char errbuf[1024] = {};
+    const long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    const u32 def_workers = (ncpu > 2) ? (ncpu - 1) : 1;
+    const u32 max_workers = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : def_workers;
+    const u32 xfer_mb     = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 8;
+
+    if (!max_workers | (max_workers > 64) | !xfer_mb) {
+        printf("%s: max_workers must be between 1 and 64 and xfer_mb non-zero.\n", args[0]);
+        return -1;
+    }
+
+    const u64 acct_len = HUGE_2M_SIZE;
+    const u64 xfer_len = ((u64)xfer_mb << 20) & ~HUGE_2M_MASK;
+    const u64 ring_len = (SPSC_RING_MEM_SIZE(ACCT_SHARD_RING_SLOTS) + 63) & ~63UL;
+    const u64 stage_len = (sizeof(acct_msg_stage_t) + 63) & ~63UL;
+    const u64 misc_len = ((ring_len + stage_len) * max_workers) + (ACCT_SHARD_BUCKETS * sizeof(u32));
+    seg_desc_t dseg = {
+        .maplen = ((acct_len * 2) + (xfer_len ? xfer_len : HUGE_2M_SIZE) + misc_len + HUGE_2M_MASK) &
+        ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &dseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    u8 *trav = (u8 *)dseg.ptr;
+    account_t * const RESTR account = (account_t *)trav;
+    account_t * const RESTR alt = (account_t *)(trav += acct_len);
+    transfer_t * const RESTR xfer = (transfer_t *)(trav += acct_len);
+    u8 * const ring_mem = (trav += (xfer_len ? xfer_len : HUGE_2M_SIZE));
+    acct_msg_stage_t * const RESTR stage = (acct_msg_stage_t *)(trav += ring_len * max_workers);
+    u32 * const RESTR bucket_to_shard = (u32 *)(trav += stage_len * max_workers);
+
+    const u32 account_n = acct_len / sizeof(account_t);
+    const u32 xfer_n = (xfer_len ? xfer_len : HUGE_2M_SIZE) / sizeof(transfer_t);
+    acct_shard_t shard[max_workers];
+    u32 i, nw;
+
+    randomize_data(xfer, xfer_n * sizeof(transfer_t));
+    gen_transfers(xfer, xfer_n, account_n - 1);
+
+    memset(alt, 0, acct_len);
+    const u64 pre_scalar = wall_clock_ns();
+    apply_transfers_scalar(alt, xfer, xfer_n);
+    const u64 scalar_ns = wall_clock_ns() - pre_scalar;
+
+    printf("%s: %u transfers over %u accounts, scalar reference %.2f Mtps.\n", args[0], xfer_n,
+           account_n, ((float)xfer_n * 1000.0) / (float)scalar_ns);
+
+    for (nw = 1; nw <= max_workers; nw++) {
+        u32 done = 0;
+
+        memset(account, 0, acct_len);
+        memset(stage, 0, stage_len * nw);
+
+        for (i = 0; i < ACCT_SHARD_BUCKETS; i++) {
+            bucket_to_shard[i] = i % nw;
+        }
+
+        for (i = 0; i < nw; i++) {
+            shard[i] = (acct_shard_t) {
+                .account = account, .done = &done,
+                .ring = spsc_ring_init(ring_mem + (ring_len * i), ACCT_SHARD_RING_SLOTS),
+            };
+        }
+
+        const u64 pre = wall_clock_ns();
+
+        for (i = 0; i < nw; i++) {
+            if (pthread_create(&shard[i].thread, NULL, acct_shard_worker, shard + i)) {
+                printf("%s: Cannot create worker thread %u.\n", args[0], i);
+                __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+                nw = i;
+
+                for (i = 0; i < nw; i++) {
+                    pthread_join(shard[i].thread, NULL);
+                }
+
+                unmap_segment(&dseg);
+                return -1;
+            }
+        }
+
+        const u32_16 lane = IDX_VEC(u32_16);
+        const u32_16 half = lane / 2;
+        const __mmask16 odd = 0xAAAA;
+
+        for (i = 0; i < xfer_n; i += 8) {
+            /* Gather 8 transfers and interleave them as debit, credit, debit, credit, ... */
+            const u32_16 xidx = (half + i) * (sizeof(transfer_t) / sizeof(u32));
+            const __mmask16 valid = VEC_TO_MASK((half + i) < xfer_n);
+            const u32_16 zero = {};
+            const u32_16 from = (u32_16)_mm512_mask_i32gather_epi32((__m512i)zero, valid,
+                                (__m512i)xidx, &xfer->from, sizeof(u32));
+            const u32_16 to = (u32_16)_mm512_mask_i32gather_epi32((__m512i)zero, valid,
+                              (__m512i)xidx, &xfer->to, sizeof(u32));
+            const i32_16 delta = (i32_16)_mm512_mask_i32gather_epi32((__m512i)zero, valid,
+                                 (__m512i)xidx, &xfer->delta, sizeof(u32));
+            const u32_16 acct = MUX_ON_MASK(odd, to, from);
+            const i32_16 sdelta = MUX_ON_MASK(odd, delta, -delta);
+
+            acct_dispatch_x16(stage, shard, bucket_to_shard, acct, sdelta, half + i, valid);
+        }
+
+        for (i = 0; i < nw; i++) {
+            acct_stage_flush(stage + i, shard[i].ring);
+        }
+
+        __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+
+        for (i = 0; i < nw; i++) {
+            pthread_join(shard[i].thread, NULL);
+        }
+
+        const u64 elapsed = wall_clock_ns() - pre;
+
+        printf("%s: %2u worker%s %.2f Mtps (%.2fx scalar) -- ", args[0], nw, (nw > 1) ? "s:" : ": ",
+               ((float)xfer_n * 1000.0) / (float)elapsed, (float)scalar_ns / (float)elapsed);
+
+        if (memcmp(account, alt, acct_len)) {
+            printf("Result validation failed!\n");
+            unmap_segment(&dseg);
+            return -1;
+        }
+
+        printf("Result validation OK.\n");
+    }
+
+    unmap_segment(&dseg);
+    return 0;
+}
+
+PERF_FUNC_ENTRY(accounts_sharded,
+                "Accounts table sharded across 1..max_workers cores fed by per-core SPSC rings.",
+                "max_workers", "xfer_mb");
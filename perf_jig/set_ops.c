@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <libgen.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#include "perf_jig.h"
+
+/*
+ * The textbook merge, one element per iteration: 0 intersection, 1 union, 2 difference.
+ */
+static u64 __attribute__((noinline)) scalar_set_op(const int op, u32 * const RESTR dst,
+                                                   const u32 * const RESTR a, const u64 na,
+                                                   const u32 * const RESTR b, const u64 nb)
+{
+    u64 i = 0, j = 0, n = 0;
+
+    while ((i < na) && (j < nb)) {
+        if (a[i] < b[j]) {
+            if (op) {
+                dst[n++] = a[i];
+            }
+            i++;
+        } else if (b[j] < a[i]) {
+            if (op == 1) {
+                dst[n++] = b[j];
+            }
+            j++;
+        } else {
+            if (op < 2) {
+                dst[n++] = a[i];
+            }
+            i++;
+            j++;
+        }
+    }
+
+    if (op) {
+        __builtin_memcpy(dst + n, a + i, (na - i) * sizeof(u32));
+        n += na - i;
+    }
+
+    if (op == 1) {
+        __builtin_memcpy(dst + n, b + j, (nb - j) * sizeof(u32));
+        n += nb - j;
+    }
+
+    return n;
+}
+
+static u64 __attribute__((noinline)) simd_set_op(const int op, u32 * const RESTR dst,
+                                                 const u32 * const RESTR a, const u64 na,
+                                                 const u32 * const RESTR b, const u64 nb)
+{
+    switch (op) {
+    case 0:
+        return set_intersect_u32(dst, a, na, b, nb);
+    case 1:
+        return set_union_u32(dst, a, na, b, nb);
+    default:
+        return set_diff_u32(dst, a, na, b, nb);
+    }
+}
+
+/*
+ * Strictly increasing, each step 1 .. 2 * gap.
+ */
+static void make_set(u32 * const s, const u64 n, const u32 gap, u32 * const rnd)
+{
+    u32 v = 0;
+    u64 i;
+
+    randomize_data(rnd, n * sizeof(u32));
+
+    for (i = 0; i < n; i++) {
+        v += 1 + (rnd[i] % (2 * gap));
+        s[i] = v;
+    }
+}
+
+/*
+ *    Intersection, union and difference of a set of nb values with sets nb / ratio the size,
+ * for ratios from 1 to 4096, both drawn from the same range of values.  gap sets the density:
+ * the large set has about 1 in gap of the values in its range, so with gap 1 most of the small
+ * set is in the large one and with a big gap very little is.  Reports clocks per element of
+ * input (na + nb), scalar merge vs set_util.h.
+ */
+static int perf_test_set_ops(const char **args)
+{
+    char errbuf[1024] = {};
+    const u64 nb   = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : (1 << 20);
+    const u32 gap  = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 2;
+    const u32 ratios[] = { 1, 2, 4, 16, 64, 256, 1024, 4096 };
+    const char * const names[] = { "intersect", "union", "diff" };
+
+    if ((nb < 4096) | (gap == 0) | (gap > (1U << 30) / nb)) {
+        printf("%s: need 4096 <= nb and 0 < gap, with nb * gap < 2^30.\n", args[0]);
+        return -1;
+    }
+
+    const u64 len = nb * sizeof(u32);
+    seg_desc_t dseg = {
+        .maplen = ((6 * len) + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &dseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    u32 * const b = (u32 *)dseg.ptr;
+    u32 * const a = b + nb;
+    u32 * const out_scalar = a + nb;
+    u32 * const out_simd = out_scalar + (2 * nb);
+    unsigned r, op;
+    int ret = 0;
+
+    make_set(b, nb, gap, out_scalar);
+    memset(out_scalar, 0, 4 * len);
+
+    printf("%s(%lu, %u): clocks per input element, scalar / simd\n", args[0], nb, gap);
+    printf("\t%6s %8s", "ratio", "matched");
+    for (op = 0; op < 3; op++) {
+        printf(" %18s", names[op]);
+    }
+    printf("\n");
+
+    for (r = 0; r < sizeof(ratios) / sizeof(ratios[0]); r++) {
+        const u64 na = nb / ratios[r];
+        u64 matched = 0;
+
+        make_set(a, na, gap * ratios[r], out_scalar);
+        printf("\t%6u", ratios[r]);
+
+        for (op = 0; op < 3; op++) {
+            u64 pre, clk_scalar, clk_simd, n_scalar, n_simd;
+
+            pre = TSC_PRECISE();
+            n_scalar = scalar_set_op(op, out_scalar, a, na, b, nb);
+            clk_scalar = TSC_PRECISE() - pre;
+
+            pre = TSC_PRECISE();
+            n_simd = simd_set_op(op, out_simd, a, na, b, nb);
+            clk_simd = TSC_PRECISE() - pre;
+
+            if ((n_scalar != n_simd) || memcmp(out_scalar, out_simd, n_scalar * sizeof(u32))) {
+                printf("\n%s: %s with ratio %u gave %lu elements, expected %lu\n", args[0],
+                       names[op], ratios[r], n_simd, n_scalar);
+                ret = -1;
+            }
+
+            if (op == 0) {
+                matched = n_scalar;
+                printf(" %7.1f%%", na ? (100.0 * matched) / na : 0.0);
+            }
+
+            printf("      %5.2f / %5.2f", (float)clk_scalar / (na + nb),
+                   (float)clk_simd / (na + nb));
+        }
+
+        printf("\n");
+    }
+
+    unmap_segment(&dseg);
+    return ret;
+}
+
+PERF_FUNC_ENTRY(set_ops, "Sorted set intersection / union / difference at a range of size "
+                "ratios, scalar merge vs set_util.h.", "nb", "gap");
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <libgen.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#include "perf_jig.h"
+
+static int cmp_u32(const void *a, const void *b)
+{
+    const u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+    return (x > y) - (x < y);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    const u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void __attribute__((noinline)) simd_sort(void * const data, void * const scratch,
+                                                const u64 n, const u32 esz)
+{
+    if (esz == 4) {
+        sort_u32(data, scratch, n);
+    } else {
+        sort_u64(data, scratch, n);
+    }
+}
+
+/*
+ *    Sort the same random array with qsort() and with sort_u32/u64(), and the in-register
+ * networks alone on each vector of it (i.e. just the run generation), in clocks per element.
+ */
+static int perf_test_sort(const char **args)
+{
+    char errbuf[1024] = {};
+    const u64 nelem = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : (1 << 20);
+    const u32 esz   = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 4;
+
+    if ((nelem == 0) | ((esz != 4) & (esz != 8))) {
+        printf("%s: nelem must be non-zero and esz 4 or 8.\n", args[0]);
+        return -1;
+    }
+
+    const u64 len = nelem * esz;
+    const u64 alen = (len + 63) & ~63UL;
+    const u64 slen = 2 * SORT_SCRATCH_ELEMS(nelem, 64 / esz) * esz;
+    seg_desc_t dseg = {
+        .maplen = ((3 * alen) + slen + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &dseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    u8 * const orig = (u8 *)dseg.ptr;
+    u8 * const by_qsort = orig + alen;
+    u8 * const by_simd = by_qsort + alen;
+    u8 * const scratch = by_simd + alen;
+    u64 pre, clk_qsort, clk_simd, clk_runs, i;
+    int ret = 0;
+
+    randomize_data(orig, len);
+    memcpy(by_qsort, orig, len);
+    memcpy(by_simd, orig, len);
+    memset(scratch, 0, slen);
+
+    pre = TSC_PRECISE();
+    qsort(by_qsort, nelem, esz, (esz == 4) ? cmp_u32 : cmp_u64);
+    clk_qsort = TSC_PRECISE() - pre;
+
+    pre = TSC_PRECISE();
+    simd_sort(by_simd, scratch, nelem, esz);
+    clk_simd = TSC_PRECISE() - pre;
+
+    if (memcmp(by_qsort, by_simd, len)) {
+        printf("%s: qsort() and sort_u%u() disagree\n", args[0], esz * 8);
+        ret = -1;
+    }
+
+    memcpy(scratch, orig, len & ~63UL);
+
+    pre = TSC_PRECISE();
+    for (i = 0; i < (len & ~63UL); i += 64) {
+        if (esz == 4) {
+            *(u32_16 *)(scratch + i) = sort_u32_16(*(u32_16 *)(scratch + i));
+        } else {
+            *(u64_8 *)(scratch + i) = sort_u64_8(*(u64_8 *)(scratch + i));
+        }
+    }
+    clk_runs = TSC_PRECISE() - pre;
+
+    printf("%s(%lu, %u):\n", args[0], nelem, esz);
+    printf("\tqsort():         %8.2f clocks per element\n", (float)clk_qsort / nelem);
+    printf("\tsort_u%u():      %8.2f clocks per element (%.1fx)\n", esz * 8,
+           (float)clk_simd / nelem, (float)clk_qsort / clk_simd);
+    printf("\tvector networks: %8.2f clocks per element\n", (float)clk_runs / nelem);
+
+    unmap_segment(&dseg);
+    return ret;
+}
+
+PERF_FUNC_ENTRY(sort, "Sort a random array, qsort() vs bitonic networks + vector merge "
+                "(sort_u32/u64).", "nelem", "esz");
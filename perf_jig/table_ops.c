@@ -13,6 +13,7 @@
 #include "../include/simd_util.h"
 
 #include "perf_jig.h"
+#include "thread_pool.h"
 
 static int perf_test_translate_bytes(const char **args)
 {
@@ -79,3 +80,147 @@ static int perf_test_translate_bytes(const char **args)
 
 PERF_FUNC_ENTRY(translate_bytes,
                 "Perform byte-translation lookups in 256-entry tables 64 at a time.", "wset", "tables", "rounds");
+
+typedef struct {
+    u8_64 * RESTR                               data;
+    const simd_byte_translation_table * RESTR   table;
+    u32                                         tables;
+} translate_bytes_job_t;
+
+static void translate_bytes_range(void *ctx, const u64 start, const u64 end, const u32 worker)
+{
+    const translate_bytes_job_t * const RESTR job = (const translate_bytes_job_t *)ctx;
+    u64 k;
+    u32 j;
+
+    for (k = start; k < end; k++) {
+        u8_64 d = job->data[k];
+
+        for (j = 0; j < job->tables; j++) {
+            d = translate_bytes_x64(d, job->table + j);
+        }
+
+        job->data[k] = d;
+    }
+}
+
+static int perf_test_translate_bytes_mt(const char **args)
+{
+    char err_buf[1024] = {};
+    const unsigned max_threads  = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) :
+                                  sysconf(_SC_NPROCESSORS_ONLN);
+    const u64 numa_mask         = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 0;
+    const unsigned wset         = ARG_VALID(args[3]) ? strtoul(args[3], NULL, 0) : (1 << 16);
+    const unsigned tables       = ARG_VALID(args[4]) ? strtoul(args[4], NULL, 0) : 16;
+
+    if (!max_threads | !wset | !tables) {
+        printf("%s: max_threads, working set and tables must all be greater than zero.\n", args[0]);
+        return -1;
+    }
+
+    seg_desc_t dseg = {
+        .maplen = ((u64)wset * sizeof(u8_64)) + ((u64)tables * sizeof(simd_byte_translation_table)),
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &dseg, err_buf, sizeof(err_buf) - 1)) {
+        printf("%s: %s\n", args[0], err_buf);
+        return -1;
+    }
+
+    randomize_data(dseg.ptr, dseg.maplen);
+
+    translate_bytes_job_t job = {
+        .data = (u8_64 *)dseg.ptr,
+        .table = (simd_byte_translation_table *)((u8_64 *)dseg.ptr + wset),
+        .tables = tables
+    };
+
+    printf("%s(%u, 0x%lx, %u, %u):\n", args[0], max_threads, numa_mask, wset, tables);
+    const int ret = pool_scaling_curve(args[0], max_threads, numa_mask, wset, 64,
+                                       translate_bytes_range, &job, "bytes", 64.0 * tables);
+
+    consume_data(dseg.ptr, (u64)wset * sizeof(u8_64));
+    unmap_segment(&dseg);
+    return ret;
+}
+
+PERF_FUNC_ENTRY(translate_bytes_mt,
+                "Scaling curve for translate_bytes_x64() across 1..max_threads pinned workers.",
+                "max_threads", "numa_mask", "wset", "tables");
+
+typedef struct {
+    const u32 * RESTR   table;
+    const u32_16 * RESTR idx;
+    u32_16 * RESTR      accum;  // One per worker, 64 bytes apart
+    u32                 tsize;
+} table_lookup_job_t;
+
+static void table_lookup_range(void *ctx, const u64 start, const u64 end, const u32 worker)
+{
+    const table_lookup_job_t * const RESTR job = (const table_lookup_job_t *)ctx;
+    u32_16 acc = job->accum[worker];
+    u64 k;
+
+    for (k = start; k < end; k++) {
+        acc ^= gather_u32_from_lookup_table_x16(job->idx[k], job->table, job->tsize);
+    }
+
+    job->accum[worker] = acc;
+}
+
+static int perf_test_table_lookup_mt(const char **args)
+{
+    char err_buf[1024] = {};
+    const unsigned max_threads  = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) :
+                                  sysconf(_SC_NPROCESSORS_ONLN);
+    const u64 numa_mask         = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 0;
+    const unsigned table_mb     = ARG_VALID(args[3]) ? strtoul(args[3], NULL, 0) : 256;
+    const unsigned nlookups     = ARG_VALID(args[4]) ? strtoul(args[4], NULL, 0) : (1 << 24);
+
+    if (!max_threads | !table_mb | (table_mb > 4096) | !nlookups | (nlookups & 15)) {
+        printf("%s: max_threads must be non-zero, 0 < table_mb <= 4096 and nlookups must be a "
+               "non-zero multiple of 16.\n", args[0]);
+        return -1;
+    }
+
+    const u64 tlen = (u64)table_mb << 20;
+    const u64 ilen = (u64)nlookups * sizeof(u32);
+    const u64 alen = (u64)max_threads * sizeof(u32_16);
+    seg_desc_t dseg = {
+        .maplen = (tlen + ilen + alen + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &dseg, err_buf, sizeof(err_buf) - 1)) {
+        printf("%s: %s\n", args[0], err_buf);
+        return -1;
+    }
+
+    randomize_data(dseg.ptr, tlen + ilen);
+
+    table_lookup_job_t job = {
+        .table = (const u32 *)dseg.ptr,
+        .idx = (const u32_16 *)((u8 *)dseg.ptr + tlen),
+        .accum = (u32_16 *)((u8 *)dseg.ptr + tlen + ilen),
+        .tsize = tlen / sizeof(u32)
+    };
+    u32 * const idx = (u32 *)job.idx;
+    unsigned i;
+
+    for (i = 0; i < nlookups; i++) {
+        idx[i] &= job.tsize - 1;
+    }
+
+    printf("%s(%u, 0x%lx, %u, %u):\n", args[0], max_threads, numa_mask, table_mb, nlookups);
+    const int ret = pool_scaling_curve(args[0], max_threads, numa_mask, nlookups / 16, 256,
+                                       table_lookup_range, &job, "lookups", 16.0);
+
+    consume_data(job.accum, alen);
+    unmap_segment(&dseg);
+    return ret;
+}
+
+PERF_FUNC_ENTRY(table_lookup_mt,
+                "Scaling curve for random 16-wide gathers from a large table (latency / DRAM bound).",
+                "max_threads", "numa_mask", "table_mb", "nlookups");
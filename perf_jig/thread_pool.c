@@ -0,0 +1,447 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "../include/simd_util.h"
+
+#include "perf_jig.h"
+#include "thread_pool.h"
+
+#define POOL_MAX_THREADS    (256)
+
+/*
+ * One per worker, each on its own cache line(s) since thieves hammer on other workers' deques.
+ */
+typedef struct {
+    u32                 lock __attribute__((__aligned__(64)));
+    u64                 begin;
+    u64                 end;
+    pool_worker_stats_t stats;
+    thread_pool_t      *pool;
+    pthread_t           thread;
+    u32                 idx;
+    int                 cpu;
+} pool_worker_t;
+
+struct thread_pool {
+    pthread_mutex_t     mtx;
+    pthread_cond_t      go;
+    pthread_cond_t      done;
+    u64                 generation;     // Bumped for each job (and for shutdown)
+    u32                 n_done;         // Workers finished with the current job
+    u32                 shutdown;
+    u32                 nthreads;
+
+    /* The current job */
+    pool_range_fn       fn;
+    void               *ctx;
+    u64                 grain;
+
+    pool_worker_t       worker[0];
+};
+
+static inline void deque_lock(pool_worker_t * const w)
+{
+    u32 spins = 0;
+
+    while (__atomic_exchange_n(&w->lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&w->lock, __ATOMIC_RELAXED)) {
+            ring_backoff(&spins);
+        }
+    }
+}
+
+static inline void deque_unlock(pool_worker_t * const w)
+{
+    __atomic_store_n(&w->lock, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Owner side: take up to grain items off the front of our own deque.
+ */
+static int deque_take(pool_worker_t * const w, const u64 grain, u64 * const start, u64 * const end)
+{
+    int ret = 0;
+
+    deque_lock(w);
+
+    if (w->begin < w->end) {
+        *start = w->begin;
+        *end = ((w->end - w->begin) > grain) ? (w->begin + grain) : w->end;
+        w->begin = *end;
+        ret = 1;
+    }
+
+    deque_unlock(w);
+    return ret;
+}
+
+/*
+ * Thief side: move the back half of some other worker's remaining range into our own (empty)
+ * deque.  Victims are visited round robin starting just after ourselves so thieves spread out.
+ * A victim with no more than a grain left is skipped: it will finish that itself soon enough.
+ */
+static int deque_steal(pool_worker_t * const self, const u64 grain)
+{
+    thread_pool_t * const pool = self->pool;
+    u32 i;
+
+    for (i = 1; i < pool->nthreads; i++) {
+        pool_worker_t * const v = pool->worker + ((self->idx + i) % pool->nthreads);
+        u64 lo = 0, hi = 0;
+
+        if ((__atomic_load_n(&v->end, __ATOMIC_RELAXED) -
+                __atomic_load_n(&v->begin, __ATOMIC_RELAXED)) <= grain) {
+            continue;
+        }
+
+        deque_lock(v);
+
+        if ((v->end > v->begin) && ((v->end - v->begin) > grain)) {
+            hi = v->end;
+            lo = v->begin + ((v->end - v->begin) / 2);
+            v->end = lo;
+        }
+
+        deque_unlock(v);
+
+        if (hi > lo) {
+            deque_lock(self);
+            self->begin = lo;
+            self->end = hi;
+            deque_unlock(self);
+            self->stats.steals++;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void *pool_worker_main(void *arg)
+{
+    pool_worker_t * const w = (pool_worker_t *)arg;
+    thread_pool_t * const pool = w->pool;
+    u64 seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->mtx);
+
+        while ((pool->generation == seen) && !pool->shutdown) {
+            pthread_cond_wait(&pool->go, &pool->mtx);
+        }
+
+        seen = pool->generation;
+
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->mtx);
+            break;
+        }
+
+        const pool_range_fn fn = pool->fn;
+        void * const ctx = pool->ctx;
+        const u64 grain = pool->grain;
+        pthread_mutex_unlock(&pool->mtx);
+
+        do {
+            u64 start, end;
+
+            while (deque_take(w, grain, &start, &end)) {
+                fn(ctx, start, end, w->idx);
+                w->stats.items += end - start;
+            }
+        } while (deque_steal(w, grain));
+
+        pthread_mutex_lock(&pool->mtx);
+
+        if (++pool->n_done == pool->nthreads) {
+            pthread_cond_signal(&pool->done);
+        }
+
+        pthread_mutex_unlock(&pool->mtx);
+    }
+
+    return NULL;
+}
+
+/*
+ * Parse a sysfs style CPU list ("0-3,8,10-11") into set.
+ */
+static int parse_cpu_list(const char *s, cpu_set_t * const set)
+{
+    char *trav;
+
+    CPU_ZERO(set);
+
+    while (*s) {
+        const long lo = strtol(s, &trav, 10);
+        long hi = lo;
+
+        if (trav == s) {
+            return -1;
+        }
+
+        if (*trav == '-') {
+            s = trav + 1;
+            hi = strtol(s, &trav, 10);
+
+            if ((trav == s) | (hi < lo)) {
+                return -1;
+            }
+        }
+
+        for (long c = lo; (c <= hi) && (c < CPU_SETSIZE); c++) {
+            CPU_SET(c, set);
+        }
+
+        s = trav + (*trav == ',');
+
+        if ((*s == '\n') | (*s == '\0')) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * The CPUs of the NUMA nodes selected by numa_mask, from /sys so we don't depend on libnuma.
+ */
+static int numa_cpus(const u64 numa_mask, cpu_set_t * const set, char *errbuf, const unsigned eblen)
+{
+    char path[128], buf[4096];
+    cpu_set_t node;
+    u32 n;
+
+    CPU_ZERO(set);
+
+    for (n = 0; n < 64; n++) {
+        if (!((numa_mask >> n) & 1)) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", n);
+        const int fd = open(path, O_RDONLY);
+
+        if (fd < 0) {
+            snprintf(errbuf, eblen - 1, "Cannot open %s: %s", path, strerror(errno));
+            return -1;
+        }
+
+        const ssize_t len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+
+        if (len <= 0) {
+            snprintf(errbuf, eblen - 1, "Cannot read %s", path);
+            return -1;
+        }
+
+        buf[len] = '\0';
+
+        if (parse_cpu_list(buf, &node)) {
+            snprintf(errbuf, eblen - 1, "Cannot parse %s", path);
+            return -1;
+        }
+
+        CPU_OR(set, set, &node);
+    }
+
+    return 0;
+}
+
+thread_pool_t *thread_pool_create(const u32 nthreads, const u64 numa_mask, char *errbuf,
+                                  const unsigned eblen)
+{
+    cpu_set_t allowed, nodes;
+    int cpus[CPU_SETSIZE];
+    u32 i, ncpus = 0;
+
+    memset(errbuf, 0, eblen);
+
+    if ((nthreads == 0) | (nthreads > POOL_MAX_THREADS)) {
+        snprintf(errbuf, eblen - 1, "nthreads must be between 1 and %u.", POOL_MAX_THREADS);
+        return NULL;
+    }
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        snprintf(errbuf, eblen - 1, "sched_getaffinity() failed: %s", strerror(errno));
+        return NULL;
+    }
+
+    if (numa_mask) {
+        if (numa_cpus(numa_mask, &nodes, errbuf, eblen)) {
+            return NULL;
+        }
+
+        CPU_AND(&allowed, &allowed, &nodes);
+    }
+
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &allowed)) {
+            cpus[ncpus++] = i;
+        }
+    }
+
+    if (ncpus == 0) {
+        snprintf(errbuf, eblen - 1, "No usable CPUs in NUMA node mask 0x%lx.", numa_mask);
+        return NULL;
+    }
+
+    thread_pool_t * const pool = aligned_alloc(64, (sizeof(thread_pool_t) +
+                                 (nthreads * sizeof(pool_worker_t)) + 63) & ~63UL);
+
+    if (pool == NULL) {
+        snprintf(errbuf, eblen - 1, "Cannot allocate pool.");
+        return NULL;
+    }
+
+    memset(pool, 0, sizeof(*pool) + (nthreads * sizeof(pool_worker_t)));
+    pthread_mutex_init(&pool->mtx, NULL);
+    pthread_cond_init(&pool->go, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (i = 0; i < nthreads; i++) {
+        pool_worker_t * const w = pool->worker + i;
+        cpu_set_t one;
+
+        w->pool = pool;
+        w->idx = i;
+        w->cpu = cpus[i % ncpus];
+
+        if (pthread_create(&w->thread, NULL, pool_worker_main, w)) {
+            snprintf(errbuf, eblen - 1, "Cannot create worker thread %u: %s", i, strerror(errno));
+            pool->nthreads = i;
+            thread_pool_destroy(pool);
+            return NULL;
+        }
+
+        pool->nthreads = i + 1;
+        CPU_ZERO(&one);
+        CPU_SET(w->cpu, &one);
+        pthread_setaffinity_np(w->thread, sizeof(one), &one);
+    }
+
+    return pool;
+}
+
+void thread_pool_destroy(thread_pool_t *pool)
+{
+    u32 i;
+
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mtx);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->go);
+    pthread_mutex_unlock(&pool->mtx);
+
+    for (i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->worker[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->go);
+    pthread_mutex_destroy(&pool->mtx);
+    free(pool);
+}
+
+u32 thread_pool_size(const thread_pool_t *pool)
+{
+    return pool->nthreads;
+}
+
+int thread_pool_cpu(const thread_pool_t *pool, const u32 worker)
+{
+    return (worker < pool->nthreads) ? pool->worker[worker].cpu : -1;
+}
+
+const pool_worker_stats_t *thread_pool_stats(const thread_pool_t *pool, const u32 worker)
+{
+    return (worker < pool->nthreads) ? &pool->worker[worker].stats : NULL;
+}
+
+void pool_parallel_for(thread_pool_t *pool, const u64 n, const u64 grain, pool_range_fn fn,
+                       void *ctx)
+{
+    const u32 nt = pool->nthreads;
+    u32 i;
+
+    if (n == 0) {
+        return;
+    }
+
+    // Workers are all parked on the condition variable here, so their deques are ours to fill.
+    for (i = 0; i < nt; i++) {
+        pool->worker[i].begin = (n * i) / nt;
+        pool->worker[i].end = (n * (i + 1)) / nt;
+    }
+
+    pthread_mutex_lock(&pool->mtx);
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->grain = grain ? grain : 1;
+    pool->n_done = 0;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->go);
+
+    while (pool->n_done < nt) {
+        pthread_cond_wait(&pool->done, &pool->mtx);
+    }
+
+    pthread_mutex_unlock(&pool->mtx);
+}
+
+int pool_scaling_curve(const char *name, const u32 max_threads, const u64 numa_mask, const u64 n,
+                       const u64 grain, pool_range_fn fn, void *ctx, const char *unit,
+                       const double units_per_item)
+{
+    char errbuf[1024] = {};
+    double base = 0.0;
+    u32 nt, i;
+
+    for (nt = 1; nt <= max_threads; nt++) {
+        thread_pool_t * const pool = thread_pool_create(nt, numa_mask, errbuf, sizeof(errbuf));
+
+        if (pool == NULL) {
+            printf("%s: %s\n", name, errbuf);
+            return -1;
+        }
+
+        // One untimed pass to fault in / warm up caches the same way for every thread count
+        pool_parallel_for(pool, n, grain, fn, ctx);
+
+        u64 steals = 0;
+
+        for (i = 0; i < nt; i++) {
+            steals -= thread_pool_stats(pool, i)->steals;
+        }
+
+        const u64 pre = wall_clock_ns();
+        pool_parallel_for(pool, n, grain, fn, ctx);
+        const u64 elapsed = wall_clock_ns() - pre;
+
+        const double rate = ((double)n * units_per_item * 1000.0) / (double)elapsed;
+
+        for (i = 0; i < nt; i++) {
+            steals += thread_pool_stats(pool, i)->steals;
+        }
+
+        base = (nt == 1) ? rate : base;
+        printf("\t%3u thread%s %10.2f M%s/s (%.2fx) %6lu steals\n", nt, (nt > 1) ? "s:" : ": ",
+               rate, unit, rate / base, steals);
+
+        thread_pool_destroy(pool);
+    }
+
+    return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+/*
+ *    A small work-stealing thread pool so perf_jig tests can measure how a kernel scales with
+ * cores (and, past a point, with memory bandwidth).
+ *
+ *    The only kind of job is a parallel-for over [0, n).  Each worker starts out owning an equal
+ * contiguous slice of the range in its own deque and takes grain-sized pieces off the front of
+ * it; a worker which runs dry steals the back half of whatever another worker has left.  Ranges
+ * only ever shrink or move between owners, so once a worker has swept every other deque without
+ * finding more than a grain's worth of work it is done.
+ *
+ *    Workers are pinned one per CPU, taking CPUs in order from the set the process is allowed to
+ * run on (wrapping around if there are more workers than CPUs).  A non-zero numa_mask further
+ * restricts that set to the CPUs of the selected NUMA nodes (bit i selects node i).
+ */
+
+typedef struct thread_pool thread_pool_t;
+
+/*
+ * Body of a parallel-for: process items [start, end).  worker is the index of the calling worker
+ * (0 .. nthreads - 1) for callers that keep per-worker state.
+ */
+typedef void (*pool_range_fn)(void *ctx, u64 start, u64 end, u32 worker);
+
+typedef struct {
+    u64 items;      // Items this worker processed
+    u64 steals;     // Successful steals by this worker
+} pool_worker_stats_t;
+
+thread_pool_t *thread_pool_create(const u32 nthreads, const u64 numa_mask, char *errbuf,
+                                  const unsigned eblen);
+void thread_pool_destroy(thread_pool_t *pool);
+u32 thread_pool_size(const thread_pool_t *pool);
+int thread_pool_cpu(const thread_pool_t *pool, const u32 worker);
+const pool_worker_stats_t *thread_pool_stats(const thread_pool_t *pool, const u32 worker);
+
+/*
+ * Run fn over [0, n) in pieces of at most grain items and return once all of it is done.
+ */
+void pool_parallel_for(thread_pool_t *pool, const u64 n, const u64 grain, pool_range_fn fn,
+                       void *ctx);
+
+/*
+ * Time pool_parallel_for(n, grain, fn, ctx) with 1 .. max_threads workers and print throughput in
+ * millions of 'unit' per second and the speedup over one worker.  fn must be safe to run
+ * repeatedly over the same data.  Returns 0, or -1 if a pool could not be created.
+ */
+int pool_scaling_curve(const char *name, const u32 max_threads, const u64 numa_mask, const u64 n,
+                       const u64 grain, pool_range_fn fn, void *ctx, const char *unit,
+                       const double units_per_item);
+
+#endif /* _THREAD_POOL_H_ */
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <libgen.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#include "perf_jig.h"
+
+static int cmp_desc_u32(const void *a, const void *b)
+{
+    const u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+    return (x < y) - (x > y);
+}
+
+static int cmp_desc_u64(const void *a, const void *b)
+{
+    const u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+    return (x < y) - (x > y);
+}
+
+static u64 __attribute__((noinline)) simd_topk(void * const dst, const void * const src,
+                                               const u64 n, const u64 k, void * const mem,
+                                               const u32 esz)
+{
+    if (esz == 4) {
+        return topk_u32(dst, src, n, k, mem);
+    }
+
+    return topk_u64(dst, src, n, k, mem);
+}
+
+/*
+ *    The k largest of a random array of n, for n from 64K up to max_n and k from 10 to 10000:
+ * qsort() of the whole array (independent of k) vs topk_u32/u64(), in clocks per element.
+ */
+static int perf_test_topk(const char **args)
+{
+    char errbuf[1024] = {};
+    const u64 max_n = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : (1 << 22);
+    const u32 esz   = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 4;
+    const u64 ks[] = { 10, 100, 1000, 10000 };
+    const u64 nk = sizeof(ks) / sizeof(ks[0]);
+
+    if ((max_n < (1 << 16)) | ((esz != 4) & (esz != 8))) {
+        printf("%s: max_n must be at least 65536 and esz 4 or 8.\n", args[0]);
+        return -1;
+    }
+
+    const u64 len = ((max_n * esz) + 63) & ~63UL;
+    const u64 mlen = ((TOPK_MEM_ELEMS(ks[nk - 1], 64 / esz) * esz) + 63) & ~63UL;
+    seg_desc_t dseg = {
+        .maplen = ((2 * len) + mlen + (ks[nk - 1] * esz) + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &dseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    u8 * const orig = (u8 *)dseg.ptr;
+    u8 * const sorted = orig + len;
+    u8 * const mem = sorted + len;
+    u8 * const out = mem + mlen;
+    u64 n, i;
+    int ret = 0;
+
+    randomize_data(orig, max_n * esz);
+    memset(mem, 0, mlen);
+    memset(out, 0, ks[nk - 1] * esz);
+
+    printf("%s(%lu, %u): clocks per element\n", args[0], max_n, esz);
+    printf("\t%10s %10s", "n", "qsort");
+    for (i = 0; i < nk; i++) {
+        printf("  k=%-7lu", ks[i]);
+    }
+    printf("\n");
+
+    for (n = 1 << 16; n <= max_n; n <<= 2) {
+        u64 pre, clk;
+
+        memcpy(sorted, orig, n * esz);
+
+        pre = TSC_PRECISE();
+        qsort(sorted, n, esz, (esz == 4) ? cmp_desc_u32 : cmp_desc_u64);
+        clk = TSC_PRECISE() - pre;
+
+        printf("\t%10lu %10.2f", n, (float)clk / n);
+
+        /* Untimed, so every k finds the array in the same state after the qsort(). */
+        simd_topk(out, orig, n, ks[0], mem, esz);
+
+        for (i = 0; i < nk; i++) {
+            const u64 expect = (n < ks[i]) ? n : ks[i];
+            u64 got;
+
+            pre = TSC_PRECISE();
+            got = simd_topk(out, orig, n, ks[i], mem, esz);
+            clk = TSC_PRECISE() - pre;
+
+            printf(" %10.2f", (float)clk / n);
+
+            if ((got != expect) || memcmp(out, sorted, expect * esz)) {
+                printf("\n%s: topk_u%u() of %lu with k %lu disagrees with qsort()\n", args[0],
+                       esz * 8, n, ks[i]);
+                ret = -1;
+            }
+        }
+
+        printf("\n");
+    }
+
+    unmap_segment(&dseg);
+    return ret;
+}
+
+PERF_FUNC_ENTRY(topk, "The k largest of a random array, full qsort() vs threshold filter + "
+                "compress (topk_u32/u64) at a range of n and k.", "max_n", "esz");
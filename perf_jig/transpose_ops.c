@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <libgen.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#include "perf_jig.h"
+
+/*
+ * A handful of record shapes to see where per-field gathers stop paying off against loading whole
+ * records and transposing them.
+ */
+typedef struct {
+    u32 a, b, c, d;
+} sg16_t;
+
+typedef struct {
+    u32 a, pad0;
+    u64 b;
+    u32 c, pad1;
+    u64 d;
+} sg32_t;
+
+typedef struct {
+    u32 f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15;
+} sg64_t;
+
+typedef struct {
+    u64 key;
+    u32 x;
+    u32 pad[28];
+    u32 y;
+} sg128_t;
+
+#define SG16_FIELDS(F32, F64)       F32(a) F32(c)
+#define SG32_FIELDS(F32, F64)       F32(a) F64(b) F32(c) F64(d)
+#define SG64_2_FIELDS(F32, F64)     F32(f0) F32(f9)
+#define SG64_8_FIELDS(F32, F64)     F32(f0) F32(f2) F32(f4) F32(f6) F32(f8) F32(f10) F32(f12) F32(f14)
+#define SG64_16_FIELDS(F32, F64)    F32(f0) F32(f1) F32(f2) F32(f3) F32(f4) F32(f5) F32(f6)     \
+                                    F32(f7) F32(f8) F32(f9) F32(f10) F32(f11) F32(f12) F32(f13) \
+                                    F32(f14) F32(f15)
+#define SG128_FIELDS(F32, F64)      F64(key) F32(x) F32(y)
+
+DEFINE_AOS_SOA_TRANSPOSE(sg16, sg16_t, SG16_FIELDS)
+DEFINE_AOS_SOA_GATHER(sg16, sg16_t, SG16_FIELDS)
+DEFINE_AOS_SOA_TRANSPOSE(sg32, sg32_t, SG32_FIELDS)
+DEFINE_AOS_SOA_GATHER(sg32, sg32_t, SG32_FIELDS)
+DEFINE_AOS_SOA_TRANSPOSE(sg64_2, sg64_t, SG64_2_FIELDS)
+DEFINE_AOS_SOA_GATHER(sg64_2, sg64_t, SG64_2_FIELDS)
+DEFINE_AOS_SOA_TRANSPOSE(sg64_8, sg64_t, SG64_8_FIELDS)
+DEFINE_AOS_SOA_GATHER(sg64_8, sg64_t, SG64_8_FIELDS)
+DEFINE_AOS_SOA_TRANSPOSE(sg64_16, sg64_t, SG64_16_FIELDS)
+DEFINE_AOS_SOA_GATHER(sg64_16, sg64_t, SG64_16_FIELDS)
+DEFINE_SOA_TYPE(sg128, SG128_FIELDS);
+DEFINE_AOS_SOA_GATHER(sg128, sg128_t, SG128_FIELDS)
+
+/*
+ * Time each strategy over nb batches of 16 records and report clocks per batch: gather with
+ * fields, gather with rows, then scatter (of what was gathered) with fields and with rows.
+ */
+#define SG_BENCH(_name, _struct, _ptrs, _nb, _clk)                                          \
+({                                                                                          \
+    _name##_soa_t __soa[16];                                                                \
+    u64 __pre;                                                                              \
+    u32 __i;                                                                                \
+                                                                                            \
+    __pre = TSC_PRECISE();                                                                  \
+    for (__i = 0; __i < (_nb); __i++) {                                                     \
+        _name##_gather_fields((_ptrs) + (2 * __i), __soa + (__i & 15));                     \
+    }                                                                                       \
+    (_clk)[0] = TSC_PRECISE() - __pre;                                                      \
+    consume_data(__soa, sizeof(__soa));                                                     \
+                                                                                            \
+    __pre = TSC_PRECISE();                                                                  \
+    for (__i = 0; __i < (_nb); __i++) {                                                     \
+        _name##_gather_rows((_ptrs) + (2 * __i), __soa + (__i & 15));                       \
+    }                                                                                       \
+    (_clk)[1] = TSC_PRECISE() - __pre;                                                      \
+    consume_data(__soa, sizeof(__soa));                                                     \
+                                                                                            \
+    __pre = TSC_PRECISE();                                                                  \
+    for (__i = 0; __i < (_nb); __i++) {                                                     \
+        _name##_scatter_fields(__soa + (__i & 15), (_ptrs) + (2 * __i));                    \
+    }                                                                                       \
+    (_clk)[2] = TSC_PRECISE() - __pre;                                                      \
+                                                                                            \
+    __pre = TSC_PRECISE();                                                                  \
+    for (__i = 0; __i < (_nb); __i++) {                                                     \
+        _name##_scatter_rows(__soa + (__i & 15), (_ptrs) + (2 * __i));                      \
+    }                                                                                       \
+    (_clk)[3] = TSC_PRECISE() - __pre;                                                      \
+}) /* end of macro */
+
+#define SG_NFIELDS(_fields)         (0 _fields(_SG_COUNT32, _SG_COUNT64))
+
+static void sg_report(const char *shape, const u32 size, const u32 nfields, const u64 * const clk,
+                      const u32 nb)
+{
+    const char *pick = ((size <= AOS_SOA_ROWS_MAX_BYTES) && (nfields >= AOS_SOA_ROWS_MIN_FIELDS)) ?
+                       "rows" : "fields";
+
+    printf("\t%-8s %4u %7u %9.1f %9.1f %10.1f %10.1f   %s\n", shape, size, nfields,
+           (float)clk[0] / nb, (float)clk[1] / nb, (float)clk[2] / nb, (float)clk[3] / nb, pick);
+}
+
+static int perf_test_aos_soa_gather(const char **args)
+{
+    char errbuf[1024] = {};
+    const u32 nrecs = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : 4096;
+    const u32 nb    = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : (1 << 16);
+
+    if ((nrecs < 16) | !nb) {
+        printf("%s: nrecs must be at least 16 and nbatches non-zero.\n", args[0]);
+        return -1;
+    }
+
+    const u64 plen = (u64)nb * 2 * sizeof(mpv_8);
+    const u64 ilen = (u64)nb * 16 * sizeof(u32);
+    const u64 rlen = (u64)nrecs * sizeof(sg128_t);
+    seg_desc_t dseg = {
+        .maplen = (plen + ilen + rlen + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &dseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    mpv_8 * const RESTR ptrs = (mpv_8 *)dseg.ptr;
+    u32 * const RESTR ridx = (u32 *)((u8 *)dseg.ptr + plen);   // Random record per lane
+    u8 * const RESTR recs = (u8 *)ridx + ilen;
+    u64 clk[4];
+    u32 i;
+
+    randomize_data(ridx, ilen + rlen);
+
+    for (i = 0; i < nb * 16; i++) {
+        ridx[i] %= nrecs;
+    }
+
+#define SG_POINT(_struct)                                                                   \
+    for (i = 0; i < nb * 16; i++) {                                                         \
+        ptrs[i / 8].mp[i % 8].p = recs + ((u64)ridx[i] * sizeof(_struct));                  \
+    }
+
+    printf("%s(%u, %u): clocks per 16 records\n", args[0], nrecs, nb);
+    printf("\t%-8s %4s %7s %9s %9s %10s %10s   %s\n", "shape", "size", "nfields", "g_fields",
+           "g_rows", "s_fields", "s_rows", "auto");
+
+    SG_POINT(sg16_t);
+    SG_BENCH(sg16, sg16_t, ptrs, nb, clk);
+    sg_report("sg16", sizeof(sg16_t), SG_NFIELDS(SG16_FIELDS), clk, nb);
+
+    SG_POINT(sg32_t);
+    SG_BENCH(sg32, sg32_t, ptrs, nb, clk);
+    sg_report("sg32", sizeof(sg32_t), SG_NFIELDS(SG32_FIELDS), clk, nb);
+
+    SG_POINT(sg64_t);
+    SG_BENCH(sg64_2, sg64_t, ptrs, nb, clk);
+    sg_report("sg64_2", sizeof(sg64_t), SG_NFIELDS(SG64_2_FIELDS), clk, nb);
+    SG_BENCH(sg64_8, sg64_t, ptrs, nb, clk);
+    sg_report("sg64_8", sizeof(sg64_t), SG_NFIELDS(SG64_8_FIELDS), clk, nb);
+    SG_BENCH(sg64_16, sg64_t, ptrs, nb, clk);
+    sg_report("sg64_16", sizeof(sg64_t), SG_NFIELDS(SG64_16_FIELDS), clk, nb);
+
+    SG_POINT(sg128_t);
+    SG_BENCH(sg128, sg128_t, ptrs, nb, clk);
+    sg_report("sg128", sizeof(sg128_t), SG_NFIELDS(SG128_FIELDS), clk, nb);
+
+#undef SG_POINT
+
+    unmap_segment(&dseg);
+    return 0;
+}
+
+PERF_FUNC_ENTRY(aos_soa_gather,
+                "Gather/scatter 16 records to/from SOA via per-field gathers vs row loads + transpose.",
+                "nrecs", "nbatches");
+
+/*
+ * Plain scalar n x n transpose of 64 byte rows, as the baseline for the permute ladders.
+ */
+#define SQ_SCALAR(_type, _n, _in, _out)                                                     \
+({                                                                                          \
+    unsigned __i, __j;                                                                      \
+                                                                                            \
+    for (__i = 0; __i < (_n); __i++) {                                                      \
+        for (__j = 0; __j < (_n); __j++) {                                                  \
+            (_out)[__j][__i] = (_in)[__i][__j];                                             \
+        }                                                                                   \
+    }                                                                                       \
+}) /* end of macro */
+
+/*
+ * Transpose each of the nblk n x n blocks in src into dst, iters times over, timing the ladder
+ * (_func) and then the scalar loop.
+ */
+#define SQ_BENCH(_name, _type, _n, _func, _src, _dst, _nblk, _iters)                        \
+({                                                                                          \
+    const _type * const __s = (const _type *)(_src);                                        \
+    _type * const __d = (_type *)(_dst);                                                    \
+    const u64 __nt = (u64)(_nblk) * (_iters);                                               \
+    u64 __pre, __clk[2];                                                                    \
+    u32 __i, __b;                                                                           \
+                                                                                            \
+    __pre = TSC_PRECISE();                                                                  \
+    for (__i = 0; __i < (_iters); __i++) {                                                  \
+        for (__b = 0; __b < (_nblk); __b++) {                                               \
+            _func(__s + ((u64)__b * (_n)), __d + ((u64)__b * (_n)));                        \
+        }                                                                                   \
+    }                                                                                       \
+    __clk[0] = TSC_PRECISE() - __pre;                                                       \
+    consume_data(__d, (u64)(_nblk) * 64 * (_n));                                            \
+                                                                                            \
+    __pre = TSC_PRECISE();                                                                  \
+    for (__i = 0; __i < (_iters); __i++) {                                                  \
+        for (__b = 0; __b < (_nblk); __b++) {                                               \
+            SQ_SCALAR(_type, _n, __s + ((u64)__b * (_n)), __d + ((u64)__b * (_n)));         \
+        }                                                                                   \
+    }                                                                                       \
+    __clk[1] = TSC_PRECISE() - __pre;                                                       \
+    consume_data(__d, (u64)(_nblk) * 64 * (_n));                                            \
+                                                                                            \
+    printf("\t%-8s %6u %10.1f %10.2f %10.1f %10.2f\n", _name, 64 * (_n),                  \
+           (float)__clk[0] / __nt, (float)(64 * (_n) * __nt) / __clk[0],                    \
+           (float)__clk[1] / __nt, (float)(64 * (_n) * __nt) / __clk[1]);                   \
+}) /* end of macro */
+
+static int perf_test_transpose_square(const char **args)
+{
+    char errbuf[1024] = {};
+    const u32 nblk  = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : 16;
+    const u32 iters = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 4096;
+
+    if (!nblk | !iters) {
+        printf("%s: nblocks and iters must be non-zero.\n", args[0]);
+        return -1;
+    }
+
+    /* Room for nblk of the biggest (64 row) blocks, in and out. */
+    const u64 blen = (u64)nblk * 64 * 64;
+    seg_desc_t dseg = {
+        .maplen = ((2 * blen) + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+
+    if (map_segment(NULL, &dseg, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    u8 * const RESTR src = (u8 *)dseg.ptr;
+    u8 * const RESTR dst = src + blen;
+
+    randomize_data(src, blen);
+
+    printf("%s(%u, %u): per n x n block\n", args[0], nblk, iters);
+    printf("\t%-8s %6s %10s %10s %10s %10s\n", "shape", "bytes", "clk", "B/clk", "scalar_clk",
+           "B/clk");
+
+    SQ_BENCH("u64_8x8", u64_8, 8, transpose_u64_8x8, src, dst, nblk, iters);
+    SQ_BENCH("u32_16x16", u32_16, 16, transpose_u32_16x16, src, dst, nblk, iters);
+    SQ_BENCH("u16_32x32", u16_32, 32, transpose_u16_32x32, src, dst, nblk, iters);
+#ifdef __AVX512VBMI__
+    SQ_BENCH("u8_64x64", u8_64, 64, transpose_u8_64x64, src, dst, nblk, iters);
+#endif
+
+    unmap_segment(&dseg);
+    return 0;
+}
+
+PERF_FUNC_ENTRY(transpose_square, "Square 64 byte row transposes (8x8 u64 .. 64x64 u8) via permute "
+                "ladder vs scalar.", "nblocks", "iters");
+
+static int transpose_segment(const seg_desc_t * const in, const seg_desc_t * const out,
+                             const u32 esz, const u64 n, const u32 flags)
+{
+    switch (esz) {
+#ifdef __AVX512VBMI__
+    case 1:
+        return transpose_u8_segment(in, out, n, n, flags);
+#endif
+    case 2:
+        return transpose_u16_segment(in, out, n, n, flags);
+    case 4:
+        return transpose_u32_segment(in, out, n, n, flags);
+    default:
+        return transpose_u64_segment(in, out, n, n, flags);
+    }
+}
+
+/*
+ *    Transpose square matrices of esz byte elements from 1MB up to max_mb between two segments,
+ * with ordinary and with streaming stores, and report GB/s of matrix transposed (memory traffic
+ * is at least twice that) next to a memcpy() of the same size for scale.  Each size is repeated
+ * enough to move at least 1GB.
+ */
+static int perf_test_transpose_stream(const char **args)
+{
+    char errbuf[1024] = {};
+    const u32 max_mb = ARG_VALID(args[1]) ? strtoul(args[1], NULL, 0) : 1024;
+    const u32 esz    = ARG_VALID(args[2]) ? strtoul(args[2], NULL, 0) : 4;
+
+    if ((max_mb == 0) | (esz == 0) | (esz & (esz - 1)) | (esz > 8)) {
+        printf("%s: max_mb must be non-zero and esz one of 1, 2, 4 or 8.\n", args[0]);
+        return -1;
+    }
+
+#ifndef __AVX512VBMI__
+    if (esz == 1) {
+        printf("%s: esz 1 needs AVX512_VBMI.\n", args[0]);
+        return -1;
+    }
+#endif
+
+    const u64 max_bytes = (u64)max_mb << 20;
+    seg_desc_t in = {
+        .maplen = (max_bytes + HUGE_2M_MASK) & ~HUGE_2M_MASK,
+        .flags = SEG_DESC_INITD | SEG_DESC_ANON
+    };
+    seg_desc_t out = in;
+    u64 bytes;
+
+    if (map_segment(NULL, &in, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        return -1;
+    }
+
+    if (map_segment(NULL, &out, errbuf, sizeof(errbuf) - 1)) {
+        printf("%s: %s\n", args[0], errbuf);
+        unmap_segment(&in);
+        return -1;
+    }
+
+    randomize_data(in.ptr, max_bytes);
+    __builtin_memset(out.ptr, 0, max_bytes);
+
+    printf("%s(%u, %u): GB/s of matrix transposed\n", args[0], max_mb, esz);
+    printf("\t%10s %8s %10s %10s %10s\n", "MB", "n", "cached", "streaming", "memcpy");
+
+    for (bytes = 1 << 20; bytes <= max_bytes; bytes <<= 2) {
+        /* Largest square that fits, in whole 64 x 64 element tiles so every shape can do it. */
+        u64 n = 64;
+
+        while (((n + 64) * (n + 64) * esz) <= bytes) {
+            n += 64;
+        }
+
+        const u64 mbytes = n * n * esz;
+        const u32 iters = (mbytes >= (1UL << 30)) ? 1 : ((1UL << 30) / mbytes);
+        double gbs[3];
+        u32 mode, i;
+
+        for (mode = 0; mode < 3; mode++) {
+            const u64 pre = wall_clock_ns();
+
+            for (i = 0; i < iters; i++) {
+                if (mode == 2) {
+                    memcpy(out.ptr, in.ptr, mbytes);
+                } else if (transpose_segment(&in, &out, esz, n, mode ? TRANSPOSE_SEGMENT_NT : 0)) {
+                    printf("%s: transpose of %lu x %lu failed.\n", args[0], n, n);
+                    unmap_segment(&in);
+                    unmap_segment(&out);
+                    return -1;
+                }
+            }
+
+            gbs[mode] = ((double)mbytes * iters) / (double)(wall_clock_ns() - pre);
+            consume_data(out.ptr, 64);
+        }
+
+        printf("\t%10.1f %8lu %10.2f %10.2f %10.2f\n", (double)mbytes / (1 << 20), n, gbs[0],
+               gbs[1], gbs[2]);
+    }
+
+    unmap_segment(&in);
+    unmap_segment(&out);
+    return 0;
+}
+
+PERF_FUNC_ENTRY(transpose_stream, "Tiled transpose of 1MB .. max_mb matrices between segments, "
+                "cached vs streaming stores.", "max_mb", "esz");
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "../include/simd_util.h"
+
+#define OUT_PREFIX "\t"
+
+#define _CHECK_SANITY(_expr, _str, _file, _line)                                    \
+({                                                                                  \
+    const int res = _expr;                                                          \
+    if (!res) {                                                                     \
+        printf(OUT_PREFIX "Sanity check assertion %s failed! (%s:%d)\n", _str,      \
+                 _file, _line);                                                     \
+        return 1;                                                                   \
+    }                                                                               \
+}) /*end of macro */
+
+#define CHECK_SANITY(__expr)    _CHECK_SANITY((__expr), #__expr, __FILE__, __LINE__)
+
+#define MAX_RULES   (3000)
+#define NPKTS       (8192)
+#define NPREFIXES   (24)
+
+static acl_rule_t rules[MAX_RULES];
+static pkt_metadata_t pkts[NPKTS] __attribute__((__aligned__(64)));
+static u32 prefixes[NPREFIXES];
+
+static const u32 l4_types[] = { 0, MD_PROTO_L4_TCP, MD_PROTO_L4_UDP, MD_PROTO_L4_SCTP,
+                                MD_PROTO_L4_ICMP };
+
+static u32 rand_u32(void)
+{
+    u32 r;
+
+    randomize_data(&r, sizeof(r));
+    return r;
+}
+
+/* A prefix of one of a few lengths under one of a few networks, so rules overlap and nest. */
+static void make_prefix(u32 * const lo, u32 * const hi)
+{
+    static const u32 lens[] = { 0, 8, 16, 24, 24, 28, 32, 32 };
+    const u32 len = lens[rand_u32() % 8];
+    const u32 mask = len ? ~0U << (32 - len) : 0;
+    const u32 net = (prefixes[rand_u32() % NPREFIXES] | (rand_u32() & 0x0000FFFF)) & mask;
+
+    *lo = net;
+    *hi = net | ~mask;
+}
+
+static void make_port_range(u32 * const lo, u32 * const hi)
+{
+    const u32 r = rand_u32();
+
+    switch (r % 4) {
+    case 0:
+        *lo = 0;
+        *hi = 0xFFFF;
+        break;
+    case 1:
+        *lo = *hi = (r >> 8) % 1100;
+        break;
+    case 2:
+        *lo = 1024;
+        *hi = 0xFFFF;
+        break;
+    default:
+        *lo = (r >> 8) & 0xFFFF;
+        *hi = *lo + ((r >> 24) * 16);
+        *hi = (*hi > 0xFFFF) ? 0xFFFF : *hi;
+        break;
+    }
+}
+
+static void make_rules(void)
+{
+    u32 r;
+
+    randomize_data(prefixes, sizeof(prefixes));
+
+    for (r = 0; r < MAX_RULES; r++) {
+        const u32 p = rand_u32();
+
+        make_prefix(&rules[r].lo[ACL_SRC], &rules[r].hi[ACL_SRC]);
+        make_prefix(&rules[r].lo[ACL_DST], &rules[r].hi[ACL_DST]);
+        make_port_range(&rules[r].lo[ACL_SPORT], &rules[r].hi[ACL_SPORT]);
+        make_port_range(&rules[r].lo[ACL_DPORT], &rules[r].hi[ACL_DPORT]);
+        rules[r].l4 = (p % 3) ? ACL_L4(l4_types[p % 5]) : ACL_L4_ANY;
+        rules[r].l4 |= (p % 7) ? 0 : ACL_L4(MD_PROTO_L4_UDP);
+    }
+}
+
+static u32 in_range(const u32 lo, const u32 hi)
+{
+    return lo + (rand_u32() % ((u64)hi - lo + 1));
+}
+
+/*
+ *    Packets near the first nrules rules: a point inside a random rule, mostly of a protocol it
+ * takes, with some fields bumped to just past its bounds, and a few packets which aren't IPv4.
+ */
+static void make_pkts(const u32 nrules)
+{
+    u64 i;
+
+    randomize_data(pkts, sizeof(pkts));
+
+    for (i = 0; i < NPKTS; i++) {
+        const acl_rule_t * const ru = &rules[rand_u32() % nrules];
+        const u32 r = rand_u32();
+        u32 f[ACL_NRANGES], d, t = (r >> 20) % 5;
+
+        for (d = 0; d < ACL_NRANGES; d++) {
+            f[d] = in_range(ru->lo[d], ru->hi[d]);
+
+            if (((r >> (d * 4)) & 15) == 0) {
+                f[d] = ru->lo[d] - 1;
+            } else if (((r >> (d * 4)) & 15) == 1) {
+                f[d] = ru->hi[d] + 1;
+            }
+        }
+
+        pkts[i].src_ip.u32[0] = htonl(f[ACL_SRC]);
+        pkts[i].dst_ip.u32[0] = htonl(f[ACL_DST]);
+        pkts[i].src_port = htons(f[ACL_SPORT]);
+        pkts[i].dst_port = htons(f[ACL_DPORT]);
+
+        while ((r >> 28) && !((ru->l4 >> (l4_types[t] >> 16)) & 1)) {
+            t = (t + 1) % 5;
+        }
+
+        pkts[i].proto_flags = (pkts[i].proto_flags & 0xFF) | l4_types[t] |
+                              (((r >> 24) % 64) ? MD_PROTO_L3_IP4 : MD_PROTO_L3_IP6);
+    }
+}
+
+/* The first rule md matches, one rule at a time. */
+static u32 ref_classify(const pkt_metadata_t * const md, const u32 nrules)
+{
+    const u32 f[ACL_NRANGES] = { ntohl(md->src_ip.u32[0]), ntohl(md->dst_ip.u32[0]),
+                                 ntohs(md->src_port), ntohs(md->dst_port) };
+    u32 r, d;
+
+    if ((md->proto_flags & (3 << 8)) != MD_PROTO_L3_IP4) {
+        return ACL_NONE;
+    }
+
+    for (r = 0; r < nrules; r++) {
+        for (d = 0; d < ACL_NRANGES; d++) {
+            if ((f[d] < rules[r].lo[d]) | (f[d] > rules[r].hi[d])) {
+                break;
+            }
+        }
+
+        if ((d == ACL_NRANGES) && ((rules[r].l4 >> ((md->proto_flags >> 16) & 31)) & 1)) {
+            return r;
+        }
+    }
+
+    return ACL_NONE;
+}
+
+/*
+ *    Both engines must agree with ref_classify() for every packet, with random lanes left out
+ * (ACL_NONE in those), and the packets must hit a spread of rules as well as no rule.
+ */
+static int test_classify(const u32 nrules)
+{
+    void * const lmem = aligned_alloc(64, ACL_LINEAR_MEM_SIZE(nrules));
+    void * const bmem = aligned_alloc(64, ACL_BV_MEM_SIZE(nrules));
+    const acl_linear_t * const lin = acl_linear_init(lmem, rules, nrules);
+    const acl_bv_t * const bv = acl_bv_init(bmem, rules, nrules);
+    u64 hits = 0, misses = 0, b, i;
+
+    CHECK_SANITY(lin != NULL);
+    CHECK_SANITY(bv != NULL);
+    CHECK_SANITY(bv->mem_used <= ACL_BV_MEM_SIZE(nrules));
+    make_pkts(nrules);
+
+    for (b = 0; b < NPKTS; b += 16) {
+        const u32 r = rand_u32();
+        const __mmask16 lanes = r | (r >> 16);
+        const u32_16 lres = acl_linear_classify_x16(lin, &pkts[b], lanes);
+        const u32_16 bres = acl_bv_classify_x16(bv, &pkts[b], lanes);
+
+        for (i = 0; i < 16; i++) {
+            const u32 ref = ((lanes >> i) & 1) ? ref_classify(&pkts[b + i], nrules) : ACL_NONE;
+
+            CHECK_SANITY(lres[i] == ref);
+            CHECK_SANITY(bres[i] == ref);
+            hits += (ref != ACL_NONE);
+            misses += ((lanes >> i) & 1) & (ref == ACL_NONE);
+        }
+    }
+
+    CHECK_SANITY(hits > NPKTS / 4);
+    CHECK_SANITY(misses > NPKTS / 256);
+    free(lmem);
+    free(bmem);
+    return 0;
+}
+
+static int test_acl_init(void)
+{
+    static u8 mem[ACL_BV_MEM_SIZE(2)] __attribute__((__aligned__(64)));
+    acl_rule_t bad[2] = { rules[0], rules[1] };
+
+    CHECK_SANITY(acl_linear_init(NULL, rules, 2) == NULL);
+    CHECK_SANITY(acl_linear_init(mem + 8, rules, 2) == NULL);
+    CHECK_SANITY(acl_linear_init(mem, rules, 0) == NULL);
+    CHECK_SANITY(acl_bv_init(NULL, rules, 2) == NULL);
+    CHECK_SANITY(acl_bv_init(mem + 8, rules, 2) == NULL);
+    CHECK_SANITY(acl_bv_init(mem, rules, 0) == NULL);
+    CHECK_SANITY(acl_bv_init(mem, rules, 2) != NULL);
+
+    bad[1].lo[ACL_DST] = 10;
+    bad[1].hi[ACL_DST] = 9;
+    CHECK_SANITY(acl_linear_init(mem, bad, 2) == NULL);
+    CHECK_SANITY(acl_bv_init(mem, bad, 2) == NULL);
+
+    bad[1] = rules[1];
+    bad[1].hi[ACL_SPORT] = 0x10000;
+    CHECK_SANITY(acl_linear_init(mem, bad, 2) == NULL);
+    CHECK_SANITY(acl_bv_init(mem, bad, 2) == NULL);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const u32 sizes[] = { 1, 15, 16, 17, 100, 1000, 1024, 1025, MAX_RULES };
+    u32 i;
+
+    make_rules();
+
+    if (test_acl_init()) {
+        return -1;
+    }
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (test_classify(sizes[i])) {
+            printf(OUT_PREFIX "%u rules\n", sizes[i]);
+            return -1;
+        }
+    }
+
+    printf(OUT_PREFIX "%s: PASS\n", __FILE__);
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#define OUT_PREFIX "\t"
+
+#define _CHECK_SANITY(_expr, _str, _file, _line)                                    \
+({                                                                                  \
+    const int res = _expr;                                                          \
+    if (!res) {                                                                     \
+        printf(OUT_PREFIX "Sanity check assertion %s failed! (%s:%d)\n", _str,      \
+                 _file, _line);                                                     \
+        return 1;                                                                   \
+    }                                                                               \
+}) /*end of macro */
+
+#define CHECK_SANITY(__expr)    _CHECK_SANITY((__expr), #__expr, __FILE__, __LINE__)
+
+#define NITEMS  (4096)
+#define NBINS   (5)
+#define NKEYS   (23)
+
+typedef struct {
+    u32 bin[NITEMS];
+    u32 key[NITEMS];
+    u32 seen[NITEMS];
+    u32 order[NITEMS];
+    u32 n_out;
+    u32 errors;
+    u32 n_deadline;
+} dispatch_log_t;
+
+static void log_dispatch(void *ctx, const u32 bin, const u32_16 items, const u32_16 keys,
+                         const __mmask16 lanes, const u32 reason)
+{
+    dispatch_log_t * const RESTR log = (dispatch_log_t *)ctx;
+    const u32 n = __builtin_popcount(lanes);
+    unsigned i, j;
+
+    // Lanes must be packed to the bottom of the vector.
+    if (lanes != ((1U << n) - 1)) {
+        log->errors++;
+    }
+
+    for (i = 0; i < n; i++) {
+        const u32 it = items[i];
+
+        if ((it >= NITEMS) || (log->bin[it] != bin) || (log->key[it] != keys[i])) {
+            log->errors++;
+            continue;
+        }
+
+        // No two items in one batch may share a key.
+        for (j = 0; j < i; j++) {
+            if (keys[j] == keys[i]) {
+                log->errors++;
+            }
+        }
+
+        log->seen[it]++;
+        log->order[log->n_out++] = it;
+    }
+
+    log->n_deadline += (reason == BIN_DISPATCH_DEADLINE);
+}
+
+static bin_dispatch_t bd;
+static dispatch_log_t dlog;
+
+/*
+ * Push a stream of items with random bins and keys through the dispatcher and verify:
+ *      == Every item comes out exactly once, in the bin it was put in.
+ *      == No batch contains two items with the same key.
+ *      == Items sharing a bin and a key come out in the order they went in.
+ */
+static int test_bin_dispatch(void)
+{
+    unsigned i, j;
+
+    randomize_data(dlog.bin, sizeof(dlog.bin) + sizeof(dlog.key));
+
+    for (i = 0; i < NITEMS; i++) {
+        dlog.bin[i] %= NBINS;
+        dlog.key[i] %= NKEYS;
+    }
+
+    CHECK_SANITY(bin_dispatch_init(&bd, NBINS, BIN_DISPATCH_NEVER, log_dispatch, &dlog) == 0);
+
+    for (i = 0; i < NITEMS; i += 16) {
+        const u32_16 items = IDX_VEC(u32_16) + i;
+        const u32_16 bins = (u32_16)_mm512_loadu_si512(dlog.bin + i);
+        const u32_16 keys = (u32_16)_mm512_loadu_si512(dlog.key + i);
+        bin_dispatch_add_x16(&bd, bins, items, keys, 0xFFFF, 0);
+    }
+
+    bin_dispatch_flush(&bd);
+
+    CHECK_SANITY(dlog.errors == 0);
+    CHECK_SANITY(dlog.n_out == NITEMS);
+    CHECK_SANITY(bd.pending == 0);
+    CHECK_SANITY(bd.n_items == NITEMS);
+
+    for (i = 0; i < NITEMS; i++) {
+        CHECK_SANITY(dlog.seen[i] == 1);
+    }
+
+    for (i = 0; i < NBINS; i++) {
+        for (j = 0; j < NKEYS; j++) {
+            int prev = -1;
+            unsigned k;
+
+            for (k = 0; k < NITEMS; k++) {
+                const u32 it = dlog.order[k];
+
+                if ((dlog.bin[it] == i) & (dlog.key[it] == j)) {
+                    CHECK_SANITY((int)it > prev);
+                    prev = it;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * A part-full bin must be held until its deadline passes and then be dispatched by a poll.
+ */
+static int test_bin_deadline(void)
+{
+    unsigned i;
+
+    memset(&dlog, 0, sizeof(dlog));
+
+    for (i = 0; i < 8; i++) {
+        dlog.key[i] = i;
+    }
+
+    CHECK_SANITY(bin_dispatch_init(&bd, 2, 100, log_dispatch, &dlog) == 0);
+
+    const u32_16 items = IDX_VEC(u32_16);
+    const u32_16 bins = {};
+    const u32_16 keys = IDX_VEC(u32_16);
+
+    bin_dispatch_add_x16(&bd, bins, items, keys, 0x000F, 1000);
+
+    CHECK_SANITY(bd.pending == 4);
+    CHECK_SANITY(bin_dispatch_poll(&bd, 1099) == 0);
+    CHECK_SANITY(dlog.n_out == 0);
+
+    // Later arrivals must not extend the deadline of the oldest item.
+    bin_dispatch_add_x16(&bd, bins, items + 4, keys + 4, 0x000F, 1050);
+
+    CHECK_SANITY(bin_dispatch_poll(&bd, 1100) == 1);
+    CHECK_SANITY(dlog.n_out == 8);
+    CHECK_SANITY(dlog.n_deadline == 1);
+    CHECK_SANITY(dlog.errors == 0);
+    CHECK_SANITY(bd.pending == 0);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (test_bin_dispatch()) {
+        printf(OUT_PREFIX "%s FAIL!\n", __FILE__);
+        return 1;
+    }
+
+    if (test_bin_deadline()) {
+        printf(OUT_PREFIX "%s FAIL!\n", __FILE__);
+        return 1;
+    }
+
+    printf(OUT_PREFIX "%s: PASS\n", __FILE__);
+    return 0;
+}
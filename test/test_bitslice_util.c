@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#define OUT_PREFIX "\t"
+
+#define NVALS   (512)
+#define NBITS   (12)
+
+static u64 vals[NVALS] __attribute__((__aligned__(64)));
+static u64 back[NVALS] __attribute__((__aligned__(64)));
+static u64_8 planes[64];
+
+static void ref_slice(const u64 * const in, u64_8 * const out, const unsigned nbits)
+{
+    unsigned b, i;
+
+    __builtin_memset(out, 0, sizeof(u64_8) * nbits);
+
+    for (b = 0; b < nbits; b++) {
+        for (i = 0; i < NVALS; i++) {
+            out[b][i / 64] |= ((in[i] >> b) & 1) << (i % 64);
+        }
+    }
+}
+
+static int mask_bit(const u64_8 m, const unsigned i)
+{
+    return (m[i / 64] >> (i % 64)) & 1;
+}
+
+#if defined(__GFNI__) && defined(__AVX512VBMI__)
+/*
+ * Plain bit-at-a-time reference for the bit matrix transposes.
+ */
+static u64 ref_transpose_8x8(const u64 in)
+{
+    u64 out = 0;
+    unsigned i, j;
+
+    for (i = 0; i < 8; i++) {
+        for (j = 0; j < 8; j++) {
+            out |= ((in >> ((8 * i) + j)) & 1) << ((8 * j) + i);
+        }
+    }
+
+    return out;
+}
+
+int test_bit_transposes(void)
+{
+    u64_8 in[8], out[8], io[8];
+    unsigned pass, r, c;
+
+    for (pass = 0; pass < 16; pass++) {
+        randomize_data(in, sizeof(in));
+
+        const u64_8 t = transpose_bits_8x8_x8(in[0]);
+
+        for (r = 0; r < 8; r++) {
+            if (t[r] != ref_transpose_8x8(in[0][r])) {
+                printf(OUT_PREFIX "%s: 8x8 of 0x%lx gave 0x%lx, expected 0x%lx\n", __FUNCTION__,
+                       in[0][r], t[r], ref_transpose_8x8(in[0][r]));
+                return -1;
+            }
+        }
+
+        memcpy(io, in, sizeof(in));
+        transpose_bits_64x64(in, out);
+        transpose_bits_64x64(io, io);
+
+        for (r = 0; r < 64; r++) {
+            for (c = 0; c < 64; c++) {
+                const u64 bit = (in[r / 8][r % 8] >> c) & 1;
+                const u64 got = (out[c / 8][c % 8] >> r) & 1;
+                const u64 got_io = (io[c / 8][c % 8] >> r) & 1;
+
+                if ((got != bit) | (got_io != bit)) {
+                    printf(OUT_PREFIX "%s: 64x64 bit (%u, %u) did not move to (%u, %u)\n",
+                           __FUNCTION__, r, c, c, r);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+int test_bitslice_round_trip(void)
+{
+    u64_8 expect[64];
+    unsigned i;
+
+    randomize_data(vals, sizeof(vals));
+    bitslice_u64_x512(vals, planes);
+    ref_slice(vals, expect, 64);
+
+    if (memcmp(planes, expect, sizeof(expect))) {
+        printf(OUT_PREFIX "%s: bitslice_u64_x512() planes differ from the reference\n",
+               __FUNCTION__);
+        return -1;
+    }
+
+    unbitslice_u64_x512(planes, back);
+
+    for (i = 0; i < NVALS; i++) {
+        if (back[i] != vals[i]) {
+            printf(OUT_PREFIX "%s: value %u went in as 0x%lx and came back 0x%lx\n", __FUNCTION__,
+                   i, vals[i], back[i]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+#endif
+
+/*
+ *    Check the constant compares against every value for a spread of constants, including the
+ * extremes and constants known to be present, with both u64_8 planes (all 512 values) and u64
+ * planes (the first 64).
+ */
+int test_bs_compare(void)
+{
+    u64 ks[40], lo_planes[NBITS];
+    unsigned n, i, b;
+
+    randomize_data(vals, sizeof(vals));
+
+    for (i = 0; i < NVALS; i++) {
+        vals[i] &= (1 << NBITS) - 1;
+    }
+
+    /* Plenty of duplicates to make the equality masks interesting. */
+    for (i = 0; i < NVALS; i += 7) {
+        vals[i] = vals[i / 2];
+    }
+
+    ref_slice(vals, planes, NBITS);
+
+    for (b = 0; b < NBITS; b++) {
+        lo_planes[b] = planes[b][0];
+    }
+
+    randomize_data(ks, sizeof(ks));
+    ks[0] = 0;
+    ks[1] = (1 << NBITS) - 1;
+
+    for (n = 2; n < 40; n++) {
+        ks[n] = (n & 1) ? vals[ks[n] % NVALS] : (ks[n] & ((1 << NBITS) - 1));
+    }
+
+    for (n = 0; n < 40; n++) {
+        const u64 k = ks[n];
+        const u64_8 eq = BS_CMPEQ_K(planes, NBITS, k);
+        const u64_8 lt = BS_CMPLT_K(planes, NBITS, k);
+        const u64_8 gt = BS_CMPGT_K(planes, NBITS, k);
+        const u64_8 in = BS_IN_RANGE_K(planes, NBITS, k / 2, k);
+        const u64 eq64 = BS_CMPEQ_K(lo_planes, NBITS, k);
+        const u64 lt64 = BS_CMPLT_K(lo_planes, NBITS, k);
+
+        for (i = 0; i < NVALS; i++) {
+            if ((mask_bit(eq, i) != (vals[i] == k)) | (mask_bit(lt, i) != (vals[i] < k)) |
+                    (mask_bit(gt, i) != (vals[i] > k)) |
+                    (mask_bit(in, i) != ((vals[i] >= (k / 2)) & (vals[i] < k)))) {
+                printf(OUT_PREFIX "%s: value[%u] = %lu vs %lu: eq %d lt %d gt %d range %d\n",
+                       __FUNCTION__, i, vals[i], k, mask_bit(eq, i), mask_bit(lt, i),
+                       mask_bit(gt, i), mask_bit(in, i));
+                return -1;
+            }
+        }
+
+        if ((eq64 != eq[0]) | (lt64 != lt[0])) {
+            printf(OUT_PREFIX "%s: u64 planes disagree with u64_8 planes for %lu\n", __FUNCTION__,
+                   k);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Two bitsliced operands against each other, half of the b values equal to their a values.
+ */
+int test_bs_compare_pair(void)
+{
+    u64_8 bplanes[NBITS];
+    unsigned i;
+
+    randomize_data(vals, sizeof(vals));
+    randomize_data(back, sizeof(back));
+
+    for (i = 0; i < NVALS; i++) {
+        vals[i] &= (1 << NBITS) - 1;
+        back[i] = (i & 1) ? vals[i] : (back[i] & ((1 << NBITS) - 1));
+    }
+
+    ref_slice(vals, planes, NBITS);
+    ref_slice(back, bplanes, NBITS);
+
+    const u64_8 eq = BS_CMPEQ(planes, bplanes, NBITS);
+    const u64_8 lt = BS_CMPLT(planes, bplanes, NBITS);
+
+    for (i = 0; i < NVALS; i++) {
+        if ((mask_bit(eq, i) != (vals[i] == back[i])) | (mask_bit(lt, i) != (vals[i] < back[i]))) {
+            printf(OUT_PREFIX "%s: %lu vs %lu: eq %d lt %d\n", __FUNCTION__, vals[i], back[i],
+                   mask_bit(eq, i), mask_bit(lt, i));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Count matches of 40 random masks per value in a 5-bit counter (so it wraps) and check the
+ * per-value counts and the totals from bs_count_u64_8().
+ */
+int test_bs_counter(void)
+{
+    u64_8 cnt[5] = {}, m;
+    u32 ref[NVALS] = {};
+    u64 total = 0, got = 0;
+    unsigned n, i;
+
+    for (n = 0; n < 40; n++) {
+        randomize_data(&m, sizeof(m));
+
+        /* Thin some of them out so the counts spread. */
+        if (n & 1) {
+            m &= (u64_8) {} + (0x0F0F0F0F0F0F0F0FULL << (n % 4));
+        }
+
+        BS_COUNTER_ADD(cnt, 5, m);
+        got += bs_count_u64_8(m);
+
+        for (i = 0; i < NVALS; i++) {
+            ref[i] += mask_bit(m, i);
+            total += mask_bit(m, i);
+        }
+    }
+
+    if (got != total) {
+        printf(OUT_PREFIX "%s: bs_count_u64_8() counted %lu of %lu\n", __FUNCTION__, got, total);
+        return -1;
+    }
+
+    const u64_8 over = BS_CMPGT_K(cnt, 5, 20);
+
+    for (i = 0; i < NVALS; i++) {
+        u32 c = 0, b;
+
+        for (b = 0; b < 5; b++) {
+            c |= mask_bit(cnt[b], i) << b;
+        }
+
+        if ((c != (ref[i] & 31)) | (mask_bit(over, i) != ((ref[i] & 31) > 20))) {
+            printf(OUT_PREFIX "%s: value %u counted %u, expected %u\n", __FUNCTION__, i, c,
+                   ref[i] & 31);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+#if defined(__GFNI__) && defined(__AVX512VBMI__)
+    if (test_bit_transposes()) {
+        return -1;
+    }
+
+    if (test_bitslice_round_trip()) {
+        return -1;
+    }
+#endif
+
+    if (test_bs_compare()) {
+        return -1;
+    }
+
+    if (test_bs_compare_pair()) {
+        return -1;
+    }
+
+    if (test_bs_counter()) {
+        return -1;
+    }
+
+    printf(OUT_PREFIX "%s: PASS\n", __FILE__);
+    return 0;
+}
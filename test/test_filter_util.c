@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#define OUT_PREFIX "\t"
+
+#define MAXLEN  (1031)
+
+static u32 src32[MAXLEN], dst32[MAXLEN + 16], ref32[MAXLEN];
+static u64 src64[MAXLEN], dst64[MAXLEN + 8], ref64[MAXLEN];
+
+/*
+ * Keep the values below the threshold pointed to by ctx.
+ */
+static __mmask16 below_u32(const u32_16 v, const void *ctx)
+{
+    return _mm512_cmplt_epu32_mask((__m512i)v, _mm512_set1_epi32(*(const u32 *)ctx));
+}
+
+static __mmask8 below_u64(const u64_8 v, const void *ctx)
+{
+    return _mm512_cmplt_epu64_mask((__m512i)v, _mm512_set1_epi64(*(const u64 *)ctx));
+}
+
+/*
+ *    Every length up to a few vectors and one odd long one, at a handful of thresholds from
+ * nothing kept to everything kept, against a plain loop.  The output must match exactly and the
+ * elements past the count must be untouched except for the last partial vector's worth (the
+ * masked stores don't write past the count at all, so check that too).
+ */
+int test_filter_u32(void)
+{
+    const u32 thresholds[] = { 0, 1U << 28, 1U << 31, 0xF0000000U, ~0U };
+    unsigned t, len, i;
+
+    randomize_data(src32, sizeof(src32));
+
+    for (t = 0; t < sizeof(thresholds) / sizeof(thresholds[0]); t++) {
+        for (len = 0; len <= MAXLEN; len = (len < 48) ? (len + 1) : MAXLEN + (len == MAXLEN)) {
+            u64 n = 0;
+
+            for (i = 0; i < len; i++) {
+                if (src32[i] < thresholds[t]) {
+                    ref32[n++] = src32[i];
+                }
+            }
+
+            memset(dst32, 0xA5, sizeof(dst32));
+
+            const u64 got = filter_u32(dst32, src32, len, below_u32, &thresholds[t]);
+
+            if ((got != n) | !!memcmp(dst32, ref32, n * sizeof(u32))) {
+                printf(OUT_PREFIX "%s: length %u below 0x%x kept %lu, expected %lu\n",
+                       __FUNCTION__, len, thresholds[t], got, n);
+                return -1;
+            }
+
+            for (i = n; i < MAXLEN + 16; i++) {
+                if (dst32[i] != 0xA5A5A5A5U) {
+                    printf(OUT_PREFIX "%s: length %u below 0x%x wrote past the count at %u\n",
+                           __FUNCTION__, len, thresholds[t], i);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    /* In place. */
+    memcpy(dst32, src32, sizeof(src32));
+
+    const u64 n = filter_u32(ref32, src32, MAXLEN, below_u32, &thresholds[2]);
+    const u64 got = filter_u32(dst32, dst32, MAXLEN, below_u32, &thresholds[2]);
+
+    if ((got != n) | !!memcmp(dst32, ref32, n * sizeof(u32))) {
+        printf(OUT_PREFIX "%s: in place filter kept %lu, expected %lu\n", __FUNCTION__, got, n);
+        return -1;
+    }
+
+    return 0;
+}
+
+int test_filter_u64(void)
+{
+    const u64 thresholds[] = { 0, 1UL << 60, 1UL << 63, 0xF000000000000000UL, ~0UL };
+    unsigned t, len, i;
+
+    randomize_data(src64, sizeof(src64));
+
+    for (t = 0; t < sizeof(thresholds) / sizeof(thresholds[0]); t++) {
+        for (len = 0; len <= MAXLEN; len = (len < 24) ? (len + 1) : MAXLEN + (len == MAXLEN)) {
+            u64 n = 0;
+
+            for (i = 0; i < len; i++) {
+                if (src64[i] < thresholds[t]) {
+                    ref64[n++] = src64[i];
+                }
+            }
+
+            memset(dst64, 0xA5, sizeof(dst64));
+
+            const u64 got = filter_u64(dst64, src64, len, below_u64, &thresholds[t]);
+
+            if ((got != n) | !!memcmp(dst64, ref64, n * sizeof(u64))) {
+                printf(OUT_PREFIX "%s: length %u below 0x%lx kept %lu, expected %lu\n",
+                       __FUNCTION__, len, thresholds[t], got, n);
+                return -1;
+            }
+
+            for (i = n; i < MAXLEN + 8; i++) {
+                if (dst64[i] != 0xA5A5A5A5A5A5A5A5UL) {
+                    printf(OUT_PREFIX "%s: length %u below 0x%lx wrote past the count at %u\n",
+                           __FUNCTION__, len, thresholds[t], i);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    memcpy(dst64, src64, sizeof(src64));
+
+    const u64 n = filter_u64(ref64, src64, MAXLEN, below_u64, &thresholds[2]);
+    const u64 got = filter_u64(dst64, dst64, MAXLEN, below_u64, &thresholds[2]);
+
+    if ((got != n) | !!memcmp(dst64, ref64, n * sizeof(u64))) {
+        printf(OUT_PREFIX "%s: in place filter kept %lu, expected %lu\n", __FUNCTION__, got, n);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (test_filter_u32()) {
+        return -1;
+    }
+
+    if (test_filter_u64()) {
+        return -1;
+    }
+
+    printf(OUT_PREFIX "%s: PASS\n", __FILE__);
+    return 0;
+}
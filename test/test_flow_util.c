@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#define OUT_PREFIX "\t"
+
+#define _CHECK_SANITY(_expr, _str, _file, _line)                                    \
+({                                                                                  \
+    const int res = _expr;                                                          \
+    if (!res) {                                                                     \
+        printf(OUT_PREFIX "Sanity check assertion %s failed! (%s:%d)\n", _str,      \
+                 _file, _line);                                                     \
+        return 1;                                                                   \
+    }                                                                               \
+}) /*end of macro */
+
+#define CHECK_SANITY(__expr)    _CHECK_SANITY((__expr), #__expr, __FILE__, __LINE__)
+
+#define NFLOWS  (1000)
+#define NPKTS   (20000)
+#define NHDRS   (64)
+
+#define NQUEUES     (5)
+#define RING_SLOTS  (2048)
+
+static u8 table_mem[FLOW_TABLE_MEM_SIZE(NFLOWS)] __attribute__((__aligned__(64)));
+static u8 ring_mem[NQUEUES][SPSC_RING_MEM_SIZE(RING_SLOTS)] __attribute__((__aligned__(64)));
+static flow_steer_t steer;
+static pkt_metadata_t flows[NFLOWS + 1];
+static pkt_metadata_t pkts[NPKTS];
+static u32 pkt_flow[NPKTS];
+static pcap_pkt_hdr_t hdrs[NHDRS];
+
+static u64 ref_pkts[NFLOWS], ref_bytes[NFLOWS];
+static u32 flow_of[NFLOWS];     // Table index each flow got, or FLOW_NONE if not yet seen
+
+/*
+ *    Random flows, and packets of them which differ in everything outside flow_key_mask (so the
+ * key must be masked to match).  The flows are skewed, so most are seen many times and a batch
+ * often has the same flow in it more than once.
+ */
+static void make_pkts(void)
+{
+    u32 r[2];
+    u64 i;
+
+    randomize_data(flows, sizeof(flows));
+    randomize_data(pkts, sizeof(pkts));
+    randomize_data(hdrs, sizeof(hdrs));
+
+    for (i = 0; i < NHDRS; i++) {
+        hdrs[i].orig_len &= 0xFFFF;
+    }
+
+    for (i = 0; i < NPKTS; i++) {
+        randomize_data(r, sizeof(r));
+        pkt_flow[i] = (r[0] % NFLOWS) % ((r[1] % NFLOWS) + 1);
+        pkts[i].zmm = (flows[pkt_flow[i]].zmm & flow_key_mask.zmm) |
+                      (pkts[i].zmm & ~flow_key_mask.zmm);
+        pkts[i].pph = &hdrs[r[1] % NHDRS];
+    }
+}
+
+/*
+ *    Push every packet through in batches of 16 with random lanes left out (those packets are
+ * not counted).  Each flow must get one index the first time it's seen and keep it, and the
+ * counters must match.
+ */
+static int test_flow_update(void)
+{
+    flow_table_t * const ft = flow_table_init(table_mem, NFLOWS, 0x12345678);
+    u32 flow[16], nseen = 0;
+    u64 b, i;
+
+    CHECK_SANITY(ft != NULL);
+    memset(ref_pkts, 0, sizeof(ref_pkts));
+    memset(ref_bytes, 0, sizeof(ref_bytes));
+    memset(flow_of, 0xFF, sizeof(flow_of));
+
+    for (b = 0; b < NPKTS; b += 16) {
+        u32 r;
+
+        randomize_data(&r, sizeof(r));
+
+        const __mmask16 lanes = r | (r >> 16);
+        const __mmask16 added = flow_table_update_x16(ft, &pkts[b], lanes, flow);
+
+        for (i = 0; i < 16; i++) {
+            const u32 f = pkt_flow[b + i];
+
+            if (!((lanes >> i) & 1)) {
+                CHECK_SANITY(flow[i] == FLOW_NONE);
+                continue;
+            }
+
+            if (flow_of[f] == FLOW_NONE) {
+                CHECK_SANITY((added >> i) & 1);
+                CHECK_SANITY(flow[i] == nseen);
+                flow_of[f] = flow[i];
+                nseen++;
+            } else {
+                CHECK_SANITY(!((added >> i) & 1));
+                CHECK_SANITY(flow[i] == flow_of[f]);
+            }
+
+            ref_pkts[f]++;
+            ref_bytes[f] += pkts[b + i].pph->orig_len;
+        }
+    }
+
+    CHECK_SANITY(ft->n_flows == nseen);
+    CHECK_SANITY(ft->drops == 0);
+
+    for (i = 0; i < NFLOWS; i++) {
+        const flow_entry_t * const e = flow_table_find(ft, &flows[i]);
+
+        if (flow_of[i] == FLOW_NONE) {
+            CHECK_SANITY(e == NULL);
+            continue;
+        }
+
+        CHECK_SANITY(e == &flow_table_entries(ft)[flow_of[i]]);
+        CHECK_SANITY(e->pkts == ref_pkts[i]);
+        CHECK_SANITY(e->bytes == ref_bytes[i]);
+        CHECK_SANITY(e->hash == flow_hash(&flows[i], ft->seed));
+        CHECK_SANITY(!_mm512_test_epi32_mask((__m512i)(e->zmm ^ flows[i].zmm),
+                                             (__m512i)flow_key_mask.zmm));
+    }
+
+    CHECK_SANITY(flow_table_find(ft, &flows[NFLOWS]) == NULL);
+    return 0;
+}
+
+/*
+ *    flow_hash_x16() must agree with flow_hash() lane for lane, whatever is outside
+ * flow_key_mask.
+ */
+static int test_flow_hash_x16(void)
+{
+    u64 b, i;
+
+    for (b = 0; b < NPKTS; b += 16) {
+        const u32 seed = b * 0x9e3779b9U;
+        const u32_16 h = flow_hash_x16(&pkts[b], seed);
+
+        for (i = 0; i < 16; i++) {
+            CHECK_SANITY(h[i] == flow_hash(&pkts[b + i], seed));
+            CHECK_SANITY(h[i] == flow_hash(&flows[pkt_flow[b + i]], seed));
+        }
+    }
+
+    return 0;
+}
+
+/*
+ *    flow_hash_sym() must not change when source and destination are swapped, and
+ * flow_hash_sym_x16() must agree with it.
+ */
+static int test_flow_hash_sym(void)
+{
+    pkt_metadata_t rev[16] __attribute__((__aligned__(64)));
+    u64 b, i;
+
+    for (b = 0; b < NPKTS; b += 16) {
+        const u32 seed = b * 0x9e3779b9U;
+
+        for (i = 0; i < 16; i++) {
+            rev[i] = pkts[b + i];
+            rev[i].src_ip = pkts[b + i].dst_ip;
+            rev[i].dst_ip = pkts[b + i].src_ip;
+            rev[i].src_port = pkts[b + i].dst_port;
+            rev[i].dst_port = pkts[b + i].src_port;
+        }
+
+        const u32_16 h = flow_hash_sym_x16(&pkts[b], seed);
+        const u32_16 hr = flow_hash_sym_x16(rev, seed);
+
+        for (i = 0; i < 16; i++) {
+            CHECK_SANITY(h[i] == flow_hash_sym(&pkts[b + i], seed));
+            CHECK_SANITY(h[i] == flow_hash_sym(&rev[i], seed));
+            CHECK_SANITY(hr[i] == h[i]);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ *    Steer every packet (its index as the handle) with random lanes left out, and read the rings
+ * back: each steered handle must turn up exactly once, in order, on the queue its hash picks.
+ * Then with the rings left full, every further slot must be dropped and counted.
+ */
+static int test_flow_steer(void)
+{
+    spsc_ring_t *ring[NQUEUES];
+    u64 steered = 0, found = 0, b, i;
+    u32 q;
+
+    for (q = 0; q < NQUEUES; q++) {
+        ring[q] = spsc_ring_init(ring_mem[q], RING_SLOTS);
+        CHECK_SANITY(ring[q] != NULL);
+    }
+
+    CHECK_SANITY(flow_steer_init(&steer, ring, 0, 64) == -1);
+    CHECK_SANITY(flow_steer_init(&steer, ring, NQUEUES, 96) == -1);
+    CHECK_SANITY(flow_steer_init(&steer, ring, NQUEUES, 64) == 0);
+    memset(pkt_flow, 0xFF, sizeof(pkt_flow));
+
+    for (b = 0; b < NPKTS; b += 16) {
+        u32 r;
+
+        randomize_data(&r, sizeof(r));
+
+        const __mmask16 lanes = r | (r >> 16);
+        const u32_16 h = flow_hash_sym_x16(&pkts[b], 42);
+        const u32_16 queue = flow_steer_x16(&steer, h, IDX_VEC(u32_16) + (u32)b, lanes);
+
+        for (i = 0; i < 16; i++) {
+            CHECK_SANITY(queue[i] == steer.reta[h[i] & 63]);
+
+            if ((lanes >> i) & 1) {
+                pkt_flow[b + i] = queue[i];     // Reused as each packet's queue
+                steered++;
+            }
+        }
+    }
+
+    CHECK_SANITY(flow_steer_flush(&steer) == 0);
+
+    for (q = 0; q < NQUEUES; q++) {
+        u64 last = 0, n = 0;
+        u32_16 slot;
+
+        while (spsc_ring_dequeue(ring[q], &slot, 1)) {
+            for (i = 0; i < 16; i++) {
+                if (slot[i] == FLOW_NONE) {
+                    continue;
+                }
+
+                CHECK_SANITY(slot[i] < NPKTS);
+                CHECK_SANITY(pkt_flow[slot[i]] == q);
+                CHECK_SANITY((n == 0) | (slot[i] > last));
+                last = slot[i];
+                n++;
+            }
+        }
+
+        CHECK_SANITY(n == steer.handles[q]);
+        CHECK_SANITY(steer.drops[q] == 0);
+        found += n;
+    }
+
+    CHECK_SANITY(found == steered);
+
+    /* Fill queue 0's ring, then one more full slot has nowhere to go */
+    for (q = 0; q < RING_SLOTS; q++) {
+        CHECK_SANITY(flow_steer_x16(&steer, (u32_16){}, (u32_16){}, 0xFFFF)[0] == 0);
+    }
+
+    CHECK_SANITY(steer.drops[0] == 0);
+    flow_steer_x16(&steer, (u32_16){}, (u32_16){}, 0x00FF);
+    CHECK_SANITY(steer.drops[0] == 0);
+    CHECK_SANITY(flow_steer_flush(&steer) == 1);
+    flow_steer_x16(&steer, (u32_16){}, (u32_16){}, 0x00FF);
+    CHECK_SANITY(steer.drops[0] == 16);
+    CHECK_SANITY(steer.count[0] == 0);
+    return 0;
+}
+
+/*
+ * A table with room for fewer flows than turn up drops (and counts) the packets of the rest.
+ */
+static int test_flow_full(void)
+{
+    const u32 max = 37;
+    flow_table_t * const ft = flow_table_init(table_mem, max, 0);
+    u64 drops = 0, b, i;
+    u32 flow[16];
+
+    CHECK_SANITY(ft != NULL);
+    memset(flow_of, 0xFF, sizeof(flow_of));
+
+    for (b = 0; b < NPKTS; b += 16) {
+        flow_table_update_x16(ft, &pkts[b], 0xFFFF, flow);
+
+        for (i = 0; i < 16; i++) {
+            const u32 f = pkt_flow[b + i];
+
+            if (flow[i] == FLOW_NONE) {
+                CHECK_SANITY(flow_of[f] == FLOW_NONE);
+                drops++;
+            } else if (flow_of[f] == FLOW_NONE) {
+                flow_of[f] = flow[i];
+            } else {
+                CHECK_SANITY(flow_of[f] == flow[i]);
+            }
+        }
+    }
+
+    CHECK_SANITY(ft->n_flows == max);
+    CHECK_SANITY(ft->drops == drops);
+    CHECK_SANITY(drops > 0);
+    return 0;
+}
+
+static int test_flow_init(void)
+{
+    CHECK_SANITY(flow_table_init(NULL, 10, 0) == NULL);
+    CHECK_SANITY(flow_table_init(table_mem + 8, 10, 0) == NULL);
+    CHECK_SANITY(flow_table_init(table_mem, 0, 0) == NULL);
+    CHECK_SANITY(_FLOW_TABLE_BUCKETS(1) == 1);
+    CHECK_SANITY(_FLOW_TABLE_BUCKETS(5) == 2);
+    CHECK_SANITY(_FLOW_TABLE_BUCKETS(9) == 4);
+    CHECK_SANITY(_FLOW_TABLE_BUCKETS(NFLOWS) == 256);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    make_pkts();
+
+    if (test_flow_init() || test_flow_hash_x16() || test_flow_hash_sym() || test_flow_update() ||
+        test_flow_full() || test_flow_steer()) {
+        return -1;
+    }
+
+    printf(OUT_PREFIX "%s: PASS\n", __FILE__);
+    return 0;
+}
@@ -72,9 +72,45 @@ static int test_murmur3(void)
     return 0;
 }
 
+/*
+ * murmur3_u32_16_cols() of random keys of every length up to 16 dwords against the scalar hash.
+ */
+static int test_murmur3_cols(void)
+{
+    u32 keys[16][16], ref[16];
+    u32_16 col[16];
+    unsigned nblk, i, j;
+
+    for (nblk = 0; nblk <= 16; nblk++) {
+        const u32 seed = nblk * 0x9e3779b9U;
+
+        randomize_data(keys, sizeof(keys));
+
+        for (i = 0; i < 16; i++) {
+            ref[i] = murmur3_u32(keys[i], nblk * 4, seed);
+
+            for (j = 0; j < 16; j++) {
+                col[j][i] = keys[i][j];
+            }
+        }
+
+        const u32_16 h = murmur3_u32_16_cols(col, nblk, seed);
+
+        for (i = 0; i < 16; i++) {
+            if (h[i] != ref[i]) {
+                printf(OUT_PREFIX "%s Error: murmur3_u32_16_cols() of %u dwords lane %u: "
+                       "0x%08x, expected 0x%08x\n", __FILE__, nblk, i, h[i], ref[i]);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
-    if (test_murmur3()) {
+    if (test_murmur3() || test_murmur3_cols()) {
         return 1;
     }
 
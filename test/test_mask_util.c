@@ -239,6 +239,437 @@ static int test_mux_blend(void)
     return 0;
 }
 
+#define _TEST_COMPRESS(_type, _tstr, _file, _line)                                              \
+({                                                                                              \
+    const _type v = in_vals._type;                                                              \
+    const _type packed = COMPRESS_ON_MASK(in_mask.m64, v);                                      \
+    const unsigned nlanes = VEC_LANES(v), lsz = sizeof(v[0]);                                   \
+    u8 got[sizeof(v) + 64], expect[sizeof(v) + 64], expect_packed[sizeof(v)] = {};              \
+    unsigned i, n = 0;                                                                          \
+                                                                                                \
+    __builtin_memset(got, 0xA5, sizeof(got));                                                   \
+    __builtin_memset(expect, 0xA5, sizeof(expect));                                             \
+                                                                                                \
+    /* Stored one lane in, so the destination is never aligned. */                              \
+    const unsigned cnt = COMPRESS_STORE((typeof(v[0]) *)(got + lsz), in_mask.m64, v);           \
+                                                                                                \
+    for (i = 0; i < nlanes; i++) {                                                              \
+        if ((in_mask.u64 >> i) & 1) {                                                           \
+            __builtin_memcpy(expect + lsz + (n * lsz), (const u8 *)&v + (i * lsz), lsz);        \
+            __builtin_memcpy(expect_packed + (n * lsz), (const u8 *)&v + (i * lsz), lsz);       \
+            n++;                                                                                \
+        }                                                                                       \
+    }                                                                                           \
+                                                                                                \
+    if ((cnt != n) | !!__builtin_memcmp(got, expect, sizeof(got)) |                             \
+            !!__builtin_memcmp(&packed, expect_packed, sizeof(packed))) {                       \
+        printf(OUT_PREFIX "Unexpected COMPRESS_ON_MASK()/COMPRESS_STORE() results with "        \
+               "type %s, %u of %u lanes stored. (%s:%d)\n", _tstr, cnt, n, _file, _line);       \
+        debug_print_vec(v, ~0);                                                                 \
+        debug_print_vec(packed, ~0);                                                            \
+        return 1;                                                                               \
+    }                                                                                           \
+}) /* end of macro */
+
+#define TEST_COMPRESS(__type) _TEST_COMPRESS(__type, #__type, __FILE__, __LINE__)
+
+static int test_compress(void)
+{
+    const union {
+        __mmask64   m64;
+        u64         u64;
+    } in_mask = { .m64 = 0xdeadbeef15f00d11UL };
+
+    MEGA_UNION in_vals;
+    unsigned i;
+
+    for (i = 0; i < sizeof(in_vals); i++) {
+        in_vals.u8[i] = (i * 7) + 1;
+    }
+
+#ifdef __AVX512VBMI2__
+    /* Byte and word lanes need vpcompressb/w */
+    TEST_COMPRESS(u8_16);
+    TEST_COMPRESS(u8_32);
+    TEST_COMPRESS(u8_64);
+
+    TEST_COMPRESS(u16_8);
+    TEST_COMPRESS(u16_16);
+    TEST_COMPRESS(u16_32);
+
+    TEST_COMPRESS(i8_16);
+    TEST_COMPRESS(i8_32);
+    TEST_COMPRESS(i8_64);
+
+    TEST_COMPRESS(i16_8);
+    TEST_COMPRESS(i16_16);
+    TEST_COMPRESS(i16_32);
+#endif
+
+    TEST_COMPRESS(u32_4);
+    TEST_COMPRESS(u32_8);
+    TEST_COMPRESS(u32_16);
+
+    TEST_COMPRESS(u64_2);
+    TEST_COMPRESS(u64_4);
+    TEST_COMPRESS(u64_8);
+
+    TEST_COMPRESS(i32_4);
+    TEST_COMPRESS(i32_8);
+    TEST_COMPRESS(i32_16);
+
+    TEST_COMPRESS(i64_2);
+    TEST_COMPRESS(i64_4);
+    TEST_COMPRESS(i64_8);
+
+    TEST_COMPRESS(f32_4);
+    TEST_COMPRESS(f32_8);
+    TEST_COMPRESS(f32_16);
+
+    TEST_COMPRESS(f64_2);
+    TEST_COMPRESS(f64_4);
+    TEST_COMPRESS(f64_8);
+
+    return 0;
+}
+
+#define _TEST_REDUCE(_type, _tstr, _file, _line)                                                \
+({                                                                                              \
+    typedef typeof(((_type){})[0]) _lt;                                                         \
+    const int _is_float = ((_lt)0.5 != 0), _is_signed = ((_lt)-1 < 0);                          \
+    const _lt _lmax = _is_float ? (_lt)__builtin_inf() :                                        \
+                      _is_signed ? (_lt)(~0ULL >> (65 - BIT_SIZE(_lt))) : (_lt)~0ULL;           \
+    const _lt _lmin = _is_float ? (_lt)-__builtin_inf() : _is_signed ? -_lmax - 1 : 0;          \
+    unsigned _pass, _i;                                                                         \
+                                                                                                \
+    for (_pass = 0; _pass < 64; _pass++) {                                                      \
+        const u64 _m = (_pass == 0) ? 0 : (_pass == 1) ? ~0ULL : masks[_pass];                  \
+        _type _v = vals[_pass]._type;                                                           \
+        _lt _sum = 0, _msum = 0, _mmn = _lmax, _mmx = _lmin;                                    \
+        u64 _and = ~0ULL, _or = 0, _xor = 0, _mand = ~0ULL, _mor = 0, _mxor = 0, _b;            \
+        u32 _amin = 0, _amax = 0, _mamin = VEC_LANES(_v), _mamax = VEC_LANES(_v);               \
+                                                                                                \
+        /* Small whole numbers in floating point lanes so the sums are exact. */                \
+        for (_i = 0; _is_float && (_i < VEC_LANES(_v)); _i++) {                                 \
+            _v[_i] = (_lt)((const i8 *)&vals[_pass])[_i];                                       \
+        }                                                                                       \
+                                                                                                \
+        for (_i = 0; _i < VEC_LANES(_v); _i++) {                                                \
+            const _lt _x = _v[_i];                                                              \
+                                                                                                \
+            _b = 0;                                                                             \
+            __builtin_memcpy(&_b, &_x, sizeof(_x));                                             \
+            _sum = (_lt)(_sum + _x);                                                            \
+            _amin = (_x < _v[_amin]) ? _i : _amin;                                              \
+            _amax = (_x > _v[_amax]) ? _i : _amax;                                              \
+            _and &= _b;                                                                         \
+            _or |= _b;                                                                          \
+            _xor ^= _b;                                                                         \
+                                                                                                \
+            if ((_m >> _i) & 1) {                                                               \
+                _msum = (_lt)(_msum + _x);                                                      \
+                _mamin = ((_mamin == VEC_LANES(_v)) || (_x < _mmn)) ? _i : _mamin;              \
+                _mamax = ((_mamax == VEC_LANES(_v)) || (_x > _mmx)) ? _i : _mamax;              \
+                _mmn = (_x < _mmn) ? _x : _mmn;                                                 \
+                _mmx = (_x > _mmx) ? _x : _mmx;                                                 \
+                _mand &= _b;                                                                    \
+                _mor |= _b;                                                                     \
+                _mxor ^= _b;                                                                    \
+            }                                                                                   \
+        }                                                                                       \
+                                                                                                \
+        const _lt _got[] = {                                                                    \
+            VEC_REDUCE_ADD(_v), VEC_REDUCE_MIN(_v), VEC_REDUCE_MAX(_v),                         \
+            VEC_REDUCE_ADD_MASKED(_m, _v), VEC_REDUCE_MIN_MASKED(_m, _v),                       \
+            VEC_REDUCE_MAX_MASKED(_m, _v)                                                       \
+        };                                                                                      \
+        const _lt _bits[] = {                                                                   \
+            VEC_REDUCE_AND(_v), VEC_REDUCE_OR(_v), VEC_REDUCE_XOR(_v),                          \
+            VEC_REDUCE_AND_MASKED(_m, _v), VEC_REDUCE_OR_MASKED(_m, _v),                        \
+            VEC_REDUCE_XOR_MASKED(_m, _v)                                                       \
+        };                                                                                      \
+        const _lt _expect[] = { _sum, _v[_amin], _v[_amax], _msum, _mmn, _mmx };                \
+        const u64 _lmask = ~0ULL >> (64 - BIT_SIZE(_lt));                                       \
+        const u64 _expect_bits[] = { _and, _or, _xor, _mand, _mor, _mxor };                     \
+        const u32 _args[] = { VEC_ARGMIN(_v), VEC_ARGMAX(_v), VEC_ARGMIN_MASKED(_m, _v),        \
+                              VEC_ARGMAX_MASKED(_m, _v) };                                      \
+        const u32 _expect_args[] = { _amin, _amax, _mamin, _mamax };                            \
+                                                                                                \
+        for (_i = 0; _i < 6; _i++) {                                                            \
+            _b = 0;                                                                             \
+            __builtin_memcpy(&_b, &_bits[_i], sizeof(_lt));                                     \
+                                                                                                \
+            if ((_got[_i] != _expect[_i]) | (_b != (_expect_bits[_i] & _lmask)) |               \
+                    ((_i < 4) && (_args[_i] != _expect_args[_i]))) {                            \
+                printf(OUT_PREFIX "Unexpected VEC_REDUCE_*() result %u with type %s, "          \
+                       "mask %#lx (%s:%d)\n", _i, _tstr, _m, _file, _line);                     \
+                debug_print_vec(_v, ~0);                                                        \
+                return 1;                                                                       \
+            }                                                                                   \
+        }                                                                                       \
+    }                                                                                           \
+}) /* end of macro */
+
+#define TEST_REDUCE(__type) _TEST_REDUCE(__type, #__type, __FILE__, __LINE__)
+
+/*
+ *    Every reduction, masked and not, against a lane at a time loop for every type, with random
+ * values and masks plus the empty and full masks.
+ */
+static int test_reduce(void)
+{
+    static MEGA_UNION vals[64];
+    static u64 masks[64];
+
+    randomize_data(vals, sizeof(vals));
+    randomize_data(masks, sizeof(masks));
+
+    TEST_REDUCE(u8_16);
+    TEST_REDUCE(u8_32);
+    TEST_REDUCE(u8_64);
+
+    TEST_REDUCE(u16_8);
+    TEST_REDUCE(u16_16);
+    TEST_REDUCE(u16_32);
+
+    TEST_REDUCE(u32_4);
+    TEST_REDUCE(u32_8);
+    TEST_REDUCE(u32_16);
+
+    TEST_REDUCE(u64_2);
+    TEST_REDUCE(u64_4);
+    TEST_REDUCE(u64_8);
+
+    TEST_REDUCE(i8_16);
+    TEST_REDUCE(i8_32);
+    TEST_REDUCE(i8_64);
+
+    TEST_REDUCE(i16_8);
+    TEST_REDUCE(i16_16);
+    TEST_REDUCE(i16_32);
+
+    TEST_REDUCE(i32_4);
+    TEST_REDUCE(i32_8);
+    TEST_REDUCE(i32_16);
+
+    TEST_REDUCE(i64_2);
+    TEST_REDUCE(i64_4);
+    TEST_REDUCE(i64_8);
+
+    TEST_REDUCE(f32_4);
+    TEST_REDUCE(f32_8);
+    TEST_REDUCE(f32_16);
+
+    TEST_REDUCE(f64_2);
+    TEST_REDUCE(f64_4);
+    TEST_REDUCE(f64_8);
+
+    return 0;
+}
+
+#define _TEST_MASKED_OP(_type, _tstr, _file, _line)                                             \
+({                                                                                              \
+    typedef typeof(((_type){})[0]) _lt;                                                         \
+    const int _is_float = ((_lt)0.5 != 0);                                                      \
+    const _type _zero = {};                                                                     \
+    unsigned _pass, _i, _k;                                                                     \
+                                                                                                \
+    for (_pass = 0; _pass < 61; _pass++) {                                                      \
+        const u64 _m = (_pass == 0) ? 0 : (_pass == 1) ? ~0ULL : masks[_pass];                  \
+        _type _a = vals[_pass]._type, _b = vals[_pass + 1]._type, _s = vals[_pass + 2]._type;   \
+                                                                                                \
+        /* Small whole numbers in floating point lanes so the arithmetic is exact. */           \
+        for (_i = 0; _is_float && (_i < VEC_LANES(_a)); _i++) {                                 \
+            _a[_i] = (_lt)((const i8 *)&vals[_pass])[_i];                                       \
+            _b[_i] = (_lt)((const i8 *)&vals[_pass + 1])[_i];                                   \
+        }                                                                                       \
+                                                                                                \
+        const _type _got[] = {                                                                  \
+            MASKED_OP(add, _m, _s, _a, _b), MASKED_OP(sub, _m, _s, _a, _b),                     \
+            MASKED_OP(min, _m, _s, _a, _b), MASKED_OP(max, _m, _s, _a, _b),                     \
+            MASKED_OP(and, _m, _s, _a, _b), MASKED_OP(or, _m, _s, _a, _b),                      \
+            MASKED_OP(xor, _m, _s, _a, _b),                                                     \
+            MASKZ_OP(add, _m, _a, _b), MASKZ_OP(sub, _m, _a, _b),                               \
+            MASKZ_OP(min, _m, _a, _b), MASKZ_OP(max, _m, _a, _b),                               \
+            MASKZ_OP(and, _m, _a, _b), MASKZ_OP(or, _m, _a, _b),                                \
+            MASKZ_OP(xor, _m, _a, _b)                                                           \
+        };                                                                                      \
+                                                                                                \
+        for (_i = 0; _i < VEC_LANES(_a); _i++) {                                                \
+            const _lt _x = _a[_i], _y = _b[_i];                                                 \
+            const int _sel = (_m >> _i) & 1;                                                    \
+            u64 _bx = 0, _by = 0, _bits[4];                                                     \
+            _lt _e[7];                                                                          \
+                                                                                                \
+            __builtin_memcpy(&_bx, &_x, sizeof(_lt));                                           \
+            __builtin_memcpy(&_by, &_y, sizeof(_lt));                                           \
+            /* Integer add and sub through u64 so they wrap rather than overflow. */            \
+            _bits[0] = _bx + _by;                                                               \
+            _bits[1] = _bx - _by;                                                               \
+            _bits[2] = _bx & _by;                                                               \
+            _bits[3] = _bx | _by;                                                               \
+            __builtin_memcpy(&_e[0], &_bits[0], sizeof(_lt));                                   \
+            __builtin_memcpy(&_e[1], &_bits[1], sizeof(_lt));                                   \
+            _e[0] = _is_float ? (_lt)(_x + _y) : _e[0];                                         \
+            _e[1] = _is_float ? (_lt)(_x - _y) : _e[1];                                         \
+            _e[2] = (_x < _y) ? _x : _y;                                                        \
+            _e[3] = (_x > _y) ? _x : _y;                                                        \
+            __builtin_memcpy(&_e[4], &_bits[2], sizeof(_lt));                                   \
+            __builtin_memcpy(&_e[5], &_bits[3], sizeof(_lt));                                   \
+            _bits[0] = _bx ^ _by;                                                               \
+            __builtin_memcpy(&_e[6], &_bits[0], sizeof(_lt));                                   \
+                                                                                                \
+            for (_k = 0; _k < 14; _k++) {                                                       \
+                const _lt _want = _sel ? _e[_k % 7] : (_k < 7) ? _s[_i] : _zero[_i];            \
+                const _lt _have = _got[_k][_i];                                                 \
+                                                                                                \
+                if (__builtin_memcmp(&_want, &_have, sizeof(_lt))) {                            \
+                    printf(OUT_PREFIX "Unexpected MASK%s_OP() result %u lane %u with type %s, " \
+                           "mask %#lx (%s:%d)\n", (_k < 7) ? "ED" : "Z", _k % 7, _i, _tstr,     \
+                           _m, _file, _line);                                                   \
+                    debug_print_vec(_got[_k], ~0);                                              \
+                    return 1;                                                                   \
+                }                                                                               \
+            }                                                                                   \
+        }                                                                                       \
+    }                                                                                           \
+}) /* end of macro */
+
+#define _TEST_MASKED_MEM(_type, _tstr, _file, _line)                                            \
+({                                                                                              \
+    typedef typeof(((_type){})[0]) _lt;                                                         \
+    unsigned _pass, _i;                                                                         \
+                                                                                                \
+    for (_pass = 0; _pass < 62; _pass++) {                                                      \
+        const u64 _m = (_pass == 0) ? 0 : (_pass == 1) ? ~0ULL : masks[_pass];                  \
+        const _lt * const _src = (const _lt *)((const u8 *)&vals[_pass] + (_pass % 8));         \
+        _lt _dst[VEC_TYPE_LANES(_type) + 1];                                                    \
+        const _type _got = MASKED_LOADU(_src, _m, _type);                                       \
+        const _type _v = vals[_pass + 1]._type;                                                 \
+                                                                                                \
+        __builtin_memset(_dst, 0xA5, sizeof(_dst));                                             \
+        MASKED_STOREU(_dst, _m, _v);                                                            \
+                                                                                                \
+        for (_i = 0; _i <= VEC_LANES(_v); _i++) {                                               \
+            const int _sel = (_i < VEC_LANES(_v)) && ((_m >> _i) & 1);                          \
+            _lt _load = 0, _store;                                                              \
+                                                                                                \
+            __builtin_memset(&_store, 0xA5, sizeof(_store));                                    \
+                                                                                                \
+            if (_sel) {                                                                         \
+                __builtin_memcpy(&_load, &_src[_i], sizeof(_lt));                               \
+                _store = _v[_i];                                                                \
+            }                                                                                   \
+                                                                                                \
+            if (((_i < VEC_LANES(_v)) && __builtin_memcmp(&_got[_i], &_load, sizeof(_lt))) ||   \
+                    __builtin_memcmp(&_dst[_i], &_store, sizeof(_lt))) {                        \
+                printf(OUT_PREFIX "Unexpected MASKED_LOADU/STOREU() lane %u with type %s, "     \
+                       "mask %#lx (%s:%d)\n", _i, _tstr, _m, _file, _line);                     \
+                return 1;                                                                       \
+            }                                                                                   \
+        }                                                                                       \
+    }                                                                                           \
+}) /* end of macro */
+
+#define TEST_MASKED_OP(__type) _TEST_MASKED_OP(__type, #__type, __FILE__, __LINE__)
+#define TEST_MASKED_MEM(__type) _TEST_MASKED_MEM(__type, #__type, __FILE__, __LINE__)
+
+/*
+ *    Every MASKED_OP() / MASKZ_OP() op against a lane at a time loop, and the masked loads and
+ * stores against memcpy(), for every type with random values and masks plus the empty and full
+ * masks.  The stores also check the lane past the end of the vector isn't touched.
+ */
+static int test_masked_ops(void)
+{
+    static MEGA_UNION vals[64];
+    static u64 masks[64];
+
+    randomize_data(vals, sizeof(vals));
+    randomize_data(masks, sizeof(masks));
+
+    TEST_MASKED_OP(u8_16);
+    TEST_MASKED_OP(u8_32);
+    TEST_MASKED_OP(u8_64);
+
+    TEST_MASKED_OP(u16_8);
+    TEST_MASKED_OP(u16_16);
+    TEST_MASKED_OP(u16_32);
+
+    TEST_MASKED_OP(u32_4);
+    TEST_MASKED_OP(u32_8);
+    TEST_MASKED_OP(u32_16);
+
+    TEST_MASKED_OP(u64_2);
+    TEST_MASKED_OP(u64_4);
+    TEST_MASKED_OP(u64_8);
+
+    TEST_MASKED_OP(i8_16);
+    TEST_MASKED_OP(i8_32);
+    TEST_MASKED_OP(i8_64);
+
+    TEST_MASKED_OP(i16_8);
+    TEST_MASKED_OP(i16_16);
+    TEST_MASKED_OP(i16_32);
+
+    TEST_MASKED_OP(i32_4);
+    TEST_MASKED_OP(i32_8);
+    TEST_MASKED_OP(i32_16);
+
+    TEST_MASKED_OP(i64_2);
+    TEST_MASKED_OP(i64_4);
+    TEST_MASKED_OP(i64_8);
+
+    TEST_MASKED_OP(f32_4);
+    TEST_MASKED_OP(f32_8);
+    TEST_MASKED_OP(f32_16);
+
+    TEST_MASKED_OP(f64_2);
+    TEST_MASKED_OP(f64_4);
+    TEST_MASKED_OP(f64_8);
+
+    TEST_MASKED_MEM(u8_16);
+    TEST_MASKED_MEM(u8_32);
+    TEST_MASKED_MEM(u8_64);
+
+    TEST_MASKED_MEM(u16_8);
+    TEST_MASKED_MEM(u16_16);
+    TEST_MASKED_MEM(u16_32);
+
+    TEST_MASKED_MEM(u32_4);
+    TEST_MASKED_MEM(u32_8);
+    TEST_MASKED_MEM(u32_16);
+
+    TEST_MASKED_MEM(u64_2);
+    TEST_MASKED_MEM(u64_4);
+    TEST_MASKED_MEM(u64_8);
+
+    TEST_MASKED_MEM(i8_16);
+    TEST_MASKED_MEM(i8_32);
+    TEST_MASKED_MEM(i8_64);
+
+    TEST_MASKED_MEM(i16_8);
+    TEST_MASKED_MEM(i16_16);
+    TEST_MASKED_MEM(i16_32);
+
+    TEST_MASKED_MEM(i32_4);
+    TEST_MASKED_MEM(i32_8);
+    TEST_MASKED_MEM(i32_16);
+
+    TEST_MASKED_MEM(i64_2);
+    TEST_MASKED_MEM(i64_4);
+    TEST_MASKED_MEM(i64_8);
+
+    TEST_MASKED_MEM(f32_4);
+    TEST_MASKED_MEM(f32_8);
+    TEST_MASKED_MEM(f32_16);
+
+    TEST_MASKED_MEM(f64_2);
+    TEST_MASKED_MEM(f64_4);
+    TEST_MASKED_MEM(f64_8);
+
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     const union {
@@ -295,6 +726,21 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    if (test_compress()) {
+        printf(OUT_PREFIX "%s FAIL!\n", __FILE__);
+        return 1;
+    }
+
+    if (test_reduce()) {
+        printf(OUT_PREFIX "%s FAIL!\n", __FILE__);
+        return 1;
+    }
+
+    if (test_masked_ops()) {
+        printf(OUT_PREFIX "%s FAIL!\n", __FILE__);
+        return 1;
+    }
+
     printf(OUT_PREFIX "%s: PASS\n", __FILE__);
     return 0;
 }
@@ -0,0 +1,528 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "../include/simd_util.h"
+
+#define OUT_PREFIX "\t"
+
+#define REC_SIZE    (256)
+#define NCASES      (6)
+
+static u8 recs[16][REC_SIZE] __attribute__((__aligned__(64)));
+
+/*
+ *    Build packet case c in the pcap record r, filling in what pkt_digest_x16() should produce
+ * for it at full length, and return the packet's length.
+ */
+static unsigned build(pcap_pkt_hdr_t * const r, const unsigned c, pkt_metadata_t * const exp)
+{
+    u8 * const p = r->pkt;
+    eth_hdr_t * const eh = (eth_hdr_t *)p;
+    unsigned cur = sizeof(eth_hdr_t);
+
+    memset(r, 0, REC_SIZE);
+    randomize_data(p, REC_SIZE - sizeof(*r));
+    memset(exp, 0, sizeof(*exp));
+    exp->pph = r;
+    exp->offs_vlan = exp->offs_l3 = exp->offs_l4 = exp->offs_payload = 0xFFFF;
+
+    switch (c) {
+    case 0:     // C-tag, S-tag, IPv4 with one option word, TCP with 12 bytes of options
+    case 1:     // IPv4, ICMP
+        {
+            u16 * et = &eh->et;
+
+            if (c == 0) {
+                dot_q_t * const q0 = (dot_q_t *)(p + cur);
+                dot_q_t * const q1 = (dot_q_t *)(p + cur + sizeof(dot_q_t));
+
+                *et = CONST_HTONS(ET_CVLAN);
+                q0->et = CONST_HTONS(ET_SVLAN);
+                exp->c_tag = q0->tag;
+                exp->s_tag = q1->tag;
+                exp->proto_flags |= MD_PROTO_L2_CTAG | MD_PROTO_L2_STAG;
+                exp->offs_vlan = cur + sizeof(dot_q_t);
+                et = &q1->et;
+                cur += 2 * sizeof(dot_q_t);
+            }
+
+            ip4_hdr_t * const ip4 = (ip4_hdr_t *)(p + cur);
+
+            *et = CONST_HTONS(ET_IP4);
+            ip4->ver = 4;
+            ip4->ihl = (c == 0) ? 6 : 5;
+            ip4->proto = (c == 0) ? L4T_TCP : L4T_ICMP;
+            exp->src_ip.u32[0] = ip4->src;
+            exp->dst_ip.u32[0] = ip4->dst;
+            exp->proto_flags |= MD_PROTO_L3_IP4;
+            exp->offs_l3 = cur;
+            cur += ip4->ihl * sizeof(u32);
+            exp->offs_l4 = cur;
+
+            if (c == 1) {
+                exp->proto_flags |= MD_PROTO_L4_ICMP;
+                return cur + 8;
+            }
+
+            tcp_hdr_t * const tcp = (tcp_hdr_t *)(p + cur);
+
+            tcp->doff_flags = 0x0080 | (tcp->doff_flags & 0xFF00);
+            exp->src_port = tcp->sport;
+            exp->dst_port = tcp->dport;
+            exp->proto_flags |= MD_PROTO_L4_TCP;
+            exp->offs_payload = cur + 32;
+            return cur + 32 + 10;
+        }
+
+    case 2:     // IPv6 with a hop-by-hop and a 16 byte routing header, then UDP
+        {
+            ip6_hdr_t * const ip6 = (ip6_hdr_t *)(p + cur);
+            ip6_generic_opt_t * const hbh = (ip6_generic_opt_t *)ip6->next;
+            ip6_generic_opt_t * const rt = (ip6_generic_opt_t *)hbh->next;
+            udp_hdr_t * const udp = (udp_hdr_t *)(rt->next + 8);
+
+            eh->et = CONST_HTONS(ET_IP6);
+            ip6->ver = 6;
+            ip6->nexthdr = 0;
+            hbh->nexthdr = 43;
+            hbh->optlen = 0;
+            rt->nexthdr = L4T_UDP;
+            rt->optlen = 1;
+            memcpy(exp->src_ip.u32, ip6->src, sizeof(ip6->src));
+            memcpy(exp->dst_ip.u32, ip6->dst, sizeof(ip6->dst));
+            exp->src_port = udp->sport;
+            exp->dst_port = udp->dport;
+            exp->proto_flags = MD_PROTO_L3_IP6 | MD_PROTO_L4_UDP;
+            exp->offs_l3 = cur;
+            exp->offs_l4 = (u8 *)udp - p;
+            exp->offs_payload = exp->offs_l4 + sizeof(*udp);
+            return exp->offs_payload + 4;
+        }
+
+    case 3:     // ARP
+        {
+            arp_eth_ip4_t * const arp = (arp_eth_ip4_t *)(p + cur);
+
+            eh->et = CONST_HTONS(ET_ARP);
+            arp->hw_type = CONST_HTONS(HW_ETHERNET);
+            arp->l3_type = CONST_HTONS(ET_IP4);
+            exp->proto_flags = MD_PROTO_L3_ARP;
+            exp->offs_l3 = cur;
+            return cur + sizeof(*arp);
+        }
+
+    case 4:     // Unknown ethertype, only the Ethernet header is looked at
+        eh->et = CONST_HTONS(0x1234);
+        return cur + 20;
+
+    default:    // ARP for something other than IPv4, refused
+        {
+            arp_eth_ip4_t * const arp = (arp_eth_ip4_t *)(p + cur);
+
+            eh->et = CONST_HTONS(ET_ARP);
+            arp->hw_type = CONST_HTONS(HW_ETHERNET);
+            arp->l3_type = CONST_HTONS(ET_IP6);
+            exp->offs_l3 = cur;
+            return cur + sizeof(*arp);
+        }
+    }
+}
+
+/*
+ *    Whether case c parses at a length of len (the full length being full).  The IPv6 case stops
+ * walking extension headers silently when the next one doesn't fit, which only fails if that
+ * leaves it looking at the UDP next header with too little room for the UDP header.
+ */
+static int parses(const unsigned c, const unsigned len, const unsigned full)
+{
+    switch (c) {
+    case 0:
+        return len >= full - 10;
+    case 1:
+        return len >= full - 8;
+    case 2:
+        return (len >= 14 + 40) & !((len >= 14 + 40 + 16) & (len < 14 + 40 + 24 + 8));
+    case 3:
+        return len >= full;
+    case 4:
+        return len >= 14;
+    default:
+        return 0;
+    }
+}
+
+static const pcap_pkt_hdr_t *hdr(const unsigned i)
+{
+    return (const pcap_pkt_hdr_t *)recs[i];
+}
+
+/*
+ * Every case at full length, alone and in every lane, gives exactly the expected metadata.
+ */
+int test_pkt_digest_fields(void)
+{
+    const pcap_pkt_hdr_t *hdrs[16];
+    pkt_metadata_t exp[16], md[16];
+    unsigned c, i;
+
+    for (c = 0; c < NCASES; c++) {
+        for (i = 0; i < 16; i++) {
+            pcap_pkt_hdr_t * const r = (pcap_pkt_hdr_t *)recs[i];
+
+            r->incl_len = r->orig_len = build(r, c, &exp[i]);
+            hdrs[i] = r;
+        }
+
+        const __mmask16 ok = pkt_digest_x16(hdrs, md, 16);
+
+        if (ok != ((c < NCASES - 1) ? 0xFFFF : 0)) {
+            printf(OUT_PREFIX "Case %u: pkt_digest_x16() returned 0x%04x\n", c, ok);
+            return -1;
+        }
+
+        for (i = 0; i < 16; i++) {
+            if (memcmp(&md[i], &exp[i], sizeof(md[i]))) {
+                printf(OUT_PREFIX "Case %u: metadata of lane %u differs from the expected\n", c,
+                       i);
+                debug_print_vec(md[i].zmm, ~0);
+                debug_print_vec(exp[i].zmm, ~0);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ *    Each case truncated to every length by incl_len, then by orig_len, in a lane among full
+ * length packets, fails exactly when it should and leaves the other lanes alone.
+ */
+int test_pkt_digest_truncated(void)
+{
+    const pcap_pkt_hdr_t *hdrs[16];
+    pkt_metadata_t exp, md[16];
+    unsigned c, len, by, lane;
+
+    for (c = 0; c < NCASES - 1; c++) {
+        for (lane = 0; lane < 16; lane++) {
+            pcap_pkt_hdr_t * const r = (pcap_pkt_hdr_t *)recs[lane];
+
+            r->incl_len = r->orig_len = build(r, c, &exp);
+            hdrs[lane] = r;
+        }
+
+        const unsigned full = hdr(0)->incl_len;
+
+        for (by = 0; by < 2; by++) {
+            for (len = 0; len <= full; len++) {
+                pcap_pkt_hdr_t * const r = (pcap_pkt_hdr_t *)recs[len & 15];
+                const __mmask16 want = ~(!parses(c, len, full) << (len & 15));
+
+                if (by == 0) {
+                    r->incl_len = len;
+                } else {
+                    r->orig_len = len;
+                }
+
+                const __mmask16 ok = pkt_digest_x16(hdrs, md, 16);
+
+                r->incl_len = r->orig_len = full;
+
+                if (ok != want) {
+                    printf(OUT_PREFIX "Case %u cut to %u by %s_len: returned 0x%04x, "
+                           "expected 0x%04x\n", c, len, by ? "orig" : "incl", ok, want);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ *    A random mix of cases and truncations over n = 1..16 lanes: each lane matches the same
+ * packet digested alone and nothing past md[n - 1] is written.
+ */
+int test_pkt_digest_mixed(void)
+{
+    const pcap_pkt_hdr_t *hdrs[16];
+    pkt_metadata_t exp, md[16], one;
+    unsigned pass, n, i;
+    u32 r[16];
+
+    for (pass = 0; pass < 256; pass++) {
+        randomize_data(r, sizeof(r));
+
+        for (i = 0; i < 16; i++) {
+            pcap_pkt_hdr_t * const rec = (pcap_pkt_hdr_t *)recs[i];
+            const unsigned full = build(rec, r[i] % NCASES, &exp);
+
+            rec->incl_len = rec->orig_len = full;
+
+            if (r[i] & (1 << 8)) {
+                rec->incl_len = (r[i] >> 9) % (full + 1);
+            }
+
+            hdrs[i] = rec;
+        }
+
+        for (n = 1; n <= 16; n++) {
+            memset(md, 0xA5, sizeof(md));
+
+            const __mmask16 ok = pkt_digest_x16(hdrs, md, n);
+
+            if (ok >> n) {
+                printf(OUT_PREFIX "n %u: lanes past n reported parsed (0x%04x)\n", n, ok);
+                return -1;
+            }
+
+            for (i = 0; i < 16; i++) {
+                if (i >= n) {
+                    memset(&one, 0xA5, sizeof(one));
+                } else if (((pkt_digest_x16(&hdrs[i], &one, 1) ^ (ok >> i)) & 1)) {
+                    printf(OUT_PREFIX "n %u: lane %u parsed differently alone\n", n, i);
+                    return -1;
+                }
+
+                if (memcmp(&md[i], &one, sizeof(one))) {
+                    printf(OUT_PREFIX "n %u: lane %u metadata differs from the lane alone\n", n,
+                           i);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+#define CSUM_REC_SIZE   (1600)
+#define NCSUM_CASES     (9)
+
+static u8 csum_recs[16][CSUM_REC_SIZE] __attribute__((__aligned__(64)));
+
+/* RFC 1071 over network order words, written out independently of the code under test. */
+static u16 ref_csum(u32 sum, const u8 * const p, const unsigned len)
+{
+    unsigned i;
+
+    for (i = 0; i < len; i++) {
+        sum += (i & 1) ? p[i] : (p[i] << 8);
+    }
+
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    return ~sum & 0xFFFF;
+}
+
+/*
+ *    Build checksum case c with paylen bytes of payload after its last header, every checksum
+ * correct, in the pcap record r.  Returns the packet's length, and the offsets of the bytes a
+ * corruption test may flip: the payload (*pay) and the IPv4 TTL (*ttl, 0 for IPv6 and ARP).
+ */
+static unsigned build_csum(pcap_pkt_hdr_t * const r, const unsigned c, const unsigned paylen,
+                           unsigned * const pay, unsigned * const ttl)
+{
+    u8 * const p = r->pkt;
+    eth_hdr_t * const eh = (eth_hdr_t *)p;
+    const unsigned l3 = sizeof(eth_hdr_t);
+    unsigned l4, len, proto = 0, ph;
+    u8 pseudo[40];
+
+    memset(r, 0, CSUM_REC_SIZE);
+    randomize_data(p, CSUM_REC_SIZE - sizeof(*r));
+    *ttl = 0;
+
+    switch (c) {
+    case 0:     // IPv4 with an option word, TCP with 12 bytes of options
+    case 1:     // IPv4, UDP
+    case 2:     // IPv4, UDP without a checksum
+    case 5:     // IPv4, ICMP (header checksum only)
+    case 6:     // IPv4 first fragment (MF set), UDP whose checksum covers the whole datagram
+    case 7:     // IPv4 later fragment (non-zero offset), no L4 header
+        {
+            ip4_hdr_t * const ip4 = (ip4_hdr_t *)(p + l3);
+
+            eh->et = CONST_HTONS(ET_IP4);
+            ip4->ver = 4;
+            ip4->ihl = (c == 0) ? 6 : 5;
+            proto = (c == 0) ? L4T_TCP : (c == 5) ? L4T_ICMP : L4T_UDP;
+            ip4->proto = proto;
+            ip4->flags_offs = (c == 6) ? CONST_HTONS(0x2000) : (c == 7) ? CONST_HTONS(185) : 0;
+            ip4->csum = 0;
+            l4 = l3 + (ip4->ihl * 4);
+            len = l4 + ((c == 0) ? 32 : 8) + paylen;
+            ip4->total_len = htons(len - l3);
+            ip4->csum = htons(ref_csum(0, (u8 *)ip4, ip4->ihl * 4));
+            memcpy(pseudo, &ip4->src, 8);
+            ph = 8;
+            *ttl = l3 + offsetof(ip4_hdr_t, ttl);
+
+            if (c >= 6) {
+                /* Only the IP header can be checked: leave the UDP checksum random. */
+                if (c == 6) {
+                    ((udp_hdr_t *)(p + l4))->len = htons(len - l4 + 1480);
+                }
+
+                *pay = len - paylen;
+                return len;
+            }
+
+            break;
+        }
+
+    case 3:     // IPv6 with a hop-by-hop header, UDP
+    case 4:     // IPv6, TCP
+        {
+            ip6_hdr_t * const ip6 = (ip6_hdr_t *)(p + l3);
+            ip6_generic_opt_t * const hbh = (ip6_generic_opt_t *)ip6->next;
+
+            eh->et = CONST_HTONS(ET_IP6);
+            ip6->ver = 6;
+            proto = (c == 3) ? L4T_UDP : L4T_TCP;
+
+            if (c == 3) {
+                ip6->nexthdr = 0;
+                hbh->nexthdr = proto;
+                hbh->optlen = 0;
+                l4 = l3 + sizeof(*ip6) + sizeof(*hbh);
+            } else {
+                ip6->nexthdr = proto;
+                l4 = l3 + sizeof(*ip6);
+            }
+
+            len = l4 + ((c == 3) ? 8 : 20) + paylen;
+            ip6->paylen = htons(len - l3 - sizeof(*ip6));
+            memcpy(pseudo, ip6->src, 32);
+            ph = 32;
+            break;
+        }
+
+    default:    // ARP, nothing to check
+        {
+            arp_eth_ip4_t * const arp = (arp_eth_ip4_t *)(p + l3);
+
+            eh->et = CONST_HTONS(ET_ARP);
+            arp->hw_type = CONST_HTONS(HW_ETHERNET);
+            arp->l3_type = CONST_HTONS(ET_IP4);
+            *pay = l3 + sizeof(*arp);
+            return *pay + paylen;
+        }
+    }
+
+    if (proto == L4T_TCP) {
+        tcp_hdr_t * const tcp = (tcp_hdr_t *)(p + l4);
+
+        tcp->doff_flags = (c == 0) ? 0x0080 : 0x0050;
+        tcp->csum = 0;
+    } else if (proto == L4T_UDP) {
+        udp_hdr_t * const udp = (udp_hdr_t *)(p + l4);
+
+        udp->len = htons(len - l4);
+        udp->csum = 0;
+    }
+
+    if ((proto == L4T_TCP) | ((proto == L4T_UDP) & (c != 2))) {
+        u16 * const csum = (u16 *)(p + l4 + ((proto == L4T_TCP) ? 16 : 6));
+        u16 sum;
+
+        pseudo[ph] = 0;
+        pseudo[ph + 1] = proto;
+        pseudo[ph + 2] = (len - l4) >> 8;
+        pseudo[ph + 3] = (len - l4) & 0xFF;
+        sum = ref_csum(0xFFFF & ~ref_csum(0, pseudo, ph + 4), p + l4, len - l4);
+        *csum = htons(sum ? sum : 0xFFFF);
+    }
+
+    *pay = len - paylen;
+    return len;
+}
+
+/*
+ *    Random cases and payload lengths in every lane, and in one lane either nothing changed,
+ * a payload bit flipped, the IPv4 TTL changed or the capture cut short by a byte.  Only the lanes
+ * whose checksums that breaks may fail, and only lanes asked about may pass.
+ */
+int test_pkt_csum(void)
+{
+    const pcap_pkt_hdr_t *hdrs[16];
+    pkt_metadata_t md[16] __attribute__((__aligned__(64)));
+    unsigned pass, i, c[16], pay[16], ttl[16];
+    u32 r[17];
+
+    for (pass = 0; pass < 4096; pass++) {
+        randomize_data(r, sizeof(r));
+
+        for (i = 0; i < 16; i++) {
+            pcap_pkt_hdr_t * const rec = (pcap_pkt_hdr_t *)csum_recs[i];
+
+            c[i] = r[i] % NCSUM_CASES;
+            rec->incl_len = rec->orig_len = build_csum(rec, c[i], (r[i] >> 8) % 1400, &pay[i],
+                                                       &ttl[i]);
+            hdrs[i] = rec;
+        }
+
+        const __mmask16 parsed = pkt_digest_x16(hdrs, md, 16);
+        const unsigned lane = r[16] & 15;
+        const unsigned how = (r[16] >> 4) & 3;
+        pcap_pkt_hdr_t * const rec = (pcap_pkt_hdr_t *)csum_recs[lane];
+        const int l4_sum = (c[lane] != 2) & (c[lane] < 5);
+        int breaks = 0;
+
+        if (parsed != 0xFFFF) {
+            printf(OUT_PREFIX "Pass %u: pkt_digest_x16() returned 0x%04x\n", pass, parsed);
+            return -1;
+        }
+
+        if ((how == 1) & (pay[lane] < rec->incl_len)) {
+            rec->pkt[pay[lane] + ((r[16] >> 8) % (rec->incl_len - pay[lane]))] ^=
+                1 << ((r[16] >> 24) & 7);
+            breaks = l4_sum;
+        } else if ((how == 2) & (ttl[lane] != 0)) {
+            rec->pkt[ttl[lane]]++;
+            breaks = 1;
+        } else if ((how == 3) & (pay[lane] < rec->incl_len)) {
+            rec->incl_len--;
+            breaks = (c[lane] < 5);
+        }
+
+        const __mmask16 want = ~(breaks << lane) & (r[16] >> 16);
+        const __mmask16 ok = pkt_csum_ok_x16(md, r[16] >> 16);
+
+        if (ok != want) {
+            printf(OUT_PREFIX "Pass %u: case %u in lane %u, change %u: returned 0x%04x, "
+                   "expected 0x%04x\n", pass, c[lane], lane, how, ok, want);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (test_pkt_digest_fields()) {
+        return -1;
+    }
+
+    if (test_pkt_digest_truncated()) {
+        return -1;
+    }
+
+    if (test_pkt_digest_mixed()) {
+        return -1;
+    }
+
+    if (test_pkt_csum()) {
+        return -1;
+    }
+
+    printf(OUT_PREFIX "%s: PASS\n", __FILE__);
+    return 0;
+}
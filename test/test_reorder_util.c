@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#define OUT_PREFIX "\t"
+
+#define _CHECK_SANITY(_expr, _str, _file, _line)                                    \
+({                                                                                  \
+    const int res = _expr;                                                          \
+    if (!res) {                                                                     \
+        printf(OUT_PREFIX "Sanity check assertion %s failed! (%s:%d)\n", _str,      \
+                 _file, _line);                                                     \
+        return 1;                                                                   \
+    }                                                                               \
+}) /*end of macro */
+
+#define CHECK_SANITY(__expr)    _CHECK_SANITY((__expr), #__expr, __FILE__, __LINE__)
+
+#define NSLOTS  (64)
+#define NSEQ    (4000)
+
+static union {
+    u32_16  z[0];
+    u32     u32[NSLOTS * 2];
+} rob_mem;
+
+static u32 order[NSEQ];
+static u32 out[NSEQ];
+
+/*
+ * Complete sequence numbers in a shuffled order (shuffled only within a window small enough to
+ * always fit in the ring) and check that release hands them back strictly in sequence.  The first
+ * sequence number is chosen so the sequence counter wraps through zero part way through and
+ * the head crosses the end of the ring at every possible alignment.
+ */
+static int test_reorder(void)
+{
+    const u32 first = 0U - 1000;
+    const u32 window = 24;
+    rob_t rob;
+    u32 i, n_out = 0, n_in = 0;
+
+    CHECK_SANITY(rob_init(&rob, &rob_mem, NSLOTS, first) == 0);
+    CHECK_SANITY(rob_release(&rob, out, NSEQ) == 0);
+
+    for (i = 0; i < NSEQ; i++) {
+        order[i] = first + i;
+    }
+
+    srandom(1234);
+
+    for (i = 0; i < NSEQ; i++) {
+        const u32 lim = ((i / window) + 1) * window;
+        const u32 j = i + (random() % (((lim < NSEQ) ? lim : NSEQ) - i));
+        const u32 t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    while (n_in < NSEQ) {
+        const u32 k = 1 + (random() % 16);
+        const u32 n = ((NSEQ - n_in) < k) ? (NSEQ - n_in) : k;
+        const __mmask16 m = (__mmask16)((1U << n) - 1);
+        const u32_16 posn = (u32_16)_mm512_maskz_loadu_epi32(m, order + n_in);
+
+        if ((rob_fits_x16(&rob, posn) & m) != m) {
+            n_out += rob_release(&rob, out + n_out, NSEQ - n_out);
+        }
+
+        CHECK_SANITY((rob_fits_x16(&rob, posn) & m) == m);
+        rob_complete_x16(&rob, posn, ~posn, m);
+        n_in += n;
+
+        n_out += rob_release(&rob, out + n_out, 1 + (random() % 40));
+    }
+
+    while (n_out < NSEQ) {
+        const u32 r = rob_release(&rob, out + n_out, NSEQ - n_out);
+        CHECK_SANITY(r > 0);
+        n_out += r;
+    }
+
+    for (i = 0; i < NSEQ; i++) {
+        CHECK_SANITY(out[i] == ~(first + i));
+    }
+
+    CHECK_SANITY(rob.head == first + NSEQ);
+    CHECK_SANITY(rob_release(&rob, out, NSEQ) == 0);
+
+    // A sequence number one full ring ahead of the head must not fit.
+    const u32_16 far = IDX_VEC(u32_16) + rob.head + NSLOTS - 8;
+    CHECK_SANITY(rob_fits_x16(&rob, far) == 0x00FF);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (test_reorder()) {
+        printf(OUT_PREFIX "%s FAIL!\n", __FILE__);
+        return 1;
+    }
+
+    printf(OUT_PREFIX "%s: PASS\n", __FILE__);
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#define OUT_PREFIX "\t"
+
+#define _CHECK_SANITY(_expr, _str, _file, _line)                                    \
+({                                                                                  \
+    const int res = _expr;                                                          \
+    if (!res) {                                                                     \
+        printf(OUT_PREFIX "Sanity check assertion %s failed! (%s:%d)\n", _str,      \
+                 _file, _line);                                                     \
+        return 1;                                                                   \
+    }                                                                               \
+}) /*end of macro */
+
+#define CHECK_SANITY(__expr)    _CHECK_SANITY((__expr), #__expr, __FILE__, __LINE__)
+
+#define NSLOTS  (16)
+
+static u8 ring_mem[MPMC_RING_MEM_SIZE(NSLOTS)] __attribute__((__aligned__(64)));
+
+/*
+ * Single threaded checks of the SPSC ring:
+ *      == Bad sizes / alignment are refused.
+ *      == Multi-slot enqueues are all-or-nothing and never overrun the consumer.
+ *      == Slots come out in the order they went in across many laps of the ring.
+ */
+static int test_spsc_ring(void)
+{
+    CHECK_SANITY(spsc_ring_init(ring_mem, 12) == NULL);
+    CHECK_SANITY(spsc_ring_init(ring_mem + 4, NSLOTS) == NULL);
+
+    spsc_ring_t * const r = spsc_ring_init(ring_mem, NSLOTS);
+    u32_16 buf[3];
+    u32 in = 0, out = 0, i, j;
+
+    CHECK_SANITY(r != NULL);
+    CHECK_SANITY(spsc_ring_dequeue(r, buf, 1) == 0);
+
+    for (i = 0; i < 5; i++) {
+        buf[0] = buf[1] = buf[2] = IDX_VEC(u32_16) + (in += 16);
+        CHECK_SANITY(spsc_ring_enqueue(r, buf, 3) == 3);
+    }
+
+    // 15 of 16 slots used: a 3 slot message must not partially go in
+    CHECK_SANITY(spsc_ring_enqueue(r, buf, 3) == 0);
+    CHECK_SANITY(r->tail == 15);
+
+    in = 0;
+
+    for (i = 0; i < 1000; i++) {
+        CHECK_SANITY(spsc_ring_dequeue(r, buf, 3) == 3);
+
+        for (j = 0; j < 3; j++) {
+            CHECK_SANITY(!_mm512_cmpneq_epi32_mask((__m512i)buf[j],
+                                                   (__m512i)(IDX_VEC(u32_16) + (out + 16))));
+        }
+
+        out += 16;
+        buf[0] = buf[1] = buf[2] = IDX_VEC(u32_16) + (out + 80);
+        CHECK_SANITY(spsc_ring_enqueue(r, buf, 3) == 3);
+    }
+
+    CHECK_SANITY(r->tail - r->head == 15);
+    CHECK_SANITY(spsc_ring_dequeue(r, buf, 16) == 0);
+
+    return 0;
+}
+
+/*
+ * Single threaded checks of the MPMC ring: it holds exactly nslots, refuses more, comes back out
+ * in order and keeps doing so after the per-slot sequence numbers have gone round many laps.
+ */
+static int test_mpmc_ring(void)
+{
+    CHECK_SANITY(mpmc_ring_init(ring_mem, 24) == NULL);
+
+    mpmc_ring_t * const r = mpmc_ring_init(ring_mem, NSLOTS);
+    u32_16 v;
+    u32 in = 0, out = 0, i;
+
+    CHECK_SANITY(r != NULL);
+    CHECK_SANITY((u8 *)mpmc_ring_slots(r) + (NSLOTS * sizeof(u32_16)) ==
+                 ring_mem + MPMC_RING_MEM_SIZE(NSLOTS));
+    CHECK_SANITY(mpmc_ring_dequeue(r, &v) == 0);
+
+    while (mpmc_ring_enqueue(r, IDX_VEC(u32_16) + in)) {
+        in++;
+    }
+
+    CHECK_SANITY(in == NSLOTS);
+
+    for (i = 0; i < 1000; i++) {
+        CHECK_SANITY(mpmc_ring_dequeue(r, &v) == 1);
+        CHECK_SANITY(!_mm512_cmpneq_epi32_mask((__m512i)v, (__m512i)(IDX_VEC(u32_16) + out)));
+        out++;
+        CHECK_SANITY(mpmc_ring_enqueue(r, IDX_VEC(u32_16) + in++) == 1);
+        CHECK_SANITY(mpmc_ring_enqueue(r, v) == 0);
+    }
+
+    while (mpmc_ring_dequeue(r, &v)) {
+        CHECK_SANITY(v[0] == out++);
+    }
+
+    CHECK_SANITY(out == in);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (test_spsc_ring()) {
+        printf(OUT_PREFIX "%s FAIL!\n", __FILE__);
+        return 1;
+    }
+
+    if (test_mpmc_ring()) {
+        printf(OUT_PREFIX "%s FAIL!\n", __FILE__);
+        return 1;
+    }
+
+    printf(OUT_PREFIX "%s: PASS\n", __FILE__);
+    return 0;
+}
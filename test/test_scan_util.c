@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#define OUT_PREFIX "\t"
+
+#define MAXLEN  (1031)
+
+static u32 src32[MAXLEN], dst32[MAXLEN], ref32[MAXLEN];
+static u64 src64[MAXLEN], dst64[MAXLEN], ref64[MAXLEN];
+static u64 heads[(MAXLEN + 63) / 64];
+
+/*
+ *    Scalar reference: inclusive or exclusive, only counting the elements whose bit is set in
+ * keep, restarting at the elements whose bit is set in segs (either may be NULL).
+ */
+#define REF_SCAN(_dst, _src, _n, _init, _excl, _keep, _segs)                                    \
+({                                                                                              \
+    const u64 * const __keep = (_keep), * const __segs = (_segs);                               \
+    typeof((_dst)[0]) __sum = (_init);                                                          \
+    u64 __i;                                                                                    \
+                                                                                                \
+    for (__i = 0; __i < (_n); __i++) {                                                          \
+        const typeof(__sum) __x = (!__keep || ((__keep[__i / 64] >> (__i % 64)) & 1)) ?         \
+            (_src)[__i] : 0;                                                                    \
+                                                                                                \
+        if (__segs && ((__segs[__i / 64] >> (__i % 64)) & 1)) {                                 \
+            __sum = 0;                                                                          \
+        }                                                                                       \
+                                                                                                \
+        (_dst)[__i] = (_excl) ? __sum : (__sum + __x);                                          \
+        __sum += __x;                                                                           \
+    }                                                                                           \
+                                                                                                \
+    __sum;                                                                                      \
+}) /* end of macro */
+
+#define CHECK_VEC(_got, _expect, _what)                                                         \
+({                                                                                              \
+    const typeof(_got) __got = (_got);                                                          \
+                                                                                                \
+    if (memcmp(&__got, (_expect), sizeof(__got))) {                                             \
+        printf(OUT_PREFIX "%s: %s differs from the reference\n", __FUNCTION__, (_what));        \
+        debug_print_vec(__got, ~0);                                                             \
+        return -1;                                                                              \
+    }                                                                                           \
+}) /* end of macro */
+
+int test_vector_scans(void)
+{
+    unsigned pass;
+
+    for (pass = 0; pass < 256; pass++) {
+        u32_16 v32;
+        u64_8 v64;
+        u64 m[1];
+
+        randomize_data(&v32, sizeof(v32));
+        randomize_data(&v64, sizeof(v64));
+        randomize_data(m, sizeof(m));
+
+        /* Small values now and then so the sums are readable when it goes wrong. */
+        if (pass & 1) {
+            v32 &= 0xFF;
+            v64 &= 0xFF;
+        }
+
+        REF_SCAN(ref32, v32, 16, 0, 0, NULL, NULL);
+        CHECK_VEC(scan_incl_u32_16(v32), ref32, "scan_incl_u32_16()");
+        REF_SCAN(ref32, v32, 16, 0, 1, NULL, NULL);
+        CHECK_VEC(scan_excl_u32_16(v32), ref32, "scan_excl_u32_16()");
+        REF_SCAN(ref32, v32, 16, 0, 0, m, NULL);
+        CHECK_VEC(scan_incl_masked_u32_16(v32, m[0]), ref32, "scan_incl_masked_u32_16()");
+        REF_SCAN(ref32, v32, 16, 0, 1, m, NULL);
+        CHECK_VEC(scan_excl_masked_u32_16(v32, m[0]), ref32, "scan_excl_masked_u32_16()");
+        REF_SCAN(ref32, v32, 16, 0, 0, NULL, m);
+        CHECK_VEC(scan_seg_incl_u32_16(v32, m[0]), ref32, "scan_seg_incl_u32_16()");
+        REF_SCAN(ref32, v32, 16, 0, 1, NULL, m);
+        CHECK_VEC(scan_seg_excl_u32_16(v32, m[0]), ref32, "scan_seg_excl_u32_16()");
+
+        REF_SCAN(ref64, v64, 8, 0, 0, NULL, NULL);
+        CHECK_VEC(scan_incl_u64_8(v64), ref64, "scan_incl_u64_8()");
+        REF_SCAN(ref64, v64, 8, 0, 1, NULL, NULL);
+        CHECK_VEC(scan_excl_u64_8(v64), ref64, "scan_excl_u64_8()");
+        REF_SCAN(ref64, v64, 8, 0, 0, m, NULL);
+        CHECK_VEC(scan_incl_masked_u64_8(v64, m[0]), ref64, "scan_incl_masked_u64_8()");
+        REF_SCAN(ref64, v64, 8, 0, 1, m, NULL);
+        CHECK_VEC(scan_excl_masked_u64_8(v64, m[0]), ref64, "scan_excl_masked_u64_8()");
+        REF_SCAN(ref64, v64, 8, 0, 0, NULL, m);
+        CHECK_VEC(scan_seg_incl_u64_8(v64, m[0]), ref64, "scan_seg_incl_u64_8()");
+        REF_SCAN(ref64, v64, 8, 0, 1, NULL, m);
+        CHECK_VEC(scan_seg_excl_u64_8(v64, m[0]), ref64, "scan_seg_excl_u64_8()");
+    }
+
+    return 0;
+}
+
+#define CHECK_ARRAY(_got_sum, _sum, _dst, _ref, _n, _what)                                      \
+({                                                                                              \
+    if (((_got_sum) != (_sum)) | !!memcmp((_dst), (_ref), (_n) * sizeof((_dst)[0]))) {          \
+        printf(OUT_PREFIX "%s: %s over %u elements returned %lu, expected %lu\n", __FUNCTION__, \
+               (_what), (unsigned)(_n), (u64)(_got_sum), (u64)(_sum));                          \
+        return -1;                                                                              \
+    }                                                                                           \
+}) /* end of macro */
+
+/*
+ *    Every length up to a few vectors and a long odd one, with an initial value, and in place.
+ * Sparse heads for the segmented scans so some vectors have none and the carry has to cross them.
+ */
+int test_array_scans(void)
+{
+    unsigned len, i;
+    u64 sum, got;
+
+    randomize_data(src32, sizeof(src32));
+    randomize_data(src64, sizeof(src64));
+    randomize_data(heads, sizeof(heads));
+
+    for (i = 0; i < sizeof(heads) / sizeof(heads[0]); i++) {
+        heads[i] &= heads[i] >> 7;
+        heads[i] &= heads[i] >> 13;
+    }
+
+    for (len = 0; len <= MAXLEN; len = (len < 40) ? (len + 1) : MAXLEN + (len == MAXLEN)) {
+        sum = REF_SCAN(ref32, src32, len, 12345, 0, NULL, NULL);
+        got = scan_incl_u32(dst32, src32, len, 12345);
+        CHECK_ARRAY((u32)got, (u32)sum, dst32, ref32, len, "scan_incl_u32()");
+
+        sum = REF_SCAN(ref32, src32, len, 12345, 1, NULL, NULL);
+        got = scan_excl_u32(dst32, src32, len, 12345);
+        CHECK_ARRAY((u32)got, (u32)sum, dst32, ref32, len, "scan_excl_u32()");
+
+        sum = REF_SCAN(ref32, src32, len, 0, 0, NULL, heads);
+        got = scan_seg_incl_u32(dst32, src32, heads, len);
+        CHECK_ARRAY((u32)got, (u32)sum, dst32, ref32, len, "scan_seg_incl_u32()");
+
+        sum = REF_SCAN(ref64, src64, len, 12345, 0, NULL, NULL);
+        got = scan_incl_u64(dst64, src64, len, 12345);
+        CHECK_ARRAY(got, sum, dst64, ref64, len, "scan_incl_u64()");
+
+        sum = REF_SCAN(ref64, src64, len, 12345, 1, NULL, NULL);
+        got = scan_excl_u64(dst64, src64, len, 12345);
+        CHECK_ARRAY(got, sum, dst64, ref64, len, "scan_excl_u64()");
+
+        sum = REF_SCAN(ref64, src64, len, 0, 0, NULL, heads);
+        got = scan_seg_incl_u64(dst64, src64, heads, len);
+        CHECK_ARRAY(got, sum, dst64, ref64, len, "scan_seg_incl_u64()");
+    }
+
+    /* In place. */
+    sum = REF_SCAN(ref32, src32, MAXLEN, 0, 1, NULL, NULL);
+    got = scan_excl_u32(src32, src32, MAXLEN, 0);
+    CHECK_ARRAY((u32)got, (u32)sum, src32, ref32, MAXLEN, "in place scan_excl_u32()");
+
+    sum = REF_SCAN(ref64, src64, MAXLEN, 0, 0, NULL, NULL);
+    got = scan_incl_u64(src64, src64, MAXLEN, 0);
+    CHECK_ARRAY(got, sum, src64, ref64, MAXLEN, "in place scan_incl_u64()");
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (test_vector_scans()) {
+        return -1;
+    }
+
+    if (test_array_scans()) {
+        return -1;
+    }
+
+    printf(OUT_PREFIX "%s: PASS\n", __FILE__);
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#define OUT_PREFIX "\t"
+
+#define MAXLEN  (5000)
+
+static u32 a[MAXLEN], b[MAXLEN], got[2 * MAXLEN], ref[2 * MAXLEN];
+
+/*
+ *    A random strictly increasing set of n values, each step between 1 and 2 * gap so about 1 in
+ * gap values are present.  The top value is forced to ~0 when top is set.
+ */
+static void make_set(u32 * const s, const u64 n, const u32 gap, const u32 base, const int top)
+{
+    u32 r[256];
+    u64 i;
+    u32 v = base;
+
+    for (i = 0; i < n; i++) {
+        if ((i & 255) == 0) {
+            randomize_data(r, sizeof(r));
+        }
+
+        v += 1 + (r[i & 255] % (2 * gap));
+        s[i] = v;
+    }
+
+    if (top && n) {
+        s[n - 1] = ~0U;
+    }
+}
+
+/*
+ * Plain merge based references: 0 intersection, 1 union, 2 difference.
+ */
+static u64 ref_op(const int op, const u32 * const x, const u64 nx, const u32 * const y,
+                  const u64 ny)
+{
+    u64 i = 0, j = 0, n = 0;
+
+    while ((i < nx) | (j < ny)) {
+        const int take_x = (j == ny) || ((i < nx) && (x[i] <= y[j]));
+        const int take_y = (i == nx) || ((j < ny) && (y[j] <= x[i]));
+        const int both = take_x & take_y;
+        const u32 v = take_x ? x[i] : y[j];
+
+        if (((op == 0) & both) | (op == 1) | ((op == 2) & take_x & !both)) {
+            ref[n++] = v;
+        }
+
+        i += take_x;
+        j += take_y;
+    }
+
+    return n;
+}
+
+static int check(const char * const what, const int op, const u64 na, const u64 nb, const u64 n)
+{
+    const u64 expect = ref_op(op, a, na, b, nb);
+
+    if ((n != expect) || memcmp(got, ref, n * sizeof(u32))) {
+        printf(OUT_PREFIX "%s of %lu and %lu elements gave %lu, expected %lu\n", what, na, nb, n,
+               expect);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ *    Sizes from empty through a few blocks to skewed enough to gallop both ways, sets from
+ * dense (most values shared) to sparse, and with and without ~0 in either set (the union pads
+ * with it).
+ */
+int test_set_ops(void)
+{
+    const u64 sizes[] = { 0, 1, 5, 15, 16, 17, 31, 32, 33, 100, 257, 1000, MAXLEN };
+    const u32 gaps[] = { 1, 3, 50 };
+    unsigned sa, sb, g, top;
+
+    for (sa = 0; sa < sizeof(sizes) / sizeof(sizes[0]); sa++) {
+        for (sb = 0; sb < sizeof(sizes) / sizeof(sizes[0]); sb++) {
+            for (g = 0; g < sizeof(gaps) / sizeof(gaps[0]); g++) {
+                for (top = 0; top < 4; top++) {
+                    const u64 na = sizes[sa], nb = sizes[sb];
+                    u64 n;
+
+                    /* Scale the gaps so the sets cover about the same range. */
+                    make_set(a, na, gaps[g] * (nb > na ? nb / (na + 1) + 1 : 1), 0, top & 1);
+                    make_set(b, nb, gaps[g] * (na > nb ? na / (nb + 1) + 1 : 1), 0, top & 2);
+
+                    memset(got, 0xA5, sizeof(got));
+                    n = set_intersect_u32(got, a, na, b, nb);
+
+                    if (check("set_intersect_u32()", 0, na, nb, n)) {
+                        return -1;
+                    }
+
+                    memset(got, 0xA5, sizeof(got));
+                    n = set_union_u32(got, a, na, b, nb);
+
+                    if (check("set_union_u32()", 1, na, nb, n)) {
+                        return -1;
+                    }
+
+                    if (got[n] != 0xA5A5A5A5U) {
+                        printf(OUT_PREFIX "set_union_u32() of %lu and %lu elements wrote past "
+                               "the result\n", na, nb);
+                        return -1;
+                    }
+
+                    memset(got, 0xA5, sizeof(got));
+                    n = set_diff_u32(got, a, na, b, nb);
+
+                    if (check("set_diff_u32()", 2, na, nb, n)) {
+                        return -1;
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (test_set_ops()) {
+        return -1;
+    }
+
+    printf(OUT_PREFIX "%s: PASS\n", __FILE__);
+    return 0;
+}
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#define OUT_PREFIX "\t"
+
+#define MAXLEN  (4133)
+
+static u32 data32[MAXLEN], ref32[MAXLEN];
+static u64 data64[MAXLEN], ref64[MAXLEN];
+static u32 scratch32[2 * SORT_SCRATCH_ELEMS(MAXLEN, 16)] __attribute__((__aligned__(64)));
+static u64 scratch64[2 * SORT_SCRATCH_ELEMS(MAXLEN, 8)] __attribute__((__aligned__(64)));
+
+static int cmp_u32(const void *a, const void *b)
+{
+    const u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+    return (x > y) - (x < y);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    const u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * Random values, narrowed on some passes so there are plenty of duplicates.
+ */
+static void fill(void * const data, const size_t len, const unsigned pass)
+{
+    const u8 masks[] = { 0xFF, 0x03, 0x1F, 0x01 };
+    u64 * const p = data;
+    size_t i;
+
+    randomize_data(data, len);
+
+    for (i = 0; i < len / sizeof(u64); i++) {
+        p[i] &= 0x0101010101010101ULL * masks[pass % 4];
+    }
+}
+
+int test_vector_sorts(void)
+{
+    unsigned pass, i;
+
+    for (pass = 0; pass < 512; pass++) {
+        u32_16 k32, v32 = IDX_VEC(u32_16), s32;
+        u64_8 k64, v64 = IDX_VEC(u64_8), s64;
+
+        fill(&k32, sizeof(k32), pass);
+        fill(&k64, sizeof(k64), pass);
+
+        memcpy(ref32, &k32, sizeof(k32));
+        memcpy(ref64, &k64, sizeof(k64));
+        qsort(ref32, 16, sizeof(u32), cmp_u32);
+        qsort(ref64, 8, sizeof(u64), cmp_u64);
+
+        s32 = sort_u32_16(k32);
+        s64 = sort_u64_8(k64);
+
+        if (memcmp(&s32, ref32, sizeof(s32)) | memcmp(&s64, ref64, sizeof(s64))) {
+            printf(OUT_PREFIX "%s: sort_u32_16() / sort_u64_8() out of order\n", __FUNCTION__);
+            debug_print_vec(s32, ~0);
+            debug_print_vec(s64, ~0);
+            return -1;
+        }
+
+        /* The payload is where each key came from, so it has to point back at the same key. */
+        const u32_16 in32 = k32;
+        const u64_8 in64 = k64;
+        u32 seen32 = 0, seen64 = 0;
+
+        sort_kv_u32_16(&k32, &v32);
+        sort_kv_u64_8(&k64, &v64);
+
+        for (i = 0; i < 16; i++) {
+            seen32 |= 1U << v32[i];
+
+            if ((k32[i] != ref32[i]) | (in32[v32[i] & 15] != k32[i])) {
+                printf(OUT_PREFIX "%s: sort_kv_u32_16() lane %u key %u payload %u\n",
+                       __FUNCTION__, i, k32[i], v32[i]);
+                return -1;
+            }
+        }
+
+        for (i = 0; i < 8; i++) {
+            seen64 |= 1U << v64[i];
+
+            if ((k64[i] != ref64[i]) | (in64[v64[i] & 7] != k64[i])) {
+                printf(OUT_PREFIX "%s: sort_kv_u64_8() lane %u key %lu payload %lu\n",
+                       __FUNCTION__, i, k64[i], v64[i]);
+                return -1;
+            }
+        }
+
+        if ((seen32 != 0xFFFF) | (seen64 != 0xFF)) {
+            printf(OUT_PREFIX "%s: a payload was duplicated (seen 0x%x / 0x%x)\n", __FUNCTION__,
+                   seen32, seen64);
+            return -1;
+        }
+
+        /* Merge the sorted vector with another sorted one. */
+        u32_16 lo32 = s32, hi32;
+        u64_8 lo64 = s64, hi64;
+
+        fill(&hi32, sizeof(hi32), pass);
+        fill(&hi64, sizeof(hi64), pass);
+        hi32 = sort_u32_16(hi32);
+        hi64 = sort_u64_8(hi64);
+        memcpy(ref32 + 16, &hi32, sizeof(hi32));
+        memcpy(ref64 + 8, &hi64, sizeof(hi64));
+        qsort(ref32, 32, sizeof(u32), cmp_u32);
+        qsort(ref64, 16, sizeof(u64), cmp_u64);
+
+        merge_u32_16(&lo32, &hi32);
+        merge_u64_8(&lo64, &hi64);
+
+        if (memcmp(&lo32, ref32, sizeof(lo32)) | memcmp(&hi32, ref32 + 16, sizeof(hi32)) |
+                memcmp(&lo64, ref64, sizeof(lo64)) | memcmp(&hi64, ref64 + 8, sizeof(hi64))) {
+            printf(OUT_PREFIX "%s: merge_u32_16() / merge_u64_8() out of order\n", __FUNCTION__);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ *    Lengths around the vector and run sizes, and a long odd one, against qsort.  The element
+ * past the end of the array must not be touched.
+ */
+int test_array_sorts(void)
+{
+    const unsigned lens[] = { 0, 1, 7, 8, 9, 15, 16, 17, 31, 32, 33, 48, 64, 65, 100, 255, 256, 257,
+                              1000, 1024, MAXLEN - 1 };
+    unsigned l, pass;
+
+    for (pass = 0; pass < 4; pass++) {
+        for (l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+            const unsigned n = lens[l];
+
+            fill(data32, sizeof(data32), pass);
+            fill(data64, sizeof(data64), pass);
+            memcpy(ref32, data32, sizeof(data32));
+            memcpy(ref64, data64, sizeof(data64));
+            qsort(ref32, n, sizeof(u32), cmp_u32);
+            qsort(ref64, n, sizeof(u64), cmp_u64);
+
+            sort_u32(data32, scratch32, n);
+            sort_u64(data64, scratch64, n);
+
+            if (memcmp(data32, ref32, (n + 1) * sizeof(u32))) {
+                printf(OUT_PREFIX "%s: sort_u32() of %u elements differs from qsort\n",
+                       __FUNCTION__, n);
+                return -1;
+            }
+
+            if (memcmp(data64, ref64, (n + 1) * sizeof(u64))) {
+                printf(OUT_PREFIX "%s: sort_u64() of %u elements differs from qsort\n",
+                       __FUNCTION__, n);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (test_vector_sorts()) {
+        return -1;
+    }
+
+    if (test_array_sorts()) {
+        return -1;
+    }
+
+    printf(OUT_PREFIX "%s: PASS\n", __FILE__);
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/simd_util.h"
+
+#define OUT_PREFIX "\t"
+
+#define MAXLEN  (5000)
+#define MAXK    (600)
+
+static u32 data32[MAXLEN], ref32[MAXLEN], got32[MAXLEN];
+static u64 data64[MAXLEN], ref64[MAXLEN], got64[MAXLEN];
+static u32 mem32[TOPK_MEM_ELEMS(MAXK, 16)] __attribute__((__aligned__(64)));
+static u64 mem64[TOPK_MEM_ELEMS(MAXK, 8)] __attribute__((__aligned__(64)));
+
+static int cmp_desc_u32(const void *a, const void *b)
+{
+    const u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+    return (x < y) - (x > y);
+}
+
+static int cmp_desc_u64(const void *a, const void *b)
+{
+    const u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+    return (x < y) - (x > y);
+}
+
+/*
+ *    Random values, narrowed so there are plenty of duplicates, or ascending (every value beats
+ * the threshold, the most cuts) or descending (nothing does after the first cut).
+ */
+static void fill(const unsigned pattern, const u64 n)
+{
+    u64 i;
+
+    randomize_data(data32, sizeof(data32));
+    randomize_data(data64, sizeof(data64));
+
+    for (i = 0; i < n; i++) {
+        switch (pattern) {
+        case 1:
+            data32[i] &= 0x0F;
+            data64[i] &= 0x0F;
+            break;
+        case 2:
+            data32[i] = i;
+            data64[i] = i << 33;
+            break;
+        case 3:
+            data32[i] = ~(u32)i;
+            data64[i] = ~i;
+            break;
+        }
+    }
+}
+
+static int check(const char * const what, const u64 n, const u64 k, const unsigned pattern,
+                 const u64 got_n, const void * const got, const void * const ref, const size_t esz)
+{
+    const u64 expect = (n < k) ? n : k;
+
+    if ((got_n != expect) || memcmp(got, ref, expect * esz)) {
+        printf(OUT_PREFIX "%s of %lu with k %lu, pattern %u gave %lu, expected %lu\n", what, n, k,
+               pattern, got_n, expect);
+        return -1;
+    }
+
+    return 0;
+}
+
+int test_topk(void)
+{
+    const u64 sizes[] = { 0, 1, 15, 16, 17, 100, 1000, MAXLEN };
+    const u64 ks[] = { 1, 3, 16, 17, 100, MAXK };
+    unsigned s, ki, pattern;
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (ki = 0; ki < sizeof(ks) / sizeof(ks[0]); ki++) {
+            for (pattern = 0; pattern < 4; pattern++) {
+                const u64 n = sizes[s], k = ks[ki];
+                u64 got_n;
+
+                fill(pattern, n);
+                memcpy(ref32, data32, n * sizeof(u32));
+                memcpy(ref64, data64, n * sizeof(u64));
+                qsort(ref32, n, sizeof(u32), cmp_desc_u32);
+                qsort(ref64, n, sizeof(u64), cmp_desc_u64);
+
+                got_n = topk_u32(got32, data32, n, k, mem32);
+
+                if (check("topk_u32()", n, k, pattern, got_n, got32, ref32, sizeof(u32))) {
+                    return -1;
+                }
+
+                got_n = topk_u64(got64, data64, n, k, mem64);
+
+                if (check("topk_u64()", n, k, pattern, got_n, got64, ref64, sizeof(u64))) {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ *    The same stream pushed in random sized chunks, taking a result part way through, must give
+ * the same answer as all at once.
+ */
+int test_topk_stream(void)
+{
+    unsigned pass;
+
+    for (pass = 0; pass < 64; pass++) {
+        const u64 k = 1 + (pass * 37) % MAXK;
+        topk_u32_t t32;
+        topk_u64_t t64;
+        u64 i = 0, got_n;
+        u32 r[2];
+
+        fill(pass % 4, MAXLEN);
+        memcpy(ref32, data32, sizeof(data32));
+        memcpy(ref64, data64, sizeof(data64));
+        qsort(ref32, MAXLEN, sizeof(u32), cmp_desc_u32);
+        qsort(ref64, MAXLEN, sizeof(u64), cmp_desc_u64);
+
+        if (topk_u32_init(&t32, mem32, k) || topk_u64_init(&t64, mem64, k)) {
+            printf(OUT_PREFIX "topk_*_init() failed for k %lu\n", k);
+            return -1;
+        }
+
+        while (i < MAXLEN) {
+            randomize_data(r, sizeof(r));
+
+            const u64 len = (r[0] % 300 < MAXLEN - i) ? r[0] % 300 : MAXLEN - i;
+
+            topk_u32_push(&t32, data32 + i, len);
+            topk_u64_push(&t64, data64 + i, len);
+            i += len;
+
+            if ((r[1] & 15) == 0) {
+                topk_u32_result(&t32, got32);
+                topk_u64_result(&t64, got64);
+            }
+        }
+
+        got_n = topk_u32_result(&t32, got32);
+
+        if (check("topk_u32_push()", MAXLEN, k, pass % 4, got_n, got32, ref32, sizeof(u32))) {
+            return -1;
+        }
+
+        got_n = topk_u64_result(&t64, got64);
+
+        if (check("topk_u64_push()", MAXLEN, k, pass % 4, got_n, got64, ref64, sizeof(u64))) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (test_topk()) {
+        return -1;
+    }
+
+    if (test_topk_stream()) {
+        return -1;
+    }
+
+    printf(OUT_PREFIX "%s: PASS\n", __FILE__);
+    return 0;
+}
@@ -117,12 +117,383 @@ int test_basic_transpose(void)
     return 0;
 }
 
+/*
+ *    Check an n x n transpose of n-lane rows against the definition, both out of place and in
+ * place.  The permutes don't look at the data, so running it once with every element set to its
+ * row number and once with its column number pins down where each element came from even for u8
+ * rows where the elements can't all be distinct; a third random fill catches anything else.
+ */
+#define CHECK_SQUARE_TRANSPOSE(_type, _n, _func)                                            \
+({                                                                                          \
+    _type __in[_n], __out[_n], __io[_n];                                                    \
+    unsigned __pass, __i, __j;                                                              \
+    int __ret = 0;                                                                          \
+                                                                                            \
+    for (__pass = 0; (__pass < 3) && !__ret; __pass++) {                                    \
+        if (__pass == 2) {                                                                  \
+            randomize_data(__in, sizeof(__in));                                             \
+        } else {                                                                            \
+            for (__i = 0; __i < (_n); __i++) {                                              \
+                for (__j = 0; __j < (_n); __j++) {                                          \
+                    __in[__i][__j] = __pass ? __j : __i;                                    \
+                }                                                                           \
+            }                                                                               \
+        }                                                                                   \
+                                                                                            \
+        memcpy(__io, __in, sizeof(__in));                                                   \
+        _func(__in, __out);                                                                 \
+        _func(__io, __io);                                                                  \
+                                                                                            \
+        for (__i = 0; (__i < (_n)) && !__ret; __i++) {                                      \
+            for (__j = 0; __j < (_n); __j++) {                                              \
+                if ((__out[__j][__i] != __in[__i][__j]) |                                   \
+                        (__io[__j][__i] != __in[__i][__j])) {                               \
+                    printf(OUT_PREFIX "%s: pass %u in[%u][%u] = 0x%lx, out[%u][%u] = "      \
+                           "0x%lx, in place 0x%lx\n", #_func, __pass, __i, __j,             \
+                           (u64)__in[__i][__j], __j, __i, (u64)__out[__j][__i],             \
+                           (u64)__io[__j][__i]);                                            \
+                    __ret = -1;                                                             \
+                    break;                                                                  \
+                }                                                                           \
+            }                                                                               \
+        }                                                                                   \
+    }                                                                                       \
+                                                                                            \
+    __ret;                                                                                  \
+}) /* end of macro */
+
+int test_square_transpose(void)
+{
+    if (CHECK_SQUARE_TRANSPOSE(u64_8, 8, transpose_u64_8x8) ||
+            CHECK_SQUARE_TRANSPOSE(u32_16, 16, transpose_u32_16x16) ||
+            CHECK_SQUARE_TRANSPOSE(u16_32, 32, transpose_u16_32x32)) {
+        return -1;
+    }
+
+#ifdef __AVX512VBMI__
+    if (CHECK_SQUARE_TRANSPOSE(u8_64, 64, transpose_u8_64x64)) {
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ *    Run one of the segment transposes over a rows x cols matrix of random elements, with and
+ * without streaming stores, and check every element against the definition.  Also check that it
+ * refuses dimensions that aren't whole tiles and an output segment that's too small.
+ */
+#define CHECK_SEGMENT_TRANSPOSE(_etype, _tile, _func, _in, _out, _rows, _cols)              \
+({                                                                                          \
+    const _etype * const __a = (const _etype *)(_in)->ptr;                                  \
+    const _etype * const __t = (const _etype *)(_out)->ptr;                                 \
+    seg_desc_t __small = *(_out);                                                           \
+    unsigned __pass, __r, __c;                                                              \
+    int __ret = 0;                                                                          \
+                                                                                            \
+    __small.maplen = ((_rows) * (_cols) * sizeof(_etype)) - 1;                              \
+    randomize_data((_in)->ptr, (_rows) * (_cols) * sizeof(_etype));                         \
+                                                                                            \
+    if (!_func((_in), (_out), (_rows) + 1, (_cols), 0) ||                                   \
+            !_func((_in), (_out), (_rows), (_cols) - (_tile) / 2, 0) ||                     \
+            !_func((_in), &__small, (_rows), (_cols), 0)) {                                 \
+        printf(OUT_PREFIX "%s: accepted a bad geometry\n", #_func);                         \
+        __ret = -1;                                                                         \
+    }                                                                                       \
+                                                                                            \
+    for (__pass = 0; (__pass < 2) && !__ret; __pass++) {                                    \
+        __builtin_memset((_out)->ptr, 0, (_rows) * (_cols) * sizeof(_etype));               \
+                                                                                            \
+        if (_func((_in), (_out), (_rows), (_cols), __pass ? TRANSPOSE_SEGMENT_NT : 0)) {    \
+            printf(OUT_PREFIX "%s: failed for %u x %u\n", #_func, (_rows), (_cols));        \
+            __ret = -1;                                                                     \
+        }                                                                                   \
+                                                                                            \
+        for (__r = 0; (__r < (_rows)) && !__ret; __r++) {                                   \
+            for (__c = 0; __c < (_cols); __c++) {                                           \
+                if (__t[(__c * (_rows)) + __r] != __a[(__r * (_cols)) + __c]) {             \
+                    printf(OUT_PREFIX "%s: pass %u element (%u, %u) = 0x%lx, got 0x%lx\n",  \
+                           #_func, __pass, __r, __c, (u64)__a[(__r * (_cols)) + __c],       \
+                           (u64)__t[(__c * (_rows)) + __r]);                                \
+                    __ret = -1;                                                             \
+                    break;                                                                  \
+                }                                                                           \
+            }                                                                               \
+        }                                                                                   \
+    }                                                                                       \
+                                                                                            \
+    __ret;                                                                                  \
+}) /* end of macro */
+
+int test_segment_transpose(void)
+{
+    char errbuf[256] = {};
+    seg_desc_t in = {.maplen = HUGE_2M_SIZE, .flags = SEG_DESC_INITD | SEG_DESC_ANON};
+    seg_desc_t out = in;
+    int ret = 0;
+
+    if (map_segment(NULL, &in, errbuf, sizeof(errbuf) - 1) ||
+            map_segment(NULL, &out, errbuf, sizeof(errbuf) - 1)) {
+        printf(OUT_PREFIX "%s: %s\n", __FUNCTION__, errbuf);
+        return -1;
+    }
+
+    /* Non-square, with more than TRANSPOSE_SEGMENT_PF_TILES tiles across. */
+    if (CHECK_SEGMENT_TRANSPOSE(u64, 8, transpose_u64_segment, &in, &out, 24, 8 * 11) ||
+            CHECK_SEGMENT_TRANSPOSE(u32, 16, transpose_u32_segment, &in, &out, 16 * 10, 48) ||
+            CHECK_SEGMENT_TRANSPOSE(u16, 32, transpose_u16_segment, &in, &out, 64, 32 * 9)) {
+        ret = -1;
+    }
+
+#ifdef __AVX512VBMI__
+    if (!ret && CHECK_SEGMENT_TRANSPOSE(u8, 64, transpose_u8_segment, &in, &out, 64 * 3, 64 * 10)) {
+        ret = -1;
+    }
+#endif
+
+    unmap_segment(&in);
+    unmap_segment(&out);
+    return ret;
+}
+
+/* Packed so the 64-bit fields are only 4 byte aligned, which the generator has to cope with. */
+typedef struct {
+    u32 a;
+    u64 b;
+    u32 c;
+    u64 d;
+    u32 e;
+} __attribute__((packed)) wire_rec_t;
+
+#define WIRE_REC_FIELDS(F32, F64)   F32(a) F64(b) F32(c) F64(d) F32(e)
+DEFINE_AOS_SOA_TRANSPOSE(wire_rec, wire_rec_t, WIRE_REC_FIELDS)
+
+/* A full 64 byte record where only some of the fields are listed (and not in struct order). */
+typedef struct {
+    u64 key_lo, key_hi;
+    u32 hash;
+    u32 flags;
+    u64 ts;
+    u32 pad[7];
+    u32 tail;
+} big_rec_t;
+
+#define BIG_REC_FIELDS(F32, F64)    F64(ts) F32(hash) F64(key_hi) F32(tail)
+DEFINE_AOS_SOA_TRANSPOSE(big_rec, big_rec_t, BIG_REC_FIELDS)
+
+DEFINE_AOS_SOA_GATHER(wire_rec, wire_rec_t, WIRE_REC_FIELDS)
+
+/* Too big for the row strategy, so _rows() has to fall back to per-field gathers. */
+typedef struct {
+    u32 id;
+    u32 pad[19];
+    u64 stamp;
+    u32 tail;
+} huge_rec_t;
+
+#define HUGE_REC_FIELDS(F32, F64)   F32(id) F64(stamp) F32(tail)
+DEFINE_SOA_TYPE(huge_rec, HUGE_REC_FIELDS);
+DEFINE_AOS_SOA_GATHER(huge_rec, huge_rec_t, HUGE_REC_FIELDS)
+
+int test_aos_soa_round_trip(void)
+{
+    wire_rec_t w[16], wb[16];
+    wire_rec_soa_t ws;
+    big_rec_t b[16], bb[16];
+    big_rec_soa_t bs;
+    unsigned i;
+
+    randomize_data(w, sizeof(w));
+    randomize_data(b, sizeof(b));
+    memset(wb, 0xA5, sizeof(wb));
+    memset(bb, 0xA5, sizeof(bb));
+
+    wire_rec_aos_to_soa(w, &ws);
+    big_rec_aos_to_soa(b, &bs);
+
+    for (i = 0; i < 16; i++) {
+        if ((ws.a[i] != w[i].a) | (ws.b[i / 8][i % 8] != w[i].b) | (ws.c[i] != w[i].c) |
+                (ws.d[i / 8][i % 8] != w[i].d) | (ws.e[i] != w[i].e)) {
+            printf(OUT_PREFIX "%s: wire_rec field mismatch in record %u\n", __FUNCTION__, i);
+            return -1;
+        }
+
+        if ((bs.ts[i / 8][i % 8] != b[i].ts) | (bs.hash[i] != b[i].hash) |
+                (bs.key_hi[i / 8][i % 8] != b[i].key_hi) | (bs.tail[i] != b[i].tail)) {
+            printf(OUT_PREFIX "%s: big_rec field mismatch in record %u\n", __FUNCTION__, i);
+            return -1;
+        }
+    }
+
+    wire_rec_soa_to_aos(&ws, wb);
+    big_rec_soa_to_aos(&bs, bb);
+
+    if (memcmp(w, wb, sizeof(w))) {
+        printf(OUT_PREFIX "%s: wire_rec round trip mismatch\n", __FUNCTION__);
+        return -1;
+    }
+
+    for (i = 0; i < 16; i++) {
+        const big_rec_t expect = {
+            .key_hi = b[i].key_hi, .hash = b[i].hash, .ts = b[i].ts, .tail = b[i].tail
+        };
+
+        if (memcmp(&expect, bb + i, sizeof(expect))) {
+            printf(OUT_PREFIX "%s: big_rec round trip mismatch in record %u\n", __FUNCTION__, i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+#define SG_NREC     (64)
+#define SG_INVALID  (0x0210)    // Lanes given NULL pointers
+#define SOA64(_v, _i)   ((_v)[(_i) / 8][(_i) % 8])
+
+/*
+ * Point the 16 lanes of ptrs at distinct random records of pool (NULL for SG_INVALID lanes).
+ */
+static void pick_records(void *pool, const size_t rsize, mpv_8 * const ptrs, int * const which)
+{
+    u8 used[SG_NREC] = {};
+    unsigned i, r;
+
+    for (i = 0; i < 16; i++) {
+        do {
+            r = random() % SG_NREC;
+        } while (used[r]);
+
+        used[r] = 1;
+        which[i] = ((SG_INVALID >> i) & 1) ? -1 : (int)r;
+        ptrs[i / 8].mp[i % 8].p = (which[i] < 0) ? NULL : (u8 *)pool + (r * rsize);
+    }
+}
+
+static void repoint_records(void *pool, const size_t rsize, mpv_8 * const ptrs,
+                            const int * const which)
+{
+    unsigned i;
+
+    for (i = 0; i < 16; i++) {
+        ptrs[i / 8].mp[i % 8].p = (which[i] < 0) ? NULL : (u8 *)pool + (which[i] * rsize);
+    }
+}
+
+/*
+ * Gather 16 scattered records with both strategies and check them against the records (invalid
+ * lanes must read as zero), then scatter modified columns back with both strategies and check
+ * that exactly the listed fields of the valid lanes' records changed.
+ */
+int test_sg_transpose(void)
+{
+    static wire_rec_t wp[SG_NREC], wf[SG_NREC], wr[SG_NREC], we[SG_NREC];
+    static huge_rec_t hp[SG_NREC], hf[SG_NREC], hr[SG_NREC], he[SG_NREC];
+    wire_rec_soa_t wsf, wsr;
+    huge_rec_soa_t hsf, hsr;
+    mpv_8 wptrs[2], hptrs[2];
+    int wwhich[16], hwhich[16];
+    unsigned i;
+
+    randomize_data(wp, sizeof(wp));
+    randomize_data(hp, sizeof(hp));
+    pick_records(wp, sizeof(wire_rec_t), wptrs, wwhich);
+    pick_records(hp, sizeof(huge_rec_t), hptrs, hwhich);
+
+    wire_rec_gather_fields(wptrs, &wsf);
+    wire_rec_gather_rows(wptrs, &wsr);
+    huge_rec_gather_fields(hptrs, &hsf);
+    huge_rec_gather_rows(hptrs, &hsr);
+
+    for (i = 0; i < 16; i++) {
+        const wire_rec_t w = (wwhich[i] < 0) ? (wire_rec_t) {} : wp[wwhich[i]];
+        const huge_rec_t h = (hwhich[i] < 0) ? (huge_rec_t) {} : hp[hwhich[i]];
+
+        if ((wsf.a[i] != w.a) | (SOA64(wsf.b, i) != w.b) | (wsf.c[i] != w.c) |
+                (SOA64(wsf.d, i) != w.d) | (wsf.e[i] != w.e) | memcmp(&wsf, &wsr, sizeof(wsf))) {
+            printf(OUT_PREFIX "%s: wire_rec gather mismatch in lane %u\n", __FUNCTION__, i);
+            return -1;
+        }
+
+        if ((hsf.id[i] != h.id) | (SOA64(hsf.stamp, i) != h.stamp) | (hsf.tail[i] != h.tail) |
+                memcmp(&hsf, &hsr, sizeof(hsf))) {
+            printf(OUT_PREFIX "%s: huge_rec gather mismatch in lane %u\n", __FUNCTION__, i);
+            return -1;
+        }
+    }
+
+    randomize_data(&wsf, sizeof(wsf));
+    randomize_data(&hsf, sizeof(hsf));
+    memcpy(wf, wp, sizeof(wp));
+    memcpy(wr, wp, sizeof(wp));
+    memcpy(we, wp, sizeof(wp));
+    memcpy(hf, hp, sizeof(hp));
+    memcpy(hr, hp, sizeof(hp));
+    memcpy(he, hp, sizeof(hp));
+
+    for (i = 0; i < 16; i++) {
+        if (wwhich[i] >= 0) {
+            wire_rec_t * const w = we + wwhich[i];
+            w->a = wsf.a[i];
+            w->b = SOA64(wsf.b, i);
+            w->c = wsf.c[i];
+            w->d = SOA64(wsf.d, i);
+            w->e = wsf.e[i];
+        }
+
+        if (hwhich[i] >= 0) {
+            huge_rec_t * const h = he + hwhich[i];
+            h->id = hsf.id[i];
+            h->stamp = SOA64(hsf.stamp, i);
+            h->tail = hsf.tail[i];
+        }
+    }
+
+    repoint_records(wf, sizeof(wire_rec_t), wptrs, wwhich);
+    wire_rec_scatter_fields(&wsf, wptrs);
+    repoint_records(wr, sizeof(wire_rec_t), wptrs, wwhich);
+    wire_rec_scatter_rows(&wsf, wptrs);
+    repoint_records(hf, sizeof(huge_rec_t), hptrs, hwhich);
+    huge_rec_scatter_fields(&hsf, hptrs);
+    repoint_records(hr, sizeof(huge_rec_t), hptrs, hwhich);
+    huge_rec_scatter_rows(&hsf, hptrs);
+
+    if (memcmp(wf, we, sizeof(we)) | memcmp(wr, we, sizeof(we))) {
+        printf(OUT_PREFIX "%s: wire_rec scatter mismatch\n", __FUNCTION__);
+        return -1;
+    }
+
+    if (memcmp(hf, he, sizeof(he)) | memcmp(hr, he, sizeof(he))) {
+        printf(OUT_PREFIX "%s: huge_rec scatter mismatch\n", __FUNCTION__);
+        return -1;
+    }
+
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     if (test_basic_transpose()) {
         return -1;
     }
 
+    if (test_square_transpose()) {
+        return -1;
+    }
+
+    if (test_segment_transpose()) {
+        return -1;
+    }
+
+    if (test_aos_soa_round_trip()) {
+        return -1;
+    }
+
+    if (test_sg_transpose()) {
+        return -1;
+    }
+
     if (test_mixed_transpose()) {
         return -1;
     }